@@ -57,7 +57,7 @@ void DrawCommand::undo() {
 
     // If the stroke was not linked to any group we only need to update the animation
     if (m_group == Group::ERROR_ID && m_groupType != MAIN) {
-        keyframe->makeInbetweensDirty();  // TODO dirty update
+        keyframe->makeStrokeInbetweensDirty(m_stroke->id());
         return;
     }
 
@@ -79,7 +79,9 @@ void DrawCommand::undo() {
 
     emit m_editor->tabletCanvas()->groupModified(m_groupType, m_group);
 
-    keyframe->makeInbetweensDirty();  // TODO dirty update
+    if (m_groupType != PRE) keyframe->makeGroupInbetweensDirty(m_group);
+    else                    updatePrevPostGroup(group);
+    keyframe->makeStrokeInbetweensDirty(m_stroke->id());
 }
 
 void DrawCommand::redo() {
@@ -90,7 +92,7 @@ void DrawCommand::redo() {
     // Add a stroke without any group
     if (m_group == Group::ERROR_ID && m_groupType != MAIN) {
         keyframe->addStroke(copyStroke, nullptr, m_resample);
-        keyframe->makeInbetweensDirty();
+        keyframe->makeStrokeInbetweensDirty(copyStroke->id());
         return;
     }
 
@@ -119,7 +121,17 @@ void DrawCommand::redo() {
         addNonBreakdownStroke(layer, keyframe, group, copyStroke);
 
     emit m_editor->tabletCanvas()->groupModified(m_groupType, m_group);
-    keyframe->makeInbetweensDirty();  // TODO dirty update
+    if (m_groupType != PRE) keyframe->makeGroupInbetweensDirty(m_group);
+    else                    updatePrevPostGroup(group);
+    keyframe->makeStrokeInbetweensDirty(copyStroke->id());
+}
+
+// The strokes of a pre group are the backward strokes of the corresponding post group in the previous keyframe (see EraseCommand::updatePreGroup)
+void DrawCommand::updatePrevPostGroup(Group *group) {
+    Group *prevPostGroup = group->prevPostGroup();
+    if (prevPostGroup == nullptr) return;
+    if (prevPostGroup->lattice() != nullptr) prevPostGroup->lattice()->setBackwardUVDirty(true);
+    prevPostGroup->getParentKeyframe()->makeGroupInbetweensDirty(prevPostGroup->id());
 }
 
 void DrawCommand::addBreakdownStroke(Layer *layer, VectorKeyFrame *keyframe, Group *group, const StrokePtr &copyStroke) {
@@ -155,7 +167,7 @@ void DrawCommand::addBreakdownStroke(Layer *layer, VectorKeyFrame *keyframe, Gro
         int prevPostGroupId = prev->correspondences().key(preGroupId, Group::ERROR_ID);
         if (prevPostGroupId == Group::ERROR_ID) qCritical() << "Error in DrawCommand redo: breakdown key should have valid correspondences (" << preGroupId << ")";
         prev->postGroups().fromId(prevPostGroupId)->lattice()->setBackwardUVDirty(true);
-        prev->makeInbetweensDirty();
+        prev->makeGroupInbetweensDirty(prevPostGroupId);
     }
 
     // bake the new stroke in the selected group lattice (without adding new quads since the topology shouldn't change at a breakdown key)
@@ -192,7 +204,6 @@ void DrawCommand::addNonBreakdownStroke(Layer *layer, VectorKeyFrame *keyframe,
                     newStroke->points()[i]->setPos(group->lattice()->getWarpedPoint(newStroke->points()[i]->pos(), uv.quadKey, uv.uv, REF_POS));
                     keyframe->visibility()[Utils::cantor(newStroke->id(), i)] = alpha;
                 }
-                keyframe->makeInbetweensDirty();
             } else {
                 keyframe->removeStroke(newStroke->id());
             }
@@ -225,7 +236,7 @@ void DrawCommand::addNonBreakdownStroke(Layer *layer, VectorKeyFrame *keyframe,
 
         Group *prevPostGroup = prev->postGroups().fromId(prePostGroupId);
         prevPostGroup->lattice()->setBackwardUVDirty(true);
-        prev->makeInbetweensDirty();
+        prev->makeGroupInbetweensDirty(prePostGroupId);
 
         // clamp stroke intervals to the lattice
         Intervals clampedStroke;
@@ -341,7 +352,7 @@ void EraseCommand::undo() {
         emit m_editor->tabletCanvas()->groupsModified(PRE);
     }
 
-    m_keyframe->makeInbetweensDirty();  // TODO dirty update
+    makeInbetweensDirty();
 }
 
 void EraseCommand::redo() {
@@ -366,7 +377,15 @@ void EraseCommand::redo() {
         emit m_editor->tabletCanvas()->groupsModified(PRE);
     }
 
-    m_keyframe->makeInbetweensDirty();  // TODO dirty update
+    makeInbetweensDirty();
+}
+
+// Only the groups referencing the erased stroke need to be re-baked
+void EraseCommand::makeInbetweensDirty() {
+    for (auto it = m_postCopy.constBegin(); it != m_postCopy.constEnd(); ++it) {
+        m_keyframe->makeGroupInbetweensDirty(it.key());
+    }
+    m_keyframe->makeStrokeInbetweensDirty(m_stroke);
 }
 
 // If we're erasing strokes in a PRE group, then we need to update the corresponding POST group in the previous frame
@@ -378,8 +397,8 @@ void EraseCommand::updatePreGroup() {
         if (prePostGroupId == Group::ERROR_ID) qWarning() << "Warning in EraseCommand: this pre group is not connected to any post group in the previous keyframe. Why does it even exist?";
         Group *prevPostGroup = prev->postGroups().fromId(prePostGroupId);
         prevPostGroup->lattice()->setBackwardUVDirty(true);
+        prev->makeGroupInbetweensDirty(prePostGroupId);
     }
-    prev->makeInbetweensDirty();
 }
 
 ClearCommand::ClearCommand(Editor *editor, int layer, int frame, QUndoCommand *parent)
@@ -765,12 +784,14 @@ void SetGridCommand::undo() {
     m_group->setGrid(new Lattice(*m_prevGridCopy));
     m_group->setGridDirty();
     m_group->lattice()->setBackwardUVDirty(true);
+    m_group->getParentKeyframe()->makeGroupInbetweensDirty(m_group->id());
 }
 
 void SetGridCommand::redo() {
     m_group->setGrid(new Lattice(*m_newGridCopy));
     m_group->setGridDirty();
     m_group->lattice()->setBackwardUVDirty(true);
+    m_group->getParentKeyframe()->makeGroupInbetweensDirty(m_group->id());
 }
 
 SetSelectedTrajectoryCommand::SetSelectedTrajectoryCommand(Editor *editor, int layer, int frame, Trajectory *traj, bool selectInAllKF, QUndoCommand *parent)
@@ -35,6 +35,8 @@ class DrawCommand : public QUndoCommand {
     void addNonBreakdownStroke(Layer *layer, VectorKeyFrame *keyframe, Group *group, const StrokePtr &copyStroke);
 
    private:
+    void updatePrevPostGroup(Group *group);
+
     Editor *m_editor;
     int m_layerIndex;
     int m_frame;
@@ -56,6 +58,7 @@ class EraseCommand : public QUndoCommand {
     void redo() override;
 
     void updatePreGroup();
+    void makeInbetweensDirty();
 
    private:
     Editor *m_editor;
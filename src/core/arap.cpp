@@ -14,14 +14,239 @@
 #include "gridmanager.h"
 #include "utils/stopwatch.h"
 
+#include <QtConcurrent/QtConcurrent>
+#include <Eigen/QR>
+
 #include <iostream>
+#include <deque>
 
 dkBool k_cornersFixed("Options->Grid->Exterior corners fixed", false);
+static dkBool k_referenceRegularization("Options->Grid->Reference regularization (sequential)", false);
+static dkBool k_parallelRegularization("Options->Grid->Parallel regularization", true);
+static dkInt k_regularizationAcceleration("Options->Grid->Regularization Anderson depth", 0, 0, 10, 1);
 
 #define EPSILON 0.001
+#define PIN_WEIGHT 10000.0
+#define REGULARIZATION_CHUNK 256
 
 using namespace Eigen;
 
+namespace {
+/**
+ * Structure of arrays view of a lattice for the regularization sweeps (see Arap::regularizeLattice).
+ * Positions are interleaved (x, y) and indexed by corner key. Slot 4 * q + i is the i-th corner of the q-th quad, quads
+ * are in the order of Lattice::quads().
+ * A sweep is a Jacobi iteration: the optimal rotation of every quad is computed independently (in parallel), then
+ * each corner averages the positions proposed by its adjacent quads (gather instead of the scatter of regularizeQuad,
+ * which keeps the sum order deterministic).
+ */
+class Regularization {
+public:
+    Regularization(Lattice &lattice, PosTypeIndex dstPos, bool forcePinPos, bool laggedCentroids);
+
+    // Run one sweep from x, the result is stored in g. Returns the maximum squared displacement of the deformable corners
+    double sweep(const VectorXd &x, VectorXd &g);
+    const VectorXd &initialPositions() const { return m_x0; }
+
+private:
+    template<typename F> void forEachChunk(int n, F f) const;
+    void rotateQuads(int from, int to, const VectorXd &x);
+    void gatherCorners(int from, int to, VectorXd &acc) const;
+
+    PosTypeIndex m_dstPos;
+    bool m_forcePinPos, m_laggedCentroids;
+    int m_nQuads, m_nCorners;
+    VectorXd m_x0;
+
+    std::vector<int> m_slotCorner;                      // corner key of each slot
+    std::vector<double> m_slotInvValence;               // 1 / nb of quads adjacent to the slot corner
+    std::vector<double> m_srcX, m_srcY;                 // source position of each slot relative to the quad source (biased) centroid
+    std::vector<double> m_outX, m_outY;                 // position proposed by the quad for each slot, divided by the valence
+    std::vector<double> m_centroidX, m_centroidY;       // target centroid of each quad
+    std::vector<double> m_pinW;                         // pin weight (0 if the quad is not pinned)
+    std::vector<double> m_pinSrcX, m_pinSrcY;           // pin source position relative to the quad source (biased) centroid
+    std::vector<double> m_pinX, m_pinY;                 // pin position in the canvas
+    std::vector<Point::VectorType> m_pinUV;
+    std::vector<int> m_pinned;                          // pinned quads
+    std::vector<int> m_cornerSlotsBegin, m_cornerSlots; // slots of each corner (CSR)
+    std::vector<char> m_movable;
+};
+
+Regularization::Regularization(Lattice &lattice, PosTypeIndex dstPos, bool forcePinPos, bool laggedCentroids)
+    : m_dstPos(dstPos), m_forcePinPos(forcePinPos), m_laggedCentroids(laggedCentroids), m_nQuads(lattice.quads().size()), m_nCorners(lattice.corners().size()) {
+    m_x0.resize(2 * m_nCorners);
+    m_movable.resize(m_nCorners);
+    for (Corner *c : lattice.corners()) {
+        m_x0[2 * c->getKey()] = c->coord(dstPos).x();
+        m_x0[2 * c->getKey() + 1] = c->coord(dstPos).y();
+        m_movable[c->getKey()] = c->isDeformable() && (!k_cornersFixed || c->nbQuads() > 1);
+    }
+
+    int nSlots = 4 * m_nQuads;
+    m_slotCorner.resize(nSlots);
+    m_slotInvValence.resize(nSlots);
+    m_srcX.resize(nSlots);
+    m_srcY.resize(nSlots);
+    m_outX.resize(nSlots);
+    m_outY.resize(nSlots);
+    m_centroidX.resize(m_nQuads);
+    m_centroidY.resize(m_nQuads);
+    m_pinW.resize(m_nQuads, 0.0);
+    m_pinSrcX.resize(m_nQuads, 0.0);
+    m_pinSrcY.resize(m_nQuads, 0.0);
+    m_pinX.resize(m_nQuads, 0.0);
+    m_pinY.resize(m_nQuads, 0.0);
+    m_pinUV.resize(m_nQuads, Point::VectorType::Zero());
+    int q = 0;
+    for (QuadPtr quad : lattice.quads()) {
+        Point::VectorType srcCentroid = quad->biasedCentroid(INTERP_POS);
+        for (int i = 0; i < 4; ++i) {
+            Corner *c = quad->corners[i];
+            Point::VectorType p = c->coord(INTERP_POS) - srcCentroid;
+            m_slotCorner[4 * q + i] = c->getKey();
+            m_slotInvValence[4 * q + i] = 1.0 / double(c->nbQuads());
+            m_srcX[4 * q + i] = p.x();
+            m_srcY[4 * q + i] = p.y();
+        }
+        m_centroidX[q] = quad->centroid(dstPos).x();
+        m_centroidY[q] = quad->centroid(dstPos).y();
+        if (quad->isPinned()) {
+            Point::VectorType p = quad->getPoint(quad->pinUV(), INTERP_POS) - srcCentroid;
+            m_pinW[q] = PIN_WEIGHT;
+            m_pinSrcX[q] = p.x();
+            m_pinSrcY[q] = p.y();
+            m_pinX[q] = quad->pinPos().x();
+            m_pinY[q] = quad->pinPos().y();
+            m_pinUV[q] = quad->pinUV();
+            m_pinned.push_back(q);
+        }
+        q++;
+    }
+
+    m_cornerSlotsBegin.assign(m_nCorners + 1, 0);
+    for (int slot = 0; slot < nSlots; ++slot) m_cornerSlotsBegin[m_slotCorner[slot] + 1]++;
+    for (int c = 0; c < m_nCorners; ++c) m_cornerSlotsBegin[c + 1] += m_cornerSlotsBegin[c];
+    m_cornerSlots.resize(nSlots);
+    std::vector<int> fill(m_cornerSlotsBegin.begin(), m_cornerSlotsBegin.end() - 1);
+    for (int slot = 0; slot < nSlots; ++slot) m_cornerSlots[fill[m_slotCorner[slot]]++] = slot;
+}
+
+template<typename F>
+void Regularization::forEachChunk(int n, F f) const {
+    if (!k_parallelRegularization || n <= REGULARIZATION_CHUNK) {
+        f(0, n);
+        return;
+    }
+    std::vector<int> chunks;
+    for (int i = 0; i < n; i += REGULARIZATION_CHUNK) chunks.push_back(i);
+    QtConcurrent::blockingMap(chunks, [&](int from) { f(from, std::min(n, from + REGULARIZATION_CHUNK)); });
+}
+
+// Same as Arap::regularizeQuad for the quads [from, to)
+void Regularization::rotateQuads(int from, int to, const VectorXd &x) {
+    int n = to - from;
+    std::vector<double> cornerX(4 * n), cornerY(4 * n), centroidX(n), centroidY(n);
+
+    // Gather the corners and compute the target centroids
+    for (int q = from; q < to; ++q) {
+        const int *c = &m_slotCorner[4 * q];
+        double *cx = &cornerX[4 * (q - from)], *cy = &cornerY[4 * (q - from)];
+        for (int i = 0; i < 4; ++i) {
+            cx[i] = x[2 * c[i]];
+            cy[i] = x[2 * c[i] + 1];
+        }
+        double meanX = 0.25 * (cx[0] + cx[1] + cx[2] + cx[3]);
+        double meanY = 0.25 * (cy[0] + cy[1] + cy[2] + cy[3]);
+        if (m_pinW[q] > 0.0) {
+            // See Quad::biasedCentroid
+            Point::VectorType pinTarget(m_pinX[q], m_pinY[q]);
+            if (m_dstPos != TARGET_POS) {
+                const Point::VectorType &uv = m_pinUV[q];
+                pinTarget.x() = (cx[TOP_LEFT] * (1.0 - uv.x()) + cx[TOP_RIGHT] * uv.x()) * (1.0 - uv.y()) + (cx[BOTTOM_LEFT] * (1.0 - uv.x()) + cx[BOTTOM_RIGHT] * uv.x()) * uv.y();
+                pinTarget.y() = (cy[TOP_LEFT] * (1.0 - uv.x()) + cy[TOP_RIGHT] * uv.x()) * (1.0 - uv.y()) + (cy[BOTTOM_LEFT] * (1.0 - uv.x()) + cy[BOTTOM_RIGHT] * uv.x()) * uv.y();
+            }
+            centroidX[q - from] = (4.0 * meanX + PIN_WEIGHT * pinTarget.x()) / (4.0 + PIN_WEIGHT);
+            centroidY[q - from] = (4.0 * meanY + PIN_WEIGHT * pinTarget.y()) / (4.0 + PIN_WEIGHT);
+        } else if (m_laggedCentroids) {
+            // regularizeQuad reads the centroid computed by the previous sweep
+            centroidX[q - from] = m_centroidX[q];
+            centroidY[q - from] = m_centroidY[q];
+        } else {
+            centroidX[q - from] = meanX;
+            centroidY[q - from] = meanY;
+        }
+        m_centroidX[q] = meanX;
+        m_centroidY[q] = meanY;
+    }
+
+    // Optimal rotations, branch-free over contiguous arrays so it can be vectorized
+    // The proposed positions are R * (p - pc) + qc, i.e. R * p + t with t = qc - R * pc
+    for (int j = 0; j < n; ++j) {
+        const int q = from + j;
+        const double *px = &m_srcX[4 * q], *py = &m_srcY[4 * q];
+        const double *cx = &cornerX[4 * j], *cy = &cornerY[4 * j];
+        const double qcx = centroidX[j], qcy = centroidY[j];
+        double a = 0.0, b = 0.0;
+        for (int i = 0; i < 4; ++i) {
+            a += (cx[i] - qcx) * px[i] + (cy[i] - qcy) * py[i];
+            b += -(cx[i] - qcx) * py[i] + (cy[i] - qcy) * px[i];
+        }
+        // Pin contribution (the weight is 0 for unpinned quads)
+        a += m_pinW[q] * ((m_pinX[q] - qcx) * m_pinSrcX[q] + (m_pinY[q] - qcy) * m_pinSrcY[q]);
+        b += m_pinW[q] * (-(m_pinX[q] - qcx) * m_pinSrcY[q] + (m_pinY[q] - qcy) * m_pinSrcX[q]);
+        double mu = std::max(std::sqrt(a * a + b * b), EPSILON);
+        double r1 = a / mu, r2 = -b / mu;
+        for (int i = 0; i < 4; ++i) {
+            m_outX[4 * q + i] = (r1 * px[i] + r2 * py[i] + qcx) * m_slotInvValence[4 * q + i];
+            m_outY[4 * q + i] = (-r2 * px[i] + r1 * py[i] + qcy) * m_slotInvValence[4 * q + i];
+        }
+    }
+}
+
+// Average of the positions proposed by the adjacent quads for the corners [from, to)
+void Regularization::gatherCorners(int from, int to, VectorXd &acc) const {
+    for (int c = from; c < to; ++c) {
+        double sumX = 0.0, sumY = 0.0;
+        for (int s = m_cornerSlotsBegin[c]; s < m_cornerSlotsBegin[c + 1]; ++s) {
+            sumX += m_outX[m_cornerSlots[s]];
+            sumY += m_outY[m_cornerSlots[s]];
+        }
+        acc[2 * c] = sumX;
+        acc[2 * c + 1] = sumY;
+    }
+}
+
+double Regularization::sweep(const VectorXd &x, VectorXd &g) {
+    forEachChunk(m_nQuads, [&](int from, int to) { rotateQuads(from, to, x); });
+    forEachChunk(m_nCorners, [&](int from, int to) { gatherCorners(from, to, g); });
+
+    // Same as Lattice::displacePinsQuads, pins are processed sequentially since they may share corners
+    if (m_forcePinPos) {
+        for (int q : m_pinned) {
+            const int *c = &m_slotCorner[4 * q];
+            const Point::VectorType &uv = m_pinUV[q];
+            double wTL = (1.0 - uv.x()) * (1.0 - uv.y()), wTR = uv.x() * (1.0 - uv.y()), wBL = (1.0 - uv.x()) * uv.y(), wBR = uv.x() * uv.y();
+            for (int k = 0; k < 2; ++k) {
+                double pin = k == 0 ? m_pinX[q] : m_pinY[q];
+                double displacement = pin - (g[2 * c[TOP_LEFT] + k] * wTL + g[2 * c[TOP_RIGHT] + k] * wTR + g[2 * c[BOTTOM_LEFT] + k] * wBL + g[2 * c[BOTTOM_RIGHT] + k] * wBR);
+                for (int i = 0; i < 4; ++i) g[2 * c[i] + k] += displacement;
+            }
+        }
+    }
+
+    // Only deformable corners move, keep track of the max displacement
+    double maxDisp = 0.0;
+    for (int c = 0; c < m_nCorners; ++c) {
+        if (m_movable[c]) {
+            maxDisp = std::max(maxDisp, (g.segment<2>(2 * c) - x.segment<2>(2 * c)).squaredNorm());
+        } else {
+            g.segment<2>(2 * c) = x.segment<2>(2 * c);
+        }
+    }
+    return maxDisp;
+}
+}  // namespace
+
 // See Sykora et al. ARAP Image Registration for Hand-drawn Cartoon Animation (sec. 3.3)
 void Arap::regularizeQuad(QuadPtr q, PosTypeIndex dstPos) {
     double a = 0;
@@ -71,6 +296,8 @@ void Arap::regularizeQuad(QuadPtr q, PosTypeIndex dstPos) {
  * Returns the maximum corner displacement (squared L2 norm)
  */
 double Arap::regularizeQuads(Lattice &lattice, PosTypeIndex dstPos, bool forcePinPos) {
+    if (dstPos == REF_POS) lattice.setRestDirty();
+
     // Compute ARAP deformation and average
     for (QuadPtr q : lattice.quads()) {
         regularizeQuad(q, dstPos);
@@ -107,11 +334,16 @@ double Arap::regularizeQuads(Lattice &lattice, PosTypeIndex dstPos, bool forcePi
  * @param convergenceStop   Stops the iterative process when the maximum corner displacement falls under an hardcoded threshold. Otherwise run #maxIterations
  * @param forcePinPos       Guarantee that pinned quad contains their pin after regularization
  * @return                  Number of regularization iterations done
+ *
+ * The sweeps run on a structure of arrays copy of the lattice (see Regularization), regularizeQuads is the sequential
+ * reference. With a non-zero "Regularization Anderson depth" the sweeps are accelerated with Anderson mixing, which
+ * reaches the convergence threshold in fewer iterations (the centroids are then not lagged by one sweep).
  */
 int Arap::regularizeLattice(Lattice &lattice, PosTypeIndex sourcePos, PosTypeIndex dstPos, int maxIterations, bool allGrid, bool convergenceStop, bool forcePinPos) {
     if (maxIterations <= 0) {
         return 0;
     }
+    if (dstPos == REF_POS) lattice.setRestDirty();
 
     Point::Affine scaling = sourcePos == DEFORM_POS ? Point::Affine::Identity() : lattice.scaling();
 
@@ -129,10 +361,66 @@ int Arap::regularizeLattice(Lattice &lattice, PosTypeIndex sourcePos, PosTypeInd
     // Apply regularization until convergence or a max number of iteration
     double maxDisp = 0;
     int i = 0;
-    do {
-        maxDisp = Arap::regularizeQuads(lattice, dstPos, forcePinPos);
-        i++;
-    } while (convergenceStop ? (i < maxIterations && sqrt(maxDisp) > 5e-3) : (i < maxIterations));
+    if (k_referenceRegularization) {
+        do {
+            maxDisp = Arap::regularizeQuads(lattice, dstPos, forcePinPos);
+            i++;
+        } while (convergenceStop ? (i < maxIterations && sqrt(maxDisp) > 5e-3) : (i < maxIterations));
+    } else {
+        int depth = k_regularizationAcceleration;
+        Regularization regularization(lattice, dstPos, forcePinPos, depth == 0);
+        VectorXd x = regularization.initialPositions(), g(x.size());
+        VectorXd f, fPrev, gPrev;
+        std::deque<VectorXd> dF, dG;
+        bool done;
+        do {
+            maxDisp = regularization.sweep(x, g);
+            i++;
+            done = convergenceStop ? (i >= maxIterations || sqrt(maxDisp) <= 5e-3) : (i >= maxIterations);
+            if (done || depth == 0) {
+                x.swap(g);
+                continue;
+            }
+
+            // Anderson mixing: x = g - dG * gamma with gamma minimizing |f - dF * gamma| (f is the residual g - x)
+            // The history is dropped whenever the residual grows, falling back to a plain sweep
+            f = g - x;
+            if (fPrev.size() > 0 && f.squaredNorm() > fPrev.squaredNorm()) {
+                dF.clear();
+                dG.clear();
+                fPrev.resize(0);
+            }
+            if (fPrev.size() > 0) {
+                dF.push_back(f - fPrev);
+                dG.push_back(g - gPrev);
+                if ((int)dF.size() > depth) {
+                    dF.pop_front();
+                    dG.pop_front();
+                }
+            }
+            fPrev = f;
+            gPrev = g;
+            if (dF.empty()) {
+                x = g;
+                continue;
+            }
+            MatrixXd F(f.size(), dF.size()), G(g.size(), dG.size());
+            for (int j = 0; j < (int)dF.size(); ++j) {
+                F.col(j) = dF[j];
+                G.col(j) = dG[j];
+            }
+            VectorXd gamma = F.colPivHouseholderQr().solve(f);
+            x = g - G * gamma;
+        } while (!done);
+
+        if (forcePinPos) lattice.setArapDirty();
+        for (Corner *corner : lattice.corners()) {
+            corner->coord(dstPos) = Point::VectorType(x[2 * corner->getKey()], x[2 * corner->getKey() + 1]);
+        }
+        for (QuadPtr q : lattice.quads()) {
+            q->computeCentroid(dstPos);
+        }
+    }
 
     // Save configuration for plastic deformation
     for (Corner *corner : lattice.corners()) {
@@ -39,11 +39,11 @@
 #include "visibilitymanager.h"
 #include "arap.h"
 #include "tools/localmasktool.h"
+#include "GL/StrokeRasterizer.h"
 #include "utils/stopwatch.h"
 
 static dkBool k_autoBreak("Options->Layers->Auto-Break", true);
 static dkBool k_exportGrid("Options->Export->Draw grid", false);
-static dkBool k_exportHighRes("Options->Export->High res export", true);
 static dkInt k_regularizationIt("Options->Grid->Manual regularization iterations", 100, 0, 1000, 1);
 static dkBool k_onXs("Options->On X's", false);
 static dkInt k_Xs("Options->X's", 2, 1, 5, 1);
@@ -63,6 +63,8 @@ extern dkBool k_drawSplat;
 extern dkBool k_debug_out;
 extern dkBool k_exportOnionSkinMode;
 extern dkBool k_useDeformAsSource;
+extern dkBool k_useInterpolation;
+extern dkFloat k_thetaEps;
 
 static VectorKeyFrame *g_clipboardVectorKeyFrame = nullptr;
 
@@ -102,10 +104,15 @@ bool Editor::init(TabletCanvas *canvas) {
     m_undoStack = new QUndoStack(this);
     connect(m_undoStack, &QUndoStack::indexChanged, this, &Editor::updateTimeLine);
 
-    setTabletCanvas(canvas);
-
-    m_toolsManager->initTools();
-    m_fixedSceneManager->setScene(m_tabletCanvas->fixedGraphicsScene());
+    // Without a canvas there are no tools, only loading, interpolating and exporting on the CPU are possible
+    if (canvas != nullptr) {
+        setTabletCanvas(canvas);
+        m_toolsManager->initTools();
+    } else {
+        m_headlessScene = new QGraphicsScene(this);
+        setCanvasRect(1920, 1080);
+    }
+    m_fixedSceneManager->setScene(fixedGraphicsScene());
     connect(&k_drawSplat, SIGNAL(valueChanged(bool)), this, SLOT(toggleDrawSplat(bool)));
     connect(&k_splatSamplingRate, &dkSlider::valueChanged, this, [&] { toggleDrawSplat(true); });
     connect(&k_onXs, SIGNAL(valueChanged(bool)), this, SLOT(makeInbetweensDirty(void)));
@@ -127,33 +134,51 @@ void Editor::setTabletCanvas(TabletCanvas *canvas) {
     canvas->setEditor(this);
 }
 
+QRect Editor::canvasRect() const {
+    return m_tabletCanvas != nullptr ? m_tabletCanvas->canvasRect() : m_headlessCanvasRect;
+}
+
+void Editor::setCanvasRect(int width, int height) {
+    if (m_tabletCanvas != nullptr) {
+        m_tabletCanvas->setCanvasRect(width, height);
+        return;
+    }
+    // Same convention as TabletCanvas::setCanvasRect, the scene covers the canvas like the fixed view does at the default zoom
+    m_headlessCanvasRect = QRect(-width / 2, -height / 2, width, height);
+    m_headlessScene->setSceneRect(0, 0, width, height);
+}
+
+QGraphicsScene *Editor::fixedGraphicsScene() const {
+    return m_tabletCanvas != nullptr ? m_tabletCanvas->fixedGraphicsScene() : m_headlessScene;
+}
+
 bool Editor::load(QDomElement &element, const QString &path) {
     if (element.tagName() != "editor") return false;
 
     if (element.hasAttribute("width") && element.hasAttribute("height")) {
         int width = element.attribute("width").toInt();
         int height = element.attribute("height").toInt();
-        m_tabletCanvas->setCanvasRect(width, height);
+        setCanvasRect(width, height);
     }
 
-    m_tabletCanvas->hide();
+    if (m_tabletCanvas) m_tabletCanvas->hide();
     if (!m_layerManager->load(element, path)) return false;
-    m_tabletCanvas->show();
+    if (m_tabletCanvas) m_tabletCanvas->show();
 
     emit currentFrameChanged(playback()->currentFrame());
     QCoreApplication::processEvents(); // not very elegent way but we need the previous to be processed immediately 
 
-    m_toolsManager->currentTool()->toggled(true);
+    if (m_toolsManager->currentTool()) m_toolsManager->currentTool()->toggled(true);
     m_fixedSceneManager->updateKeyChart(m_layerManager->currentLayer()->getLastKey(m_playbackManager->currentFrame()));
 
     return true;
 }
 
-bool Editor::save(QDomDocument &doc, QDomElement &root, const QString &path) const {
+bool Editor::save(QDomDocument &doc, QDomElement &root, const QString &path, bool keyframes) const {
     QDomElement element = doc.createElement("editor");
-    element.setAttribute("width", m_tabletCanvas->canvasRect().width());
-    element.setAttribute("height", m_tabletCanvas->canvasRect().height());
-    m_layerManager->save(doc, element, path);
+    element.setAttribute("width", canvasRect().width());
+    element.setAttribute("height", canvasRect().height());
+    m_layerManager->save(doc, element, path, keyframes);
 
     root.appendChild(element);
     return true;
@@ -329,8 +354,13 @@ int Editor::updateInbetweens(VectorKeyFrame *keyframe, int inbetween, int stride
         keyframe->initInbetweens(stride);
     }
     if (stride == 0 || inbetween < 0) return inbetween;
-    if (!m_exporting && QOpenGLContext::currentContext() != m_tabletCanvas->context()) m_tabletCanvas->makeCurrent();
-    keyframe->bakeInbetween(this, keyframe->parentLayer()->getVectorKeyFramePosition(keyframe), inbetween, stride);
+    if (!m_exporting && m_tabletCanvas && QOpenGLContext::currentContext() != m_tabletCanvas->context()) m_tabletCanvas->makeCurrent();
+    // During playback and export all the inbetweens of the keyframe are going to be displayed, bake them in a single parallel pass
+    if ((m_exporting || m_playbackManager->isPlaying()) && !keyframe->inbetweens().isClean(inbetween)) {
+        keyframe->bakeInbetweens(this, keyframe->parentLayer()->getVectorKeyFramePosition(keyframe), stride);
+    } else {
+        keyframe->bakeInbetween(this, keyframe->parentLayer()->getVectorKeyFramePosition(keyframe), inbetween, stride);
+    }
     return inbetween;
 }
 
@@ -357,8 +387,9 @@ void Editor::deleteAllEmptyGroups(int layerNumber, int frameIndex) {
     m_undoStack->endMacro();
 }
 
-void Editor::exportFrames(const QString &path, QSize exportSize, bool transparency) {
+void Editor::exportFrames(const QString &path, QSize exportSize, bool transparency, int from, int to) {
     QFileInfo info(path);
+    int firstFrame = from >= 0 ? from : int(k_exportFrom);
     int maxFrame = m_layerManager->maxFrame();
     int nbDigits = QString::number(maxFrame).length();
 
@@ -371,21 +402,23 @@ void Editor::exportFrames(const QString &path, QSize exportSize, bool transparen
         layer->color = newColor;
     }
 
-    if (k_exportOnionSkinMode) maxFrame = k_exportFrom;
-    if (!k_exportHighRes) exportSize = QSize(m_tabletCanvas->canvasRect().width(), m_tabletCanvas->canvasRect().height());
+    if (k_exportOnionSkinMode) maxFrame = firstFrame;
+    else if (to >= 0) maxFrame = std::min(maxFrame, to);
     
     // Destroy buffers made with the OpenGLCanvas default FBO
     m_layerManager->destroyBuffers();
 
+    exportSize = exportFrameSize(exportSize);
+    double scaleW = (double)exportSize.width() / canvasRect().width();
+    double scaleH = (double)exportSize.height() / canvasRect().height();
+
     if (QOpenGLContext::currentContext() != m_tabletCanvas->context()) m_tabletCanvas->makeCurrent();
     m_exporting = true;
-    for (int frame = k_exportFrom; frame <= maxFrame; frame++) {
+    for (int frame = firstFrame; frame <= maxFrame; frame++) {
         QString frameNumberString = QString::number(frame);
         while (frameNumberString.length() < nbDigits) frameNumberString.prepend("0");
 
 
-        double scaleW = exportSize.width() / m_tabletCanvas->canvasRect().width();
-        double scaleH = exportSize.height() / m_tabletCanvas->canvasRect().height();
         if (info.completeSuffix() == "svg") {
             scrubTo(frame);
             QRectF targetRect(QPointF(0, 0), exportSize);
@@ -418,11 +451,8 @@ void Editor::exportFrames(const QString &path, QSize exportSize, bool transparen
                 VectorKeyFrame *keyframe = layer->getLastKey(frame);
                 int inbetween = layer->inbetweenPosition(frame);
                 int stride = layer->stride(frame);
-                qreal alphaLinear = alpha(frame);
                 for (Group *group : keyframe->postGroups()) {
                     group->setShowGrid(true);
-                    if (group->lattice()->isArapPrecomputeDirty()) group->lattice()->precompute();
-                    group->lattice()->interpolateARAP(alphaLinear, group->spacingAlpha(alphaLinear), keyframe->rigidTransform(alphaLinear), false);
                     if (inbetween == 0) group->drawGrid(painter, 0, REF_POS);
                     else                group->drawGrid(painter, inbetween, INTERP_POS);
                     group->setShowGrid(false);
@@ -474,7 +504,6 @@ void Editor::exportFrames(const QString &path, QSize exportSize, bool transparen
                 VectorKeyFrame *keyframe = layer->getLastKey(frame);
                 int inbetween = layer->inbetweenPosition(frame);
                 int stride = layer->stride(frame);
-                qreal alphaLinear = alpha(frame);
 
                 if (inbetween == 0 && frame == 9) {
                     VectorKeyFrame *previousKeyframe = layer->getVectorKeyFrameAtFrame(layer->getPreviousKeyFramePosition(frame));
@@ -487,8 +516,6 @@ void Editor::exportFrames(const QString &path, QSize exportSize, bool transparen
 
                 for (Group *group : keyframe->postGroups()) {
                     group->setShowGrid(true);
-                    if (group->lattice()->isArapPrecomputeDirty()) group->lattice()->precompute();
-                    group->lattice()->interpolateARAP(alphaLinear, group->spacingAlpha(alphaLinear), keyframe->rigidTransform(alphaLinear), false);
                     if (inbetween == 0) group->drawGrid(painter, 0, REF_POS);
                     else                group->drawGrid(painter, inbetween, INTERP_POS);
                     group->setShowGrid(false);
@@ -511,6 +538,98 @@ void Editor::exportFrames(const QString &path, QSize exportSize, bool transparen
     m_tabletCanvas->doneCurrent();
 }
 
+/**
+ * The frames are scaled uniformly from the canvas: fit the requested size to the aspect ratio of the canvas
+ */
+QSize Editor::exportFrameSize(QSize requested) const {
+    QSize canvasSize = canvasRect().size();
+    if (!requested.isValid() || requested.isEmpty()) return canvasSize;
+    QSize size = canvasSize.scaled(requested, Qt::KeepAspectRatio).expandedTo(QSize(1, 1));
+    if (size != requested) {
+        qWarning("The export size %dx%d does not have the aspect ratio of the canvas (%dx%d), the frames are exported at %dx%d.",
+                 requested.width(), requested.height(), canvasSize.width(), canvasSize.height(), size.width(), size.height());
+    }
+    return size;
+}
+
+/**
+ * Export the frames without an OpenGL context: the strokes go through the software version of the stroke shader
+ * (see StrokeRasterizer) and are composited with the fixed scene like in exportFrames.
+ * Only the canvas rect and the fixed scene are used, the editor does not need a canvas (see init).
+ */
+void Editor::exportFramesSoftware(const QString &path, QSize exportSize, int from, int to) {
+    QFileInfo info(path);
+    int firstFrame = from >= 0 ? from : int(k_exportFrom);
+    int maxFrame = m_layerManager->maxFrame();
+    int nbDigits = QString::number(maxFrame).length();
+    if (to >= 0) maxFrame = std::min(maxFrame, to);
+
+    // Uniforms of TabletCanvas::paintGLInit when exporting
+    exportSize = exportFrameSize(exportSize);
+    double scaleW = (double)exportSize.width() / canvasRect().width();
+    double scaleH = (double)exportSize.height() / canvasRect().height();
+    StrokeStyle style;
+    style.view = QTransform().scale(scaleW, scaleH).translate(canvasRect().width() / 2, canvasRect().height() / 2);
+    style.proj.ortho(QRect(0, 0, exportSize.width(), exportSize.height()));
+    style.winSize = Eigen::Vector2f(exportSize.width(), exportSize.height());
+    style.zoom = scaleW;
+    style.thetaEpsilon = k_thetaEps;
+    StrokeRasterizer rasterizer(exportSize.width(), exportSize.height());
+
+    m_exporting = true;
+    for (int frame = firstFrame; frame <= maxFrame; frame++) {
+        QString frameNumberString = QString::number(frame);
+        while (frameNumberString.length() < nbDigits) frameNumberString.prepend("0");
+
+        scrubTo(frame);
+
+        // Same layers and group order as TabletCanvas::drawCanvas and TabletCanvas::drawKeyFrame
+        rasterizer.clear();
+        for (int l = m_layerManager->layersCount() - 1; l >= 0; l--) {
+            Layer *layer = m_layerManager->layerAt(l);
+            if (!layer || !layer->visible()) continue;
+            VectorKeyFrame *keyframe = layer->getLastVectorKeyFrameAtFrame(frame, 0);
+            int stride = layer->stride(frame);
+            int inbetween = updateInbetweens(keyframe, layer->inbetweenPosition(frame), stride);
+            double alphaOrder = k_useInterpolation ? ((double)inbetween / stride) : 0.0;
+            const std::vector<std::vector<int>> &order = keyframe->orderPartials().lastPartialAt(alphaOrder).groupOrder().order();
+            for (int i = (int)order.size() - 1; i >= 0; --i) {
+                for (int groupId : order[i]) {
+                    keyframe->paintGroup(rasterizer, style, alpha(frame), layer->opacity(), keyframe->postGroups().fromId(groupId), inbetween);
+                }
+            }
+        }
+        QImage strokes = rasterizer.image();
+
+        QRectF targetRect(QPointF(0, 0), exportSize);
+        QString fileName = info.absolutePath() + "/" + info.baseName() + "_" + frameNumberString + "." + info.completeSuffix();
+        if (info.completeSuffix() == "svg") {
+            QSvgGenerator generator;
+            generator.setFileName(fileName);
+            generator.setSize(exportSize);
+            generator.setViewBox(targetRect.toRect());
+            QPainter painter;
+            painter.begin(&generator);
+            painter.drawImage(QPoint(0, 0), strokes);
+            fixedGraphicsScene()->render(&painter, targetRect);
+            painter.end();
+        } else {
+            QImage img(exportSize, QImage::Format_ARGB32_Premultiplied);
+            img.fill(Qt::white);
+            QPainter painter(&img);
+            painter.setRenderHint(QPainter::Antialiasing, true);
+            painter.setRenderHint(QPainter::SmoothPixmapTransform, true);
+            painter.drawImage(QPoint(0, 0), strokes);
+            painter.translate(canvasRect().width()/2, canvasRect().height()/2);
+            fixedGraphicsScene()->render(&painter, targetRect);
+            painter.end();
+            img.save(fileName);
+        }
+        std::cout << "Frame " << frame << " has been exported" << std::endl;
+    }
+    m_exporting = false;
+}
+
 VectorKeyFrame *Editor::currentKeyFrame() {
     Layer *layer = m_layerManager->currentLayer();
     return layer->getVectorKeyFrameAtFrame(m_playbackManager->currentFrame());
@@ -521,19 +640,22 @@ VectorKeyFrame *Editor::prevKeyFrame() {
     return layer->getLastVectorKeyFrameAtFrame(m_playbackManager->currentFrame(), 0);
 }
 
+// Keyframe the given keyframe is registered with: the next one, or the first selected keyframe if it is the last selected one
+VectorKeyFrame *Editor::registrationTarget(VectorKeyFrame *key) {
+    VectorKeyFrame *target = key->nextKeyframe();
+    int currentFrame = layers()->currentLayer()->getVectorKeyFramePosition(key);
+    if (layers()->currentLayer()->isVectorKeyFrameSelected(key) && layers()->currentLayer()->getLastKeyFrameSelected() == currentFrame){
+        int frame = layers()->currentLayer()->getFirstKeyFrameSelected();
+        target = layers()->currentLayer()->getVectorKeyFrameAtFrame(frame);
+    }
+    return target;
+}
+
 void Editor::registerFromRestPosition(VectorKeyFrame * key, bool registerToNextKeyframe){
     if (key == nullptr) return;
     
     if (registerToNextKeyframe) {
-        VectorKeyFrame *target = key->nextKeyframe();
-
-        int lastFrame = layers()->currentLayer()->getMaxKeyFramePosition();
-        int currentFrame = layers()->currentLayer()->getVectorKeyFramePosition(key);
-        if (layers()->currentLayer()->isVectorKeyFrameSelected(key) && layers()->currentLayer()->getLastKeyFrameSelected() == currentFrame){
-            int frame = layers()->currentLayer()->getFirstKeyFrameSelected();
-            target = layers()->currentLayer()->getVectorKeyFrameAtFrame(frame);
-        }
-        m_registrationManager->setRegistrationTarget(target);
+        m_registrationManager->setRegistrationTarget(registrationTarget(key));
     }
     const QMap<int, Group *> &groups = key->selection().selectedPostGroups().empty() ? key->groups(POST) : key->selection().selectedPostGroups();
     bool multipleGroupsSelected = groups.size() > 1;
@@ -552,6 +674,20 @@ void Editor::registerFromRestPosition(VectorKeyFrame * key, bool registerToNextK
     m_tabletCanvas->update();
 }
 
+// Register each keyframe with its registration target, the keyframes are processed in parallel
+void Editor::registerFromRestPosition(const QVector<VectorKeyFrame *> &keys) {
+    std::vector<std::pair<VectorKeyFrame *, VectorKeyFrame *>> pairs;
+    for (VectorKeyFrame *key : keys) {
+        if (key == nullptr) continue;
+        pairs.push_back({key, registrationTarget(key)});
+    }
+    m_registrationManager->registration(pairs);
+    for (VectorKeyFrame *key : keys) {
+        if (key != nullptr) key->makeInbetweensDirty();
+    }
+    m_tabletCanvas->update();
+}
+
 void Editor::duplicateKey() {
     Layer *layer = m_layerManager->layerAt(layers()->currentLayerIndex());
     if (layer != nullptr) {
@@ -947,7 +1083,7 @@ void Editor::makeInbetweensDirty() {
 
 void Editor::toggleDrawSplat(bool drawSplat) {
     // Update all strokes buffers
-    if (!m_exporting && QOpenGLContext::currentContext() != m_tabletCanvas->context()) m_tabletCanvas->makeCurrent();
+    if (!m_exporting && m_tabletCanvas && QOpenGLContext::currentContext() != m_tabletCanvas->context()) m_tabletCanvas->makeCurrent();
     for (int layerIndex = 0; layerIndex < m_layerManager->layersCount(); ++layerIndex) {
         Layer *layer = m_layerManager->layerAt(layerIndex);
         if (layer == nullptr) continue;
@@ -955,7 +1091,7 @@ void Editor::toggleDrawSplat(bool drawSplat) {
             keyframe.value()->updateBuffers();
         }
     }
-    m_tabletCanvas->update();
+    if (m_tabletCanvas) m_tabletCanvas->update();
 }
 
 /**
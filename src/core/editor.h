@@ -80,6 +80,11 @@ class Editor : public QObject {
     void setTabletCanvas(TabletCanvas *canvas);
     TabletCanvas *tabletCanvas() { return m_tabletCanvas; }
 
+    // Without a canvas (init(nullptr), e.g. frite-render on the CPU) the editor keeps its own canvas rect and fixed scene
+    QRect canvasRect() const;
+    void setCanvasRect(int width, int height);
+    QGraphicsScene *fixedGraphicsScene() const;
+
     qreal alpha(int frame, Layer *layer=nullptr);
     qreal currentAlpha();
     void scrubTo(int frameNumber);
@@ -88,7 +93,8 @@ class Editor : public QObject {
     void addEndStroke(StrokePtr stroke);
 
     bool load(QDomElement &element, const QString &path);
-    bool save(QDomDocument &doc, QDomElement &root, const QString &path) const;
+    // Without keyframes, the keyframes elements only have their frame attribute (see FileManager::journal)
+    bool save(QDomDocument &doc, QDomElement &root, const QString &path, bool keyframes = true) const;
 
     int addKeyFrame(int layerNumber, int frameNumber, bool updateCurves=true);
     void removeKeyFrame(int layerNumber, int frameIndex);
@@ -97,7 +103,10 @@ class Editor : public QObject {
 
     QUndoStack *undoStack() const { return m_undoStack; }
 
-    void exportFrames(const QString &path, QSize exportSize, bool transparency = true);
+    // Export frames [from, to] (defaults to the export range of the dials) at exportSize, the frame number is appended to the file name
+    void exportFrames(const QString &path, QSize exportSize, bool transparency = true, int from = -1, int to = -1);
+    // Same without OpenGL, the strokes are rasterized on the CPU (no masks, onion skins or tool gizmos)
+    void exportFramesSoftware(const QString &path, QSize exportSize, int from = -1, int to = -1);
 
     QColor backwardColor() const { return m_backwardColor; }
     void setBackwardColor(const QColor &backwardColor);
@@ -113,6 +122,8 @@ class Editor : public QObject {
     VectorKeyFrame *prevKeyFrame();
 
     void registerFromRestPosition(VectorKeyFrame * key, bool registerToNextKeyframe);
+    void registerFromRestPosition(const QVector<VectorKeyFrame *> &keys);
+    VectorKeyFrame *registrationTarget(VectorKeyFrame *key);
 
    signals:
     void updateTimeLine();
@@ -190,8 +201,12 @@ class Editor : public QObject {
     void debugReport();
 
    private:
+    QSize exportFrameSize(QSize requested) const;
+
     ColorManager *m_colorManager = nullptr;
     TabletCanvas *m_tabletCanvas = nullptr;
+    QRect m_headlessCanvasRect;
+    QGraphicsScene *m_headlessScene = nullptr;
     PlaybackManager *m_playbackManager = nullptr;
     LayerManager *m_layerManager = nullptr;
     ViewManager *m_viewManager = nullptr;
@@ -21,8 +21,10 @@
 #include "gridmanager.h"
 #include "viewmanager.h"
 #include "utils/geom.h"
+#include "utils/numberreader.h"
 #include "dialsandknobs.h"
 #include "utils/stopwatch.h"
+#include "utils/chunkfile.h"
 
 extern dkBool k_displayGrids;
 extern dkBool k_displayMask;
@@ -147,24 +149,42 @@ Group::~Group() {
 
 void Group::reset() {}
 
-void Group::loadStrokes(QDomElement &strokesElt, uint size) {
+void Group::loadStrokes(QDomElement &strokesElt, uint size, const ChunkReader *data) {
     m_drawingPartials.firstPartial().strokes().reserve(size);
+
+    // Intervals of all the strokes are stored contiguously in the "group.intervals" array
+    if (data != nullptr && strokesElt.hasAttribute("offset")) {
+        size_t offset = strokesElt.attribute("offset").toULongLong();
+        for (QDomElement strokeElt = strokesElt.firstChildElement("stroke"); !strokeElt.isNull(); strokeElt = strokeElt.nextSiblingElement("stroke")) {
+            int strokeId = strokeElt.attribute("id").toInt();
+            size_t size = strokeElt.attribute("size").toULongLong();
+            const std::array<qint32, 2> *intervals = data->array<std::array<qint32, 2>>("group.intervals", offset, size);
+            if (intervals == nullptr) {
+                qCritical() << "Error in Group::loadStrokes: missing intervals of stroke " << strokeId;
+                return;
+            }
+            for (size_t i = 0; i < size; ++i) addStroke(strokeId, Interval(intervals[i][0], intervals[i][1]));
+            offset += size;
+        }
+        return;
+    }
+
     QDomNode strokeTag = strokesElt.firstChild();
     while (!strokeTag.isNull()) {
         int strokeId = strokeTag.toElement().attribute("id").toInt();
         int size = strokeTag.toElement().attribute("size").toInt();
-        QString stringIntervals = strokeTag.toElement().text();
-        QTextStream streamIntervals(&stringIntervals);
+        QString stringIntervals = NumberReader::text(strokeTag.toElement());
+        NumberReader streamIntervals(stringIntervals);
         int toIdx, fromIdx;
         for (size_t i = 0; i < size; ++i) {
-            streamIntervals >> fromIdx >> toIdx;
+            streamIntervals.read(fromIdx, toIdx);
             addStroke(strokeId, Interval(fromIdx, toIdx));
         }
         strokeTag = strokeTag.nextSibling();
     }
 }
 
-void Group::load(QDomNode &groupNode) {
+void Group::load(QDomNode &groupNode, const ChunkReader *data) {
     QDomElement groupElt = groupNode.toElement();
     m_id = groupElt.attribute("id").toInt();
     m_color = QColor::fromHslF(m_parentKeyframe->getNextGroupHue(), 1.0f, 0.5f);
@@ -178,7 +198,7 @@ void Group::load(QDomNode &groupNode) {
     // load strokes
     QDomElement strokesElt = groupNode.firstChildElement();
     if (!strokesElt.isNull()) {
-        loadStrokes(strokesElt, size);
+        loadStrokes(strokesElt, size, data);
     }
 
     // load spacing curve
@@ -189,7 +209,7 @@ void Group::load(QDomNode &groupNode) {
     QDomElement latticeElt = strokesElt.nextSiblingElement("lattice");
     if (!latticeElt.isNull()) {
         setGrid(new Lattice(m_parentKeyframe));
-        m_grid->load(latticeElt);
+        m_grid->load(latticeElt, data);
     } else {
         for (auto it = strokes().constBegin(); it != strokes().constEnd(); ++it) {
             Stroke *stroke = m_parentKeyframe->stroke(it.key());
@@ -202,20 +222,36 @@ void Group::load(QDomNode &groupNode) {
 
     // load uvs quad keys
     QDomElement uvQuadKeyElt = strokesElt.nextSiblingElement("uvquadkey");
-    if (!uvQuadKeyElt.isNull()) {
+    if (!uvQuadKeyElt.isNull() && data != nullptr && uvQuadKeyElt.hasAttribute("offset")) {
+        size_t size = uvQuadKeyElt.attribute("size", "0").toULongLong();
+        const std::array<quint32, 3> *uvs = data->array<std::array<quint32, 3>>("group.uvs", uvQuadKeyElt.attribute("offset").toULongLong(), size);
+        if (uvs == nullptr) {
+            qCritical() << "Error in Group::load: missing UVs of group " << m_id;
+            return;
+        }
+        for (size_t i = 0; i < size; ++i) {
+            m_forwardUVs.add(uvs[i][0], uvs[i][1], {(int)uvs[i][2], Point::VectorType::Zero()});
+        }
+    } else if (!uvQuadKeyElt.isNull()) {
         int size = uvQuadKeyElt.attribute("size", "0").toInt();
-        QString stringQuadKey = uvQuadKeyElt.text();
-        QTextStream posQuadKey(&stringQuadKey);
+        QString stringQuadKey = NumberReader::text(uvQuadKeyElt);
+        NumberReader posQuadKey(stringQuadKey);
         unsigned int key;
         int quadKey;
         for (int i = 0; i < size; ++i) {
-            posQuadKey >> key >> quadKey;
-            m_forwardUVs[key] = {quadKey, Point::VectorType::Zero()};
+            posQuadKey.read(key, quadKey);
+            auto point = Utils::invCantor(key);
+            m_forwardUVs.add(point.first, point.second, {quadKey, Point::VectorType::Zero()});
         }
     }
 }
 
-void Group::save(QDomDocument &doc, QDomElement &groupsElt) const {
+/**
+ * Save the group in a "group" element. If data is not null, the strokes intervals and the UVs quad keys are appended to
+ * its "group.intervals" (from, to) and "group.uvs" (stroke id, point index, quad key) arrays instead of being written as text.
+ * Unlike the text format, the binary UVs do not pack the point with Utils::cantor, which overflows 32 bits on long strokes.
+ */
+void Group::save(QDomDocument &doc, QDomElement &groupsElt, ChunkWriter *data) const {
     QDomElement groupElt = doc.createElement("group");
 
     // save group attributes
@@ -230,8 +266,16 @@ void Group::save(QDomDocument &doc, QDomElement &groupsElt) const {
     // save strokes intervals
     QDomElement strokesElt = doc.createElement("strokes");
     // const StrokeIntervals &strokes = m_showInterStroke ? m_origin_strokes : m_strokes;
+    std::vector<std::array<qint32, 2>> intervals;
     for (auto it = m_drawingPartials.firstPartial().strokes().constBegin(); it != m_drawingPartials.firstPartial().strokes().constEnd(); it++) {
         QDomElement strokeElt = doc.createElement("stroke");
+        if (data != nullptr) {
+            strokesElt.appendChild(strokeElt);
+            strokeElt.setAttribute("id", it.key());
+            strokeElt.setAttribute("size", (unsigned int)it.value().size());
+            for (const Interval &interval : it.value()) intervals.push_back({(qint32)interval.from(), (qint32)interval.to()});
+            continue;
+        }
         QString stringIntervals;
         QTextStream streamIntervals(&stringIntervals);
         strokesElt.appendChild(strokeElt);
@@ -241,6 +285,7 @@ void Group::save(QDomDocument &doc, QDomElement &groupsElt) const {
         QDomText txtIntervals = doc.createTextNode(stringIntervals);
         strokeElt.appendChild(txtIntervals);
     }
+    if (data != nullptr) strokesElt.setAttribute("offset", qulonglong(data->append("group.intervals", intervals)));
     groupElt.appendChild(strokesElt);
 
     QDomElement spacingElt = doc.createElement("spacing");
@@ -250,18 +295,29 @@ void Group::save(QDomDocument &doc, QDomElement &groupsElt) const {
     // save lattice
     if (m_grid != nullptr) {
         QDomElement latticeElt = doc.createElement("lattice");
-        m_grid->save(doc, latticeElt);
+        m_grid->save(doc, latticeElt, data);
         groupElt.appendChild(latticeElt);
     }
 
     // save forward UV quads
     QDomElement uvQuadKeyElt = doc.createElement("uvquadkey");
     uvQuadKeyElt.setAttribute("size", uint(m_forwardUVs.size()));
+    if (data != nullptr) {
+        std::vector<std::array<quint32, 3>> uvs;
+        uvs.reserve(m_forwardUVs.size());
+        m_forwardUVs.forEach([&uvs](unsigned int strokeId, unsigned int i, const UVInfo &uv) {
+            uvs.push_back({(quint32)strokeId, (quint32)i, (quint32)uv.quadKey});
+        });
+        uvQuadKeyElt.setAttribute("offset", qulonglong(data->append("group.uvs", uvs)));
+        groupElt.appendChild(uvQuadKeyElt);
+        groupsElt.appendChild(groupElt);
+        return;
+    }
     QString stringQuadKey;
     QTextStream startPosQuadKey(&stringQuadKey);
-    for (auto it = m_forwardUVs.constBegin(); it != m_forwardUVs.constEnd(); ++it) {
-        startPosQuadKey << it.key() << " " << it.value().quadKey << " ";
-    }
+    m_forwardUVs.forEach([&startPosQuadKey](unsigned int strokeId, unsigned int i, const UVInfo &uv) {
+        startPosQuadKey << Utils::cantor(strokeId, i) << " " << uv.quadKey << " ";
+    });
     QDomText txt = doc.createTextNode(stringQuadKey);
     txt = doc.createTextNode(stringQuadKey);
     uvQuadKeyElt.appendChild(txt);
@@ -333,19 +389,20 @@ void Group::makeBreakdown(VectorKeyFrame *newKeyframe, VectorKeyFrame *nextKeyfr
 
     // create the lattice of the new group with the same topology as the previous group
     // the reference position of the new group and the target position of the previous group are both set to the intermediate lattice position
-    m_grid->interpolateARAP(linearAlpha, spacingAlpha(linearAlpha), rigidTransform, false);
+    InterpolatedFrame frame = m_grid->interpolateARAP(linearAlpha, spacingAlpha(linearAlpha), rigidTransform, false);
     breakdown->setGrid(new Lattice(*m_grid));
     breakdown->lattice()->setKeyframe(newKeyframe);
     for (Corner *c : m_grid->corners()) {
         int key = c->getKey();
-        c->coord(TARGET_POS) = c->coord(INTERP_POS);
-        c->coord(DEFORM_POS) = c->coord(INTERP_POS);
+        c->coord(TARGET_POS) = frame[key];
+        c->coord(DEFORM_POS) = frame[key];
         // !a corner key id in the previous group does not necessarily correspond to the same corner key in the new group
         // here it doesn't matter since we're using the corners from the same grid in both sides of the followings assigments
-        breakdown->lattice()->corners()[key]->coord(REF_POS) = rigidTransform * breakdown->lattice()->corners()[key]->coord(INTERP_POS);
-        breakdown->lattice()->corners()[key]->coord(INTERP_POS) = rigidTransform * breakdown->lattice()->corners()[key]->coord(INTERP_POS);
+        breakdown->lattice()->corners()[key]->coord(REF_POS) = rigidTransform * frame[key];
+        breakdown->lattice()->corners()[key]->coord(INTERP_POS) = rigidTransform * frame[key];
         breakdown->lattice()->corners()[key]->coord(TARGET_POS) = rigidTransform * breakdown->lattice()->corners()[key]->coord(TARGET_POS);
     }
+    breakdown->lattice()->setRestDirty();
 
     // rebake stroke intervals in the lattice quads
     breakdown->strokes().forEachInterval(
@@ -354,10 +411,8 @@ void Group::makeBreakdown(VectorKeyFrame *newKeyframe, VectorKeyFrame *nextKeyfr
     // dirty both the previous and new group lattices
     setGridDirty();
 
-    m_grid->resetPrecomputedTime();
     m_grid->setBackwardUVDirty(true);
     breakdown->setGridDirty();
-    breakdown->lattice()->resetPrecomputedTime();
     breakdown->lattice()->setBackwardUVDirty(true);
 
     // split trajectories
@@ -648,6 +703,11 @@ qreal Group::spacingAlpha(qreal alpha) {
     return res < std::numeric_limits<qreal>::epsilon() ? 0.0 : res;
 }
 
+qreal Group::evalSpacingAlpha(qreal alpha) const {
+    qreal res = m_spacing->curve()->evalAt(alpha);
+    return res < std::numeric_limits<qreal>::epsilon() ? 0.0 : res;
+}
+
 void Group::computeSpacingProxy(Bezier2D &proxy) const {
     // Create data to fit
     Curve *curve = m_spacing->curve();
@@ -863,6 +923,15 @@ void Group::setGridDirty() {
     m_maskBackward->setDirty();
 }
 
+/**
+ * Only the hard constraints of the lattice have changed, the lattice ARAP factorization is kept
+ */
+void Group::setConstraintsDirty() {
+    m_grid->setConstraintsDirty();
+    m_mask->setDirty();
+    m_maskBackward->setDirty();
+}
+
 /**
  * Synchronize the corresponding pre group strokes (if correspondence exists)
  * And eventually the next post group lattice REF_POS (if intra-correspondence exists)
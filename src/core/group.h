@@ -34,6 +34,8 @@ enum GroupType : unsigned int { PRE, POST, MAIN };
 
 class VectorKeyFrame;
 class Editor;
+class ChunkWriter;
+class ChunkReader;
 
 class Group {
    public:
@@ -43,9 +45,9 @@ class Group {
     ~Group();
 
     static void reset();
-    void loadStrokes(QDomElement &strokesElt, uint size);
-    void load(QDomNode &groupNode);
-    void save(QDomDocument &doc, QDomElement &groupsElt) const;
+    void loadStrokes(QDomElement &strokesElt, uint size, const ChunkReader *data = nullptr);
+    void load(QDomNode &groupNode, const ChunkReader *data = nullptr);
+    void save(QDomDocument &doc, QDomElement &groupsElt, ChunkWriter *data = nullptr) const;
     void update();
     void makeBreakdown(VectorKeyFrame *newKeyframe, VectorKeyFrame *nextKeyframe, Group *breakdown, int inbetween, qreal linearAlpha, const Point::Affine &rigidTransform, const QHash<int, int> &backwardStrokesMap, Editor *editor);
     void clear();
@@ -60,6 +62,7 @@ class Group {
     const StrokeIntervals &strokes() const { return m_drawingPartials.firstPartial().strokes(); }
     StrokeIntervals &strokes() { return m_drawingPartials.firstPartial().strokes(); }
     StrokeIntervals &strokes(double t) { return m_drawingPartials.lastPartialAt(t).strokes(); }
+    const StrokeIntervals &strokes(double t) const { return m_drawingPartials.constLastPartialAt(t).strokes(); }
     Partials<DrawingPartial> &drawingPartials() { return m_drawingPartials; }
     size_t size(double t=0.0) const { return m_drawingPartials.constLastPartialAt(t).strokes().size(); }
     int nbPoints(double t=0.0) const { return m_drawingPartials.constLastPartialAt(t).strokes().nbPoints(); }
@@ -84,6 +87,8 @@ class Group {
     // lattice
     Lattice *lattice() const { return m_grid.get(); }
     void setGrid(Lattice *grid) { m_grid.reset(grid); }
+    // Exchange the lattice and its forward UVs with the given ones (e.g. to embed the strokes in a temporary lattice)
+    void swapGrid(std::shared_ptr<Lattice> &grid, UVHash &uvs) { m_grid.swap(grid); std::swap(m_forwardUVs, uvs); }
     void clearLattice();
     void clearLattice(int strokeId);
     bool showGrid() const { return m_showGrid; };
@@ -99,6 +104,7 @@ class Group {
     bool isSticker() const { return m_sticker; }
     void setSticker(bool sticker) { m_sticker = sticker; }
     void setGridDirty();
+    void setConstraintsDirty();
     void syncTargetPosition(VectorKeyFrame *next);
     void syncSourcePosition(VectorKeyFrame *prev);
     void syncSourcePosition();
@@ -111,6 +117,7 @@ class Group {
     Point::Affine forwardTransform(qreal linear_alpha, bool useSpacingIndirection = true);
     Point::Affine backwardTransform(qreal linear_alpha);
     qreal spacingAlpha(qreal alpha);
+    qreal evalSpacingAlpha(qreal alpha) const;  // same as spacingAlpha but does not update the spacing curve current value
     void computeSpacingProxy(Bezier2D &proxy) const;
     void transform(const Point::Affine &transform);
     Point::Affine rigidTransform(qreal t) const;
@@ -7,7 +7,148 @@
 #include "inbetweens.h"
 
 #include "stroke.h"
+#include "dialsandknobs.h"
 #include "utils/geom.h"
+#include "GL/StrokeRasterizer.h"
+
+#include <QOpenGLContext>
+
+extern dkBool k_drawSplat;
+
+InbetweenStroke::InbetweenStroke(const StrokePtr &source) : m_source(source) {
+    m_positions.resize(source->size());
+    for (size_t i = 0; i < m_positions.size(); ++i) {
+        m_positions[i] = source->points()[i]->pos();
+    }
+}
+
+Point::VectorType InbetweenStroke::centroid() const {
+    StrokePtr stroke = materialized();
+    if (stroke != nullptr) return stroke->centroid();
+    Point::VectorType center = Point::VectorType::Zero();
+    for (const Point::VectorType &pos : m_positions) {
+        center += pos;
+    }
+    return center / m_positions.size();
+}
+
+/**
+ * Return the full stroke, it is created from the source stroke and the warped positions on the first call.
+ * Can be called concurrently (layout, visibility), the first materialized stroke wins and is never replaced until invalidate.
+ */
+const StrokePtr &InbetweenStroke::stroke() const {
+    StrokePtr expected = materialized();
+    if (expected == nullptr) {
+        StrokePtr stroke = toStroke();
+        std::atomic_compare_exchange_strong(&m_stroke, &expected, stroke);
+    }
+    return m_stroke;
+}
+
+/**
+ * Return a new copy of the source stroke with the warped positions
+ */
+StrokePtr InbetweenStroke::toStroke() const {
+    StrokePtr materializedStroke = materialized();
+    if (materializedStroke != nullptr) return std::make_shared<Stroke>(*materializedStroke);
+    StrokePtr stroke = std::make_shared<Stroke>(*m_source);
+    for (size_t i = 0; i < m_positions.size(); ++i) {
+        stroke->points()[i]->pos() = m_positions[i];
+    }
+    stroke->polyline().updateLengths();
+    return stroke;
+}
+
+bool InbetweenStroke::buffersCreated() const {
+    StrokePtr stroke = materialized();
+    return stroke != nullptr ? stroke->buffersCreated() : m_buffers != nullptr;
+}
+
+// Line buffers or materialized stroke buffers
+bool InbetweenStroke::hasBuffers() const {
+    StrokePtr stroke = materialized();
+    return m_buffers != nullptr || (stroke != nullptr && stroke->buffersCreated());
+}
+
+/**
+ * The splat rendering mode needs the arclength of the warped stroke, the stroke is materialized in this case.
+ * Must be called in a valid OpenGL context!
+ */
+void InbetweenStroke::createBuffers(QOpenGLShaderProgram *program, VectorKeyFrame *keyframe) {
+    if (materialized() != nullptr || k_drawSplat) {
+        // the line buffers are not used anymore once the stroke is materialized
+        if (m_buffers != nullptr) {
+            m_buffers->ebo.destroy();
+            m_buffers->vbo.destroy();
+            m_buffers->vao.destroy();
+            m_buffers.reset();
+        }
+        stroke()->createBuffers(program, keyframe);
+        return;
+    }
+    if (m_buffers != nullptr) return;
+    m_buffers = std::make_shared<Buffers>();
+    Stroke::initBuffers(program, m_buffers->vao, m_buffers->vbo, m_buffers->ebo);
+
+    std::vector<GLfloat> data;
+    std::vector<GLuint> dataElt;
+    m_source->lineBufferData(keyframe, m_positions.data(), data, dataElt);
+
+    m_buffers->vbo.bind();
+    m_buffers->vbo.allocate(data.data(), data.size() * sizeof(GLfloat));
+    m_buffers->vbo.release();
+
+    m_buffers->ebo.bind();
+    m_buffers->ebo.allocate(dataElt.data(), dataElt.size() * sizeof(GLuint));
+    m_buffers->ebo.release();
+}
+
+/**
+ * Should be called in a valid OpenGL context!
+ */
+void InbetweenStroke::destroyBuffers() {
+    StrokePtr stroke = materialized();
+    if (stroke != nullptr) stroke->destroyBuffers();
+    if (m_buffers == nullptr) return;
+    m_buffers->ebo.destroy();
+    m_buffers->vbo.destroy();
+    m_buffers->vao.destroy();
+    m_buffers.reset();
+    m_mesh.reset();
+}
+
+/**
+ * Forget the GL buffers, the software mesh and the materialized stroke without destroying them, the positions are kept.
+ * The buffers must have been destroyed or handed to another owner before (see Inbetween::invalidate).
+ * Must be called while no other thread reads this stroke!
+ */
+void InbetweenStroke::forgetBuffers() {
+    m_buffers.reset();
+    m_mesh.reset();
+    std::atomic_store(&m_stroke, StrokePtr());
+}
+
+// see Stroke::render (line mode)
+void InbetweenStroke::render(GLenum mode, QOpenGLFunctions *functions, const Interval &interval, bool overshoot) {
+    StrokePtr stroke = materialized();
+    if (stroke != nullptr) {
+        stroke->render(mode, functions, interval, overshoot);
+        return;
+    }
+    m_buffers->vao.bind();
+    GLsizei count = interval.to() - interval.from() + 3;
+    if (overshoot && interval.canOvershoot() && interval.to() < size() - 1) count += 1;
+    functions->glDrawElements(mode, count, GL_UNSIGNED_INT, (const void *)(interval.from() * sizeof(GL_UNSIGNED_INT)));
+    m_buffers->vao.release();
+}
+
+// see render, the same segments and caps are tessellated
+const StrokeMesh &InbetweenStroke::mesh(VectorKeyFrame *keyframe, const Intervals &intervals, bool overshoot, const StrokeStyle &style) {
+    if (m_mesh == nullptr) m_mesh = std::make_shared<StrokeMeshCache>();
+    StrokePtr stroke = materialized();
+    if (stroke != nullptr) return m_mesh->mesh(stroke.get(), keyframe, nullptr, intervals, overshoot, style);
+    return m_mesh->mesh(m_source.get(), keyframe, m_positions.data(), intervals, overshoot, style);
+}
 
 // Point::VectorType Inbetween::getWarpedPoint(Group *group, Point::VectorType p) const {
 //     int quadKey;
@@ -24,7 +165,7 @@ bool Inbetween::quadContainsPoint(Group *group, QuadPtr quad, const Point::Vecto
     if (quad == nullptr || group == nullptr) return false;
     Point::VectorType q(-1e7, -1e7);
     Point::VectorType c[4];
-    const std::vector<Point::VectorType> &cornersPos = corners[group->id()];
+    const InterpolatedFrame &cornersPos = frame(group);
     c[0] = cornersPos[quad->corners[TOP_RIGHT]->getKey()];
     c[1] = cornersPos[quad->corners[BOTTOM_RIGHT]->getKey()];
     c[2] = cornersPos[quad->corners[BOTTOM_LEFT]->getKey()];
@@ -62,7 +203,7 @@ Point::VectorType Inbetween::getUV(Group *group, const Point::VectorType &p, int
         return Point::VectorType::Zero();
     }
 
-    const std::vector<Point::VectorType> &cornersPos = corners[group->id()];
+    const InterpolatedFrame &cornersPos = frame(group);
     Point::VectorType pos[4];
     for (int i = 0; i < 4; i++) pos[i] = cornersPos[quad->corners[i]->getKey()];
 
@@ -129,30 +270,104 @@ bool Inbetween::bakeForwardUV(Group *group, const Stroke *stroke, Interval &inte
 
     return true;
 }
+/**
+ * The grid is kept up to date by the partial bakes (see VectorKeyFrame::updateInbetweens) and dropped by the full ones
+ */
+const StrokeGrid &Inbetween::spatialIndex() const {
+    if (grid == nullptr) {
+        grid = std::make_shared<StrokeGrid>();
+        for (const InbetweenStroke &stroke : strokes) {
+            grid->insert(stroke);
+        }
+    }
+    return *grid;
+}
+
 /**
  * Should be called in a valid OpenGL context!
 */
 void Inbetween::clear() {
     destroyBuffers();
+    grid.reset();
     strokes.clear();
     backwardStrokes.clear();
     corners.clear();
     centerOfMass.clear();
+    groupNbVertices.clear();
 }
 
 /**
  * Should be called in a valid OpenGL context!
 */
 void Inbetween::destroyBuffers() {
-    for (StrokePtr stroke : strokes) {
-        stroke->destroyBuffers();
+    for (InbetweenStroke &stroke : strokes) {
+        stroke.destroyBuffers();
+    }
+    for (InbetweenStroke &stroke : backwardStrokes) {
+        stroke.destroyBuffers();
+    }
+    destroyRetiredBuffers();
+}
+
+/**
+ * Should be called in a valid OpenGL context!
+*/
+void Inbetween::destroyRetiredBuffers() {
+    for (InbetweenStroke &stroke : retired) {
+        stroke.destroyBuffers();
     }
-    for (StrokePtr stroke : backwardStrokes) {
-        stroke->destroyBuffers();
+    retired.clear();
+}
+
+/**
+ * Release the buffers of a stroke that is about to be replaced or erased from this inbetween.
+ * They are destroyed right away if a GL context is current, otherwise they are kept until the next 
+ * destroyRetiredBuffers, so the partial bakes can run without a GL context (e.g. software export).
+ */
+void Inbetween::retire(const InbetweenStroke &stroke) {
+    if (!stroke.hasBuffers()) return;
+    if (QOpenGLContext::currentContext() != nullptr) {
+        InbetweenStroke(stroke).destroyBuffers();
+        return;
     }
+    retired.push_back(stroke);
+}
+
+// Drop the buffers and the materialized stroke of one of the strokes of this inbetween before its positions are modified
+void Inbetween::invalidate(InbetweenStroke &stroke) {
+    retire(stroke);
+    stroke.forgetBuffers();
 }
 
 void Inbetweens::makeDirty() {
     m_dirty.resize(size());
     std::fill(m_dirty.begin(), m_dirty.end(), true);
+    m_dirtyGroups.resize(size());
+    m_dirtyStrokes.resize(size());
+    for (QSet<int> &groups : m_dirtyGroups) groups.clear();
+    for (QSet<int> &strokes : m_dirtyStrokes) strokes.clear();
+}
+
+/**
+ * Re-bake the given post group in every inbetween (its lattice interpolation and the warp of its forward and backward strokes)
+ */
+void Inbetweens::makeGroupDirty(int groupId) {
+    for (size_t i = 0; i < m_dirtyGroups.size(); ++i) {
+        if (!m_dirty[i]) m_dirtyGroups[i].insert(groupId);
+    }
+}
+
+/**
+ * Recreate the given stroke in every inbetween, the post groups containing the stroke are re-baked
+ */
+void Inbetweens::makeStrokeDirty(int strokeId) {
+    for (size_t i = 0; i < m_dirtyStrokes.size(); ++i) {
+        if (!m_dirty[i]) m_dirtyStrokes[i].insert(strokeId);
+    }
+}
+
+void Inbetweens::makeClean(size_t i) {
+    m_dirty[i] = false;
+    m_dirtyGroups[i].clear();
+    m_dirtyStrokes[i].clear();
 }
\ No newline at end of file
@@ -9,29 +9,89 @@
 
 #include <vector>
 #include <QHash>
+#include <QSet>
+#include <memory>
 #include "stroke.h"
+#include "strokegrid.h"
+
+class StrokeMesh;
+class StrokeMeshCache;
+struct StrokeStyle;
+
+/**
+ * Stroke of an inbetween frame. Only the warped positions are stored, all the other attributes (color, width, pressure, ...) 
+ * are read from the keyframe stroke. A full Stroke is materialized on demand for the code that needs one (see stroke()).
+ * Once materialized, the full stroke is the one rendered.
+ */
+class InbetweenStroke {
+public:
+    InbetweenStroke() { }
+    InbetweenStroke(const StrokePtr &source);
+
+    unsigned int id() const { return m_source->id(); }
+    size_t size() const { return m_positions.size(); }
+    const StrokePtr &source() const { return m_source; }
+    inline const Point::VectorType &pos(size_t i) const { return m_positions[i]; }
+    inline void setPos(size_t i, const Point::VectorType &pos) { m_positions[i] = pos; }
+    Point::VectorType centroid() const;
+
+    const StrokePtr &stroke() const;
+    StrokePtr toStroke() const;
+
+    // OpenGL stuff
+    bool buffersCreated() const;
+    bool hasBuffers() const;
+    void createBuffers(QOpenGLShaderProgram *program, VectorKeyFrame *keyframe);
+    void destroyBuffers();
+    void forgetBuffers();
+    void render(GLenum mode, QOpenGLFunctions *functions, const Interval &interval, bool overshoot);
+
+    // Software rendering (see StrokeMesh), no OpenGL context needed. The mesh is kept until the intervals or the style change
+    const StrokeMesh &mesh(VectorKeyFrame *keyframe, const Intervals &intervals, bool overshoot, const StrokeStyle &style);
+
+private:
+    struct Buffers {
+        QOpenGLVertexArrayObject vao;
+        QOpenGLBuffer vbo{QOpenGLBuffer::VertexBuffer}, ebo{QOpenGLBuffer::IndexBuffer};
+    };
+
+    // m_stroke may be materialized concurrently by stroke(), it is only read through this
+    StrokePtr materialized() const { return std::atomic_load(&m_stroke); }
+
+    StrokePtr m_source;                         // keyframe stroke
+    std::vector<Point::VectorType> m_positions; // warped position of each point of the source stroke
+    mutable StrokePtr m_stroke;                 // materialized stroke (nullptr until requested, accessed atomically)
+    std::shared_ptr<Buffers> m_buffers;         // buffers of the non-materialized stroke
+    std::shared_ptr<StrokeMeshCache> m_mesh;    // software counterpart of the buffers (nullptr until requested)
+};
 
 struct Inbetween {
-    QHash<int, StrokePtr> strokes;                          // stroke id -> stroke
-    QHash<int, StrokePtr> backwardStrokes;                  // stroke id -> stroke
-    QHash<int, std::vector<Point::VectorType>> corners;     // group id  -> list of corner positions
+    QHash<int, InbetweenStroke> strokes;                    // stroke id -> stroke
+    QHash<int, InbetweenStroke> backwardStrokes;            // stroke id -> stroke
+    QHash<int, InterpolatedFrame> corners;                  // group id  -> interpolated lattice corners
     QHash<int, Point::VectorType> centerOfMass;             // group id  -> center of mass
     QHash<int, QRectF> aabbs;                               // group id  -> aabb
     QHash<int, bool> fullyVisible;                          // group id  -> are all visibility threshold 0?
+    QHash<int, unsigned int> groupNbVertices;               // group id  -> number of warped vertices
     unsigned int nbVertices;
+    mutable std::shared_ptr<StrokeGrid> grid;               // spatial index of the forward strokes (nullptr until requested)
+    std::vector<InbetweenStroke> retired;                   // strokes whose buffers wait for a GL context to be destroyed
  
     inline Point::VectorType getWarpedPoint(Group *group, const UVInfo &info) const {
         Lattice *grid = group->lattice();
         if (!grid->contains(info.quadKey)) qCritical() << "Error in inbetween getWarpedPoint (inbetween): invalid quad key " << info.quadKey;
-        QuadPtr quad = grid->operator[](info.quadKey);
-        Point::VectorType pos[4];
-        for (int i = 0; i < 4; i++) pos[i] = corners[group->id()][quad->corners[i]->getKey()];
-        Point::VectorType top =  pos[TOP_LEFT] * (1.0 - info.uv.x()) + pos[TOP_RIGHT] * info.uv.x(); 
-        Point::VectorType bot =  pos[BOTTOM_LEFT] * (1.0 - info.uv.x()) + pos[BOTTOM_RIGHT] * info.uv.x();
-        Point::VectorType res = top * (1.0 - info.uv.y()) + bot * info.uv.y();
-        return res;
+        return grid->getWarpedPoint(frame(group), info.quadKey, info.uv);
     }
 
+    // interpolated lattice corners of the given group (the group must have been baked in this inbetween)
+    inline const InterpolatedFrame &frame(Group *group) const { return corners.constFind(group->id()).value(); }
+
+    // materialized stroke (see InbetweenStroke)
+    inline const StrokePtr &stroke(int id) const { return strokes.constFind(id).value().stroke(); }
+
+    // spatial index of the forward strokes vertices, built on the first call
+    const StrokeGrid &spatialIndex() const;
+
     // Point::VectorType getWarpedPoint(Group *group, Point::VectorType p) const;
     bool quadContainsPoint(Group *group, QuadPtr quad, const Point::VectorType &p) const;
     bool contains(Group *group, const Point::VectorType &p, QuadPtr &quad, int &key) const;
@@ -39,17 +99,32 @@ struct Inbetween {
     bool bakeForwardUV(Group *group, const Stroke *stroke, Interval &interval, UVHash &uvs) const;
     void clear();
     void destroyBuffers();
+    void destroyRetiredBuffers();
+    void retire(const InbetweenStroke &stroke);
+    void invalidate(InbetweenStroke &stroke);
 };
 
+/**
+ * Inbetween frames of a keyframe and their dirty state.
+ * An inbetween is either fully dirty (everything is recomputed) or only some of its post groups and strokes are dirty,
+ * in which case only these groups are re-baked and the rest of the inbetween is reused.
+ */
 class Inbetweens : public std::vector<Inbetween> {
 public:
     void makeDirty();
     void makeDirty(size_t i) { m_dirty[i] = true; }
-    void makeClean(size_t i) { m_dirty[i] = false; }
-    bool isClean(size_t i) const { return !m_dirty[i]; }
+    void makeGroupDirty(int groupId);
+    void makeStrokeDirty(int strokeId);
+    void makeClean(size_t i);
+    bool isClean(size_t i) const { return !m_dirty[i] && m_dirtyGroups[i].empty() && m_dirtyStrokes[i].empty(); }
+    bool isFullyDirty(size_t i) const { return m_dirty[i]; }
+    const QSet<int> &dirtyGroups(size_t i) const { return m_dirtyGroups[i]; }
+    const QSet<int> &dirtyStrokes(size_t i) const { return m_dirtyStrokes[i]; }
 
 private:
     std::vector<bool> m_dirty;
+    std::vector<QSet<int>> m_dirtyGroups;   // post groups to re-bake in each inbetween
+    std::vector<QSet<int>> m_dirtyStrokes;  // strokes to recreate in each inbetween
 };
 
 #endif // __INBETWEENS_H__
\ No newline at end of file
@@ -16,19 +16,27 @@
 #include "bezier2D.h"
 #include "qteigen.h"
 #include "mask.h"
+#include "utils/chunkfile.h"
+#include "utils/numberreader.h"
 
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QStack>
+#include <QSet>
 
+#include <algorithm>
 #include <set>
+#include <numeric>
+#include <limits>
 #include <unsupported/Eigen/MatrixFunctions>
 
 typedef Eigen::Triplet<double> TripletD;
 
 static dkBool k_useGlobalRigidTransform("Options->Drawing->Use global transform for groups", true);
 static dkBool k_drawDebugLattice("Debug->Draw lattice debug", false);
+static dkBool k_symmetricSolver("Options->Grid->Symmetric ARAP solver", true);
+static dkInt k_cornersTrajectoriesRes("Options->Trajectory->Corners trajectories resolution", 40, 2, 200, 1);
 
 struct LatticeVtx {
     GLfloat x;
@@ -45,12 +53,15 @@ Lattice::Lattice(VectorKeyFrame *keyframe)
       m_toRestPos(Point::Affine::Identity()),
       m_scaling(Point::Affine::Identity()),
       m_precomputeDirty(true),
-      m_arapDirty(true),
+      m_constraintsDirty(true),
+      m_cornersTrajectoriesDirty(true),
       m_backwardUVDirty(true),
       m_singleConnectedComponent(false),
       m_retrocomp(false),
-      m_currentPrecomputedTime(-1.0f),
+      m_restRegularDirty(true),
+      m_restRegular(false),
       m_maxCornerKey(0),
+      m_symmetricSolver(false),
       m_rot(0.0),
       m_scale(1.0),
       m_vbo(QOpenGLBuffer::VertexBuffer), 
@@ -70,11 +81,16 @@ Lattice::Lattice(const Lattice &other)
       m_toRestPos(other.m_toRestPos),
       m_scaling(other.m_scaling),
       m_precomputeDirty(true),
-      m_arapDirty(true),
+      m_constraintsDirty(true),
+      m_cornersTrajectoriesDirty(true),
       m_backwardUVDirty(true),
       m_retrocomp(false),
-      m_currentPrecomputedTime(-1.0),
+      m_restRegularDirty(true),
+      m_restRegular(false),
       m_maxCornerKey(0),
+      m_LUPatternKey(0),
+      m_LDLTPatternKey(0),
+      m_symmetricSolver(false),
       m_rot(0.0),
       m_scale(1.0), 
       m_vbo(QOpenGLBuffer::VertexBuffer), 
@@ -110,11 +126,16 @@ Lattice::Lattice(const Lattice &other, const std::vector<int> &quads)
       m_oGrid(other.m_oGrid),
       m_scaling(Point::Affine::Identity()),
       m_precomputeDirty(true),
-      m_arapDirty(true),
+      m_constraintsDirty(true),
+      m_cornersTrajectoriesDirty(true),
       m_backwardUVDirty(true),
       m_retrocomp(false),
-      m_currentPrecomputedTime(-1.0),
+      m_restRegularDirty(true),
+      m_restRegular(false),
       m_maxCornerKey(0),
+      m_LUPatternKey(0),
+      m_LDLTPatternKey(0),
+      m_symmetricSolver(false),
       m_rot(0.0),
       m_scale(1.0), 
       m_vbo(QOpenGLBuffer::VertexBuffer), 
@@ -150,7 +171,13 @@ void Lattice::init(int cellsize, int nbCols, int nbRows, Eigen::Vector2i origin)
     m_oGrid = origin;
 }
 
-void Lattice::save(QDomDocument &doc, QDomElement &latticeElt) const {
+/**
+ * Save the lattice attributes and its toRestTransform in latticeElt.
+ * If data is not null the quads and corners are appended to its "lattice.quads" (key, flags), "lattice.corners"
+ * (key, flags, number of quads, 4 quad keys) and "lattice.cornerpos" (TARGET_POS, REF_POS) arrays, otherwise they are
+ * saved as "quad" and "corner" elements.
+ */
+void Lattice::save(QDomDocument &doc, QDomElement &latticeElt, ChunkWriter *data) const {
     // Save grid attributes
     // latticeElt.setAttribute("nbInterStrokes", uint(nbInterStrokes()));
     latticeElt.setAttribute("cellSize", int(cellSize()));
@@ -159,6 +186,48 @@ void Lattice::save(QDomDocument &doc, QDomElement &latticeElt) const {
     latticeElt.setAttribute("origin_x", origin().x());
     latticeElt.setAttribute("origin_y", origin().y());
 
+    if (data != nullptr) {
+        saveBinary(latticeElt, data);
+    } else {
+        saveElements(doc, latticeElt);
+    }
+
+    // Save toRestTransform
+    QDomElement transformElt = doc.createElement("transform");
+    QString string;
+    QTextStream stream(&string);
+    auto matrix = m_toRestPos.matrix();
+    stream << matrix(0, 0) << " " << matrix(0, 1) << " " << matrix(0, 2) << " ";
+    stream << matrix(1, 0) << " " << matrix(1, 1) << " " << matrix(1, 2) << " ";
+    stream << matrix(2, 0) << " " << matrix(2, 1) << " " << matrix(2, 2) << " ";
+    QDomText txt = doc.createTextNode(string);
+    transformElt.appendChild(txt);
+    latticeElt.appendChild(transformElt);    
+}
+
+void Lattice::saveBinary(QDomElement &latticeElt, ChunkWriter *data) const {
+    auto quadKey = [](Corner *c, CornerIndex i) { return c->quads(i) == nullptr ? INT_MAX : c->quads(i)->key(); };
+    std::vector<std::array<qint32, 2>> quads;
+    std::vector<std::array<qint32, 7>> corners;
+    std::vector<std::array<double, 4>> cornersPos;
+    quads.reserve(m_quads.size());
+    corners.reserve(m_corners.size());
+    cornersPos.reserve(m_corners.size());
+    for (auto it = m_quads.begin(); it != m_quads.end(); ++it) {
+        quads.push_back({it.key(), (qint32)it.value()->flags().to_ulong()});
+    }
+    for (Corner *c : m_corners) {
+        corners.push_back({c->getKey(), (qint32)c->flags().to_ulong(), c->nbQuads(), quadKey(c, TOP_LEFT), quadKey(c, TOP_RIGHT), quadKey(c, BOTTOM_RIGHT), quadKey(c, BOTTOM_LEFT)});
+        cornersPos.push_back({c->coord(TARGET_POS).x(), c->coord(TARGET_POS).y(), c->coord(REF_POS).x(), c->coord(REF_POS).y()});
+    }
+    latticeElt.setAttribute("nbQuads", qulonglong(quads.size()));
+    latticeElt.setAttribute("quadsOffset", qulonglong(data->append("lattice.quads", quads)));
+    latticeElt.setAttribute("nbCorners", qulonglong(corners.size()));
+    latticeElt.setAttribute("cornersOffset", qulonglong(data->append("lattice.corners", corners)));
+    data->append("lattice.cornerpos", cornersPos);
+}
+
+void Lattice::saveElements(QDomDocument &doc, QDomElement &latticeElt) const {
     // Save quads
     int count = 0;
     for (auto it = m_quads.begin(); it != m_quads.end(); ++it) {
@@ -187,23 +256,76 @@ void Lattice::save(QDomDocument &doc, QDomElement &latticeElt) const {
         cornerElt.setAttribute("quadKey_3", c->quads(BOTTOM_LEFT) == nullptr ? INT_MAX : c->quads(BOTTOM_LEFT)->key());
         latticeElt.appendChild(cornerElt);
     }
+}
 
-    // Save toRestTransform
-    QDomElement transformElt = doc.createElement("transform");
-    QString string;
+void Lattice::load(QDomElement &latticeElt, const ChunkReader *data) {
+    init(latticeElt.attribute("cellSize").toInt(), latticeElt.attribute("nbCols").toInt(), latticeElt.attribute("nbRows").toInt(),
+         Eigen::Vector2i(latticeElt.attribute("origin_x").toInt(), latticeElt.attribute("origin_y").toInt()));
+
+    if (data != nullptr && latticeElt.hasAttribute("quadsOffset")) {
+        loadBinary(latticeElt, data);
+    } else {
+        loadElements(latticeElt);
+    }
+
+    // Load transform
+    QDomElement transformElt = latticeElt.firstChildElement("transform");
+    QString string = transformElt.text();
     QTextStream stream(&string);
     auto matrix = m_toRestPos.matrix();
-    stream << matrix(0, 0) << " " << matrix(0, 1) << " " << matrix(0, 2) << " ";
-    stream << matrix(1, 0) << " " << matrix(1, 1) << " " << matrix(1, 2) << " ";
-    stream << matrix(2, 0) << " " << matrix(2, 1) << " " << matrix(2, 2) << " ";
-    QDomText txt = doc.createTextNode(string);
-    transformElt.appendChild(txt);
-    latticeElt.appendChild(transformElt);    
+    stream >> matrix(0, 0) >> matrix(0, 1) >> matrix(0, 2);
+    stream >> matrix(1, 0) >> matrix(1, 1) >> matrix(1, 2);
+    stream >> matrix(2, 0) >> matrix(2, 1) >> matrix(2, 2);
+    m_toRestPos.matrix() = matrix;
+
+    m_maxCornerKey = m_corners.size();
+    m_backwardUVDirty = true;
+    isConnected();
 }
 
-void Lattice::load(QDomElement &latticeElt) {
-    init(latticeElt.attribute("cellSize").toInt(), latticeElt.attribute("nbCols").toInt(), latticeElt.attribute("nbRows").toInt(),
-         Eigen::Vector2i(latticeElt.attribute("origin_x").toInt(), latticeElt.attribute("origin_y").toInt()));
+void Lattice::loadBinary(QDomElement &latticeElt, const ChunkReader *data) {
+    size_t nbQuads = latticeElt.attribute("nbQuads").toULongLong();
+    size_t nbCorners = latticeElt.attribute("nbCorners").toULongLong();
+    size_t cornersOffset = latticeElt.attribute("cornersOffset").toULongLong();
+    const std::array<qint32, 2> *quads = data->array<std::array<qint32, 2>>("lattice.quads", latticeElt.attribute("quadsOffset").toULongLong(), nbQuads);
+    const std::array<qint32, 7> *corners = data->array<std::array<qint32, 7>>("lattice.corners", cornersOffset, nbCorners);
+    const std::array<double, 4> *cornersPos = data->array<std::array<double, 4>>("lattice.cornerpos", cornersOffset, nbCorners);
+    if ((quads == nullptr && nbQuads > 0) || ((corners == nullptr || cornersPos == nullptr) && nbCorners > 0)) {
+        qCritical() << "Error in Lattice::load: missing lattice payload";
+        return;
+    }
+
+    m_quads.reserve(nbQuads);
+    for (size_t i = 0; i < nbQuads; ++i) {
+        QuadPtr quad = addEmptyQuad(quads[i][0]);
+        quad->setFlags(std::bitset<8>((unsigned long)quads[i][1]));
+    }
+    m_retrocomp = false;
+
+    m_corners.reserve(nbCorners);
+    for (size_t i = 0; i < nbCorners; ++i) {
+        const std::array<qint32, 7> &corner = corners[i];
+        Corner *c = new Corner();
+        c->setKey(corner[0]);
+        c->setFlags(std::bitset<8>((unsigned long)corner[1]));
+        c->setNbQuads(corner[2]);
+        c->coord(TARGET_POS) = Point::VectorType(cornersPos[i][0], cornersPos[i][1]);
+        c->coord(REF_POS) = Point::VectorType(cornersPos[i][2], cornersPos[i][3]);
+        c->coord(DEFORM_POS) = c->coord(REF_POS);
+        c->coord(INTERP_POS) = c->coord(REF_POS);
+        // Set quad/corner correspondences
+        for (int j = 0; j < 4; ++j) {
+            auto it = m_quads.constFind(corner[3 + j]);
+            if (it != m_quads.cend()) {
+                c->quads(CornerIndex(j)) = it.value();
+                it.value()->corners[(j + 2) % 4] = c;
+            }
+        }
+        m_corners.push_back(c);
+    }
+}
+
+void Lattice::loadElements(QDomElement &latticeElt) {
 
     // Load quads
     QDomElement quadElt = latticeElt.firstChildElement("quad");
@@ -222,44 +344,32 @@ void Lattice::load(QDomElement &latticeElt) {
     m_retrocomp = retrocomp;
 
     // Load corners
-    QDomElement cornerElt = latticeElt.firstChildElement("corner");
+    // (attribute names are static and numbers are parsed in place, corners are the bulk of the text projects)
+    static const QString quadKeyNames[4] = {QStringLiteral("quadKey_0"), QStringLiteral("quadKey_1"), QStringLiteral("quadKey_2"), QStringLiteral("quadKey_3")};
+    QDomElement cornerElt = latticeElt.firstChildElement(QStringLiteral("corner"));
     while (!cornerElt.isNull()) {
-        int key = cornerElt.attribute("key").toInt();
+        int key = NumberReader::number<int>(cornerElt.attribute(QStringLiteral("key")));
         Corner *c = new Corner();
         c->setKey(key);
-        c->setFlags(std::bitset<8>(cornerElt.attribute("flags", "00000000").toStdString()));
-        c->setNbQuads(cornerElt.attribute("quadNum").toInt());
-        c->coord(TARGET_POS) = Point::VectorType(cornerElt.attribute("coord_TARGET_POS_x").toDouble(), cornerElt.attribute("coord_TARGET_POS_y").toDouble());
-        c->coord(REF_POS) = Point::VectorType(cornerElt.attribute("coord_REF_POS_x").toDouble(), cornerElt.attribute("coord_REF_POS_y").toDouble());
+        c->setFlags(std::bitset<8>(cornerElt.attribute(QStringLiteral("flags"), QStringLiteral("00000000")).toStdString()));
+        c->setNbQuads(NumberReader::number<int>(cornerElt.attribute(QStringLiteral("quadNum"))));
+        c->coord(TARGET_POS) = Point::VectorType(NumberReader::number<double>(cornerElt.attribute(QStringLiteral("coord_TARGET_POS_x"))),
+                                                 NumberReader::number<double>(cornerElt.attribute(QStringLiteral("coord_TARGET_POS_y"))));
+        c->coord(REF_POS) = Point::VectorType(NumberReader::number<double>(cornerElt.attribute(QStringLiteral("coord_REF_POS_x"))),
+                                              NumberReader::number<double>(cornerElt.attribute(QStringLiteral("coord_REF_POS_y"))));
         c->coord(DEFORM_POS) = c->coord(REF_POS);
         c->coord(INTERP_POS) = c->coord(REF_POS);
         // Set quad/corner correspondences
         for (int i = 0; i < 4; ++i) {
-            int quadKey = cornerElt.attribute("quadKey_" + QString::number(i)).toInt();
+            int quadKey = NumberReader::number<int>(cornerElt.attribute(quadKeyNames[i]));
             if (contains(quadKey)) {
                 c->quads(CornerIndex(i)) = m_quads[quadKey];
                 c->quads(CornerIndex(i))->corners[(i + 2) % 4] = c;
             }
         }
         m_corners.push_back(c);
-        cornerElt = cornerElt.nextSiblingElement("corner");
+        cornerElt = cornerElt.nextSiblingElement(QStringLiteral("corner"));
     }
-
-    // Load transform
-    QDomElement transformElt = latticeElt.firstChildElement("transform");
-    QString string = transformElt.text();
-    QTextStream stream(&string);
-    auto matrix = m_toRestPos.matrix();
-    stream >> matrix(0, 0) >> matrix(0, 1) >> matrix(0, 2);
-    stream >> matrix(1, 0) >> matrix(1, 1) >> matrix(1, 2);
-    stream >> matrix(2, 0) >> matrix(2, 1) >> matrix(2, 2);
-    m_toRestPos.matrix() = matrix;
-
-    m_maxCornerKey = m_corners.size();
-    m_arapDirty = true;
-    m_backwardUVDirty = true;
-    m_currentPrecomputedTime = -1.0f;
-    isConnected();
 }
 
 void Lattice::clear() {
@@ -270,10 +380,9 @@ void Lattice::clear() {
     m_quads.clear();
     m_corners.clear();
     m_maxCornerKey = 0;
-    m_arapDirty = true;
     m_backwardUVDirty = true;
+    m_restRegularDirty = true;
     m_singleConnectedComponent = false;
-    m_currentPrecomputedTime = -1.0f;
     m_rot = 0.0;
     m_scale = 1.0;
 }
@@ -296,11 +405,11 @@ void Lattice::removeStroke(int strokeId, bool breakdown) {
     }
     deleteUnusedCorners();
     isConnected();
+    m_restRegularDirty = true;
 }
 
 void Lattice::setArapDirty() {
     m_precomputeDirty = true;
-    m_arapDirty = true;
 }
 
 /**
@@ -405,10 +514,123 @@ QuadPtr Lattice::addQuad(int key, int x, int y, bool &isNewQuad) {
 
     insert(key, cell);
     m_precomputeDirty = true;
-    m_arapDirty = true;
+    m_restRegularDirty = true;  // the new corners are in rest space until the caller moves them
     return cell;
 }
 
+/**
+ * Add all the quads covered by the polyline stroke[interval] in one pass.
+ * The segments are walked in rest space with a grid traversal (supercover DDA) which gives the cells containing a
+ * vertex as well as the cells crossed in between, so the stroke is 4-connected in the lattice and no bowtie can appear
+ * along it. Cells crossed without containing a vertex are marked as pivots if they are new.
+ * Returns false (and adds nothing) if the lattice is no longer a regular grid in rest space, in which case the quads
+ * must be added point by point with addQuad(point).
+ */
+bool Lattice::addStrokeQuads(const Stroke *stroke, const Interval &interval, std::vector<QuadPtr> &newQuads) {
+    if (!isRestRegular()) return false;
+
+    const std::vector<Point *> &points = stroke->points();
+    const Point::VectorType origin(m_oGrid.x(), m_oGrid.y());
+    auto toGrid = [&](int i) -> Point::VectorType { return (m_toRestPos * points[i]->pos() - origin) / double(m_cellSize); };
+
+    // Touched cells in traversal order, true if the cell contains a vertex of the stroke
+    std::vector<int> cells;
+    QHash<int, bool> hasVertex;
+    auto visit = [&](int x, int y, bool vertex) {
+        if (x < 0 || y < 0 || x >= m_nbCols || y >= m_nbRows) {
+            if (vertex) qWarning() << "addStrokeQuads: stroke " << stroke->id() << " is outside of the lattice bounds";
+            return;
+        }
+        int key = coordToKey(x, y);
+        auto it = hasVertex.find(key);
+        if (it == hasVertex.end()) {
+            hasVertex.insert(key, vertex);
+            cells.push_back(key);
+        } else if (vertex) {
+            it.value() = true;
+        }
+    };
+
+    Point::VectorType prev = toGrid(interval.from()), cur;
+    visit(int(floor(prev.x())), int(floor(prev.y())), true);
+    for (int i = interval.from() + 1; i <= interval.to(); ++i) {
+        cur = toGrid(i);
+        int x = int(floor(prev.x())), y = int(floor(prev.y()));
+        int xEnd = int(floor(cur.x())), yEnd = int(floor(cur.y()));
+        Point::VectorType d = cur - prev;
+        int stepX = xEnd > x ? 1 : -1, stepY = yEnd > y ? 1 : -1;
+        double tDeltaX = d.x() != 0.0 ? std::abs(1.0 / d.x()) : std::numeric_limits<double>::infinity();
+        double tDeltaY = d.y() != 0.0 ? std::abs(1.0 / d.y()) : std::numeric_limits<double>::infinity();
+        double tMaxX = (stepX > 0 ? (x + 1 - prev.x()) : (prev.x() - x)) * tDeltaX;
+        double tMaxY = (stepY > 0 ? (y + 1 - prev.y()) : (prev.y() - y)) * tDeltaY;
+        while (x != xEnd || y != yEnd) {
+            if (y == yEnd || (x != xEnd && tMaxX < tMaxY)) {
+                x += stepX;
+                tMaxX += tDeltaX;
+            } else {
+                y += stepY;
+                tMaxY += tDeltaY;
+            }
+            visit(x, y, x == xEnd && y == yEnd);
+        }
+        prev = cur;
+    }
+
+    // Create the quads and their missing corners
+    const Point::Affine toScreen = m_toRestPos.inverse();
+    for (int key : cells) {
+        int x, y;
+        bool isNewQuad = false;
+        keyToCoord(key, x, y);
+        QuadPtr quad = addQuad(key, x, y, isNewQuad);
+        if (isNewQuad) {
+            for (Corner *corner : quad->corners) {
+                if (corner->nbQuads() < 2) {
+                    corner->coord(REF_POS) = toScreen * corner->coord(REF_POS);
+                    corner->coord(TARGET_POS) = toScreen * corner->coord(TARGET_POS);
+                }
+            }
+            newQuads.push_back(quad);
+        }
+        if (hasVertex.value(key)) quad->setPivot(false);
+        else if (isNewQuad) quad->setPivot(true);
+    }
+
+    // the new quads were created at their regular position
+    m_restRegular = true;
+    m_restRegularDirty = false;
+    return true;
+}
+
+/**
+ * Returns true if the REF_POS corners of every quad are where addQuad(point) would have created them, i.e. the
+ * lattice has not been deformed in rest space (which may happen with breakdowns).
+ * The result is cached until quads are added or removed or the rest positions change.
+ */
+bool Lattice::isRestRegular() const {
+    if (m_restRegularDirty) {
+        m_restRegular = computeRestRegular();
+        m_restRegularDirty = false;
+    }
+    return m_restRegular;
+}
+
+bool Lattice::computeRestRegular() const {
+    const Point::Affine toScreen = m_toRestPos.inverse();
+    const Point::VectorType origin(m_oGrid.x(), m_oGrid.y());
+    const double eps = 1e-6 * m_cellSize;
+    for (auto it = m_quads.cbegin(); it != m_quads.cend(); ++it) {
+        int x, y;
+        keyToCoord(it.key(), x, y);
+        const Point::VectorType positions[4] = {Point::VectorType(x, y), Point::VectorType(x + 1, y), Point::VectorType(x + 1, y + 1), Point::VectorType(x, y + 1)};
+        for (int i = 0; i < 4; ++i) {
+            const Corner *corner = it.value()->corners[i];
+            if (corner == nullptr || (corner->coord(REF_POS) - toScreen * (m_cellSize * positions[i] + origin)).squaredNorm() > eps * eps) return false;
+        }
+    }
+    return true;
+}
+
 // Add an empty quad object (no corners, no elements)
 QuadPtr Lattice::addEmptyQuad(int key) {
     if (contains(key)) return m_quads[key];
@@ -451,6 +673,7 @@ void Lattice::deleteQuad(int key) {
     }
     m_quads.remove(key);
     deleteUnusedCorners();
+    m_restRegularDirty = true;
 }
 void Lattice::deleteQuadsPredicate(std::function<bool(QuadPtr)> predicate) {
     QMutableHashIterator<int, QuadPtr> it(m_quads);
@@ -548,6 +771,20 @@ bool Lattice::quadContainsPoint(QuadPtr quad, const Point::VectorType &p, PosTyp
 }
 
 bool Lattice::contains(const Point::VectorType &p, PosTypeIndex cornerType, QuadPtr &quad, int &key) const {
+    // In rest space the lattice is usually still a regular grid: try the quad under the point first
+    if (cornerType == REF_POS) {
+        int x, y;
+        posToCoord(m_toRestPos * p, x, y);
+        if (x >= 0 && y >= 0 && x < m_nbCols && y < m_nbRows) {
+            auto it = m_quads.constFind(coordToKey(x, y));
+            if (it != m_quads.cend() && quadContainsPoint(it.value(), p, cornerType)) {
+                quad = it.value();
+                key = it.key();
+                return true;
+            }
+        }
+    }
+
     // TODO bounding box test before
     for (auto it = m_quads.cbegin(); it != m_quads.cend(); ++it) {
         if (quadContainsPoint(it.value(), p, cornerType)) {
@@ -790,6 +1027,18 @@ Point::VectorType Lattice::getWarpedPoint(const Point::VectorType &p, int quadKe
           + (quad->corners[BOTTOM_LEFT]->coord(type) * (1.0 - uv.x()) + quad->corners[BOTTOM_RIGHT]->coord(type) * uv.x()) * uv.y();
 }
 
+// Same as above but with the corners positions of an interpolated frame (see interpolateARAP)
+Point::VectorType Lattice::getWarpedPoint(const InterpolatedFrame &frame, int quadKey, const Point::VectorType &uv) const {
+    auto it = m_quads.constFind(quadKey);
+    if (it == m_quads.constEnd()) {
+        qWarning() << "getWarpedPoint: can't find quad with key " << quadKey;
+        return Point::VectorType::Zero();
+    }
+    const QuadPtr &quad = it.value();
+    return (frame[quad->corners[TOP_LEFT]->getKey()] * (1.0 - uv.x()) + frame[quad->corners[TOP_RIGHT]->getKey()] * uv.x()) * (1.0 - uv.y()) 
+          + (frame[quad->corners[BOTTOM_LEFT]->getKey()] * (1.0 - uv.x()) + frame[quad->corners[BOTTOM_RIGHT]->getKey()] * uv.x()) * uv.y();
+}
+
 bool Lattice::bakeForwardUV(const Stroke *stroke, Interval &interval, UVHash &uvs, PosTypeIndex type) {
     if (stroke == nullptr) {
         qWarning() << "Cannot compute UVs for this interval: invalid stroke: " << stroke;
@@ -966,6 +1215,7 @@ void Lattice::displacePinsQuads(PosTypeIndex dstPos) {
             q->corners[i]->coord(dstPos) += displacement;
         }
     }
+    if (dstPos == REF_POS) m_restRegularDirty = true;
     setArapDirty();
 }
 
@@ -1023,7 +1273,10 @@ void Lattice::drawLattice(QPainter &painter, const QColor &color, VectorKeyFrame
     float t = stride > 1 ?  float(inbetween) / (stride - 1) : 0.0f;
     const Point::Affine A = keyframe->rigidTransform(t);
 
-    const std::vector<Point::VectorType> &corners = keyframe->inbetweenCorners(inbetween).value(groupID);
+    const QHash<int, InterpolatedFrame> &frames = keyframe->inbetweenCorners(inbetween);
+    auto itFrame = frames.constFind(groupID);
+    if (itFrame == frames.constEnd()) return;
+    const InterpolatedFrame &corners = itFrame.value();
 
     for (auto it = m_quads.constBegin(); it != m_quads.constEnd(); ++it) {
         QuadPtr quad = it.value();
@@ -1084,24 +1337,23 @@ void Lattice::drawCornersTrajectories(QPainter &painter, const QColor &color, Gr
             i++;
         }
     } else {
-        precompute();
-        float t;
-        Point::VectorType prev;
+        const CornersTrajectories &trajectories = cornersTrajectories(group);
+        std::vector<Point::Affine> transforms(trajectories.nbSamples, Point::Affine::Identity());
+        if (k_useGlobalRigidTransform) {
+            for (int i = 0; i < trajectories.nbSamples; ++i) transforms[i] = group->globalRigidTransform(trajectories.sampleAlpha(i));
+        }
+        QPolygonF path(trajectories.nbSamples);
         int idx = 0;
         for (Corner *c : m_corners) {
-            prev = c->coord(REF_POS);
             gridPen.setColor(QColor(40 + 180 * idx / float(m_corners.size()), 20, 180 - 120 * idx / float(m_corners.size())));
             painter.setPen(gridPen);
-            for (int i = 1; i < 40; ++i) {
-                t = (float)i / (float)40;
-                interpolateARAP(t, group->spacingAlpha(t), group->globalRigidTransform(t));
-                painter.drawLine(QPointF(prev.x(), prev.y()), QPointF(c->coord(INTERP_POS).x(), c->coord(INTERP_POS).y()));
-                prev = c->coord(INTERP_POS);
+            for (int i = 0; i < trajectories.nbSamples; ++i) {
+                Point::VectorType p = transforms[i] * trajectories.at(c->getKey(), i);
+                path[i] = QPointF(p.x(), p.y());
             }
+            painter.drawPolyline(path);
             idx++;
         }
-        m_arapDirty = true;
-        m_precomputeDirty = true;
     }
     painter.restore();
 }
@@ -1197,25 +1449,37 @@ void Lattice::precompute() {
     int nCorners = m_corners.size();
     int P_rows = 8 * nQuads;
     int triRow = 0;
-    QuadPtr q = *m_quads.constBegin();
-    double size = (q->corners[TOP_RIGHT]->coord(REF_POS) - q->corners[TOP_LEFT]->coord(REF_POS)).norm();
+
+    // Everything below reads the dense topology and contiguous positions instead of following the quads and corners pointers
+    updateDenseTopology();
+    std::vector<Point::VectorType> refPos, tgtPos;
+    gatherPositions(REF_POS, refPos);
+    gatherPositions(TARGET_POS, tgtPos);
+    const std::array<int, 4> &firstQuad = m_denseQuadCorners.front();
+    double size = (refPos[firstQuad[TOP_RIGHT]] - refPos[firstQuad[TOP_LEFT]]).norm();
     double triArea = size * size / 2.0;
 
     // Compute P (sparse) and store its transpose to construct the RHS of the equation later
-    // TODO refactorize concatenation
-    for (auto it = m_quads.constBegin(); it != m_quads.constEnd(); ++it) {
-        q = it.value();
-        computePStar(q, TOP_LEFT, TOP_RIGHT, triRow, false, P_triplets);
-        triRow++;
-        computePStar(q, TOP_RIGHT, BOTTOM_RIGHT, triRow, false, P_triplets);
-        triRow++;
-    }
-    for (auto it = m_quads.constBegin(); it != m_quads.constEnd(); ++it) {
-        q = it.value();
-        computePStar(q, TOP_LEFT, TOP_RIGHT, triRow, true, P_triplets);
-        triRow++;
-        computePStar(q, TOP_RIGHT, BOTTOM_RIGHT, triRow, true, P_triplets);
-        triRow++;
+    // The affine map of each triangle does not depend on alpha, its polar decomposition is stored for solveARAP
+    static const CornerIndex triangles[2][2] = {{TOP_LEFT, TOP_RIGHT}, {TOP_RIGHT, BOTTOM_RIGHT}};
+    m_triAngles.resize(4 * nQuads);
+    m_triShears.resize(4 * nQuads);
+    for (int inverseOrientation = 0; inverseOrientation < 2; ++inverseOrientation) {
+        const std::vector<Point::VectorType> &src = inverseOrientation ? tgtPos : refPos;
+        const std::vector<Point::VectorType> &dst = inverseOrientation ? refPos : tgtPos;
+        for (const std::array<int, 4> &corners : m_denseQuadCorners) {
+            for (const CornerIndex *triangle : triangles) {
+                int i = corners[triangle[0]], j = corners[triangle[1]], k = corners[BOTTOM_LEFT];
+                computePStar(src[i], src[j], src[k], i, j, k, triRow, P_triplets);
+                // same as Arap::computeJAM
+                Matrix2d P, Q, A;
+                P << src[i].x() - src[k].x(), src[i].y() - src[k].y(), src[j].x() - src[k].x(), src[j].y() - src[k].y();
+                Q << dst[i].x() - dst[k].x(), dst[i].y() - dst[k].y(), dst[j].x() - dst[k].x(), dst[j].y() - dst[k].y();
+                A = P.inverse() * Q;
+                m_triAngles[triRow] = Arap::polarDecomp(A, m_triShears[triRow]);
+                triRow++;
+            }
+        }
     }
     SparseMatrix<double, ColMajor> P(P_rows, nCorners);
     P.setFromTriplets(P_triplets.begin(), P_triplets.end());
@@ -1227,128 +1491,414 @@ void Lattice::precompute() {
         m_W[i] = triArea;
     }
 
-    // Assembling LHS (with constraint)
-    unsigned int nbConstraint = m_constraintsIdx.size() > 0 ? m_constraintsIdx.size() : 1;
-    unsigned int idx = m_corners.size();
+    // Assembling LHS
+    // User defined hard constraints are not part of the LHS, see precomputeConstraints
     SparseMatrix<double, ColMajor> PTP = m_Pt * m_W.asDiagonal() * P;
-    SparseMatrix<double, ColMajor> LHS(m_corners.size() + nbConstraint, m_corners.size() + nbConstraint);
+    std::vector<TripletD> LHS_triplets;
+    LHS_triplets.reserve(PTP.nonZeros() + 2 * nCorners);
+    m_symmetricSolver = k_symmetricSolver;
+    if (m_symmetricSolver) {
+        // PTP is only semi-definite (translations are in its kernel), ground corner 0 to get a SPD matrix
+        // The center of mass constraint is then enforced like the user defined hard constraints
+        for (int k = 0; k < PTP.outerSize(); ++k) {
+            for (SparseMatrix<double, ColMajor>::InnerIterator it(PTP, k); it; ++it) {
+                if (it.row() != 0 && it.col() != 0) LHS_triplets.push_back(TripletD(it.row(), it.col(), it.value()));
+            }
+        }
+        LHS_triplets.push_back(TripletD(0, 0, 1.0));
+    } else {
+        for (int k = 0; k < PTP.outerSize(); ++k) {
+            for (SparseMatrix<double, ColMajor>::InnerIterator it(PTP, k); it; ++it) {
+                LHS_triplets.push_back(TripletD(it.row(), it.col(), it.value()));
+            }
+        }
 
-    // main constraint (linear interp of center of mass)
-    LHS.innerVectors(0, m_corners.size()) = PTP.innerVectors(0, m_corners.size());  // TODO: is there a more efficient way to do this than using the intermediate var PTP?
-    if (m_constraintsIdx.size() == 0) {
-        float constraintMean = 1.0 / m_corners.size();
-        for (int i = 0; i < m_corners.size(); ++i) {
-            LHS.insert(idx, i) = constraintMean;
-            LHS.insert(i, idx) = constraintMean;
+        // main constraint (linear interp of center of mass)
+        double constraintMean = 1.0 / nCorners;
+        for (int i = 0; i < nCorners; ++i) {
+            LHS_triplets.push_back(TripletD(nCorners, i, constraintMean));
+            LHS_triplets.push_back(TripletD(i, nCorners, constraintMean));
         }
-        ++idx;
     }
-
-    // user defined hard constraints
-    for (unsigned int constraintIdx : m_constraintsIdx) {
-        const Trajectory *traj = m_keyframe->trajectoryConstraintPtr(constraintIdx);
-        const UVInfo &latticeCoord = traj->latticeCoord();
-        QuadPtr quad = m_quads[latticeCoord.quadKey];
-        // the constraint coeff vector and its transpose are set at the same time
-        LHS.insert(idx, quad->corners[TOP_LEFT]->getKey()) = LHS.insert(quad->corners[TOP_LEFT]->getKey(), idx) = (1.0 - latticeCoord.uv.x()) * (1.0 - latticeCoord.uv.y());
-        LHS.insert(idx, quad->corners[TOP_RIGHT]->getKey()) = LHS.insert(quad->corners[TOP_RIGHT]->getKey(), idx) = latticeCoord.uv.x() * (1.0 - latticeCoord.uv.y());
-        LHS.insert(idx, quad->corners[BOTTOM_RIGHT]->getKey()) = LHS.insert(quad->corners[BOTTOM_RIGHT]->getKey(), idx) = latticeCoord.uv.x() * latticeCoord.uv.y();
-        LHS.insert(idx, quad->corners[BOTTOM_LEFT]->getKey()) = LHS.insert(quad->corners[BOTTOM_LEFT]->getKey(), idx) = (1.0 - latticeCoord.uv.x()) * latticeCoord.uv.y();
-        ++idx;
-    }
-
-    // Factorization of LHS
-    LHS.makeCompressed();
-    m_LU.compute(LHS);
-    if (m_LU.info() != Success) {
+    int LHS_size = m_symmetricSolver ? nCorners : nCorners + 1;
+    SparseMatrix<double, ColMajor> LHS(LHS_size, LHS_size);
+    LHS.setFromTriplets(LHS_triplets.begin(), LHS_triplets.end());
+
+    // Factorization of LHS, the symbolic analysis is only redone when the sparsity pattern changes
+    SparsityPattern &solverPattern = m_symmetricSolver ? m_LDLTPattern : m_LUPattern;
+    bool analyze = !solverPattern.matches(LHS);
+    bool factorized;
+    if (m_symmetricSolver) {
+        if (analyze) m_LDLT.analyzePattern(LHS);
+        m_LDLT.factorize(LHS);
+        factorized = m_LDLT.info() == Success;
+    } else {
+        if (analyze) m_LU.analyzePattern(LHS);
+        m_LU.factorize(LHS);
+        factorized = m_LU.info() == Success;
+    }
+    if (analyze) solverPattern.assign(LHS);
+    if (!factorized) {
         std::cout << "ERROR DURING FACTORIZATION" << std::endl;
         std::cout << LHS << std::endl;
+        solverPattern.clear();
         assert(0);
     }
 
     // Compute ref and target center of mass
-    m_refCM = centerOfGravity(REF_POS);
-    m_tgtCM = centerOfGravity(TARGET_POS);
+    m_refCM = std::accumulate(refPos.begin(), refPos.end(), Point::VectorType(Point::VectorType::Zero())) / nCorners;
+    m_tgtCM = std::accumulate(tgtPos.begin(), tgtPos.end(), Point::VectorType(Point::VectorType::Zero())) / nCorners;
 
     m_precomputeDirty = false;
-    m_arapDirty = true;
+    m_constraintsDirty = true;
+    m_cornersTrajectoriesDirty = true;
     sw.stop();
 }
 
-void Lattice::interpolateARAP(qreal alphaLinear, qreal alpha, const Point::Affine &globalRigidTransform, bool useRigidTransform) {
+// Corner keys of the quads sorted by key (the order of the rows of P)
+void Lattice::updateDenseTopology() {
+    std::vector<int> quadKeys;
+    quadKeys.reserve(m_quads.size());
+    for (auto it = m_quads.constBegin(); it != m_quads.constEnd(); ++it) quadKeys.push_back(it.key());
+    std::sort(quadKeys.begin(), quadKeys.end());
+    m_denseQuadCorners.resize(quadKeys.size());
+    for (int i = 0; i < (int)quadKeys.size(); ++i) {
+        const QuadPtr &q = m_quads.find(quadKeys[i]).value();
+        for (int c = 0; c < NUM_CORNERS; ++c) m_denseQuadCorners[i][c] = q->corners[c]->getKey();
+    }
+}
+
+void Lattice::gatherPositions(PosTypeIndex type, std::vector<Point::VectorType> &positions) const {
+    positions.resize(m_corners.size());
+    for (Corner *c : m_corners) positions[c->getKey()] = c->coord(type);
+}
+
+// m must be compressed
+bool Lattice::SparsityPattern::matches(const SparseMatrix<double, ColMajor> &m) const {
+    if (outer.size() != size_t(m.outerSize() + 1) || inner.size() != size_t(m.nonZeros())) return false;
+    return std::equal(outer.begin(), outer.end(), m.outerIndexPtr()) && std::equal(inner.begin(), inner.end(), m.innerIndexPtr());
+}
+
+void Lattice::SparsityPattern::assign(const SparseMatrix<double, ColMajor> &m) {
+    outer.assign(m.outerIndexPtr(), m.outerIndexPtr() + m.outerSize() + 1);
+    inner.assign(m.innerIndexPtr(), m.innerIndexPtr() + m.nonZeros());
+}
+
+/**
+ * Precompute the dense Schur complement of the hard constraints.
+ * 
+ * The constrained system [PTP C^T; C 0] is never factorized. Instead, with G the solution operator of the 
+ * base system (see baseSolve) and since PTP is only singular along the translation direction 1, the 
+ * constrained solution is x = G(r - C^T*l) + 1*t where the Lagrange multipliers l and the translation t 
+ * are given by the small system:
+ *      [C*G*C^T  -1] [l]   [C*G(r) - d]
+ *      [  1^T     0] [t] = [   1^T*r  ]
+ * Adding or removing a constraint thus only costs nbConstraints solves with the existing factorization.
+ * In the symmetric solver mode, the center of mass constraint becomes the only row of C when there are 
+ * no user defined constraints.
+ */
+void Lattice::precomputeConstraints() {
+    int nCorners = m_corners.size();
+    int nbConstraints = m_constraintsIdx.size();
+    m_constraintsDirty = false;
+
+    std::vector<TripletD> C_triplets;
+    if (nbConstraints == 0 && m_symmetricSolver) {
+        nbConstraints = 1;
+        C_triplets.reserve(nCorners);
+        for (int i = 0; i < nCorners; ++i) {
+            C_triplets.push_back(TripletD(0, i, 1.0 / nCorners));
+        }
+    }
+    m_C.resize(nbConstraints, nCorners);
+    if (nbConstraints == 0) return;
+
+    int row = 0;
+    C_triplets.reserve(4 * m_constraintsIdx.size());
+    for (unsigned int constraintIdx : m_constraintsIdx) {
+        const Trajectory *traj = m_keyframe->trajectoryConstraintPtr(constraintIdx);
+        const UVInfo &latticeCoord = traj->latticeCoord();
+        QuadPtr quad = m_quads[latticeCoord.quadKey];
+        C_triplets.push_back(TripletD(row, quad->corners[TOP_LEFT]->getKey(), (1.0 - latticeCoord.uv.x()) * (1.0 - latticeCoord.uv.y())));
+        C_triplets.push_back(TripletD(row, quad->corners[TOP_RIGHT]->getKey(), latticeCoord.uv.x() * (1.0 - latticeCoord.uv.y())));
+        C_triplets.push_back(TripletD(row, quad->corners[BOTTOM_RIGHT]->getKey(), latticeCoord.uv.x() * latticeCoord.uv.y()));
+        C_triplets.push_back(TripletD(row, quad->corners[BOTTOM_LEFT]->getKey(), (1.0 - latticeCoord.uv.x()) * latticeCoord.uv.y()));
+        ++row;
+    }
+    m_C.setFromTriplets(C_triplets.begin(), C_triplets.end());
+
+    // G*C^T
+    m_GCt = baseSolve(m_C.transpose().toDense());
+
+    // Schur complement
+    MatrixXd S = MatrixXd::Zero(nbConstraints + 1, nbConstraints + 1);
+    S.topLeftCorner(nbConstraints, nbConstraints) = m_C * m_GCt;
+    S.topRightCorner(nbConstraints, 1).setConstant(-1.0);
+    S.bottomLeftCorner(1, nbConstraints).setConstant(1.0);
+    m_schurLU.compute(S);
+    if (!m_schurLU.isInvertible()) {
+        qWarning() << "precomputeConstraints: degenerate hard constraints";
+    }
+}
+
+/**
+ * Apply the solution operator G of the base system to the nCorners x k matrix rhs (whose columns must sum to zero).
+ * In the symmetric solver mode, the base system is PTP with corner 0 grounded, otherwise it is PTP bordered 
+ * by the center of mass constraint with a null constraint value. Returns a nCorners x k matrix.
+ */
+MatrixXd Lattice::baseSolve(const MatrixXd &rhs) const {
+    int nCorners = m_corners.size();
+    MatrixXd Y;
+    bool solved;
+    if (m_symmetricSolver) {
+        MatrixXd b = rhs;
+        b.row(0).setZero();
+        Y = m_LDLT.solve(b);
+        solved = m_LDLT.info() == Success;
+    } else {
+        MatrixXd b = MatrixXd::Zero(nCorners + 1, rhs.cols());
+        b.topRows(nCorners) = rhs;
+        Y = m_LU.solve(b);
+        Y.conservativeResize(nCorners, NoChange);
+        solved = m_LU.info() == Success;
+    }
+    if (!solved) {
+        std::cout << "ERROR DURING SOLVE" << std::endl;
+        assert(0);
+    }
+    return Y;
+}
+
+/**
+ * Solve the ARAP system with the hard constraints (see precomputeConstraints).
+ * rhs is the nCorners x k RHS of the base system, constraintsValues the nbConstraints x k
+ * target positions of the constraints. Returns the nCorners x k solution.
+ */
+MatrixXd Lattice::solveConstrained(const MatrixXd &rhs, const MatrixXd &constraintsValues) const {
+    int nbConstraints = m_C.rows();
+
+    MatrixXd Y = baseSolve(rhs);
+
+    MatrixXd schurRhs(nbConstraints + 1, rhs.cols());
+    schurRhs.topRows(nbConstraints) = m_C * Y - constraintsValues;
+    schurRhs.row(nbConstraints) = rhs.colwise().sum();
+    MatrixXd L = m_schurLU.solve(schurRhs);
+
+    MatrixXd X = Y - m_GCt * L.topRows(nbConstraints);
+    X.rowwise() += L.row(nbConstraints);
+    return X;
+}
+
+/**
+ * Solve the ARAP interpolation for each given alpha in a single multi-RHS solve.
+ * Returns a nCorners x 2k matrix, columns 2i and 2i+1 are the corners positions at alphas[i].
+ */
+MatrixXd Lattice::solveARAP(const std::vector<qreal> &alphasLinear, const std::vector<qreal> &alphas) {
+    int nCorners = m_corners.size();
+    int nTriangles = m_triAngles.size();
+    int k = alphas.size();
+
+    // Compute A(t) for each alpha and stack them
+    // Each triangle interpolates the rotation and the shear of its polar decomposition (see precompute)
+    MatrixXd At(2 * nTriangles, 2 * k);
+    Matrix2d Rt, A_interp;
+    for (int j = 0; j < k; ++j) {
+        for (int r = 0; r < nTriangles; ++r) {
+            float t = r < nTriangles / 2 ? alphas[j] : 1.0f - (float)alphas[j];
+            double angle = m_triAngles[r];
+            Rt << cos(angle * t), -sin(angle * t), sin(angle * t), cos(angle * t);
+            A_interp = Rt * m_triShears[r].pow(t);
+            At(2 * r, 2 * j) = A_interp(0, 0);
+            At(2 * r, 2 * j + 1) = A_interp(1, 0);
+            At(2 * r + 1, 2 * j) = A_interp(0, 1);
+            At(2 * r + 1, 2 * j + 1) = A_interp(1, 1);
+        }
+    }
+
+    // Assembling final RHS matrix
+    MatrixXd PTAD = m_Pt * m_W.asDiagonal() * At;
+
+    if (m_constraintsDirty) precomputeConstraints();
+
+    // Without hard constraints, the center of mass constraint is part of the LU factorization
+    if (m_C.rows() == 0) {
+        MatrixXd rhs(nCorners + 1, 2 * k);
+        rhs.topRows(nCorners) = PTAD;
+        for (int j = 0; j < k; ++j) {
+            qreal t = alphas[j];
+            rhs(nCorners, 2 * j) = m_refCM.x() * (1.0 - t) + m_tgtCM.x() * t;
+            rhs(nCorners, 2 * j + 1) = m_refCM.y() * (1.0 - t) + m_tgtCM.y() * t;
+        }
+        MatrixXd V = m_LU.solve(rhs);
+        if (m_LU.info() != Success) {
+            std::cout << "ERROR DURING SOLVE" << std::endl;
+            assert(0);
+        }
+        return V.topRows(nCorners);
+    }
+
+    // Hard constraints values
+    MatrixXd constraintsValues(m_C.rows(), 2 * k);
+    for (int j = 0; j < k; ++j) {
+        qreal t = alphas[j];
+        if (m_constraintsIdx.empty()) {
+            // Main constraint (linear interp of center of mass)
+            constraintsValues(0, 2 * j) = m_refCM.x() * (1.0 - t) + m_tgtCM.x() * t;
+            constraintsValues(0, 2 * j + 1) = m_refCM.y() * (1.0 - t) + m_tgtCM.y() * t;
+            continue;
+        }
+        // User defined constraints values
+        int idx = 0;
+        for (unsigned int constraintIdx : m_constraintsIdx) {
+            Point::VectorType pos = constraintValue(constraintIdx, alphasLinear[j], t);
+            constraintsValues(idx, 2 * j) = pos.x();
+            constraintsValues(idx, 2 * j + 1) = pos.y();
+            ++idx;
+        }
+    }
+    return solveConstrained(PTAD, constraintsValues);
+}
+
+// Position of a user defined constraint at the given alpha values (the local offset is evaluated without updating its current value)
+Point::VectorType Lattice::constraintValue(unsigned int constraintIdx, qreal alphaLinear, qreal alpha) const {
+    Trajectory *traj = m_keyframe->trajectoryConstraintPtr(constraintIdx);
+    float offset = traj->localOffset()->curve()->evalAt(alphaLinear);
+    return traj->eval(alpha + (std::abs(offset) < 1e-5f ? 0.0f : offset));
+}
+
+/**
+ * Compute the ARAP interpolation of the lattice at the given alpha value.
+ * The corners coordinates are not modified, use copyPositions to write the returned frame into a corner coordinate.
+ */
+InterpolatedFrame Lattice::interpolateARAP(qreal alphaLinear, qreal alpha, const Point::Affine &globalRigidTransform, bool useRigidTransform) {
     qDebug() << "** INTERP " << alpha;
+    std::vector<InterpolatedFrame> frames;
+    interpolateARAP({alphaLinear}, {alpha}, {globalRigidTransform}, frames, useRigidTransform);
+    return std::move(frames.front());
+}
+
+/**
+ * Batched version of interpolateARAP: all the alpha values share the same factorization and are solved as 
+ * one multi-RHS system. frames[i] holds the corners positions at alphas[i].
+ */
+void Lattice::interpolateARAP(const std::vector<qreal> &alphasLinear, const std::vector<qreal> &alphas, const std::vector<Point::Affine> &globalRigidTransforms, 
+                              std::vector<InterpolatedFrame> &frames, bool useRigidTransform) {
     StopWatch sw("ARAP interpolation");
 
     useRigidTransform = useRigidTransform && k_useGlobalRigidTransform;
-    m_currentPrecomputedTime = alpha;
+    int k = alphas.size();
+    frames.resize(k);
+    for (int j = 0; j < k; ++j) {
+        frames[j].alpha = alphas[j];
+        frames[j].corners.resize(m_corners.size());
+    }
 
     // Lattices with multiple connected components cannot be interpolated, return reference or target configuration
     if (!m_singleConnectedComponent) {
-        if (alpha < 1.0) copyPositions(this, REF_POS, INTERP_POS);
-        else             copyPositions(this, TARGET_POS, INTERP_POS);
+        for (int j = 0; j < k; ++j) {
+            PosTypeIndex type = alphas[j] < 1.0 ? REF_POS : TARGET_POS;
+            for (Corner *c : m_corners) frames[j][c->getKey()] = c->coord(type);
+        }
         return;
     }
 
-    int nQuads = m_quads.size();
-    MatrixXd A(2, 8 * nQuads);
-    qreal t = alpha;
+    MatrixXd V = solveARAP(alphasLinear, alphas);
 
-    // Compute A(t)
-    QuadPtr q;
-    int i = 0;
-    for (auto it = m_quads.begin(); it != m_quads.end(); ++it) {
-        q = it.value();
-        computeQuadA(q, A, i, t, false);
-    }
-    for (auto it = m_quads.begin(); it != m_quads.end(); ++it) {
-        q = it.value();
-        computeQuadA(q, A, i, t, true);
+    // The rows of V are the corner keys, which are the dense indices of the frames too
+    int nCorners = m_corners.size();
+    for (int j = 0; j < k; ++j) {
+        std::vector<Point::VectorType> &corners = frames[j].corners;
+        for (int i = 0; i < nCorners; ++i) corners[i] = Point::VectorType(V(i, 2 * j), V(i, 2 * j + 1));
+        if (useRigidTransform) {
+            for (Point::VectorType &p : corners) p = globalRigidTransforms[j] * p;
+        }
     }
+    sw.stop();
+}
 
-    // Assembling final RHS matrix and concatenating constraints values
-    unsigned int nbConstraint = m_constraintsIdx.size() > 0 ? m_constraintsIdx.size() : 1;
-    unsigned int idx = m_corners.size();
-    MatrixXd PTAD(m_corners.size() + nbConstraint, 2);
-    PTAD.block(0, 0, m_corners.size(), 2) = m_Pt * m_W.asDiagonal() * A.transpose();
+int CornersTrajectories::sampleIdx(qreal alphaLinear) const {
+    qreal x = alphaLinear * (nbSamples - 1);
+    int i = (int)std::round(x);
+    return (i >= 0 && i < nbSamples && std::abs(x - i) < 1e-4) ? i : -1;
+}
 
-    // Main constraint (linear interp of center of mass)
-    if (m_constraintsIdx.size() == 0) {
-        PTAD(idx, 0) = m_refCM.x() * (1.0 - t) + m_tgtCM.x() * t;
-        PTAD(idx, 1) = m_refCM.y() * (1.0 - t) + m_tgtCM.y() * t;
-        ++idx;
-    }
+Point::VectorType CornersTrajectories::eval(int cornerKey, qreal alphaLinear) const {
+    qreal x = std::clamp(alphaLinear, 0.0, 1.0) * (nbSamples - 1);
+    int i = std::min((int)x, nbSamples - 2);
+    qreal t = x - i;
+    return at(cornerKey, i) * (1.0 - t) + at(cornerKey, i + 1) * t;
+}
 
-    // User defined constraints values
-    float offset;
-    for (unsigned int constraintIdx : m_constraintsIdx) {
-        Trajectory *traj = m_keyframe->trajectoryConstraintPtr(constraintIdx);
-        traj->localOffset()->frameChanged(alphaLinear);
-        offset = traj->localOffset()->get();
-        Point::VectorType pos = traj->eval(t + (std::abs(offset) < 1e-5f ? 0.0f : offset));
-        PTAD(idx, 0) = pos.x();
-        PTAD(idx, 1) = pos.y();
-        ++idx;
-    }
+/**
+ * Number of samples of the corners trajectories. 
+ * The number of intervals is a multiple of the keyframe stride so that every inbetween falls exactly on a sample.
+ */
+int Lattice::cornersTrajectoriesResolution(const Group *group) const {
+    int stride = 1;
+    VectorKeyFrame *keyframe = group->getParentKeyframe();
+    Layer *layer = keyframe != nullptr ? keyframe->parentLayer() : nullptr;
+    if (layer != nullptr) stride = std::max(1, layer->stride(layer->getVectorKeyFramePosition(keyframe)));
+    int nbIntervals = stride * (int)std::ceil((double)k_cornersTrajectoriesRes / (double)stride);
+    return nbIntervals + 1;
+}
 
-    MatrixXd V = m_LU.solve(PTAD).eval();
-    if (m_LU.info() != Success) {
-        std::cout << "ERROR DURING SOLVE" << std::endl;
-        assert(0);
+/**
+ * The lattice and its constraints set are tracked by m_cornersTrajectoriesDirty. The spacing and the constraints trajectories
+ * are tracked by the animation version of the keyframe, which changes every time its inbetweens are made dirty.
+ */
+const CornersTrajectories *Lattice::validCornersTrajectories(const Group *group) {
+    if (m_precomputeDirty || m_cornersTrajectoriesDirty) return nullptr;
+    const CornersTrajectories &traj = m_cornersTrajectories;
+    if (traj.animationVersion != m_keyframe->animationVersion() || traj.nbSamples != cornersTrajectoriesResolution(group)) return nullptr;
+    return &traj;
+}
+
+/**
+ * Return the corners trajectories of the lattice, the ARAP interpolation is sampled again (one batched solve) only if the lattice, 
+ * its constraints or the spacing of the group changed since the last call.
+ */
+const CornersTrajectories &Lattice::cornersTrajectories(const Group *group) {
+    if (validCornersTrajectories(group) != nullptr) return m_cornersTrajectories;
+    if (m_precomputeDirty) precompute();
+
+    CornersTrajectories &traj = m_cornersTrajectories;
+    traj.nbSamples = cornersTrajectoriesResolution(group);
+    traj.animationVersion = m_keyframe->animationVersion();
+    traj.spacings.resize(traj.nbSamples);
+    std::vector<qreal> alphasLinear(traj.nbSamples);
+    for (int i = 0; i < traj.nbSamples; ++i) {
+        alphasLinear[i] = traj.sampleAlpha(i);
+        traj.spacings[i] = group->evalSpacingAlpha(alphasLinear[i]);
+    }
+
+    std::vector<InterpolatedFrame> frames;
+    interpolateARAP(alphasLinear, traj.spacings, std::vector<Point::Affine>(traj.nbSamples, Point::Affine::Identity()), frames, false);
+    int nCorners = m_corners.size();
+    traj.positions.resize(nCorners * traj.nbSamples);
+    for (int key = 0; key < nCorners; ++key) {
+        for (int i = 0; i < traj.nbSamples; ++i) traj.positions[key * traj.nbSamples + i] = frames[i][key];
     }
+    m_cornersTrajectoriesDirty = false;
+    return m_cornersTrajectories;
+}
 
-    // Setting new interpolated vertices in corners INTERP_POS coordinates
-    for (auto it = m_corners.begin(); it != m_corners.end(); ++it) {
-        Corner *c;
-        c = *it;
-        i = c->getKey();
-        c->coord(INTERP_POS) = V.row(i);
-        if (useRigidTransform) {
-            c->coord(INTERP_POS) = globalRigidTransform * c->coord(INTERP_POS);
+void Lattice::interpolateCached(const std::vector<qreal> &alphasLinear, const std::vector<Point::Affine> &globalRigidTransforms, 
+                                std::vector<InterpolatedFrame> &frames, bool useRigidTransform) const {
+    const CornersTrajectories &traj = m_cornersTrajectories;
+    useRigidTransform = useRigidTransform && k_useGlobalRigidTransform;
+    frames.resize(alphasLinear.size());
+    for (size_t j = 0; j < alphasLinear.size(); ++j) {
+        int sample = traj.sampleIdx(alphasLinear[j]);
+        qreal x = std::clamp(alphasLinear[j], 0.0, 1.0) * (traj.nbSamples - 1);
+        int i = std::min((int)x, traj.nbSamples - 2);
+        frames[j].alpha = sample >= 0 ? traj.spacings[sample] : traj.spacings[i] * (1.0 - (x - i)) + traj.spacings[i + 1] * (x - i);
+        int nCorners = m_corners.size();
+        frames[j].corners.resize(nCorners);
+        for (int key = 0; key < nCorners; ++key) {
+            frames[j][key] = sample >= 0 ? traj.at(key, sample) : traj.eval(key, alphasLinear[j]);
+            if (useRigidTransform) frames[j][key] = globalRigidTransforms[j] * frames[j][key];
         }
     }
-
-    m_arapDirty = false;
-    sw.stop();
 }
 
 /**
@@ -1376,29 +1926,19 @@ bool Lattice::checkQuadsShareStroke(VectorKeyFrame *keyframe, QuadPtr q1, QuadPt
 }
 
 /**
- * Compute P* for the two triangles of the given quad and add them to the sparse matrix P (via the triplet list).
+ * Compute P* of the triangle (pi, pj, pk) and add it to the sparse matrix P (via the triplet list).
+ * i, j and k are the keys of the triangle corners.
  * See Baxter et al. 2008 
  */
-void Lattice::computePStar(QuadPtr q, int cornerI, int cornerJ, int triRow, bool inverseOrientation, std::vector<TripletD> &P_triplets) {
-    MatrixXd P(3, 2), D(2, 3), P_star(2, 3);
+void Lattice::computePStar(const Point::VectorType &pi, const Point::VectorType &pj, const Point::VectorType &pk, int i, int j, int k, int triRow, std::vector<TripletD> &P_triplets) {
+    Eigen::Matrix<double, 3, 2> P;
+    Eigen::Matrix<double, 2, 3> D, P_star;
     D << 1, 0, -1, 0, 1, -1;
-    int i, j, k;
-
-    PosTypeIndex posType = inverseOrientation ? TARGET_POS : REF_POS;
 
-    P(0, 0) = q->corners[cornerI]->coord(posType).x();
-    P(0, 1) = q->corners[cornerI]->coord(posType).y();
-    P(1, 0) = q->corners[cornerJ]->coord(posType).x();
-    P(1, 1) = q->corners[cornerJ]->coord(posType).y();
-    P(2, 0) = q->corners[BOTTOM_LEFT]->coord(posType).x();
-    P(2, 1) = q->corners[BOTTOM_LEFT]->coord(posType).y();
+    P << pi.x(), pi.y(), pj.x(), pj.y(), pk.x(), pk.y();
 
     P_star = (D * P).inverse() * D;
 
-    i = q->corners[cornerI]->getKey();
-    j = q->corners[cornerJ]->getKey();
-    k = q->corners[BOTTOM_LEFT]->getKey();
-
     P_triplets.push_back(TripletD(2 * triRow, i, P_star(0, 0)));
     P_triplets.push_back(TripletD(2 * triRow, j, P_star(0, 1)));
     P_triplets.push_back(TripletD(2 * triRow, k, P_star(0, 2)));
@@ -1407,42 +1947,13 @@ void Lattice::computePStar(QuadPtr q, int cornerI, int cornerJ, int triRow, bool
     P_triplets.push_back(TripletD(2 * triRow + 1, k, P_star(1, 2)));
 }
 
-// Compute A(t) (concatenated for the two triangles of the given quad)
-void Lattice::computeQuadA(QuadPtr q, MatrixXd &At, int &i, float t, bool inverseOrientation) {
-    Matrix2d A_interp, I;
-    Matrix2d A, Rt, S;
-    I = Matrix2d::Identity();
-    if (inverseOrientation) t = 1.0f - t;
-
-    // Compute and concatenate the interpolated linear transformation of the triangle formed by CornerA, CornerB and the bottom left corner
-    // of the quad
-    auto computeTriangleA = [&](CornerIndex cornerA, CornerIndex cornerB) {
-        Arap::computeJAM(q, cornerA, cornerB, inverseOrientation, A);
-        double angle = Arap::polarDecomp(A, S);
-        // Interpolated rotation matrix
-        Rt << cos(angle * t), -sin(angle * t), sin(angle * t), cos(angle * t);
-        // Interpolated linear transformation of the triangle (rotation and shearing interpolated independently)
-        // A_interp = Rt * ((1 - t) * I + t * S);
-        A_interp = Rt * S.pow(t);
-        // Concatenate transposed result to the input matrix A(t)
-        At(0, i) = A_interp(0, 0);
-        At(1, i) = A_interp(1, 0);
-        i++;
-        At(0, i) = A_interp(0, 1);
-        At(1, i) = A_interp(1, 1);
-        i++;
-    };
-
-    computeTriangleA(TOP_LEFT, TOP_RIGHT);
-    computeTriangleA(TOP_RIGHT, BOTTOM_RIGHT);
-}
-
 void Lattice::applyTransform(const Point::Affine &transform, PosTypeIndex ref, PosTypeIndex dst) {
     for (Corner *corner : m_corners) {
         if (corner->flag(MOVABLE)) {
             corner->coord(dst) = transform * corner->coord(ref);
         }
     }
+    if (dst == REF_POS) m_restRegularDirty = true;
 }
 
 void Lattice::copyPositions(const Lattice *dst, PosTypeIndex srcPos, PosTypeIndex dstPos) {
@@ -1452,6 +1963,15 @@ void Lattice::copyPositions(const Lattice *dst, PosTypeIndex srcPos, PosTypeInde
             quad->corners[i]->coord(dstPos) = it.value()->corners[i]->coord(srcPos);
         }
     }
+    if (dstPos == REF_POS) m_restRegularDirty = true;
+}
+
+// set the dstPos corners position to the given interpolated frame (assume the frame was interpolated from this lattice)
+void Lattice::copyPositions(const InterpolatedFrame &frame, PosTypeIndex dstPos) {
+    for (Corner *c : m_corners) {
+        c->coord(dstPos) = frame[c->getKey()];
+    }
+    if (dstPos == REF_POS) m_restRegularDirty = true;
 }
 
 // assume copied lattice (same topology and quad keys)
@@ -1467,6 +1987,7 @@ void Lattice::moveSrcPosTo(const Lattice *target, PosTypeIndex srcPos, PosTypeIn
             quad->corners[i]->coord(srcPos) = quadTarget->corners[i]->coord(targetPos);
         }
     }
+    if (srcPos == REF_POS) m_restRegularDirty = true;
     setArapDirty();
 }
 
@@ -1489,7 +2010,6 @@ void Lattice::resetDeformation() {
     }
     m_scaling = Point::Affine::Identity();
     m_scale = 1.0;
-    m_arapDirty = true;
     m_precomputeDirty = true;
 }
 
@@ -1814,12 +2334,34 @@ bool Lattice::checkPotentialBowtie(Point::VectorType &prevPoint, Point::VectorTy
  * TODO: propagate TARGET_POS coords to the new quads 
  */
 void Lattice::enforceManifoldness(Group *group) {
+    fixBowtieCorners(group, m_corners);
+}
+
+/**
+ * Same as enforceManifoldness(group) but only checks the corners of the given quads, which are the only ones whose
+ * neighborhood changed when these quads were added
+ */
+void Lattice::enforceManifoldness(Group *group, const std::vector<QuadPtr> &quads) {
+    QVector<Corner *> corners;
+    QSet<int> visited;
+    for (const QuadPtr &quad : quads) {
+        for (Corner *corner : quad->corners) {
+            if (!visited.contains(corner->getKey())) {
+                visited.insert(corner->getKey());
+                corners.append(corner);
+            }
+        }
+    }
+    fixBowtieCorners(group, corners);
+}
+
+void Lattice::fixBowtieCorners(Group *group, const QVector<Corner *> &cornersToCheck) {
     std::vector<QuadPtr> newQuads;
     VectorKeyFrame *keyframe = group->getParentKeyframe();
     int nbNewQuads = 0;
 
     // Check for bowtie corners
-    QVector<Corner *> corners = m_corners;
+    QVector<Corner *> corners = cornersToCheck;
     for (Corner *corner : corners) {
         if (corner->nbQuads() != 2) continue;
         for (int i = 0; i < NUM_CORNERS; ++i) {
@@ -1917,9 +2459,9 @@ void Lattice::restoreKeysRetrocomp(Group *group, Editor *editor) {
         }
     };
 
-    m_oGrid = Eigen::Vector2i(editor->tabletCanvas()->canvasRect().x(), editor->tabletCanvas()->canvasRect().y());
-    m_nbCols = std::ceil((float)editor->tabletCanvas()->canvasRect().width() / m_cellSize);
-    m_nbRows = std::ceil((float)editor->tabletCanvas()->canvasRect().height() / m_cellSize);
+    m_oGrid = Eigen::Vector2i(editor->canvasRect().x(), editor->canvasRect().y());
+    m_nbCols = std::ceil((float)editor->canvasRect().width() / m_cellSize);
+    m_nbRows = std::ceil((float)editor->canvasRect().height() / m_cellSize);
 
     // update the non-breakdown group
     QHash<int, QuadPtr> oldHash = m_quads;
@@ -1946,9 +2488,9 @@ void Lattice::restoreKeysRetrocomp(Group *group, Editor *editor) {
     // update following breakdowns
     Group *curGroup = group;
     while (curGroup->nextPostGroup() != nullptr) {
-        curGroup->lattice()->setOrigin(Eigen::Vector2i(editor->tabletCanvas()->canvasRect().x(), editor->tabletCanvas()->canvasRect().y()));
-        curGroup->lattice()->m_nbCols = std::ceil((float)editor->tabletCanvas()->canvasRect().width() / curGroup->lattice()->m_cellSize);
-        curGroup->lattice()->m_nbRows = std::ceil((float)editor->tabletCanvas()->canvasRect().height() / curGroup->lattice()->m_cellSize);
+        curGroup->lattice()->setOrigin(Eigen::Vector2i(editor->canvasRect().x(), editor->canvasRect().y()));
+        curGroup->lattice()->m_nbCols = std::ceil((float)editor->canvasRect().width() / curGroup->lattice()->m_cellSize);
+        curGroup->lattice()->m_nbRows = std::ceil((float)editor->canvasRect().height() / curGroup->lattice()->m_cellSize);
 
         oldHash = curGroup->lattice()->m_quads;
         curGroup->lattice()->m_quads.clear();
@@ -1964,4 +2506,4 @@ void Lattice::restoreKeysRetrocomp(Group *group, Editor *editor) {
         }
         updateTrajectories(curGroup, keysMap);
     }
-}
\ No newline at end of file
+}
@@ -17,10 +17,13 @@
 #include <QOpenGLExtraFunctions>
 #include <iostream>
 #include <set>
+#include <array>
 
 #include <Eigen/Geometry>
 #include <Eigen/SparseCore>
 #include <Eigen/SparseLU>
+#include <Eigen/SparseCholesky>
+#include <Eigen/LU>
 
 #include "corner.h"
 #include "layer.h"
@@ -33,8 +36,45 @@ class Group;
 class Stroke;
 class UVHash;
 class Mask;
+class ChunkWriter;
+class ChunkReader;
 
 using namespace Eigen;
+
+/**
+ * Corners positions of a lattice interpolated at one alpha value, indexed by corner key (see Lattice::interpolateARAP).
+ * The positions live outside of the lattice corners, so several frames of the same lattice can be solved, cached and warped concurrently.
+ */
+struct InterpolatedFrame {
+    qreal alpha = -1.0;
+    std::vector<Point::VectorType> corners;
+
+    inline bool isValid() const { return alpha >= 0.0; }
+    inline size_t size() const { return corners.size(); }
+    inline const Point::VectorType &operator[](int cornerKey) const { return corners[cornerKey]; }
+    inline Point::VectorType &operator[](int cornerKey) { return corners[cornerKey]; }
+};
+
+/**
+ * Corners positions of a lattice sampled at regular linear alpha values, spacing included and global rigid transform excluded.
+ * The samples of a corner are contiguous: at(cornerKey, i) is the position of the corner at the linear alpha sampleAlpha(i).
+ * Computed with a single batched solve and kept until the lattice, its constraints or its spacing change (see Lattice::cornersTrajectories).
+ */
+struct CornersTrajectories {
+    int nbSamples = 0;
+    unsigned int animationVersion = 0;              // animation version of the keyframe when the trajectories were computed
+    std::vector<qreal> spacings;                    // spacing alpha of each sample
+    std::vector<Point::VectorType> positions;       // nbCorners x nbSamples
+
+    inline bool isValid() const { return nbSamples > 1; }
+    inline qreal sampleAlpha(int i) const { return (qreal)i / (qreal)(nbSamples - 1); }
+    inline const Point::VectorType &at(int cornerKey, int i) const { return positions[cornerKey * nbSamples + i]; }
+    // Index of the sample at the given linear alpha, -1 if the alpha value falls between two samples
+    int sampleIdx(qreal alphaLinear) const;
+    // Corner position at the given linear alpha, linearly interpolated between the two closest samples
+    Point::VectorType eval(int cornerKey, qreal alphaLinear) const;
+};
+
 class Lattice {
    public:
     Lattice(VectorKeyFrame *keyframe);
@@ -42,8 +82,8 @@ class Lattice {
     Lattice(const Lattice &other, const std::vector<int> &quads);
 
     void init(int cellsize, int nbCols, int nbRows, Eigen::Vector2i origin = Eigen::Vector2i::Zero());
-    void save(QDomDocument &doc, QDomElement &latticeElt) const;
-    void load(QDomElement &latticeElt);
+    void save(QDomDocument &doc, QDomElement &latticeElt, ChunkWriter *data = nullptr) const;
+    void load(QDomElement &latticeElt, const ChunkReader *data = nullptr);
     void clear();
     void removeStroke(int strokeId, bool breakdown);
 
@@ -66,12 +106,11 @@ class Lattice {
 
     // Flags
     inline bool isArapPrecomputeDirty() const { return m_precomputeDirty; }
-    inline bool isArapInterpDirty() const { return m_arapDirty; }
     inline bool needRetrocomp() const { return m_retrocomp; }
     inline bool isBufferCreated() const { return m_bufferCreated; }
     void setArapDirty();
-    inline float currentPrecomputedTime() const { return m_currentPrecomputedTime; }
-    inline void resetPrecomputedTime() { m_currentPrecomputedTime = -1; }
+    void setConstraintsDirty() { m_constraintsDirty = true; m_cornersTrajectoriesDirty = true; }
+    void setRestDirty() { m_restRegularDirty = true; }   // must be called when the REF_POS corners are moved from outside the lattice
 
     // Quads & corners
     inline bool contains(int key) const { return m_quads.contains(key); }
@@ -91,6 +130,7 @@ class Lattice {
     QuadPtr addQuad(int key, int x, int y, bool &isNewQuad);
     QuadPtr addQuad(QuadPtr &quad);
     QuadPtr addEmptyQuad(int key);
+    bool addStrokeQuads(const Stroke *stroke, const Interval &interval, std::vector<QuadPtr> &newQuads);
     void deleteQuad(int key);
     void deleteQuadsPredicate(std::function<bool(QuadPtr)> predicate);
     void deleteUnusedCorners();
@@ -109,14 +149,19 @@ class Lattice {
     Point::VectorType getUV(const Point::VectorType &p, PosTypeIndex type, int &quadKey);
     Point::VectorType getUV(const Point::VectorType &p, PosTypeIndex type, QuadPtr quad);
     Point::VectorType getWarpedPoint(const Point::VectorType &p, int quadKey, const Point::VectorType &uv, PosTypeIndex type);
+    Point::VectorType getWarpedPoint(const InterpolatedFrame &frame, int quadKey, const Point::VectorType &uv) const;
     bool bakeForwardUV(const Stroke *stroke, Interval &interval, UVHash &uvs, PosTypeIndex type=REF_POS);
     bool bakeForwardUVConnectivityCheck(const Stroke *stroke, Interval &interval, UVHash &uvs, PosTypeIndex type=REF_POS);
     bool bakeForwardUVPrecomputed(const Stroke *stroke, Interval &interval, UVHash &uvs);
     bool bakeBackwardUV(const Stroke *stroke, Interval &interval, const Point::Affine &transform, UVHash &uvs);
 
     // Trajectory constraints
-    bool addConstraint(unsigned int constraintIdx) { return m_constraintsIdx.insert(constraintIdx).second; }
-    void removeConstraint(unsigned int constraintIdx) { m_constraintsIdx.erase(constraintIdx); }
+    bool addConstraint(unsigned int constraintIdx) {
+        bool inserted = m_constraintsIdx.insert(constraintIdx).second;
+        if (inserted) setConstraintsDirty();
+        return inserted;
+    }
+    void removeConstraint(unsigned int constraintIdx) { if (m_constraintsIdx.erase(constraintIdx) > 0) setConstraintsDirty(); }
     int nbConstraints() const { return m_constraintsIdx.size(); }
     const std::set<unsigned int> &constraints() const { return m_constraintsIdx; }
 
@@ -136,14 +181,27 @@ class Lattice {
     void destroyBuffer();
     void updateBuffer();
 
-    // Compute P^T and LHS of ARAP equation (with constraint)
+    // Compute P^T and factorize the LHS of ARAP equation (with the center of mass constraint)
     void precompute();
-    // Compute ARAP interpolation and store it in INTERP_POS corner coord
-    void interpolateARAP(qreal alphaLinear, qreal alpha, const Point::Affine &globalRigidTransform, bool useRigidTransform = true);
+    // Corners positions of the given configuration in a contiguous array indexed by corner key
+    void gatherPositions(PosTypeIndex type, std::vector<Point::VectorType> &positions) const;
+    // Compute ARAP interpolation, the corners coordinates are left untouched
+    InterpolatedFrame interpolateARAP(qreal alphaLinear, qreal alpha, const Point::Affine &globalRigidTransform, bool useRigidTransform = true);
+    // Compute ARAP interpolation for several alpha values with a single multi-RHS solve
+    void interpolateARAP(const std::vector<qreal> &alphasLinear, const std::vector<qreal> &alphas, const std::vector<Point::Affine> &globalRigidTransforms, 
+                         std::vector<InterpolatedFrame> &frames, bool useRigidTransform = true);
+    // Corners trajectories with the spacing of the given group, only recomputed if the lattice, its constraints or the spacing changed
+    const CornersTrajectories &cornersTrajectories(const Group *group);
+    // Cached corners trajectories if they are still valid for the given group, nullptr otherwise (nothing is solved)
+    const CornersTrajectories *validCornersTrajectories(const Group *group);
+    // Same as interpolateARAP but read from the cached corners trajectories, which must be valid (thread-safe)
+    void interpolateCached(const std::vector<qreal> &alphasLinear, const std::vector<Point::Affine> &globalRigidTransforms, 
+                           std::vector<InterpolatedFrame> &frames, bool useRigidTransform = true) const;
 
     // Misc. and utils
     void applyTransform(const Point::Affine &transform, PosTypeIndex ref, PosTypeIndex dst);
     void copyPositions(const Lattice *src, PosTypeIndex srcPos, PosTypeIndex dst);          // assume copied lattice
+    void copyPositions(const InterpolatedFrame &frame, PosTypeIndex dst);                   // assume frame interpolated from this lattice
     void moveSrcPosTo(const Lattice *target, PosTypeIndex srcPos, PosTypeIndex targetPos);  // assume copied lattice
 
     Point::VectorType centerOfGravity(PosTypeIndex type = TARGET_POS);
@@ -170,6 +228,7 @@ class Lattice {
 
     bool checkPotentialBowtie(Point::VectorType &prevPoint, Point::VectorType &curPoint, int &quadKeyOut);
     void enforceManifoldness(Group *group);
+    void enforceManifoldness(Group *group, const std::vector<QuadPtr> &quads);
     void enforceManifoldness(Stroke *stroke, Interval &interval, std::vector<QuadPtr> &newQuads, bool forceAddPivots = false);
 
     void debug(std::ostream &os) const;
@@ -195,13 +254,34 @@ class Lattice {
         y = int(floor(j));
     }
 
-    void setToRestTransform(Point::Affine transform) { m_toRestPos = transform; };
+    void setToRestTransform(Point::Affine transform) { m_toRestPos = transform; setRestDirty(); };
     Point::Affine getToRestTransform() const { return m_toRestPos; };
+    bool isRestRegular() const;
 
    private:
+    // Sparsity pattern of a matrix (outer and inner indices of its compressed storage)
+    struct SparsityPattern {
+        std::vector<int> outer, inner;
+        bool matches(const SparseMatrix<double, ColMajor> &m) const;
+        void assign(const SparseMatrix<double, ColMajor> &m);
+        void clear() { outer.clear(); inner.clear(); }
+    };
+
     bool checkQuadsShareStroke(VectorKeyFrame *keyframe, QuadPtr q1, QuadPtr q2, std::vector<QuadPtr> &newQuads);
-    void computePStar(QuadPtr q, int cornerI, int cornerJ, int quadRow, bool inverseOrientation, std::vector<Eigen::Triplet<double>> &P_triplets);
-    void computeQuadA(QuadPtr q, MatrixXd &At, int &i, float t, bool inverseOrientation);
+    void fixBowtieCorners(Group *group, const QVector<Corner *> &cornersToCheck);
+    void saveBinary(QDomElement &latticeElt, ChunkWriter *data) const;
+    void saveElements(QDomDocument &doc, QDomElement &latticeElt) const;
+    void loadBinary(QDomElement &latticeElt, const ChunkReader *data);
+    void loadElements(QDomElement &latticeElt);
+    void updateDenseTopology();
+    bool computeRestRegular() const;
+    void computePStar(const Point::VectorType &pi, const Point::VectorType &pj, const Point::VectorType &pk, int i, int j, int k, int triRow, std::vector<Eigen::Triplet<double>> &P_triplets);
+    void precomputeConstraints();
+    MatrixXd solveARAP(const std::vector<qreal> &alphasLinear, const std::vector<qreal> &alphas);
+    Point::VectorType constraintValue(unsigned int constraintIdx, qreal alphaLinear, qreal alpha) const;
+    int cornersTrajectoriesResolution(const Group *group) const;
+    MatrixXd baseSolve(const MatrixXd &rhs) const;
+    MatrixXd solveConstrained(const MatrixXd &rhs, const MatrixXd &constraintsValues) const;
     
     VectorKeyFrame *m_keyframe;
 
@@ -220,20 +300,42 @@ class Lattice {
     // Constraints indices in the keyframe list
     std::set<unsigned int> m_constraintsIdx;
 
+    // Corner keys (CornerIndex order) of each quad in the order of the ARAP rows, only used by precompute which rebuilds it.
+    // The regularization sweeps build their own structure of arrays view (see Regularization in arap.cpp)
+    std::vector<std::array<int, 4>> m_denseQuadCorners;
+
+    // Rotation angle and shear of each triangle between the two configurations (polar decomposition of its affine map),
+    // in the order of the rows of P: the 2 triangles of every quad from REF_POS to TARGET_POS, then from TARGET_POS to REF_POS
+    std::vector<double> m_triAngles;
+    std::vector<Matrix2d> m_triShears;
+
     // Matrices for ARAP interpolation
     SparseMatrix<double, ColMajor> m_Pt;
-    SparseLU<SparseMatrix<double, ColMajor>, COLAMDOrdering<int>> m_LU;
+    SparseLU<SparseMatrix<double, ColMajor>, COLAMDOrdering<int>> m_LU;   // factorization of PTP bordered by the center of mass constraint
+    SparsityPattern m_LUPattern;                                            // pattern of the last symbolic analysis of m_LU
+    SimplicialLDLT<SparseMatrix<double, ColMajor>> m_LDLT;                  // factorization of PTP with corner 0 grounded (symmetric solver mode)
+    SparsityPattern m_LDLTPattern;                                          // pattern of the last symbolic analysis of m_LDLT
+    bool m_symmetricSolver;                                                 // solver mode used by the last precompute
     VectorXd m_W;
+
+    // Hard constraints, solved with the Schur complement of the constraints so that the factorization does not depend on them
+    // In the symmetric solver mode, the center of mass constraint is also handled here when there are no user defined constraints
+    SparseMatrix<double, RowMajor> m_C;     // constraints rows (bilinear weights of the constrained lattice coordinates)
+    MatrixXd m_GCt;                         // base solve of the constraints rows
+    FullPivLU<MatrixXd> m_schurLU;          // factorization of the dense constraints Schur complement
     double m_rot, m_scale;
 
     // Flags and cached stuff
     bool m_precomputeDirty;
-    bool m_arapDirty;
+    bool m_constraintsDirty;
+    bool m_cornersTrajectoriesDirty;
     bool m_backwardUVDirty;
     bool m_singleConnectedComponent;
     bool m_retrocomp;
-    float m_currentPrecomputedTime;
+    mutable bool m_restRegularDirty;    // m_restRegular must be recomputed (quads added/removed or REF_POS moved)
+    mutable bool m_restRegular;         // cached isRestRegular
     int m_maxCornerKey;
+    CornersTrajectories m_cornersTrajectories;
 
     // GL stuff
     QOpenGLVertexArrayObject m_vao;
@@ -18,6 +18,13 @@
 #include "vectorkeyframe.h"
 #include "gridmanager.h"
 #include "playbackmanager.h"
+#include "dialsandknobs.h"
+
+#include <QtConcurrent>
+
+static dkBool k_lazyLoading("Options->Files->Load keyframes on demand", true);
+static dkInt k_prefetchRadius("Options->Files->Prefetched neighbor keyframes", 2, 0, 16, 1);
+static dkBool k_parallelSave("Options->Files->Parallel keyframe serialization", true);
 
 int Layer::m_staticIdx = 0;
 
@@ -32,12 +39,19 @@ Layer::Layer(Editor *editor)
       m_frameClicked(-1),
       m_selectedFrame(-1),
       m_backupSelectedFrame(-1),
-      m_editor(editor) {
+      m_editor(editor),
+      m_loading(false) {
     m_id = ++m_staticIdx;
     m_keyFrames[1] = new VectorKeyFrame(this);  // virtual invisible key at the end of the map
+    m_prefetchTimer.setSingleShot(true);
+    m_prefetchTimer.setInterval(0);
+    QObject::connect(&m_prefetchTimer, &QTimer::timeout, [this]() { prefetch(); });
 }
 
 Layer::~Layer() {
+    m_prefetchTimer.stop();
+    m_pendingKeyFrames.clear();
+    m_prefetchQueue.clear();
     qDeleteAll(m_keyFrames.values());
     m_keyFrames.clear();
     if (m_id == m_staticIdx) m_staticIdx--;
@@ -56,79 +70,177 @@ bool Layer::load(QDomElement &element, const QString &path) {
     m_hasMask = (bool)element.attribute("mask", "0").toInt();
     m_opacity = element.attribute("opacity", "1.0").toDouble();
 
+    m_prefetchTimer.stop();
+    m_pendingKeyFrames.clear();
+    m_prefetchQueue.clear();
     qDeleteAll(m_keyFrames.values());
     m_keyFrames.clear();
+    m_dataPath = path;
 
-    // load keyframes
+    // create the keyframes, their content is only read when they are first accessed (see ensureLoaded)
     QDomNode keyTag = element.firstChild();
     while (!keyTag.isNull()) {
         QDomElement keyElement = keyTag.toElement();
-        VectorKeyFrame *prevKey = nullptr;
         if (!keyElement.isNull()) {
             if (keyElement.tagName() == "vectorkeyframe") {
                 int frame = keyElement.attribute("frame").toInt();
-                qDebug() << "LOADING FRAME " << frame;
                 VectorKeyFrame *keyFrame = new VectorKeyFrame(this);
-                keyFrame->load(keyElement, path, m_editor);                
-                // if (frame == 20) {
-
-                // }
                 if (m_keyFrames.contains(frame)) {
+                    forgetPending(m_keyFrames[frame]);
                     delete m_keyFrames[frame];
                 }
                 m_keyFrames[frame] = keyFrame;
+                m_pendingKeyFrames.insert(keyFrame, keyElement);
             }
         }
         keyTag = keyTag.nextSibling();
     }
 
-    for (VectorKeyFrame *key : m_keyFrames) {
-        VectorKeyFrame *next = key->nextKeyframe();
-        VectorKeyFrame *prev = key->prevKeyframe();
+    qDebug() << "Loaded " << m_keyFrames.size() << " keyframes";
 
-        for (Group *group : key->postGroups()) {
-            // Restore grid-stroke correspondence (backward strokes)
-            Group *nextPre = group->nextPreGroup();
-            if (nextPre != nullptr) {
-                for (auto it = nextPre->strokes().constBegin(); it != nextPre->strokes().constEnd(); ++it) {
-                    Stroke *stroke = next->stroke(it.key());
-                    m_editor->grid()->bakeStrokeInGrid(group->lattice(), stroke, 0, stroke->size() - 1, TARGET_POS, false);
-                }
-            }
+    QDomElement compositeElt = element.firstChildElement("compositebezier");
+    m_pivotCurves.load(compositeElt);
+    for (int frame : m_keyFrames.keys()){
+        float t = getFrameTValue(frame);
+        m_keyFrames[frame]->setPivotCurve(m_pivotCurves.getBezier(t));
+    }
+
+    if (!k_lazyLoading) ensureAllLoaded();
+
+    return true;
+}
+
+/**
+ * Read the content of a keyframe created by load and link it to its neighbors.
+ * Linking needs the strokes and trajectories of the previous and next keyframes, so their content is read as well,
+ * but they are only linked when they are accessed themselves.
+ */
+void Layer::ensureLoaded(VectorKeyFrame *keyframe, bool prefetchNeighbors) const {
+    if (m_loading || keyframe == nullptr || !m_pendingKeyFrames.contains(keyframe)) return;
+
+    auto it = std::find(m_keyFrames.constBegin(), m_keyFrames.constEnd(), keyframe);
+    if (it == m_keyFrames.constEnd()) return;
+
+    m_loading = true;
+    if (it != m_keyFrames.constBegin()) loadContent(std::prev(it).value());
+    loadContent(keyframe);
+    if (std::next(it) != m_keyFrames.constEnd()) loadContent(std::next(it).value());
+    m_pendingKeyFrames.remove(keyframe);
+    linkKeyFrame(keyframe);
+    m_loading = false;
+
+    if (prefetchNeighbors) schedulePrefetch(it.key());
+}
+
+// Load the keyframes whose neighbors change when a keyframe is inserted or removed at the given frame
+void Layer::ensureLoadedAround(int frame) const {
+    if (m_pendingKeyFrames.isEmpty()) return;
+    auto it = m_keyFrames.upperBound(frame);
+    if (it != m_keyFrames.constEnd()) ensureLoaded(it.value());
+    for (int i = 0; i < 2 && it != m_keyFrames.constBegin(); ++i) {
+        --it;
+        ensureLoaded(it.value());
+    }
+}
+
+void Layer::ensureAllLoaded() const {
+    if (m_loading || m_pendingKeyFrames.isEmpty()) return;
+
+    m_loading = true;
+    for (VectorKeyFrame *keyframe : m_keyFrames) {
+        loadContent(keyframe);
+    }
+    for (VectorKeyFrame *keyframe : m_keyFrames) {
+        if (m_pendingKeyFrames.remove(keyframe)) linkKeyFrame(keyframe);
+    }
+    m_pendingKeyFrames.clear();
+    m_prefetchQueue.clear();
+    m_prefetchTimer.stop();
+    m_loading = false;
+}
+
+void Layer::loadContent(VectorKeyFrame *keyframe) const {
+    auto it = m_pendingKeyFrames.find(keyframe);
+    if (it == m_pendingKeyFrames.end() || it.value().isNull()) return;
+    QDomElement element = it.value();
+    if (!keyframe->load(element, m_dataPath, m_editor)) {
+        qWarning() << "Layer " << m_name << ": failed to load keyframe " << element.attribute("frame");
+    }
+    it.value() = QDomElement();
+}
+
+void Layer::linkKeyFrame(VectorKeyFrame *key) const {
+    VectorKeyFrame *next = key->nextKeyframe();
+    VectorKeyFrame *prev = key->prevKeyframe();
 
-            // Retrocomp
-            if (group->lattice() != nullptr && group->lattice()->origin() == Eigen::Vector2i::Zero()) {
-                group->lattice()->restoreKeysRetrocomp(group, m_editor);
-                group->lattice()->isConnected();
+    for (Group *group : key->postGroups()) {
+        // Restore grid-stroke correspondence (backward strokes)
+        Group *nextPre = group->nextPreGroup();
+        if (nextPre != nullptr) {
+            for (auto it = nextPre->strokes().constBegin(); it != nextPre->strokes().constEnd(); ++it) {
+                Stroke *stroke = next->stroke(it.key());
+                m_editor->grid()->bakeStrokeInGrid(group->lattice(), stroke, 0, stroke->size() - 1, TARGET_POS, false);
             }
         }
 
-        // Set next/prev trajectories pointers
-        for (const std::shared_ptr<Trajectory> &traj : key->trajectories()) {
-            if (traj->nextTrajectoryID() >= 0)
-                traj->setNextTrajectory(next->trajectories().value(traj->nextTrajectoryID(), nullptr));
-            if (traj->prevTrajectoryID() >= 0)
-                traj->setPrevTrajectory(prev->trajectories().value(traj->prevTrajectoryID(), nullptr));
+        // Retrocomp
+        if (group->lattice() != nullptr && group->lattice()->origin() == Eigen::Vector2i::Zero()) {
+            group->lattice()->restoreKeysRetrocomp(group, m_editor);
+            group->lattice()->isConnected();
         }
-        
-        // Check spacing
-        key->updateCurves();
     }
 
-    qDebug() << "Loaded " << m_keyFrames.size() << " keyframes";
+    // Set next/prev trajectories pointers
+    for (const std::shared_ptr<Trajectory> &traj : key->trajectories()) {
+        if (traj->nextTrajectoryID() >= 0)
+            traj->setNextTrajectory(next->trajectories().value(traj->nextTrajectoryID(), nullptr));
+        if (traj->prevTrajectoryID() >= 0)
+            traj->setPrevTrajectory(prev->trajectories().value(traj->prevTrajectoryID(), nullptr));
+    }
 
-    QDomElement compositeElt = element.firstChildElement("compositebezier");
-    m_pivotCurves.load(compositeElt);
-    for (int frame : m_keyFrames.keys()){
-        float t = getFrameTValue(frame);
-        m_keyFrames[frame]->setPivotCurve(m_pivotCurves.getBezier(t));
+    // Check spacing
+    key->updateCurves();
+}
+
+void Layer::forgetPending(VectorKeyFrame *keyframe) {
+    m_pendingKeyFrames.remove(keyframe);
+    m_prefetchQueue.removeAll(keyframe);
+}
+
+// Queue the closest unloaded keyframes around the given frame, they are loaded when the event loop is idle
+void Layer::schedulePrefetch(int frame) const {
+    if (m_pendingKeyFrames.isEmpty() || k_prefetchRadius <= 0) return;
+
+    auto next = m_keyFrames.constFind(frame), prev = next;
+    if (next == m_keyFrames.constEnd()) return;
+
+    QList<VectorKeyFrame *> neighbors;
+    for (int i = 0; i < k_prefetchRadius; ++i) {
+        if (next != m_keyFrames.constEnd() && ++next != m_keyFrames.constEnd()) neighbors.append(next.value());
+        if (prev != m_keyFrames.constBegin()) neighbors.append((--prev).value());
     }
 
+    // closest neighbors first
+    for (auto it = neighbors.crbegin(); it != neighbors.crend(); ++it) {
+        if (!m_pendingKeyFrames.contains(*it)) continue;
+        m_prefetchQueue.removeOne(*it);
+        m_prefetchQueue.prepend(*it);
+    }
+    if (!m_prefetchQueue.isEmpty()) m_prefetchTimer.start();
+}
 
-    return true;
+void Layer::prefetch() const {
+    // one keyframe per event loop iteration to keep the interface responsive
+    while (!m_prefetchQueue.isEmpty()) {
+        VectorKeyFrame *keyframe = m_prefetchQueue.takeFirst();
+        if (!m_pendingKeyFrames.contains(keyframe)) continue;
+        ensureLoaded(keyframe, false);
+        break;
+    }
+    if (!m_prefetchQueue.isEmpty()) m_prefetchTimer.start();
 }
 
-bool Layer::save(QDomDocument &doc, QDomElement &root, const QString &path) const {
+bool Layer::save(QDomDocument &doc, QDomElement &root, const QString &path, bool keyframes) const {
     QDomElement layerElt = doc.createElement("layer");
     layerElt.setAttribute("id", m_id);
     layerElt.setAttribute("name", m_name);
@@ -137,8 +249,48 @@ bool Layer::save(QDomDocument &doc, QDomElement &root, const QString &path) cons
     layerElt.setAttribute("mask", m_hasMask);
     layerElt.setAttribute("opacity", m_opacity);
 
-    for (keyframe_iterator it = m_keyFrames.begin(); it != m_keyFrames.end(); ++it) {
-        it.value()->save(doc, layerElt, path, m_id, it.key());
+    if (!keyframes) {
+        for (keyframe_iterator it = m_keyFrames.begin(); it != m_keyFrames.end(); ++it) {
+            QDomElement keyElt = doc.createElement("vectorkeyframe");
+            keyElt.setAttribute("frame", it.key());
+            layerElt.appendChild(keyElt);
+        }
+    } else if (!k_parallelSave) {
+        for (keyframe_iterator it = m_keyFrames.begin(); it != m_keyFrames.end(); ++it) {
+            QDomElement keyElt = savePending(doc, path, it.value(), it.key());
+            if (!keyElt.isNull()) {
+                layerElt.appendChild(keyElt);
+                continue;
+            }
+            ensureLoaded(it.value(), false);
+            it.value()->save(doc, layerElt, path, m_id, it.key());
+        }
+    } else {
+        // Each loaded keyframe builds its element in its own document (QDom is reentrant) and writes its payload on the
+        // pool, the elements are then imported in order. Loading links the neighbors so it stays on this thread.
+        struct KeyElement {
+            VectorKeyFrame *keyframe;
+            int frame;
+            bool pending;
+            QDomDocument doc;
+            QDomElement element;
+        };
+        std::vector<KeyElement> keys;
+        keys.reserve(m_keyFrames.size());
+        for (keyframe_iterator it = m_keyFrames.begin(); it != m_keyFrames.end(); ++it) {
+            QDomElement keyElt = savePending(doc, path, it.value(), it.key());
+            if (keyElt.isNull()) ensureLoaded(it.value(), false);
+            keys.push_back({it.value(), it.key(), !keyElt.isNull(), QDomDocument(), keyElt});
+        }
+        QtConcurrent::blockingMap(keys, [this, &path](KeyElement &key) {
+            if (key.pending) return;
+            QDomElement root = key.doc.createElement("layer");
+            key.keyframe->save(key.doc, root, path, m_id, key.frame);
+            key.element = root.firstChildElement("vectorkeyframe");
+        });
+        for (KeyElement &key : keys) {
+            layerElt.appendChild(key.pending ? key.element : doc.importNode(key.element, true));
+        }
     }
     m_pivotCurves.save(doc, layerElt);
 
@@ -146,6 +298,43 @@ bool Layer::save(QDomDocument &doc, QDomElement &root, const QString &path) cons
     return true;
 }
 
+void Layer::payloadsMoved(const QString &dataPath) {
+    m_dataPath = dataPath;
+    for (auto it = m_keyFrames.constBegin(); it != m_keyFrames.constEnd(); ++it) {
+        auto pending = m_pendingKeyFrames.find(it.value());
+        if (pending == m_pendingKeyFrames.end() || pending.value().isNull() || !pending.value().hasAttribute("data")) continue;
+        pending.value().setAttribute("data", VectorKeyFrame::payloadFileName(m_id, it.key()));   // name given by savePending
+    }
+}
+
+/**
+ * Save a keyframe whose content was never read as it was loaded: its element is copied into doc and its payload file,
+ * if any, into the path directory. Returns a null element if the keyframe is loaded or if its payload cannot be kept
+ * (no data directory to save it in), it has to be saved normally then.
+ */
+QDomElement Layer::savePending(QDomDocument &doc, const QString &path, VectorKeyFrame *keyframe, int frame) const {
+    auto it = m_pendingKeyFrames.constFind(keyframe);
+    if (it == m_pendingKeyFrames.constEnd() || it.value().isNull()) return QDomElement();
+
+    QDomElement keyElt = doc.importNode(it.value(), true).toElement();
+    keyElt.setAttribute("frame", frame);
+    if (keyElt.hasAttribute("data")) {
+        if (path.isEmpty()) return QDomElement();
+        QString src = QDir(m_dataPath).filePath(keyElt.attribute("data"));
+        QString fileName = VectorKeyFrame::payloadFileName(m_id, frame);
+        QString dst = QDir(path).filePath(fileName);
+        if (QFileInfo(src) != QFileInfo(dst)) {
+            QFile::remove(dst);
+            if (!QFile::copy(src, dst)) {
+                qWarning() << "Saving: cannot copy the payload of keyframe " << frame << " to " << path;
+                return QDomElement();
+            }
+        }
+        keyElt.setAttribute("data", fileName);
+    }
+    return keyElt;
+}
+
 void Layer::paintLabel(QPainter &painter, int x, int y, int width, int height, bool selected) {
     painter.setBrush(QGuiApplication::palette().color(QPalette::Light));
     painter.setPen(QPen(QBrush(QGuiApplication::palette().color(QPalette::Dark)), 1, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
@@ -256,7 +445,7 @@ void Layer::paintKeys(QPainter &painter, TimeLineCells *cells, int y, bool selec
                 painter.setBrush(Qt::NoBrush);
             else{
                 QPalette::ColorRole color = QPalette::Midlight;
-                if (m_selectedKeyFrames.contains(getVectorKeyFrameAtFrame(keyFrameIndices[i])) || cells->selectionContainsVectorKeyFrame(keyFrameIndices[i]))
+                if (m_selectedKeyFrames.contains(m_keyFrames.value(keyFrameIndices[i])) || cells->selectionContainsVectorKeyFrame(keyFrameIndices[i]))
                     color = QPalette::Highlight;
                 painter.setBrush(QGuiApplication::palette().color(color));
             }
@@ -472,6 +661,7 @@ KeyFrame *Layer::getKeyFrameAt(int frame) {
     if (it == m_keyFrames.end()) {
         return nullptr;
     }
+    ensureLoaded(it.value());
     return it.value();
 }
 
@@ -481,6 +671,7 @@ KeyFrame *Layer::getLastKeyFrameAtPosition(int frame) {
     keyframe_iterator it = m_keyFrames.upperBound(frame);
     if (it == m_keyFrames.end()) it--;
     if (it != m_keyFrames.begin()) it--;
+    ensureLoaded(it.value());
     return it.value();
 }
 
@@ -565,6 +756,7 @@ int Layer::inbetweenPosition(int frame) {
 }
 
 void Layer::insertKeyFrame(int frame, VectorKeyFrame *keyframe) {
+    ensureLoadedAround(frame);
     if (m_keyFrames.contains(frame)) {
         delete m_keyFrames[frame];
     }
@@ -574,11 +766,13 @@ void Layer::insertKeyFrame(int frame, VectorKeyFrame *keyframe) {
 void Layer::removeKeyFrameWithoutDisplacement(int frame) {
     auto it = m_keyFrames.find(frame);
     if (it != m_keyFrames.end()){
+        forgetPending(m_keyFrames[frame]);
         delete m_keyFrames[frame];
     }
 }
 
 void Layer::removeKeyFrame(int frame) {
+    ensureLoadedAround(frame);
     auto it = m_keyFrames.find(frame);
     if (it != m_keyFrames.end()) {
         removeSelectedKeyFrame(m_keyFrames[frame]);
@@ -596,6 +790,7 @@ void Layer::removeKeyFrame(int frame) {
 
 void Layer::moveKeyFrame(int oldFrame, int newFrame) {
     VectorKeyFrame *keyframe = m_keyFrames[oldFrame];
+    ensureLoaded(keyframe);
     VectorKeyFrame *prev = getLastVectorKeyFrameAtFrame(m_editor->playback()->currentFrame(), 0);
     int maxKeyFrameBefore = getMaxKeyFramePosition();
     m_keyFrames.remove(oldFrame);
@@ -33,7 +33,9 @@ class Layer{
     virtual ~Layer();
 
     bool load(QDomElement& element, const QString& path);
-    bool save(QDomDocument& doc, QDomElement& root, const QString& path) const;
+    bool save(QDomDocument& doc, QDomElement& root, const QString& path, bool keyframes = true) const;
+    // The payloads saved in path by save have been moved to dataPath, the keyframes that are still not loaded read theirs there
+    void payloadsMoved(const QString& dataPath);
 
     int id() const { return m_id; }
 
@@ -85,8 +87,9 @@ class Layer{
     VectorKeyFrame* getPrevKey(int frame);
     VectorKeyFrame* getNextKey(VectorKeyFrame *keyframe);
     VectorKeyFrame* getPrevKey(VectorKeyFrame *keyframe);
-    QMap<int, VectorKeyFrame*>::const_iterator keysBegin() const { return m_keyFrames.constBegin(); }
-    QMap<int, VectorKeyFrame*>::const_iterator keysEnd() const { return m_keyFrames.constEnd(); }
+    // Iterating over the keyframes loads all of them (see ensureAllLoaded)
+    QMap<int, VectorKeyFrame*>::const_iterator keysBegin() const { ensureAllLoaded(); return m_keyFrames.constBegin(); }
+    QMap<int, VectorKeyFrame*>::const_iterator keysEnd() const { ensureAllLoaded(); return m_keyFrames.constEnd(); }
     int stride(int frame);
     int inbetweenPosition(int frame);
 
@@ -98,6 +101,9 @@ class Layer{
     void removeKeyFrame(int frame);
     void moveKeyFrame(int oldFrame, int newFrame);
 
+    void ensureAllLoaded() const;
+    int nbPendingKeys() const { return m_pendingKeyFrames.size(); }
+
     void addSelectedKeyFrame(int frame);
     void removeSelectedKeyFrame(VectorKeyFrame * keyFrame);
     void sortSelectedKeyFrames();
@@ -113,6 +119,9 @@ class Layer{
     bool isSelectionRotationExtracted();
 
     QList<int> keys() const { return m_keyFrames.keys(); }
+    // The keyframes without loading them, the content of the pending ones must not be accessed
+    const QMap<int, VectorKeyFrame*> &keyFramesNoLoad() const { return m_keyFrames; }
+    bool isPending(VectorKeyFrame *keyframe) const { return m_pendingKeyFrames.contains(keyframe); }
     Editor *editor() const { return m_editor; }
 
     Point::VectorType getPivotPosition(int frame);
@@ -136,6 +145,15 @@ class Layer{
     QColor color = Qt::black;
 
    private:
+    void ensureLoaded(VectorKeyFrame *keyframe, bool prefetchNeighbors = true) const;
+    void ensureLoadedAround(int frame) const;
+    void loadContent(VectorKeyFrame *keyframe) const;
+    void linkKeyFrame(VectorKeyFrame *keyframe) const;
+    void forgetPending(VectorKeyFrame *keyframe);
+    QDomElement savePending(QDomDocument &doc, const QString &path, VectorKeyFrame *keyframe, int frame) const;
+    void schedulePrefetch(int frame) const;
+    void prefetch() const;
+
     QMap<int, VectorKeyFrame*> m_keyFrames;
     QMap<int, VectorKeyFrame*> m_backup;
     QVector<VectorKeyFrame *> m_selectedKeyFrames;
@@ -159,6 +177,14 @@ class Layer{
     Editor* m_editor;
     CompositeBezier2D m_pivotCurves;
 
+    // Keyframes created by load whose content has not been read yet: their element is kept until they are first
+    // accessed. A null element means the content is loaded but the keyframe is not linked to its neighbors yet.
+    mutable QHash<VectorKeyFrame*, QDomElement> m_pendingKeyFrames;
+    mutable QList<VectorKeyFrame*> m_prefetchQueue;
+    mutable QTimer m_prefetchTimer;
+    mutable bool m_loading;
+    QString m_dataPath;
+
     const int m_squareSize = 6;
 };
 
@@ -15,7 +15,7 @@ void PointKDTree::make(VectorKeyFrame *key, int inbetween) {
     for (Group *group : key->postGroups()) {
         if (group->size() == 0) continue;
         for (auto it = group->strokes().constBegin(); it != group->strokes().constEnd(); ++it) {
-            const StrokePtr &stroke = inb.strokes[it.key()];
+            const StrokePtr &stroke = inb.stroke(it.key());
             for (const Interval &interval : it.value()) {
                 for (unsigned int i = interval.from(); i <= interval.to(); ++i) {
                     data.push_back(stroke->points()[i]); 
@@ -7,6 +7,7 @@
 #include "polyline.h"
 
 #include "utils/geom.h"
+#include "utils/numberreader.h"
 
 #include <QDebug>
 #include <iostream>
@@ -15,11 +16,14 @@ using namespace Eigen;
 
 namespace Frite {
 
+void PointArena::reserve(size_t n) {
+    if (!m_blocks.empty() && m_blocks.back().capacity() - m_blocks.back().size() >= n) return;
+    m_blocks.emplace_back();
+    m_blocks.back().reserve(std::max(n, MIN_BLOCK_SIZE));
+}
+
 Polyline::Polyline(const std::vector<Point *> &pts) {
-    _pts.reserve(pts.size());
-    for (const Point *p : pts) {
-        _pts.push_back(new Point(*p));
-    }
+    copyPoints(pts);
     if (_pts.size() > 1) {
         _lengths.reserve(pts.size() + 1);
         _lengths.push_back(0);
@@ -30,38 +34,52 @@ Polyline::Polyline(const std::vector<Point *> &pts) {
     }
 }
 
-Polyline::Polyline(const Polyline &polyline) {
-    _pts.reserve(polyline._pts.size());
-    for (const Point *p : polyline._pts) {
-        _pts.push_back(new Point(*p));
-    }
-    _lengths.reserve(polyline._lengths.size());
-    for (size_t i = 0; i < polyline._lengths.size(); i++) {
-        _lengths.push_back(polyline._lengths[i]);
-    }
+Polyline::Polyline(const Polyline &polyline) : _lengths(polyline._lengths) {
+    copyPoints(polyline._pts);
+}
+
+Polyline &Polyline::operator=(const Polyline &polyline) {
+    if (this == &polyline) return *this;
+    clear();
+    copyPoints(polyline._pts);
+    _lengths = polyline._lengths;
+    return *this;
 }
 
 Polyline::~Polyline() {
-    for (const Point *p : _pts) {
-        delete p;
+}
+
+// Copy the given points in a single contiguous block
+void Polyline::copyPoints(const std::vector<Point *> &pts) {
+    _storage.reserve(pts.size());
+    _pts.reserve(_pts.size() + pts.size());
+    for (const Point *p : pts) {
+        _pts.push_back(_storage.create(*p));
     }
 }
 
 void Polyline::addPoint(Point *point) {
-    _pts.push_back(point);
+    addPoint(*point);
+    delete point;
+}
+
+void Polyline::addPoint(const Point &point) {
+    _pts.push_back(_storage.create(point));
     if (_pts.size() == 1)
         _lengths.push_back(0);
     else
         _lengths.push_back(_lengths.back() + (_pts[_pts.size() - 2]->pos() - _pts[_pts.size() - 1]->pos()).norm());
 }
 
-void Polyline::load(QTextStream &posStream, size_t size) {
-    _pts.clear();
+void Polyline::load(QStringView text, size_t size) {
+    clear();
+    _storage.reserve(size);
     _pts.reserve(size);
+    NumberReader reader(text);
     for (size_t j = 0; j < size; ++j) {
         double x, y, i, p;
-        posStream >> x >> y >> i >> p;
-        _pts.push_back(new Point(x, y, i, p));
+        reader.read(x, y, i, p);
+        _pts.push_back(_storage.create(x, y, i, p));
     }
     _lengths.clear();
     _lengths.reserve(_pts.size() + 1);
@@ -69,12 +87,24 @@ void Polyline::load(QTextStream &posStream, size_t size) {
     for (size_t i = 0; i < _pts.size() - 1; ++i) _lengths.push_back(_lengths.back() + (_pts[i]->pos() - _pts[i + 1]->pos()).norm());
 }
 
-void Polyline::clear() {
-    for (const Point *p : _pts) {
-        delete p;
+void Polyline::load(const std::array<double, 4> *data, size_t size) {
+    clear();
+    _storage.reserve(size);
+    _pts.reserve(size);
+    for (size_t j = 0; j < size; ++j) {
+        _pts.push_back(_storage.create(data[j][0], data[j][1], data[j][2], data[j][3]));
     }
+    _lengths.clear();
+    _lengths.reserve(_pts.size() + 1);
+    _lengths.push_back(0);
+    for (size_t i = 0; i < _pts.size() - 1; ++i) _lengths.push_back(_lengths.back() + (_pts[i]->pos() - _pts[i + 1]->pos()).norm());
+}
+
+void Polyline::clear() {
     _pts.clear();
+    _detached.clear();
     _lengths.clear();
+    _storage.clear();
 }
 
 int Polyline::paramToIdx(Point::Scalar param, Point::Scalar *outParam) const {
@@ -180,7 +210,7 @@ void Polyline::trimmed(Point::Scalar from, Point::Scalar to, Polyline &trimmedPo
     if (startIdx != endIdx || (to + tol < from))  // add points from existing polyline if necessary
     {
         for (int i = startIdx + 1; i < endIdx; i++) {
-            trimmedPoly.addPoint(new Point(*(_pts[i])));
+            trimmedPoly.addPoint(*(_pts[i]));
         }
     }
 
@@ -190,8 +220,9 @@ void Polyline::trimmed(Point::Scalar from, Point::Scalar to, Polyline &trimmedPo
 
 void Polyline::subPoly(int from, int to, Polyline &subPoly) const {
     subPoly.clear();
+    subPoly._storage.reserve(to - from + 1);
     for (int i = from; i <= to; ++i) {
-        subPoly.addPoint(new Point(*(_pts[i])));
+        subPoly.addPoint(*(_pts[i]));
         subPoly._pts.back()->setGroupId(-1);
     }
 }
@@ -200,23 +231,27 @@ bool Polyline::removeSection(std::vector<Point *> &points, std::vector<Point *>
     if (points.empty()) return false;
     int fromIdx = pointToIdx(points[0]);
     int toIdx = pointToIdx(points.back());
+    std::vector<Point *> before(_pts);
     if (toIdx == _pts.size() - 1) {
-        qDeleteAll(_pts.begin() + fromIdx, _pts.end());
         _pts.resize(fromIdx);
+        reclaimRemoved(before, {});
         return false;
     }
     if (fromIdx == 0) {
-        qDeleteAll(_pts.begin(), _pts.begin() + toIdx);
         _pts.erase(_pts.begin(), _pts.begin() + toIdx);
+        reclaimRemoved(before, {});
         return false;
     }
     std::vector<Point *>::iterator remainderIt;
+    std::vector<Point *> newRemainder;
     remainderIt = _pts.erase(_pts.begin() + fromIdx, _pts.begin() + toIdx);
     while (remainderIt != _pts.end()) {
-        remainder.push_back(*remainderIt);
+        newRemainder.push_back(*remainderIt);
         remainderIt++;
     }
     _pts.resize(fromIdx);
+    reclaimRemoved(before, newRemainder);
+    remainder.insert(remainder.end(), newRemainder.begin(), newRemainder.end());
     return true;
 }
 
@@ -226,10 +261,16 @@ bool Polyline::removeSection(std::vector<int> &points, std::vector<std::vector<P
     std::vector<std::pair<int, int>> intervals;
     std::vector<Point *>::iterator remainderIt;
     std::vector<Point *>::iterator next;
+    std::vector<Point *> before(_pts);
+    size_t firstRemainder = remainder.size();
+    auto reclaim = [&]() {
+        std::vector<Point *> newRemainder;
+        for (size_t i = firstRemainder; i < remainder.size(); ++i) newRemainder.insert(newRemainder.end(), remainder[i].begin(), remainder[i].end());
+        reclaimRemoved(before, newRemainder);
+    };
 
     if (points.size() == 1) {
         int val = points[0];
-        qDeleteAll(_pts.begin() + val, _pts.begin() + val);
         remainderIt = _pts.erase(_pts.begin() + val, _pts.begin() + val);
         if (val == 0 || val == _pts.size() - 1) return false;
         std::vector<Point *> remainderList;
@@ -239,6 +280,7 @@ bool Polyline::removeSection(std::vector<int> &points, std::vector<std::vector<P
         }
         if (!remainderList.empty()) remainder.push_back(remainderList);
         _pts.resize(val);
+        reclaim();
         return true;
     }
 
@@ -259,7 +301,6 @@ bool Polyline::removeSection(std::vector<int> &points, std::vector<std::vector<P
     for (size_t i = 0; i < intervals.size(); i++) {
         int fromIdx = intervals[i].first;
         int toIdx = intervals[i].second;
-        qDeleteAll(_pts.begin() + fromIdx, _pts.begin() + toIdx);
         if (fromIdx == 0 || toIdx == _pts.size() - 1) continue;
         res = true;
         remainderIt = ++(_pts.begin() + toIdx);
@@ -281,12 +322,30 @@ bool Polyline::removeSection(std::vector<int> &points, std::vector<std::vector<P
     } else {
         _pts.resize(intervals[0].first);
     }
+    reclaim();
     return res;
 }
 
+/**
+ * Release the points of before that are no longer in the polyline.
+ * The remainder points are handed to the caller so they are only released by the next removeSection, 
+ * which also releases the previous remainder points.
+ */
+void Polyline::reclaimRemoved(const std::vector<Point *> &before, const std::vector<Point *> &remainder) {
+    for (Point *point : _detached) _storage.release(point);
+    _detached.clear();
+    std::vector<Point *> kept(_pts), detached(remainder);
+    std::sort(kept.begin(), kept.end());
+    std::sort(detached.begin(), detached.end());
+    for (Point *point : before) {
+        if (std::binary_search(kept.begin(), kept.end(), point)) continue;
+        if (std::binary_search(detached.begin(), detached.end(), point)) _detached.push_back(point);
+        else _storage.release(point);
+    }
+}
+
 bool Polyline::removeSection(int from, int to, std::vector<Point *> &remainder) {
     for (size_t i = to+1; i < _pts.size(); i++) remainder.push_back(_pts[i]);
-    qDeleteAll(_pts.begin() + from, _pts.begin() + (to+1));
     return remainder.size() > 1;
 }
 
@@ -298,7 +357,7 @@ void Polyline::resample(Point::Scalar maxSampling, Point::Scalar minSampling, Po
     // First mark the points on the original curve we definitely want to keep (e.g., corners) using Douglas-Peucker
     std::vector<bool> keep = markDouglasPeucker(.25);
 
-    resampledPolyline.addPoint(new Point(*_pts[0]));
+    resampledPolyline.addPoint(*_pts[0]);
     Point::Scalar lengthSoFar = 0;
     for (size_t i = 1; i < _pts.size(); ++i) {
         Point *curResampled = resampledPolyline._pts[resampledPolyline.size() - 1];
@@ -323,11 +382,10 @@ void Polyline::resample(Point::Scalar maxSampling, Point::Scalar minSampling, Po
                     for (size_t j = 0; j < count - 1; ++j) {
                         double a = ((j + 1) * radius) / (dist);
                         Point::VectorType smoothInterpPos =  Geom::evalCubicHermite((j + 1) * s, 0.0, dist, curResampled->pos(), m0, curPt->pos(), m1);
-                        Point *newPoint = new Point(smoothInterpPos.x(), smoothInterpPos.y(), curPt->interval() * a + curResampled->interval() * (1.0 - a), curPt->pressure() * a + curResampled->pressure() * (1.0 - a));
-                        resampledPolyline.addPoint(newPoint);
+                        resampledPolyline.addPoint(Point(smoothInterpPos.x(), smoothInterpPos.y(), curPt->interval() * a + curResampled->interval() * (1.0 - a), curPt->pressure() * a + curResampled->pressure() * (1.0 - a)));
                     }
                 }
-                resampledPolyline.addPoint(new Point(*curPt));
+                resampledPolyline.addPoint(*curPt);
             }
         }
     }
@@ -14,13 +14,58 @@
 #include <Eigen/Geometry>
 
 #include <vector>
+#include <array>
 #include <memory>
+#include <algorithm>
 
 #include "point.h"
 
 
 namespace Frite {
 
+/**
+ * Contiguous storage of polyline samples.
+ * Points are allocated in blocks that never reallocate, so the Point* handed out by Polyline::pts() stay valid
+ * when points are added, consecutive samples share cache lines, and copying a polyline costs one allocation
+ * instead of one per point. Released points go to a free list and their slots are reused by the next creations,
+ * the blocks themselves are only freed when the arena is cleared or destroyed.
+ */
+class PointArena {
+   public:
+    PointArena() { }
+    PointArena(const PointArena &other) = delete;
+    PointArena &operator=(const PointArena &other) = delete;
+
+    // Make sure the next n points are allocated in the same block
+    void reserve(size_t n);
+    void clear() { m_blocks.clear(); m_free.clear(); m_size = 0; }
+    // The point must come from this arena and must not be used afterwards
+    void release(Point *point) { m_free.push_back(point); }
+    size_t nbFree() const { return m_free.size(); }
+
+    template <typename... Args>
+    Point *create(Args &&...args) {
+        if (!m_free.empty()) {
+            Point *point = m_free.back();
+            m_free.pop_back();
+            *point = Point(std::forward<Args>(args)...);
+            return point;
+        }
+        if (m_blocks.empty() || m_blocks.back().size() == m_blocks.back().capacity()) reserve(std::max(MIN_BLOCK_SIZE, m_size));
+        m_blocks.back().emplace_back(std::forward<Args>(args)...);
+        m_size++;
+        return &m_blocks.back().back();
+    }
+
+   private:
+    typedef std::vector<Point, Eigen::aligned_allocator<Point>> Block;
+    static constexpr size_t MIN_BLOCK_SIZE = 32;
+
+    std::vector<Block> m_blocks;
+    std::vector<Point *> m_free;
+    size_t m_size = 0;                              // number of slots in use or in the free list
+};
+
 // Must contain at least two points
 // Originally from cornucopia's implementation of polylines
 class Polyline {
@@ -28,10 +73,13 @@ class Polyline {
     Polyline() { }
     Polyline(const std::vector<Point *> &pts);
     Polyline(const Polyline &polyline);
+    Polyline &operator=(const Polyline &polyline);
     virtual ~Polyline();
 
-    void addPoint(Point *point);
-    void load(QTextStream &posStream, size_t size);
+    void addPoint(Point *point);                    // the point is copied in the polyline storage and deleted
+    void addPoint(const Point &point);
+    void load(QStringView text, size_t size);                        // "x y interval pressure" per point
+    void load(const std::array<double, 4> *data, size_t size);     // (x, y, interval, pressure) per point
     void clear();
     Point::Scalar length() const { return _lengths.back(); }
     size_t size() const { return _pts.size(); }
@@ -94,7 +142,8 @@ class Polyline {
     // Construct the sub polyline from the points indices [from, to]
     void subPoly(int from, int to, Polyline &subPoly) const;
 
-    // Points must be consecutive (interval in the _pts list)
+    // Points must be consecutive (interval in the _pts list). The removed points are reclaimed by the polyline storage, except
+    // the remainder points which stay valid until the next call to removeSection or clear
     bool removeSection(std::vector<Point *> &points, std::vector<Point *> &remainder);
     bool removeSection(std::vector<int> &points, std::vector<std::vector<Point *>> &remainder);
     bool removeSection(int from, int to, std::vector<Point *> &remainder);
@@ -122,7 +171,12 @@ class Polyline {
 
 
    private:
-    std::vector<Point *> _pts;
+    void copyPoints(const std::vector<Point *> &pts);
+    void reclaimRemoved(const std::vector<Point *> &before, const std::vector<Point *> &remainder);
+
+    PointArena _storage;
+    std::vector<Point *> _pts;                      // views on the points in _storage
+    std::vector<Point *> _detached;                 // remainder points of the last removeSection, released by the next one
 
     // lengths[x] = \sum_{i=1}^{i=x} ||pts[i]-pts[i-1]||, i.e., length up to point x
     std::vector<Point::Scalar> _lengths;
@@ -15,6 +15,7 @@
 #include "dialsandknobs.h"
 #include "qteigen.h"
 #include "utils/stopwatch.h"
+#include "utils/chunkfile.h"
 
 extern dkBool k_drawSplat;
 extern dkFloat k_penFalloffMin;
@@ -22,8 +23,6 @@ extern dkSlider k_splatSamplingRate;
 
 using namespace Frite;
 
-static const unsigned int BUFFER_STRIDE = 8;
-
 Stroke::Stroke(unsigned int id, const QColor &c, double thickness, bool _isInvisible) 
     : m_id(id),
       m_color(c), 
@@ -89,16 +88,27 @@ Point::Scalar Stroke::length(int from, int to) const {
 void Stroke::createBuffers(QOpenGLShaderProgram *program, VectorKeyFrame *keyframe) {
     if (m_bufferCreated) return;
 
-    m_vao.create();
-    m_vao.bind();
+    initBuffers(program, m_vao, m_vbo, m_ebo);
+    updateBuffer(keyframe);
 
-    m_vbo.create();
-    m_vbo.bind();
-    m_vbo.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+    m_bufferCreated = true;
+    m_bufferDestroyed = false;
+}
 
-    m_ebo.create();
-    m_ebo.bind();
-    m_ebo.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+/**
+ * Create the given GL objects and set the stroke vertex layout (position, pressure, visibility, color)
+ */
+void Stroke::initBuffers(QOpenGLShaderProgram *program, QOpenGLVertexArrayObject &vao, QOpenGLBuffer &vbo, QOpenGLBuffer &ebo) {
+    vao.create();
+    vao.bind();
+
+    vbo.create();
+    vbo.bind();
+    vbo.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+
+    ebo.create();
+    ebo.bind();
+    ebo.setUsagePattern(QOpenGLBuffer::DynamicDraw);
 
     // vtx
     program->enableAttributeArray(0); 
@@ -116,14 +126,9 @@ void Stroke::createBuffers(QOpenGLShaderProgram *program, VectorKeyFrame *keyfra
     program->enableAttributeArray(3);
     program->setAttributeBuffer(3, GL_FLOAT, 4 * sizeof(GLfloat), 4, BUFFER_STRIDE * sizeof(GLfloat));
 
-    m_vao.release();
-    m_vbo.release();
-    m_ebo.release();
-
-    updateBuffer(keyframe);
-
-    m_bufferCreated = true;
-    m_bufferDestroyed = false;
+    vao.release();
+    vbo.release();
+    ebo.release();
 }
 
 void Stroke::destroyBuffers() {
@@ -137,38 +142,51 @@ void Stroke::destroyBuffers() {
     s.stop();
 }
 
-void Stroke::updateBuffer(VectorKeyFrame *keyframe) {
-    std::vector<GLfloat> data;
-    std::vector<GLuint> dataElt;
-
-    if (!k_drawSplat) {
-        data.resize(size() * BUFFER_STRIDE);
-        dataElt.resize(size() + 2);
-        dataElt[0] = (GLuint)(0);
-        for (size_t i = 0; i < size(); ++i) {
+/**
+ * Fill the vertex data used by the line rendering mode.
+ * If positions is not null, it overrides the stroke points positions (one position per point).
+ */
+void Stroke::lineBufferData(VectorKeyFrame *keyframe, const Point::VectorType *positions, std::vector<GLfloat> &data, std::vector<GLuint> &dataElt) const {
+    data.resize(size() * BUFFER_STRIDE);
+    dataElt.resize(size() + 2);
+    dataElt[0] = (GLuint)(0);
+    for (size_t i = 0; i < size(); ++i) {
+        if (positions != nullptr) {
+            data[BUFFER_STRIDE * i] = positions[i].x();
+            data[BUFFER_STRIDE * i + 1] = positions[i].y();
+        } else {
             data[BUFFER_STRIDE * i] = m_points.pts()[i]->pos().x();
             data[BUFFER_STRIDE * i + 1] = m_points.pts()[i]->pos().y();
-            data[BUFFER_STRIDE * i + 2] = m_points.pts()[i]->pressure();
-            data[BUFFER_STRIDE * i + 3] = keyframe->visibility().contains(Utils::cantor(m_id, i)) ? keyframe->visibility().value(Utils::cantor(m_id, i)) : 0.0;
-            data[BUFFER_STRIDE * i + 4] = m_points.pts()[i]->getColor().redF();
-            data[BUFFER_STRIDE * i + 5] = m_points.pts()[i]->getColor().greenF();
-            data[BUFFER_STRIDE * i + 6] = m_points.pts()[i]->getColor().blueF();
-            data[BUFFER_STRIDE * i + 7] = m_points.pts()[i]->getColor().alphaF();
-            dataElt[i + 1] = (GLuint)i;
         }
-        dataElt[size() + 1] = (GLuint)(size() - 1);
-
-        // Apply spacing function on point visibility
-        for (Group *group : keyframe->postGroups()) {
-            if (!group->strokes().contains(m_id)) continue;
-            for (const Interval &interval : group->strokes().value(m_id)) {
-                for (unsigned int i = interval.from(); i <= interval.to(); ++i) {
-                    if (data[BUFFER_STRIDE * i + 3] >= -1.0 && keyframe->visibility().contains(Utils::cantor(m_id, i))) {
-                        data[BUFFER_STRIDE * i + 3] = Utils::sgn(keyframe->visibility()[Utils::cantor(m_id, i)]) * group->spacingAlpha(std::abs(keyframe->visibility()[Utils::cantor(m_id, i)]));
-                    }
+        data[BUFFER_STRIDE * i + 2] = m_points.pts()[i]->pressure();
+        data[BUFFER_STRIDE * i + 3] = keyframe->visibility().contains(Utils::cantor(m_id, i)) ? keyframe->visibility().value(Utils::cantor(m_id, i)) : 0.0;
+        data[BUFFER_STRIDE * i + 4] = m_points.pts()[i]->getColor().redF();
+        data[BUFFER_STRIDE * i + 5] = m_points.pts()[i]->getColor().greenF();
+        data[BUFFER_STRIDE * i + 6] = m_points.pts()[i]->getColor().blueF();
+        data[BUFFER_STRIDE * i + 7] = m_points.pts()[i]->getColor().alphaF();
+        dataElt[i + 1] = (GLuint)i;
+    }
+    dataElt[size() + 1] = (GLuint)(size() - 1);
+
+    // Apply spacing function on point visibility
+    for (Group *group : keyframe->postGroups()) {
+        if (!group->strokes().contains(m_id)) continue;
+        for (const Interval &interval : group->strokes().value(m_id)) {
+            for (unsigned int i = interval.from(); i <= interval.to(); ++i) {
+                if (data[BUFFER_STRIDE * i + 3] >= -1.0 && keyframe->visibility().contains(Utils::cantor(m_id, i))) {
+                    data[BUFFER_STRIDE * i + 3] = Utils::sgn(keyframe->visibility()[Utils::cantor(m_id, i)]) * group->spacingAlpha(std::abs(keyframe->visibility()[Utils::cantor(m_id, i)]));
                 }
             }
         }
+    }
+}
+
+void Stroke::updateBuffer(VectorKeyFrame *keyframe) {
+    std::vector<GLfloat> data;
+    std::vector<GLuint> dataElt;
+
+    if (!k_drawSplat) {
+        lineBufferData(keyframe, nullptr, data, dataElt);
     } else {
         double s = k_splatSamplingRate / 10.0;
         int maxStep = std::ceil(length() / s);
@@ -256,17 +274,33 @@ void Stroke::addPoint(Point *point) {
     m_points.addPoint(point);
 }
 
-void Stroke::load(QTextStream &posStream, size_t size) { 
-    m_points.load(posStream, size); 
+void Stroke::load(QStringView text, size_t size) {
+    m_points.load(text, size);
 }
 
-void Stroke::save(QDomDocument &doc, QDomElement strokesElt) const {
+void Stroke::load(const std::array<double, 4> *data, size_t size) {
+    m_points.load(data, size);
+}
+
+/**
+ * Save the stroke attributes in a "stroke" element. If data is not null the points are appended to its
+ * "stroke.points" array and the element only stores their offset, otherwise they are written as text.
+ */
+void Stroke::save(QDomDocument &doc, QDomElement strokesElt, ChunkWriter *data) const {
     QDomElement strokeElt = doc.createElement("stroke");
     strokeElt.setAttribute("id", uint(m_id));
     strokeElt.setAttribute("size", uint(points().size()));
     strokeElt.setAttribute("color", QString::number(m_color.rgba(), 16));
     strokeElt.setAttribute("thickness", m_strokeWidth);
     strokeElt.setAttribute("invisible", m_isInvisible);
+    if (data != nullptr) {
+        std::vector<std::array<double, 4>> values;
+        values.reserve(points().size());
+        for (const Point *p : points()) values.push_back({p->x(), p->y(), p->interval(), p->pressure()});
+        strokeElt.setAttribute("offset", qulonglong(data->append("stroke.points", values)));
+        strokesElt.appendChild(strokeElt);
+        return;
+    }
     QString string;
     QTextStream startPos(&string);
     for (const Point *p : points()) {
@@ -31,6 +31,7 @@
 
 class Point;
 class Group;
+class ChunkWriter;
 
 class Stroke {
    public:
@@ -61,14 +62,20 @@ class Stroke {
     void render(GLenum mode, QOpenGLFunctions *functions);
     void render(GLenum mode, QOpenGLFunctions *functions, const Interval &interval, bool overshoot);
     bool buffersCreated() const { return m_bufferCreated; }
+    // Line buffer vertex layout: x, y, pressure, visibility, r, g, b, a
+    static const unsigned int BUFFER_STRIDE = 8;
+    // Shared with strokes rendered from external positions (see InbetweenStroke)
+    static void initBuffers(QOpenGLShaderProgram *program, QOpenGLVertexArrayObject &vao, QOpenGLBuffer &vbo, QOpenGLBuffer &ebo);
+    void lineBufferData(VectorKeyFrame *keyframe, const Point::VectorType *positions, std::vector<GLfloat> &data, std::vector<GLuint> &dataElt) const;
 
     void addPoint(Point *point);
     void setColor(const QColor &color) { m_color = color; }
     void setPolyline(const Frite::Polyline &polyline) { m_points = polyline; m_centroidDirty = true; }
     void setCanHashId(int id) { m_canHashId = id; }
 
-    void load(QTextStream &posStream, size_t size);
-    void save(QDomDocument &doc, QDomElement strokesElt) const;
+    void load(QStringView text, size_t size);
+    void load(const std::array<double, 4> *data, size_t size);
+    void save(QDomDocument &doc, QDomElement strokesElt, ChunkWriter *data = nullptr) const;
     void draw(QPainter &painter, QPen &pen, int fromIdx, int toIdx, qreal scaleFactor = 1.0f, bool overshoot=true) const;
     void drawPolygon(QPainter &painter, QPen &pen, bool useGroupColor = false) const;
     void drawAsScribble(QPainter &painter, QPen &pen) const;
@@ -0,0 +1,44 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2024 Melvin Even <melvin.even@inria.fr>
+ *
+ * SPDX-License-Identifier: CECILL-2.1
+ */
+
+#include "strokegrid.h"
+
+#include "inbetweens.h"
+
+#include <algorithm>
+
+void StrokeGrid::insert(const InbetweenStroke &stroke) {
+    remove(stroke.id());
+    std::vector<unsigned long long> &strokeCells = m_strokeCells[stroke.id()];
+    for (size_t i = 0; i < stroke.size(); ++i) {
+        Point::VectorType pos = stroke.pos(i);
+        unsigned long long key = cellKey(cellCoord(pos.x()), cellCoord(pos.y()));
+        std::vector<Entry> &cell = m_cells[key];
+        // consecutive vertices are likely in the same cell
+        if (cell.empty() || cell.back().strokeId != stroke.id()) strokeCells.push_back(key);
+        cell.push_back({pos.cast<float>(), stroke.id(), (unsigned int)i});
+    }
+    std::sort(strokeCells.begin(), strokeCells.end());
+    strokeCells.erase(std::unique(strokeCells.begin(), strokeCells.end()), strokeCells.end());
+}
+
+void StrokeGrid::remove(unsigned int strokeId) {
+    auto it = m_strokeCells.find(strokeId);
+    if (it == m_strokeCells.end()) return;
+    for (unsigned long long key : it->second) {
+        auto cell = m_cells.find(key);
+        if (cell == m_cells.end()) continue;
+        std::vector<Entry> &entries = cell->second;
+        entries.erase(std::remove_if(entries.begin(), entries.end(), [strokeId](const Entry &entry) { return entry.strokeId == strokeId; }), entries.end());
+        if (entries.empty()) m_cells.erase(cell);
+    }
+    m_strokeCells.erase(it);
+}
+
+void StrokeGrid::clear() {
+    m_cells.clear();
+    m_strokeCells.clear();
+}
@@ -0,0 +1,92 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2024 Melvin Even <melvin.even@inria.fr>
+ *
+ * SPDX-License-Identifier: CECILL-2.1
+ */
+
+#ifndef __STROKEGRID_H__
+#define __STROKEGRID_H__
+
+#include <QRectF>
+#include <Eigen/Core>
+
+#include <cmath>
+#include <vector>
+#include <unordered_map>
+
+#include "point.h"
+
+class InbetweenStroke;
+
+/**
+ * Uniform grid over the stroke vertices of an inbetween, used by the tools to find the vertices under the cursor or
+ * inside a lasso without going through every stroke.
+ * Strokes can be inserted and removed individually so that the grid can follow the partial bakes of an inbetween
+ * (see Inbetween::spatialIndex).
+ */
+class StrokeGrid {
+public:
+    explicit StrokeGrid(double cellSize = 32.0) : m_cellSize(cellSize) { }
+
+    void insert(const InbetweenStroke &stroke);     // (re)insert all the vertices of the stroke
+    void remove(unsigned int strokeId);
+    void clear();
+
+    inline bool contains(unsigned int strokeId) const { return m_strokeCells.find(strokeId) != m_strokeCells.end(); }
+    inline size_t nbStrokes() const { return m_strokeCells.size(); }
+    inline double cellSize() const { return m_cellSize; }
+
+    // Call f(strokeId, i, pos) for every vertex i of a stroke strictly closer than radius to center
+    template<typename F>
+    void forEachPointInRadius(const Point::VectorType &center, double radius, F f) const {
+        const double radiusSq = radius * radius;
+        forEachCell(center.x() - radius, center.y() - radius, center.x() + radius, center.y() + radius, [&](const Entry &entry) {
+            Point::VectorType pos = entry.pos.cast<Point::Scalar>();
+            if ((center - pos).squaredNorm() < radiusSq) f(entry.strokeId, entry.idx, pos);
+        });
+    }
+
+    // Call f(strokeId, i, pos) for every vertex i of a stroke inside the given rectangle
+    template<typename F>
+    void forEachPointInRect(const QRectF &rect, F f) const {
+        forEachCell(rect.left(), rect.top(), rect.right(), rect.bottom(), [&](const Entry &entry) {
+            Point::VectorType pos = entry.pos.cast<Point::Scalar>();
+            if (pos.x() >= rect.left() && pos.x() <= rect.right() && pos.y() >= rect.top() && pos.y() <= rect.bottom()) f(entry.strokeId, entry.idx, pos);
+        });
+    }
+
+private:
+    struct Entry {
+        Eigen::Vector2f pos;
+        unsigned int strokeId;
+        unsigned int idx;
+    };
+
+    inline int cellCoord(double x) const { return (int)std::floor(x / m_cellSize); }
+    inline static unsigned long long cellKey(int x, int y) { return ((unsigned long long)(unsigned int)x << 32) | (unsigned int)y; }
+
+    template<typename F>
+    void forEachCell(double minX, double minY, double maxX, double maxY, F f) const {
+        int x0 = cellCoord(minX), x1 = cellCoord(maxX), y0 = cellCoord(minY), y1 = cellCoord(maxY);
+        // Large queries: go through the non-empty cells instead
+        if ((long long)(x1 - x0 + 1) * (y1 - y0 + 1) > (long long)m_cells.size()) {
+            for (const auto &cell : m_cells) {
+                for (const Entry &entry : cell.second) f(entry);
+            }
+            return;
+        }
+        for (int x = x0; x <= x1; ++x) {
+            for (int y = y0; y <= y1; ++y) {
+                auto cell = m_cells.find(cellKey(x, y));
+                if (cell == m_cells.end()) continue;
+                for (const Entry &entry : cell->second) f(entry);
+            }
+        }
+    }
+
+    double m_cellSize;
+    std::unordered_map<unsigned long long, std::vector<Entry>> m_cells;
+    std::unordered_map<unsigned int, std::vector<unsigned long long>> m_strokeCells;   // stroke id -> cells containing at least one of its vertices
+};
+
+#endif // __STROKEGRID_H__
@@ -15,6 +15,8 @@
 #include "tabletcanvas.h"
 #include "qteigen.h"
 
+#include <set>
+
 extern dkSlider k_deformRange;
 static dkBool k_eraseFromSelection("Eraser->Erase only from selected groups", false);
 
@@ -84,18 +86,13 @@ void EraserTool::erase(const EventInfo& info) {
     int layerIdx = m_editor->layers()->currentLayerIndex();
     float sizeSq = k_deformRange * k_deformRange;
     Point::VectorType pos(info.pos.x(), info.pos.y());
-    std::vector<int> strokes;
+    std::set<int> strokes;
 
     // Find all strokes intersecting the brush footprint
     const Inbetween &inbetween = info.key->inbetween(info.inbetween);
-    for (const StrokePtr &stroke : inbetween.strokes) {
-        for (Point *p : stroke->points()) {
-            if ((pos - p->pos()).norm() < k_deformRange * 0.5) {
-                strokes.push_back(stroke->id());
-                break;
-            }
-        }
-    }
+    inbetween.spatialIndex().forEachPointInRadius(pos, k_deformRange * 0.5, [&](unsigned int strokeId, unsigned int i, const Point::VectorType &) {
+        strokes.insert(strokeId);
+    });
 
     // Erase them completely
     if (strokes.size() > 0) {
@@ -164,22 +161,39 @@ void EraserTool::erase(const EventInfo& info) {
 
 void EraserTool::eraseSegments(const EventInfo& info) {
     Point::VectorType p = QE_POINT(info.pos);
-    double rangeSq = k_deformRange * k_deformRange * 0.25;
     const QMap<int, Group *> &groups = info.key->selection().selectedPostGroups().empty() ? info.key->groups(POST) : info.key->selection().selectedPostGroups();
     const Inbetween &inbetween = info.key->inbetween(info.inbetween);
     double vis = info.alpha == 0.0 ? -2.0 : -info.alpha;
     if (info.modifiers & Qt::ShiftModifier) vis = 0.0; // uneraser
+
+    // Vertices under the brush
+    QHash<int, std::vector<unsigned int>> points;
+    inbetween.spatialIndex().forEachPointInRadius(p, k_deformRange * 0.5, [&](unsigned int strokeId, unsigned int i, const Point::VectorType &) {
+        points[strokeId].push_back(i);
+    });
+    if (points.empty()) return;
+
+    // Only erase the vertices belonging to the groups
+    QSet<int> erasedStrokes;
     for (Group *group : groups) {
-        for (auto it = group->strokes(info.alpha).constBegin(); it != group->strokes(info.alpha).constEnd(); ++it) {
-            Stroke *stroke = inbetween.strokes.value(it.key()).get();
-            for (const Interval &interval : it.value()) {
-                for (unsigned int i = interval.from(); i <= interval.to(); ++i){
-                    if ((stroke->points()[i]->pos() - p).squaredNorm() < rangeSq) {
-                        info.key->visibility()[Utils::cantor(stroke->id(), i)] = vis;
+        const StrokeIntervals &strokeIntervals = group->strokes(info.alpha);
+        for (auto it = points.constBegin(); it != points.constEnd(); ++it) {
+            auto intervals = strokeIntervals.constFind(it.key());
+            if (intervals == strokeIntervals.constEnd()) continue;
+            for (unsigned int i : it.value()) {
+                for (const Interval &interval : intervals.value()) {
+                    if (i >= interval.from() && i <= interval.to()) {
+                        info.key->visibility()[Utils::cantor(it.key(), i)] = vis;
+                        erasedStrokes.insert(it.key());
+                        break;
                     }
                 }
             }
         }
     }
-    info.key->makeInbetweensDirty();
+
+    // Only the erased strokes have to be re-baked
+    for (int id : erasedStrokes) {
+        info.key->makeStrokeInbetweensDirty(id);
+    }
 }
\ No newline at end of file
@@ -113,14 +113,8 @@ void LassoTool::makeSelection(const EventInfo& info, GroupType type, VectorKeyFr
     // Complete stroke selection
     if (k_strokeMode) {
         // select strokes that have at least one point in the lasso
-        m_editor->selection()->selectStrokes(info.key, 0, [&](const StrokePtr &stroke) {
-            if (info.key->preGroups().containsStroke(stroke->id())) return false;
-            for (int i = 0; i < stroke->size(); ++i) {
-                if (m_lasso.containsPoint(QPointF(stroke->points()[i]->pos().x(),stroke->points()[i]->pos().y()), Qt::OddEvenFill)) {
-                    return true;
-                }
-            }
-            return false;
+        m_editor->selection()->selectStrokes(info.key, 0, m_lasso, [&](unsigned int strokeId) {
+            return !info.key->preGroups().containsStroke(strokeId);
         }, selection);
 
         // remove segments not in the previous KF's selected group lattice 
@@ -259,11 +259,11 @@ void LocalMaskTool::paint(const EventInfo& info) {
     const Inbetween &inbetween = info.key->inbetween(info.inbetween);
     for (Group *group : groups) {
         for (auto it = group->strokes(info.alpha).constBegin(); it != group->strokes(info.alpha).constEnd(); ++it) {
-            Stroke *stroke = inbetween.strokes.value(it.key()).get();
+            const InbetweenStroke &stroke = inbetween.strokes.constFind(it.key()).value();
             for (const Interval &interval : it.value()) {
                 for (unsigned int i = interval.from(); i <= interval.to(); ++i){
-                    if ((stroke->points()[i]->pos() - p).squaredNorm() < rangeSq) {
-                        info.key->visibility()[Utils::cantor(stroke->id(), i)] = info.key->visibility()[Utils::cantor(stroke->id(), i)] == -2.0 ? -2.0 : (info.modifiers & Qt::AltModifier ? info.alpha : std::clamp(info.key->visibility()[Utils::cantor(stroke->id(), i)] + d, -1.0, 1.0));
+                    if ((stroke.pos(i) - p).squaredNorm() < rangeSq) {
+                        info.key->visibility()[Utils::cantor(stroke.id(), i)] = info.key->visibility()[Utils::cantor(stroke.id(), i)] == -2.0 ? -2.0 : (info.modifiers & Qt::AltModifier ? info.alpha : std::clamp(info.key->visibility()[Utils::cantor(stroke.id(), i)] + d, -1.0, 1.0));
                     }
                 }
             }
@@ -64,7 +64,7 @@ void MaskPenTool::released(const EventInfo& info) {
     Group *group = info.key->selectedGroup();
     double alpha = m_editor->alpha(m_editor->playback()->currentFrame());
     if (group->lattice()->isArapPrecomputeDirty()) group->lattice()->precompute();
-    if (group->lattice()->currentPrecomputedTime() != alpha) group->lattice()->interpolateARAP(alpha, group->spacingAlpha(alpha), info.key->rigidTransform(alpha));
+    group->lattice()->copyPositions(group->lattice()->interpolateARAP(alpha, group->spacingAlpha(alpha), info.key->rigidTransform(alpha)), INTERP_POS);
     if (m_currentStroke->size() >= 2 && m_currentStroke->length() > 1e-3 && group->lattice()->intersects(m_currentStroke.get(), 0, m_currentStroke->size() - 1, INTERP_POS)) { // TODO adaptative constant based on current view?
         m_editor->addStroke(m_currentStroke);
     }
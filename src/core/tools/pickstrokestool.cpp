@@ -105,26 +105,13 @@ void PickStrokesTool::released(const EventInfo& info) {
         }
     } else {
         if ((k_onionDirection.index() == 0 || k_onionDirection.index() == 2) && next->keyframeNumber() != lay->getMaxKeyFramePosition()) {
-            m_editor->selection()->selectStrokes(next, 0, [&](const StrokePtr &stroke) {
-                if (next->preGroups().containsStroke(stroke->id())) return false;
-                for (int i = 0; i < stroke->size(); ++i) {
-                    if (m_lasso.containsPoint(QPointF(stroke->points()[i]->pos().x(),stroke->points()[i]->pos().y()), Qt::OddEvenFill)) {
-                        qDebug() << "stroke " << stroke->id();
-                        return true;
-                    }
-                }
-                return false;
+            m_editor->selection()->selectStrokes(next, 0, m_lasso, [&](unsigned int strokeId) {
+                return !next->preGroups().containsStroke(strokeId);
             }, selectionForward);
         }
         if ((k_onionDirection.index() == 1 || k_onionDirection.index() == 2) && prev != info.key) {
-            m_editor->selection()->selectStrokes(prev, 0, [&](const StrokePtr &stroke) {
-                if (prev->preGroups().containsStroke(stroke->id())) return false;
-                for (int i = 0; i < stroke->size(); ++i) {
-                    if (m_lasso.containsPoint(QPointF(stroke->points()[i]->pos().x(),stroke->points()[i]->pos().y()), Qt::OddEvenFill)) {
-                        return true;
-                    }
-                }
-                return false;
+            m_editor->selection()->selectStrokes(prev, 0, m_lasso, [&](unsigned int strokeId) {
+                return !prev->preGroups().containsStroke(strokeId);
             }, selectionBackward);
         }
     }
@@ -141,10 +141,11 @@ void PickTool::released(const EventInfo& info) {
                     auto checkGroup = [&](Group *group) {
                         const Inbetween &inb = key->inbetween(info.inbetween);
                         for (auto intervals = group->strokes().constBegin(); intervals != group->strokes().constEnd(); ++intervals) {
-                            Stroke *stroke = inb.strokes.value(intervals.key()).get();
+                            const InbetweenStroke &stroke = inb.strokes.constFind(intervals.key()).value();
                             for (const Interval &interval : intervals.value()) {
                                 for (int i = interval.from(); i <= interval.to(); ++i) {
-                                    if (m_lasso.containsPoint(QPointF(stroke->points()[i]->pos().x(),stroke->points()[i]->pos().y()), Qt::OddEvenFill)) {
+                                    Point::VectorType pos = stroke.pos(i);
+                                    if (m_lasso.containsPoint(QPointF(pos.x(), pos.y()), Qt::OddEvenFill)) {
                                         return true;
                                     }
                                 }
@@ -226,14 +227,8 @@ void PickTool::released(const EventInfo& info) {
             }
         } else if (k_selectionModeTarget.index() == 1) {
             // select all strokes intersecting the lasso
-            m_editor->selection()->selectStrokes(key, 0, [&](const StrokePtr &stroke) {
-                if (key->preGroups().containsStroke(stroke->id())) return false;
-                for (int i = 0; i < stroke->size(); ++i) {
-                    if (m_lasso.containsPoint(QPointF(stroke->points()[i]->pos().x(),stroke->points()[i]->pos().y()), Qt::OddEvenFill)) {
-                        return true;
-                    }
-                }
-                return false;
+            m_editor->selection()->selectStrokes(key, 0, m_lasso, [&](unsigned int strokeId) {
+                return !key->preGroups().containsStroke(strokeId);
             }, selection);
         } else {
             // select all stroke *segments* intersecting the lasso
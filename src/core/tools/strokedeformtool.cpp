@@ -124,10 +124,7 @@ void StrokeDeformTool::drawUI(QPainter &painter, VectorKeyFrame *key) {
         }
 
         if (k_drawTargetGrid) {
-            float spacing = group->spacingAlpha(1.0);
             int stride = key->parentLayer()->stride(key->parentLayer()->getVectorKeyFramePosition(key));
-            if (group->lattice()->currentPrecomputedTime() != spacing || group->lattice()->isArapInterpDirty()) 
-                group->lattice()->interpolateARAP(1.0, 1.0, group->globalRigidTransform(1.0));
             m_editor->updateInbetweens(key, stride, stride);
             group->drawGrid(painter, 0, TARGET_POS);
         }
@@ -469,8 +469,7 @@ void TrajectoryTool::moveLatticesTargetConfiguration() {
     for (const std::shared_ptr<Trajectory> &traj : m_trajectories) {
         group = traj->group();
         group->lattice()->precompute();
-        group->lattice()->interpolateARAP(1.0, 1.0, group->globalRigidTransform(1.0f));
-        group->lattice()->copyPositions(group->lattice(), INTERP_POS, TARGET_POS);
+        group->lattice()->copyPositions(group->lattice()->interpolateARAP(1.0, 1.0, group->globalRigidTransform(1.0f)), TARGET_POS);
         group->setGridDirty();
         group->syncTargetPosition(next);
     }
@@ -74,14 +74,21 @@ void Trajectory::sampleTrajectory() {
     std::vector<Point::Scalar> u;
     qreal alpha;
 
-    if (m_grid->isArapPrecomputeDirty()) m_grid->precompute();
+    // all the samples (cubic fit and animation curve) are read from the corners trajectories of the lattice
+    std::vector<qreal> alphasLinear;
+    for (int i = 0; i < 12; ++i) {
+        alphasLinear.push_back((float) i / 11.0f);
+    }
+    for (int i = 1; i < k_trajectoryMinRes; ++i) {
+        alphasLinear.push_back((float) i / (float) k_trajectoryMinRes);
+    }
+    m_grid->cornersTrajectories(m_group);
+    std::vector<InterpolatedFrame> frames;
+    m_grid->interpolateCached(alphasLinear, {}, frames, false);
 
     for (int i = 0; i < 12; ++i) {
-        alpha = (float) i / 11.0f;
-        float remappedAlpha = m_group->spacingAlpha(alpha);
-        m_grid->interpolateARAP(alpha, remappedAlpha, m_group->globalRigidTransform(alpha), false);
-        u.push_back(remappedAlpha);
-        data.push_back(m_grid->getWarpedPoint(Point::VectorType::Zero(), m_latticeCoord.quadKey, m_latticeCoord.uv, INTERP_POS));
+        u.push_back(m_group->spacingAlpha(alphasLinear[i]));
+        data.push_back(m_grid->getWarpedPoint(frames[i], m_latticeCoord.quadKey, m_latticeCoord.uv));
     }
     m_cubicApprox.fitWithParam(data, u);
     m_fitArap = true;
@@ -98,12 +105,9 @@ void Trajectory::sampleTrajectory() {
     m_curve->addKey("Trajectory", 1.0f);
     m_curve->curve(0)->smoothTangents();
     m_curve->curve(1)->smoothTangents();
-    float remappedAlpha;
     for (int i = 1; i < k_trajectoryMinRes; ++i) {
         alpha = (float) i / (float) k_trajectoryMinRes;
-        remappedAlpha = m_group->spacingAlpha(alpha);
-        m_grid->interpolateARAP(alpha, remappedAlpha, m_group->globalRigidTransform(alpha), false);
-        m_curve->set(m_grid->getWarpedPoint(Point::VectorType::Zero(), m_latticeCoord.quadKey, m_latticeCoord.uv, INTERP_POS));
+        m_curve->set(m_grid->getWarpedPoint(frames[11 + i], m_latticeCoord.quadKey, m_latticeCoord.uv));
         m_curve->addKey("Trajectory", alpha);
     }
     m_curve->curve(0)->smoothTangents();
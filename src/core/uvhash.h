@@ -11,6 +11,8 @@
 #include <QTransform>
 #include <QHash>
 
+#include <vector>
+
 #include "point.h"
 #include "utils/utils.h"
 
@@ -19,23 +21,75 @@ struct UVInfo {
     Point::VectorType uv;
 };
 
-// Maps a unique point index to a UVInfo struct
-// The unique point index is computed from its stroke id and position inside the stroke with the cantor pairing function
-// TODO: bake the id in the point?
-class UVHash : public QHash<unsigned int, UVInfo> {
+// Maps a point (stroke id, index of the point in the stroke) to a UVInfo struct
+// The UVs of a stroke are stored in a dense array indexed by the point index, so hot loops can look up the stroke
+// once per interval (see stroke()) instead of hashing every vertex.
+class UVHash {
 public:
-    inline virtual bool has(unsigned int strokeIdx, unsigned int i) const {
-        return contains(Utils::cantor(strokeIdx, i));
+    // UVs of a single stroke
+    class StrokeUVs {
+    public:
+        inline bool has(unsigned int i) const { return i < m_valid.size() && m_valid[i]; }
+        inline UVInfo get(unsigned int i) const { return has(i) ? m_uvs[i] : UVInfo(); }
+        inline unsigned int size() const { return m_uvs.size(); }
+
+    private:
+        friend class UVHash;
+        std::vector<UVInfo> m_uvs;
+        std::vector<bool> m_valid;
+    };
+
+    inline bool has(unsigned int strokeIdx, unsigned int i) const {
+        auto it = m_strokes.constFind(strokeIdx);
+        return it != m_strokes.constEnd() && it.value().has(i);
     }
 
-    inline virtual QHash::iterator add(unsigned int strokeIdx, unsigned int i, const UVInfo &uv) {
-        return insert(Utils::cantor(strokeIdx, i), uv);
+    inline void add(unsigned int strokeIdx, unsigned int i, const UVInfo &uv) {
+        StrokeUVs &strokeUVs = m_strokes[strokeIdx];
+        if (i >= strokeUVs.m_uvs.size()) {
+            strokeUVs.m_uvs.resize(i + 1);
+            strokeUVs.m_valid.resize(i + 1, false);
+        }
+        if (!strokeUVs.m_valid[i]) m_size++;
+        strokeUVs.m_uvs[i] = uv;
+        strokeUVs.m_valid[i] = true;
     }
 
-    inline virtual UVInfo get(unsigned int strokeIdx, unsigned int i) const {
-        return value(Utils::cantor(strokeIdx, i));
+    inline UVInfo get(unsigned int strokeIdx, unsigned int i) const {
+        auto it = m_strokes.constFind(strokeIdx);
+        return it != m_strokes.constEnd() ? it.value().get(i) : UVInfo();
     }
+
+    // UVs of the given stroke (empty if the stroke has no UV)
+    inline const StrokeUVs &stroke(unsigned int strokeIdx) const {
+        static const StrokeUVs empty;
+        auto it = m_strokes.constFind(strokeIdx);
+        return it != m_strokes.constEnd() ? it.value() : empty;
+    }
+
+    // Number of points with a UV
+    inline int size() const { return m_size; }
+    inline bool empty() const { return m_size == 0; }
+
+    inline void clear() {
+        m_strokes.clear();
+        m_size = 0;
+    }
+
+    // Call f(strokeIdx, i, uv) for every point with a UV
+    template<typename F>
+    void forEach(F f) const {
+        for (auto it = m_strokes.constBegin(); it != m_strokes.constEnd(); ++it) {
+            const StrokeUVs &strokeUVs = it.value();
+            for (unsigned int i = 0; i < strokeUVs.size(); ++i) {
+                if (strokeUVs.m_valid[i]) f(it.key(), i, strokeUVs.m_uvs[i]);
+            }
+        }
+    }
+
 private:
+    QHash<unsigned int, StrokeUVs> m_strokes;   // stroke id -> UVs
+    int m_size = 0;
 };
 
-#endif // __UVHASH_H__
\ No newline at end of file
+#endif // __UVHASH_H__
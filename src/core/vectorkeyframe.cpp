@@ -23,11 +23,16 @@
 #include "selectionmanager.h"
 #include "layermanager.h"
 #include "tabletcanvas.h"
+#include "GL/StrokeRasterizer.h"
 #include "utils/utils.h"
 #include "utils/stopwatch.h"
+#include "utils/chunkfile.h"
+#include "utils/numberreader.h"
 #include "qteigen.h"
 
 #include <QtGui>
+#include <QtConcurrent>
+#include <algorithm>
 #include <limits>
 #include <iostream>
 #include <unordered_map>
@@ -44,6 +49,7 @@ static dkBool k_showPivot("RigidDeform->Show pivot", false);
 
 dkBool k_useInterpolation("Options->Drawing->Show Interpolation", true);
 dkBool k_useCrossFade("Options->Drawing->Show Cross Fade", true);
+static dkBool k_parallelInbetweens("Options->Inbetweens->Parallel baking", true);
 
 extern dkBool k_drawSplat;
 extern dkBool k_displayMask;
@@ -57,6 +63,7 @@ VectorKeyFrame::VectorKeyFrame(Layer *layer)
     : m_layer(layer),
       m_currentGroupHue(0.0f),
       m_maxStrokeIdx(0),
+      m_animationVersion(0),
       m_orderPartials(this, OrderPartial(this, 0.0, GroupOrder(this))),
       m_preGroups(PRE, this),
       m_postGroups(POST, this),
@@ -190,7 +197,7 @@ void VectorKeyFrame::removeStroke(unsigned int id, bool free) {
         qCritical() << "Error! Cannot remove remove stroke : idx" << id << " not in the hash!";
         return;
     }
-    if (QOpenGLContext::currentContext() != m_layer->editor()->tabletCanvas()->context()) m_layer->editor()->tabletCanvas()->makeCurrent();
+    makeCanvasCurrent();
     m_strokes.value(id)->destroyBuffers();
     // TODO: to avoid iterating through all groups, or all stroke points, strokes could store the list of groups it belongs to (might be hard to keep up) 
     for (auto it = m_postGroups.begin(); it != m_postGroups.end(); ++it) (*it)->clearStrokes(id);
@@ -206,6 +213,12 @@ Stroke *VectorKeyFrame::stroke(unsigned int id) const {
     return m_strokes.value(id).get();
 }
 
+// The GL buffers belong to the context of the canvas, there is none when rendering without a canvas
+void VectorKeyFrame::makeCanvasCurrent() const {
+    TabletCanvas *canvas = m_layer->editor()->tabletCanvas();
+    if (canvas != nullptr && canvas->context() != nullptr && QOpenGLContext::currentContext() != canvas->context()) canvas->makeCurrent();
+}
+
 void VectorKeyFrame::updateBuffers() {
     for (const StrokePtr &stroke : m_strokes) {
         stroke->updateBuffer(this);
@@ -214,7 +227,7 @@ void VectorKeyFrame::updateBuffers() {
 }
 
 void VectorKeyFrame::destroyBuffers() {
-    if (QOpenGLContext::currentContext() != m_layer->editor()->tabletCanvas()->context()) m_layer->editor()->tabletCanvas()->makeCurrent();
+    makeCanvasCurrent();
     for (const StrokePtr &stroke : m_strokes) {
         stroke->destroyBuffers();
     }
@@ -223,6 +236,30 @@ void VectorKeyFrame::destroyBuffers() {
     }
 }
 
+// Per group state shared by all the inbetweens computed in one pass
+struct InbetweenGroupJob {
+    Group *group;
+    Group *next;                                                // next pre group if the backward strokes are warped, nullptr otherwise
+    std::vector<qreal> spacings;                                // spacing alpha for each inbetween
+    std::vector<Point::Affine> transforms;                      // global transform for each inbetween
+    std::vector<bool> forward;                                  // does the group have strokes at each inbetween
+    std::vector<InterpolatedFrame> frames;                      // interpolated lattice corners for each inbetween
+    bool cached;                                                // read the frames from the lattice corners trajectories
+};
+
+// Warp of the strokes of one group for one inbetween
+struct InbetweenGroupTask {
+    const InbetweenGroupJob *job;
+    size_t idx;                                                 // inbetween index in the current pass
+    qreal alpha;
+    QHash<int, InbetweenStroke *> forwardStrokes;               // inbetween strokes of the group (stroke id -> stroke)
+    std::vector<InbetweenStroke *> backwardStrokes;             // inbetween strokes of the next group
+    QRectF aabb;
+    Point::VectorType centerOfMass;
+    bool fullyVisible;
+    unsigned int nbVertices;
+};
+
 /**
  * Fill the given inbetween structure based in the given interpolating alpha value.
  * An inbetween frame is made of 2 sets of strokes:
@@ -232,103 +269,256 @@ void VectorKeyFrame::destroyBuffers() {
  * Note that strokes opacity or thickness is not yet interpolated at this point, instead this is done during the rendering of the inbetween.
 */
 void VectorKeyFrame::computeInbetween(qreal alpha, Inbetween &inbetween) const {
-    Point::Affine rigidTrans = rigidTransform(alpha);
-    inbetween.nbVertices = 0;
+    computeInbetweens({alpha}, {&inbetween});
+}
 
-    // Copy forward strokes
-    for (const StrokePtr &stroke : m_strokes) {
-        inbetween.strokes.insert(stroke->id(), std::make_shared<Stroke>(*stroke));
+/**
+ * Compute several inbetweens at once (see computeInbetween).
+ * Everything that updates shared state (animation curves, lattice factorization, backward UVs, stroke copies) is done 
+ * on the calling thread. The ARAP interpolation of each group (one batched solve for all alphas) and the warp of each 
+ * (inbetween, group) pair are then dispatched on the global thread pool.
+ * No GL resource is created here, buffers are lazily created on the GL thread when the inbetween is drawn.
+ * If dirtyGroups is not empty, the inbetweens must already be baked and only the given post groups are re-baked 
+ * in each inbetween (see updateInbetweens). The buffers of the re-baked strokes are released with Inbetween::retire, 
+ * so no GL context is needed either way.
+ */
+void VectorKeyFrame::computeInbetweens(const std::vector<qreal> &alphas, const std::vector<Inbetween *> &inbetweens, const std::vector<QSet<int>> &dirtyGroups) const {
+    StopWatch sw("Compute inbetweens");
+    size_t nbInbetweens = alphas.size();
+    bool partial = !dirtyGroups.empty();
+    auto isDirty = [&](size_t i, const Group *group) { return !partial || dirtyGroups[i].contains(group->id()); };
+
+    // Shared state
+    std::vector<Point::Affine> rigidTransforms(nbInbetweens);
+    for (size_t i = 0; i < nbInbetweens; ++i) rigidTransforms[i] = rigidTransform(alphas[i]);
+
+    std::vector<InbetweenGroupJob> jobs;
+    jobs.reserve(m_postGroups.size());
+    for (Group *group : m_postGroups) {
+        if (group->lattice() == nullptr) continue;
+        if (partial && std::none_of(dirtyGroups.begin(), dirtyGroups.end(), [group](const QSet<int> &groups) { return groups.contains(group->id()); })) continue;
+        InbetweenGroupJob job;
+        job.group = group;
+        job.next = nullptr;
+        if (m_correspondences.contains(group->id())) {
+            Group *next = group->nextPreGroup();
+            if (next->nextPostGroup() != nullptr && !next->nextPostGroup()->breakdown()) job.next = next;
+        }
+        for (size_t i = 0; i < nbInbetweens; ++i) {
+            bool forward = group->size(alphas[i]) > 0;
+            job.forward.push_back(forward);
+            job.spacings.push_back(group->spacingAlpha(alphas[i]));
+            job.transforms.push_back(forward ? rigidTransforms[i] : group->globalRigidTransform(alphas[i]));
+        }
+        if (job.next == nullptr && std::find(job.forward.begin(), job.forward.end(), true) == job.forward.end()) continue;
+
+        // the corners trajectories already hold the exact solve of every inbetween (if they are still valid)
+        const CornersTrajectories *trajectories = group->lattice()->validCornersTrajectories(group);
+        job.cached = trajectories != nullptr && std::all_of(alphas.begin(), alphas.end(), [trajectories](qreal alpha) { return trajectories->sampleIdx(alpha) >= 0; });
+
+        // bake only the portion of the backward strokes inside a pre group
+        if (job.next != nullptr && group->lattice()->backwardUVDirty()) {
+            Point::Affine backwardTransform = group->globalRigidTransform(alphas[0]).inverse();
+            for (auto it = job.next->strokes().begin(); it != job.next->strokes().end(); ++it) {
+                Stroke *stroke = job.next->stroke(it.key());
+                for (auto itIntervals = it.value().begin(); itIntervals != it.value().end(); ++itIntervals) {
+                    group->lattice()->bakeBackwardUV(stroke, (*itIntervals), backwardTransform, group->backwardUVs());
+                }
+            }
+            group->lattice()->setBackwardUVDirty(false);
+        }
+        jobs.push_back(std::move(job));
     }
 
-    // Compute the interpolated deformation of each group and use it to warp forward and backward strokes
-    for (Group *group : m_postGroups) {
-        if (group->size(alpha) > 0) {
-            qreal spacing = group->spacingAlpha(alpha);
-            if (group->lattice() == nullptr) return;
-            // Interpolate the lattice if this is not done
-            if (group->lattice()->isArapPrecomputeDirty()) {
-                group->lattice()->precompute();
+    // Interpolate the lattices
+    auto interpolateGroup = [&alphas](InbetweenGroupJob &job) {
+        Lattice *lattice = job.group->lattice();
+        if (job.cached) {
+            lattice->interpolateCached(alphas, job.transforms, job.frames);
+            return;
+        }
+        if (lattice->isArapPrecomputeDirty()) lattice->precompute();
+        lattice->interpolateARAP(alphas, job.spacings, job.transforms, job.frames);
+    };
+    if (k_parallelInbetweens) QtConcurrent::blockingMap(jobs, interpolateGroup);
+    else std::for_each(jobs.begin(), jobs.end(), interpolateGroup);
+
+    // Create the forward and backward strokes (positions only, the attributes are shared with the keyframes strokes)
+    const QHash<int, StrokePtr> *nextKeyStrokes = nullptr;
+    for (const InbetweenGroupJob &job : jobs) {
+        if (job.next != nullptr) nextKeyStrokes = &job.next->getParentKeyframe()->strokes();
+    }
+    std::vector<InbetweenGroupTask> tasks;
+    tasks.reserve(nbInbetweens * jobs.size());
+    for (size_t i = 0; i < nbInbetweens; ++i) {
+        Inbetween &inbetween = *inbetweens[i];
+        if (!partial) {
+            inbetween.nbVertices = 0;
+            inbetween.grid.reset();
+            for (const StrokePtr &stroke : m_strokes) {
+                inbetween.strokes.insert(stroke->id(), InbetweenStroke(stroke));
+            }
+        } else {
+            // forget the previous bake of the dirty groups, the strokes themselves are kept and warped again below
+            for (int groupId : dirtyGroups[i]) {
+                inbetween.nbVertices -= inbetween.groupNbVertices.value(groupId, 0);
+                inbetween.groupNbVertices.remove(groupId);
+                inbetween.aabbs.remove(groupId);
+                inbetween.centerOfMass.remove(groupId);
+                inbetween.fullyVisible.remove(groupId);
+                inbetween.corners.remove(groupId);
+            }
+            for (const InbetweenGroupJob &job : jobs) {
+                if (!isDirty(i, job.group) || !job.forward[i]) continue;
+                const StrokeIntervals &strokeIntervals = job.group->strokes(alphas[i]);
+                for (auto it = strokeIntervals.constBegin(); it != strokeIntervals.constEnd(); ++it) {
+                    auto strokeIt = inbetween.strokes.find(it.key());
+                    if (strokeIt != inbetween.strokes.end()) inbetween.invalidate(strokeIt.value());
+                    else inbetween.strokes.insert(it.key(), InbetweenStroke(m_strokes.value(it.key())));
+                }
             }
-            if (group->lattice()->isArapInterpDirty() || spacing != group->lattice()->currentPrecomputedTime()) {
-                group->lattice()->interpolateARAP(alpha, spacing, rigidTransform(alpha));
+        }
+        // forget the backward strokes removed from or replaced in the next keyframe (e.g. undoing a stroke in a pre group)
+        if (nextKeyStrokes != nullptr) {
+            for (auto it = inbetween.backwardStrokes.begin(); it != inbetween.backwardStrokes.end();) {
+                auto nextIt = nextKeyStrokes->constFind(it.key());
+                if (nextIt != nextKeyStrokes->constEnd() && nextIt.value() == it.value().source()) {
+                    ++it;
+                    continue;
+                }
+                inbetween.retire(it.value());
+                it = inbetween.backwardStrokes.erase(it);
+            }
+        }
+        for (const InbetweenGroupJob &job : jobs) {
+            if (job.next == nullptr || !isDirty(i, job.group)) continue;
+            const QHash<int, StrokePtr> &nextStrokes = job.next->getParentKeyframe()->strokes();
+            for (auto it = job.next->strokes().constBegin(); it != job.next->strokes().constEnd(); ++it) {
+                const StrokePtr &nextStroke = nextStrokes.value(it.key());
+                auto backwardIt = inbetween.backwardStrokes.find(it.key());
+                if (backwardIt != inbetween.backwardStrokes.end() && backwardIt.value().source() == nextStroke && backwardIt.value().size() == nextStroke->size()) {
+                    inbetween.invalidate(backwardIt.value());
+                    continue;
+                }
+                if (backwardIt != inbetween.backwardStrokes.end()) inbetween.retire(backwardIt.value());
+                inbetween.backwardStrokes.insert(it.key(), InbetweenStroke(nextStroke));
+            }
+        }
+        // the hashes are not modified anymore, pointers to their values stay valid (hence find instead of operator[])
+        for (const InbetweenGroupJob &job : jobs) {
+            if (!isDirty(i, job.group)) continue;
+            InbetweenGroupTask task;
+            task.job = &job;
+            task.idx = i;
+            task.alpha = alphas[i];
+            task.fullyVisible = false;
+            task.nbVertices = 0;
+            bool complete = true;
+            if (job.forward[i]) {
+                const StrokeIntervals &strokeIntervals = job.group->strokes(alphas[i]);
+                for (auto it = strokeIntervals.constBegin(); it != strokeIntervals.constEnd() && complete; ++it) {
+                    auto strokeIt = inbetween.strokes.find(it.key());
+                    complete = strokeIt != inbetween.strokes.end();
+                    if (complete) task.forwardStrokes.insert(it.key(), &strokeIt.value());
+                }
             }
-            // Use the interpolated lattice to compute the interpolated forward strokes
+            if (job.next != nullptr) {
+                for (auto it = job.next->strokes().constBegin(); it != job.next->strokes().constEnd() && complete; ++it) {
+                    auto strokeIt = inbetween.backwardStrokes.find(it.key());
+                    complete = strokeIt != inbetween.backwardStrokes.end();
+                    if (complete) task.backwardStrokes.push_back(&strokeIt.value());
+                }
+            }
+            if (!complete) {
+                qCritical() << "Error in computeInbetweens: missing inbetween stroke in group " << job.group->id();
+                continue;
+            }
+            tasks.push_back(std::move(task));
+        }
+    }
+
+    // Warp strokes
+    auto warpGroup = [this](InbetweenGroupTask &task) {
+        const InbetweenGroupJob &job = *task.job;
+        const Group *group = job.group;
+        const Lattice *lattice = group->lattice();
+        const InterpolatedFrame &frame = job.frames[task.idx];
+
+        // Use the interpolated lattice to compute the interpolated forward strokes
+        if (job.forward[task.idx]) {
+            const StrokeIntervals &strokeIntervals = group->strokes(task.alpha);
             Point::VectorType strokesCenterOfMass = Point::VectorType::Zero();
-            // qDebug() << "group->uvs().size(): " << group->uvs().size();
-            // qDebug() << "group->strokes(alpha).cbegin().key(): " << group->strokes(alpha).cbegin().key();
-            // qDebug() << "group->strokes(alpha).cbegin().value().at(0).from(): " << group->strokes(alpha).cbegin().value().at(0).from();
-            // qDebug() << "has: " << group->uvs().has(group->strokes(alpha).cbegin().key(), group->strokes(alpha).cbegin().value().at(0).from());
-            UVInfo fuv = group->uvs().get(group->strokes(alpha).cbegin().key(), group->strokes(alpha).cbegin().value().at(0).from());
-            Point::VectorType topLeft = group->lattice()->getWarpedPoint(inbetween.strokes[group->strokes(alpha).cbegin().key()]->points()[group->strokes(alpha).cbegin().value().at(0).from()]->pos(), fuv.quadKey, fuv.uv, INTERP_POS), bottomRight = topLeft;
+            unsigned int firstStrokeId = strokeIntervals.constBegin().key();
+            unsigned int firstPointIdx = strokeIntervals.constBegin().value().at(0).from();
+            UVInfo fuv = group->uvs().get(firstStrokeId, firstPointIdx);
+            Point::VectorType topLeft = lattice->getWarpedPoint(frame, fuv.quadKey, fuv.uv), bottomRight = topLeft;
             int nbPoints = 0;
             bool groupVisible = false;
             GLfloat visibility; // convert to GLfloat so that the comparison is the same as the one in the shaders
-            GLfloat spacingFloat = (GLfloat)spacing;
-            for (auto it = group->strokes(alpha).begin(); it != group->strokes(alpha).end(); ++it) {
-                const StrokePtr &stroke = inbetween.strokes[it.key()]; 
-                const Intervals &intervals = group->strokes(alpha).value(it.key());
-                for (const Interval &interval : intervals) {
+            GLfloat spacingFloat = (GLfloat)job.spacings[task.idx];
+            for (auto it = strokeIntervals.constBegin(); it != strokeIntervals.constEnd(); ++it) {
+                InbetweenStroke *stroke = task.forwardStrokes.value(it.key());
+                const UVHash::StrokeUVs &strokeUVs = group->uvs().stroke(it.key());
+                for (const Interval &interval : it.value()) {
                     for (unsigned int i = interval.from(); i <= interval.to(); i++) {
-                        UVInfo uv = group->uvs().get(it.key(), i);
-                        stroke->points()[i]->pos() = group->lattice()->getWarpedPoint(stroke->points()[i]->pos(), uv.quadKey, uv.uv, INTERP_POS);
-                        strokesCenterOfMass += stroke->points()[i]->pos();
-                        if (stroke->points()[i]->pos().x() < topLeft.x()) topLeft.x() = stroke->points()[i]->pos().x();
-                        else if (stroke->points()[i]->pos().x() > bottomRight.x()) bottomRight.x() = stroke->points()[i]->pos().x();
-                        if (stroke->points()[i]->pos().y() > topLeft.y()) topLeft.y() = stroke->points()[i]->pos().y();
-                        else if (stroke->points()[i]->pos().y() < bottomRight.y()) bottomRight.y() = stroke->points()[i]->pos().y();
+                        UVInfo uv = strokeUVs.get(i);
+                        Point::VectorType pos = lattice->getWarpedPoint(frame, uv.quadKey, uv.uv);
+                        stroke->setPos(i, pos);
+                        strokesCenterOfMass += pos;
+                        if (pos.x() < topLeft.x()) topLeft.x() = pos.x();
+                        else if (pos.x() > bottomRight.x()) bottomRight.x() = pos.x();
+                        if (pos.y() > topLeft.y()) topLeft.y() = pos.y();
+                        else if (pos.y() < bottomRight.y()) bottomRight.y() = pos.y();
                         if (!groupVisible) {
-                            visibility = m_visibility.value(Utils::cantor(stroke->id(), i), 0.0);
+                            visibility = m_visibility.value(Utils::cantor(it.key(), i), 0.0);
                             if (visibility >= -1.0 && visibility != 0.0) {
-                                visibility = Utils::sgn(visibility) * group->spacingAlpha(std::abs(visibility));
+                                visibility = Utils::sgn(visibility) * group->evalSpacingAlpha(std::abs(visibility));
                             }
                             groupVisible = groupVisible || (visibility >= -1.0 && (visibility >= 0.0 ? spacingFloat >= visibility : -(spacingFloat) > visibility));
                         }
                         nbPoints++;
-                        inbetween.nbVertices++;
                     }
                 }
             }
-            inbetween.aabbs.insert(group->id(), QRectF(EQ_POINT(topLeft), EQ_POINT(bottomRight)));
-            inbetween.centerOfMass.insert(group->id(), strokesCenterOfMass / nbPoints);
-            inbetween.fullyVisible.insert(group->id(), groupVisible);
-            // Save the lattice interpolated corners (mainly for debugging)
-            if (inbetween.corners.contains(group->id())) inbetween.corners[group->id()].clear();
-            std::vector<Point::VectorType> &cornersPoint = inbetween.corners[group->id()];
-            cornersPoint.resize(group->lattice()->corners().size());
-            int idx = 0;
-            for (Corner *corner : group->lattice()->corners()) {
-                cornersPoint[idx] = corner->coord(INTERP_POS);
-                idx++;
-            }
+            task.aabb = QRectF(EQ_POINT(topLeft), EQ_POINT(bottomRight));
+            task.centerOfMass = strokesCenterOfMass / nbPoints;
+            task.fullyVisible = groupVisible;
+            task.nbVertices = nbPoints;
         }
 
-        // If there is a corresponding next group, copy and warp backward strokes
-        if (m_correspondences.contains(group->id())) {
-            Group *next = group->nextPreGroup();
-            if (next->nextPostGroup() != nullptr && !next->nextPostGroup()->breakdown()) {
-                for (auto it = next->strokes().begin(); it != next->strokes().end(); ++it) {
-                    Stroke *stroke = next->stroke(it.key());
-                    StrokePtr newStroke = std::make_shared<Stroke>(*stroke);
-                    inbetween.backwardStrokes.insert(newStroke->id(), newStroke);
-                    for (auto itIntervals = it.value().begin(); itIntervals != it.value().end(); ++itIntervals) {
-                        qreal spacing = group->spacingAlpha(alpha);
-                        if (group->lattice() == nullptr) return;
-                        // Interpolate the lattice if this is not done
-                        if (group->lattice()->isArapPrecomputeDirty()) group->lattice()->precompute();
-                        if (group->lattice()->isArapInterpDirty() || spacing != group->lattice()->currentPrecomputedTime()) group->lattice()->interpolateARAP(alpha, spacing, group->globalRigidTransform(alpha));
-                        // bake only the portion of the stroke inside a pre group
-                        if (group->lattice()->backwardUVDirty()) group->lattice()->bakeBackwardUV(newStroke.get(), (*itIntervals), group->globalRigidTransform(alpha).inverse(), group->backwardUVs());
-                        for (int i = itIntervals->from(); i <= itIntervals->to(); ++i) {
-                            UVInfo uv = group->backwardUVs().get(newStroke->id(), i);
-                            Point::VectorType prev = newStroke->points()[i]->pos(); 
-                            newStroke->points()[i]->pos() = group->lattice()->getWarpedPoint(newStroke->points()[i]->pos(), uv.quadKey, uv.uv, INTERP_POS);
-                        }
+        // Warp the copies of the next group strokes
+        if (job.next != nullptr) {
+            const Group *next = job.next;
+            size_t strokeIdx = 0;
+            for (auto it = next->strokes().constBegin(); it != next->strokes().constEnd(); ++it, ++strokeIdx) {
+                InbetweenStroke *newStroke = task.backwardStrokes[strokeIdx];
+                const UVHash::StrokeUVs &strokeUVs = group->backwardUVs().stroke(it.key());
+                for (const Interval &interval : it.value()) {
+                    for (int i = interval.from(); i <= interval.to(); ++i) {
+                        UVInfo uv = strokeUVs.get(i);
+                        newStroke->setPos(i, lattice->getWarpedPoint(frame, uv.quadKey, uv.uv));
                     }
                 }
-                group->lattice()->setBackwardUVDirty(false);
             }
         }
-    }
+    };
+    if (k_parallelInbetweens) QtConcurrent::blockingMap(tasks, warpGroup);
+    else std::for_each(tasks.begin(), tasks.end(), warpGroup);
+
+    // Gather the per group results
+    for (const InbetweenGroupTask &task : tasks) {
+        if (!task.job->forward[task.idx]) continue;
+        Inbetween &inbetween = *inbetweens[task.idx];
+        int groupId = task.job->group->id();
+        inbetween.aabbs.insert(groupId, task.aabb);
+        inbetween.centerOfMass.insert(groupId, task.centerOfMass);
+        inbetween.fullyVisible.insert(groupId, task.fullyVisible);
+        // Save the lattice interpolated corners (mainly for debugging)
+        inbetween.corners.insert(groupId, task.job->frames[task.idx]);
+        inbetween.groupNbVertices.insert(groupId, task.nbVertices);
+        inbetween.nbVertices += task.nbVertices;
+    }
+    sw.stop();
 }
 
 /**
@@ -336,10 +526,11 @@ void VectorKeyFrame::computeInbetween(qreal alpha, Inbetween &inbetween) const {
  * Should be called in a valid OpenGL context!
 */
 void VectorKeyFrame::clearInbetweens() {
-    if (QOpenGLContext::currentContext() != m_layer->editor()->tabletCanvas()->context()) m_layer->editor()->tabletCanvas()->makeCurrent();
+    makeCanvasCurrent();
     for (Inbetween &inbetween : m_inbetweens) inbetween.destroyBuffers();
     m_inbetweens.clear(); 
     m_inbetweens.makeDirty(); 
+    ++m_animationVersion;
 }
 
 /**
@@ -369,15 +560,128 @@ void VectorKeyFrame::bakeInbetween(Editor *editor, int frame, int inbetween, int
     qreal alphaLinear = editor->alpha(frame + inbetween, m_layer);
     if (alphaLinear == 0.0f && inbetween == stride) alphaLinear = 1.0f;
 
-    m_inbetweens[inbetween].clear();
-    computeInbetween(alphaLinear, m_inbetweens[inbetween]);
+    if (m_inbetweens.isFullyDirty(inbetween)) {
+        m_inbetweens[inbetween].clear();
+        computeInbetween(alphaLinear, m_inbetweens[inbetween]);
+    } else {
+        updateInbetweens({alphaLinear}, {inbetween});
+    }
     m_inbetweens.makeClean(inbetween);
 
     qDebug() << "Baked " << inbetween << " (linear alpha = " << alphaLinear << ")";
 }
 
-void VectorKeyFrame::updateInbetween(Editor *editor, size_t i) {
-    // TODO only update strokes that have changed
+/**
+ * Bake all the dirty inbetweens between this keyframe and the next one in a single pass (see computeInbetweens).
+ */
+void VectorKeyFrame::bakeInbetweens(Editor *editor, int frame, int stride) {
+    if (stride >= m_inbetweens.size()) {
+        qCritical() << "Invalid inbetween vector size! (" << stride << " vs " << m_inbetweens.size() << ")";
+        return;
+    }
+
+    if (stride <= 0) return;
+
+    std::vector<qreal> alphas, partialAlphas;
+    std::vector<Inbetween *> inbetweens;
+    std::vector<int> indices, partialIndices;
+    for (int inbetween = 0; inbetween <= stride; ++inbetween) {
+        if (m_inbetweens.isClean(inbetween)) continue;
+        qreal alphaLinear = editor->alpha(frame + inbetween, m_layer);
+        if (alphaLinear == 0.0f && inbetween == stride) alphaLinear = 1.0f;
+        if (!m_inbetweens.isFullyDirty(inbetween)) {
+            partialAlphas.push_back(alphaLinear);
+            partialIndices.push_back(inbetween);
+            continue;
+        }
+        m_inbetweens[inbetween].clear();
+        alphas.push_back(alphaLinear);
+        inbetweens.push_back(&m_inbetweens[inbetween]);
+        indices.push_back(inbetween);
+    }
+    if (indices.empty() && partialIndices.empty()) return;
+
+    if (!indices.empty()) computeInbetweens(alphas, inbetweens);
+    if (!partialIndices.empty()) updateInbetweens(partialAlphas, partialIndices);
+    for (int inbetween : indices) m_inbetweens.makeClean(inbetween);
+    for (int inbetween : partialIndices) m_inbetweens.makeClean(inbetween);
+
+    qDebug() << "Baked " << indices.size() << " inbetweens (" << partialIndices.size() << " partially)";
+}
+
+/**
+ * Re-bake only the dirty groups and strokes of already baked inbetweens (see Inbetweens::makeGroupDirty and Inbetweens::makeStrokeDirty).
+ * Strokes added to or removed from the keyframe since the last bake are detected here, every post group warping 
+ * a recreated stroke is re-baked.
+ * Without a current GL context, the buffers of the recreated strokes are destroyed the next time the inbetween is drawn.
+ */
+void VectorKeyFrame::updateInbetweens(const std::vector<qreal> &alphas, const std::vector<int> &indices) {
+    std::vector<Inbetween *> inbetweens;
+    std::vector<QSet<int>> dirtyGroups, recreatedStrokes;
+    for (size_t i = 0; i < indices.size(); ++i) {
+        Inbetween &inbetween = m_inbetweens[indices[i]];
+        const QSet<int> &dirtyStrokes = m_inbetweens.dirtyStrokes(indices[i]);
+        QSet<int> groups = m_inbetweens.dirtyGroups(indices[i]);
+
+        // remove the strokes deleted from the keyframe
+        for (auto it = inbetween.strokes.begin(); it != inbetween.strokes.end();) {
+            if (m_strokes.contains(it.key())) {
+                ++it;
+                continue;
+            }
+            inbetween.retire(it.value());
+            if (inbetween.grid != nullptr) inbetween.grid->remove(it.key());
+            it = inbetween.strokes.erase(it);
+        }
+
+        // recreate the new, replaced and dirty strokes
+        QSet<int> newStrokes;
+        for (const StrokePtr &stroke : m_strokes) {
+            auto it = inbetween.strokes.find(stroke->id());
+            if (it != inbetween.strokes.end()) {
+                if (it.value().source() == stroke && it.value().size() == stroke->size() && !dirtyStrokes.contains(stroke->id())) continue;
+                inbetween.retire(it.value());
+            }
+            inbetween.strokes.insert(stroke->id(), InbetweenStroke(stroke));
+            newStrokes.insert(stroke->id());
+        }
+
+        // the groups warping a recreated stroke must be re-baked
+        if (!newStrokes.empty()) {
+            for (Group *group : m_postGroups) {
+                const StrokeIntervals &strokeIntervals = group->strokes(alphas[i]);
+                for (int id : newStrokes) {
+                    if (strokeIntervals.contains(id)) {
+                        groups.insert(group->id());
+                        break;
+                    }
+                }
+            }
+        }
+
+        inbetweens.push_back(&inbetween);
+        dirtyGroups.push_back(std::move(groups));
+        recreatedStrokes.push_back(std::move(newStrokes));
+    }
+
+    computeInbetweens(alphas, inbetweens, dirtyGroups);
+
+    // update the spatial index with the recreated strokes and the strokes of the re-baked groups
+    for (size_t i = 0; i < inbetweens.size(); ++i) {
+        Inbetween &inbetween = *inbetweens[i];
+        if (inbetween.grid == nullptr) continue;
+        QSet<int> &strokes = recreatedStrokes[i];
+        for (int groupId : dirtyGroups[i]) {
+            Group *group = m_postGroups.fromId(groupId);
+            if (group == nullptr) continue;
+            const StrokeIntervals &strokeIntervals = group->strokes(alphas[i]);
+            for (auto it = strokeIntervals.constBegin(); it != strokeIntervals.constEnd(); ++it) strokes.insert(it.key());
+        }
+        for (int id : strokes) {
+            auto it = inbetween.strokes.constFind(id);
+            if (it != inbetween.strokes.constEnd()) inbetween.grid->insert(it.value());
+        }
+    }
 }
 
 void VectorKeyFrame::addIntraCorrespondence(int preGroupId, int postGroupId) { 
@@ -415,13 +719,27 @@ QColor tintColor(const StrokePtr &stroke, float tintFactor, QColor color) {
                     int((stroke->color().blueF() * (100.0 - tintFactor) + color.blueF() * tintFactor) * 2.55), 255);
 };
 
+static QTransform strokeJitter(const InbetweenStroke &inbStroke, int inbetween) {
+    unsigned int jitterId = std::floor((float)inbetween/k_jitterDuration);
+    QTransform jitter;
+    if (k_useJitter && inbetween > 0 && jitterId > 0) {
+        srand(Utils::cantor(inbStroke.id(), jitterId));
+        Point::VectorType strokeCentroid = inbStroke.centroid();
+        jitter.translate(strokeCentroid.x() + static_cast<float>(rand())/(static_cast<float>(RAND_MAX/float(k_jitterTranslation))) - k_jitterTranslation * 0.5, strokeCentroid.y() + static_cast <float> (rand()) / (static_cast <float> (RAND_MAX/float(k_jitterTranslation))) - k_jitterTranslation * 0.5);
+        jitter.rotateRadians((static_cast<float>(rand())/(static_cast<float>(RAND_MAX))) * k_jitterRotation - (k_jitterRotation * 0.5f));
+        jitter.translate(-strokeCentroid.x(), -strokeCentroid.y());
+    }
+    return jitter;
+}
+
 void VectorKeyFrame::paintGroupGL(QOpenGLShaderProgram *program, QOpenGLFunctions *functions, qreal alpha, double opacityAlpha, Group *group, int inbetween, const QColor &color, double tintFactor, double strokeWeightFactor, bool useGroupColor, bool crossFade, bool ignoreMask) {
     if (!k_useInterpolation) {
         alpha = 0.0f;
         inbetween = 0;
     }
 
-    const QHash<int, StrokePtr> &strokes = m_inbetweens[inbetween].strokes;
+    m_inbetweens[inbetween].destroyRetiredBuffers();
+    QHash<int, InbetweenStroke> &strokes = m_inbetweens[inbetween].strokes;
     const StrokeIntervals &strokeIntervals = group->drawingPartials().lastPartialAt(alpha).strokes();
     Group *next = group->nextPreGroup();
     qreal spacingAlpha = group->spacingAlpha(alpha);
@@ -439,27 +757,21 @@ void VectorKeyFrame::paintGroupGL(QOpenGLShaderProgram *program, QOpenGLFunction
     // Draw forward strokes
     QColor colorAlpha;
     for (auto it = strokeIntervals.begin(); it != strokeIntervals.end(); ++it) {
-        const StrokePtr &stroke = strokes.value(it.key());
+        auto strokeIt = strokes.find(it.key());
+        if (strokeIt == strokes.end()) continue;
+        InbetweenStroke &inbStroke = strokeIt.value();
+        const StrokePtr &stroke = inbStroke.source();
         if (stroke->isInvisible() && !k_displayMask) continue;
 
         // Select stroke color
-        if (!stroke->buffersCreated()) stroke->createBuffers(program, this);
+        if (!inbStroke.buffersCreated()) inbStroke.createBuffers(program, this);
         if (useGroupColor)          colorAlpha = group->color();
         else if (tintFactor > 0.0)  colorAlpha = tintColor(stroke, tintFactor, color);
         else                        colorAlpha = stroke->color();
         colorAlpha.setAlphaF(opacityAlpha);
 
         // Optional jitter
-        unsigned int jitterId = std::floor((float)inbetween/k_jitterDuration);
-        QTransform jitter;
-        if (k_useJitter && inbetween > 0 && jitterId > 0) {
-            srand(Utils::cantor(stroke->id(), jitterId));
-            Point::VectorType strokeCentroid = stroke->centroid();
-            jitter.translate(strokeCentroid.x() + static_cast<float>(rand())/(static_cast<float>(RAND_MAX/float(k_jitterTranslation))) - k_jitterTranslation * 0.5, strokeCentroid.y() + static_cast <float> (rand()) / (static_cast <float> (RAND_MAX/float(k_jitterTranslation))) - k_jitterTranslation * 0.5);
-            jitter.rotateRadians((static_cast<float>(rand())/(static_cast<float>(RAND_MAX))) * k_jitterRotation - (k_jitterRotation * 0.5f));
-            jitter.translate(-strokeCentroid.x(), -strokeCentroid.y());
-        }
-        program->setUniformValue("jitter", jitter);
+        program->setUniformValue("jitter", strokeJitter(inbStroke, inbetween));
         
         // Stroke-wide properties
         program->setUniformValue("strokeWeight", (float)stroke->strokeWidth() * widthScalingForward * (float)strokeWeightFactor);
@@ -472,7 +784,7 @@ void VectorKeyFrame::paintGroupGL(QOpenGLShaderProgram *program, QOpenGLFunction
                 if (inbetween == 0 && interval.canOvershoot() && interval.to() < stroke->size() - 1) cap[1] += 1;
                 program->setUniformValueArray("capIdx", cap, 2); // at which points should we draw caps
             }
-            stroke->render(GL_LINE_STRIP_ADJACENCY, functions, interval, inbetween == 0);
+            inbStroke.render(GL_LINE_STRIP_ADJACENCY, functions, interval, inbetween == 0);
         }
     }
 
@@ -480,9 +792,12 @@ void VectorKeyFrame::paintGroupGL(QOpenGLShaderProgram *program, QOpenGLFunction
     // TODO factorize with above
     if (drawNext && inbetween > 0) {
         for (auto it = next->strokes().begin(); it != next->strokes().end(); ++it) {
-            const StrokePtr &stroke = m_inbetweens[inbetween].backwardStrokes.value(it.key());
+            auto strokeIt = m_inbetweens[inbetween].backwardStrokes.find(it.key());
+            if (strokeIt == m_inbetweens[inbetween].backwardStrokes.end()) continue;
+            InbetweenStroke &inbStroke = strokeIt.value();
+            const StrokePtr &stroke = inbStroke.source();
             if (stroke->isInvisible()) continue;
-            if (!stroke->buffersCreated()) stroke->createBuffers(program, this);
+            if (!inbStroke.buffersCreated()) inbStroke.createBuffers(program, this);
             if (useGroupColor)          colorAlpha = group->color();
             else if (tintFactor > 0.0)  colorAlpha = tintColor(stroke, tintFactor, color);
             else                        colorAlpha = stroke->color();
@@ -494,12 +809,70 @@ void VectorKeyFrame::paintGroupGL(QOpenGLShaderProgram *program, QOpenGLFunction
                     int cap[2] = {(int)interval.from(), (int)interval.to()}; // TODO: do this more properly
                     program->setUniformValueArray("capIdx", cap, 2);
                 }
-                stroke->render(GL_LINE_STRIP_ADJACENCY, functions, interval, false);
+                inbStroke.render(GL_LINE_STRIP_ADJACENCY, functions, interval, false);
             }
         }
     }  
 }
 
+/**
+ * Software counterpart of paintGroupGL (with the stroke colors and cross-fade), the strokes are tessellated and drawn in the given rasterizer.
+ * style holds the view and projection of the frame, the per-stroke uniforms are set here.
+ */
+void VectorKeyFrame::paintGroup(StrokeRasterizer &rasterizer, const StrokeStyle &style, qreal alpha, double opacityAlpha, Group *group, int inbetween) {
+    if (!k_useInterpolation) {
+        alpha = 0.0f;
+        inbetween = 0;
+    }
+
+    Inbetween &inb = m_inbetweens[inbetween];
+    const StrokeIntervals &strokeIntervals = group->drawingPartials().lastPartialAt(alpha).strokes();
+    Group *next = group->nextPreGroup();
+    qreal spacingAlpha = group->spacingAlpha(alpha);
+    bool drawNext = next != nullptr && k_useCrossFade && next->nextPostGroup() != nullptr && !next->nextPostGroup()->breakdown();
+    float widthScalingForward =  drawNext ? group->crossFadeValue(spacingAlpha, true)  : 1.0f;
+    float widthScalingBackward = drawNext ? group->crossFadeValue(spacingAlpha, false) : 1.0f;
+    if (group->disappear()) widthScalingForward = std::max(1.0 - spacingAlpha, 0.0);
+    if (drawNext && group->size() == 0) widthScalingBackward = std::max(spacingAlpha, 0.0);
+
+    StrokeStyle strokeStyle = style;
+    strokeStyle.ignoreMask = true;
+    strokeStyle.sticker = group->isSticker();
+    strokeStyle.time = spacingAlpha;
+
+    // one mesh per stroke (cached in the inbetween stroke), drawn in a single pass
+    std::vector<StrokeRasterizer::DrawCall> calls;
+    auto addStroke = [&](InbetweenStroke &inbStroke, const Intervals &intervals, float widthScaling, bool overshoot) {
+        const StrokePtr &stroke = inbStroke.source();
+        QColor colorAlpha = stroke->color();
+        colorAlpha.setAlphaF(opacityAlpha);
+        strokeStyle.view = strokeJitter(inbStroke, inbetween) * style.view;
+        strokeStyle.strokeWeight = stroke->strokeWidth() * widthScaling;
+        const StrokeMesh &mesh = inbStroke.mesh(this, intervals, overshoot, strokeStyle);
+        if (!mesh.empty()) calls.push_back({&mesh, colorAlpha});
+    };
+
+    // forward strokes
+    for (auto it = strokeIntervals.begin(); it != strokeIntervals.end(); ++it) {
+        auto strokeIt = inb.strokes.find(it.key());
+        if (strokeIt == inb.strokes.end()) continue;
+        if (strokeIt.value().source()->isInvisible() && !k_displayMask) continue;
+        addStroke(strokeIt.value(), it.value(), widthScalingForward, inbetween == 0);
+    }
+
+    // backward strokes (if cross-fade is enabled)
+    if (drawNext && inbetween > 0) {
+        for (auto it = next->strokes().begin(); it != next->strokes().end(); ++it) {
+            auto strokeIt = inb.backwardStrokes.find(it.key());
+            if (strokeIt == inb.backwardStrokes.end()) continue;
+            if (strokeIt.value().source()->isInvisible()) continue;
+            addStroke(strokeIt.value(), it.value(), widthScalingBackward, false);
+        }
+    }
+
+    rasterizer.draw(calls);
+}
+
 void VectorKeyFrame::paintGroupGL(QOpenGLShaderProgram *program, QOpenGLFunctions *functions, double opacityAlpha, Group *group, const QColor &color, double tintFactor, double strokeWeightFactor, bool useGroupColor, bool ignoreMask) {
     const StrokeIntervals &strokeIntervals = group->strokes();
     program->setUniformValue("ignoreMask", ignoreMask);
@@ -533,7 +906,13 @@ void VectorKeyFrame::paintGroupGL(QOpenGLShaderProgram *program, QOpenGLFunction
 }
 
 bool VectorKeyFrame::load(QDomElement &element, const QString &path, Editor *editor) {
-    Q_UNUSED(path);
+    // binary payload (see save), mapped until the keyframe is loaded
+    ChunkReader data;
+    if (element.hasAttribute("data") && !data.open(QDir(path).filePath(element.attribute("data")))) {
+        qWarning() << "Loading: cannot read the payload of keyframe " << element.attribute("frame");
+        return false;
+    }
+    const ChunkReader *payload = data.isOpen() ? &data : nullptr;
 
     // load strokes
     unsigned int maxId = 0;
@@ -550,9 +929,16 @@ bool VectorKeyFrame::load(QDomElement &element, const QString &path, Editor *edi
             bool invisible = (bool)strokeTag.toElement().attribute("invisible", "0").toInt();
             StrokePtr s = std::make_shared<Stroke>(strokeId, c, thickness, invisible);
             uint size = strokeTag.toElement().attribute("size").toUInt();
-            QString string = strokeTag.toElement().text();
-            QTextStream pos(&string);
-            s->load(pos, size);
+            if (payload != nullptr && strokeTag.toElement().hasAttribute("offset")) {
+                const std::array<double, 4> *points = payload->array<std::array<double, 4>>("stroke.points", strokeTag.toElement().attribute("offset").toULongLong(), size);
+                if (points == nullptr) {
+                    qWarning() << "Loading: missing points of stroke " << strokeId;
+                    return false;
+                }
+                s->load(points, size);
+            } else {
+                s->load(NumberReader::text(strokeTag.toElement()), size);
+            }
             addStroke(s, nullptr, false);
             strokeTag = strokeTag.nextSibling();
         }
@@ -565,11 +951,11 @@ bool VectorKeyFrame::load(QDomElement &element, const QString &path, Editor *edi
         QDomNode groupNode = postGroupsElt.firstChild();
         while (!groupNode.isNull()) {
             if (groupNode.toElement().attribute("id").toInt() == Group::MAIN_GROUP_ID) {
-                defaultGroup()->load(groupNode);
+                defaultGroup()->load(groupNode, payload);
                 defaultGroup()->update();
             } else {
                 Group *group = new Group(this, POST);
-                group->load(groupNode);
+                group->load(groupNode, payload);
                 group->update();
                 m_postGroups.add(group);
             }
@@ -591,7 +977,7 @@ bool VectorKeyFrame::load(QDomElement &element, const QString &path, Editor *edi
         QDomNode groupNode = preGroupsElt.firstChild();
         while (!groupNode.isNull()) {
             Group *group = new Group(this, PRE);
-            group->load(groupNode);
+            group->load(groupNode, payload);
             group->update();
             m_preGroups.add(group);
             groupNode = groupNode.nextSibling();
@@ -611,12 +997,12 @@ bool VectorKeyFrame::load(QDomElement &element, const QString &path, Editor *edi
     QDomElement strokeVisibilityElt = strokesElt.nextSiblingElement("strokevisibility");
     if (!strokeVisibilityElt.isNull()) {
         int size = strokeVisibilityElt.attribute("size", "0").toInt();
-        QString stringVis = strokeVisibilityElt.text();
-        QTextStream posVis(&stringVis);
+        QString stringVis = NumberReader::text(strokeVisibilityElt);
+        NumberReader posVis(stringVis);
         unsigned int key;
         double vis;
         for (int i = 0; i < size; ++i) {
-            posVis >> key >> vis;
+            posVis.read(key, vis);
             m_visibility[key] = vis;
         }
     }
@@ -625,11 +1011,11 @@ bool VectorKeyFrame::load(QDomElement &element, const QString &path, Editor *edi
     QDomElement correspondences = strokesElt.nextSiblingElement("corresp");
     if (correspondences.isNull()) qDebug() << "Loading: could not find correspondences";
     int size = correspondences.attribute("size", "0").toInt();
-    QString string = correspondences.text();
-    QTextStream pos(&string);
+    QString string = NumberReader::text(correspondences);
+    NumberReader pos(string);
     int groupA, groupB;
     for (int i = 0; i < size; ++i) {
-        pos >> groupA >> groupB;
+        pos.read(groupA, groupB);
         addCorrespondence(groupA, groupB);
     }
 
@@ -637,10 +1023,10 @@ bool VectorKeyFrame::load(QDomElement &element, const QString &path, Editor *edi
     QDomElement intraCorrespondences = strokesElt.nextSiblingElement("intra_corresp");
     if (intraCorrespondences.isNull()) qDebug() << "Loading: could not find intra correspondences";
     size = intraCorrespondences.attribute("size", "0").toInt();
-    QString stringIntra = intraCorrespondences.text();
-    QTextStream posIntra(&stringIntra);
+    QString stringIntra = NumberReader::text(intraCorrespondences);
+    NumberReader posIntra(stringIntra);
     for (int i = 0; i < size; ++i) {
-        posIntra >> groupA >> groupB;
+        posIntra.read(groupA, groupB);
         addIntraCorrespondence(groupA, groupB);
     }
 
@@ -748,9 +1134,28 @@ bool VectorKeyFrame::load(QDomElement &element, const QString &path, Editor *edi
     return true;
 }
 
+/**
+ * Save the keyframe in a "vectorkeyframe" element.
+ * If path is not empty, the bulk of the keyframe (strokes points, groups intervals and UVs, lattices quads and corners)
+ * is written as little-endian arrays in the file payloadFileName(layer, frame) of the path directory (see ChunkWriter),
+ * and the XML elements only keep the attributes and the offsets in these arrays.
+ * Otherwise everything is saved as XML text.
+ */
 bool VectorKeyFrame::save(QDomDocument &doc, QDomElement &root, const QString &path, int layer, int frame) const {
-    Q_UNUSED(path);
-    Q_UNUSED(layer);
+    if (path.isEmpty()) {
+        saveElement(doc, root, nullptr, layer, frame);
+        return true;
+    }
+    ChunkWriter data;
+    saveElement(doc, root, &data, layer, frame);
+    if (!data.write(QDir(path).filePath(payloadFileName(layer, frame)))) {
+        qWarning() << "Saving: cannot write the payload of keyframe " << frame << " in " << path;
+        return false;
+    }
+    return true;
+}
+
+QDomElement VectorKeyFrame::saveElement(QDomDocument &doc, QDomElement &root, ChunkWriter *payload, int layer, int frame) const {
     QDomElement keyElt = doc.createElement("vectorkeyframe");
     keyElt.setAttribute("frame", frame);
 
@@ -758,7 +1163,7 @@ bool VectorKeyFrame::save(QDomDocument &doc, QDomElement &root, const QString &p
     QDomElement strokesElt = doc.createElement("strokes");
     strokesElt.setAttribute("size", uint(m_strokes.size()));
     for (const StrokePtr &stroke : m_strokes) {
-        stroke->save(doc, strokesElt);
+        stroke->save(doc, strokesElt, payload);
     }
     keyElt.appendChild(strokesElt);
 
@@ -766,7 +1171,7 @@ bool VectorKeyFrame::save(QDomDocument &doc, QDomElement &root, const QString &p
     QDomElement postGroupsElt = doc.createElement("postgroups");
     postGroupsElt.setAttribute("size", uint(m_postGroups.size()));
     for (const Group *group : m_postGroups) {
-        group->save(doc, postGroupsElt);
+        group->save(doc, postGroupsElt, payload);
     }
     keyElt.appendChild(postGroupsElt);
 
@@ -774,7 +1179,7 @@ bool VectorKeyFrame::save(QDomDocument &doc, QDomElement &root, const QString &p
     QDomElement preGroupsElt = doc.createElement("pregroups");
     preGroupsElt.setAttribute("size", uint(m_preGroups.size()));
     for (const Group *group : m_preGroups) {
-        group->save(doc, preGroupsElt);
+        group->save(doc, preGroupsElt, payload);
     }
     keyElt.appendChild(preGroupsElt);
 
@@ -871,7 +1276,13 @@ bool VectorKeyFrame::save(QDomDocument &doc, QDomElement &root, const QString &p
     keyElt.appendChild(orderPartialsElt);
 
     root.appendChild(keyElt);
-    return true;
+
+    if (payload != nullptr) keyElt.setAttribute("data", payloadFileName(layer, frame));
+    return keyElt;
+}
+
+QString VectorKeyFrame::payloadFileName(int layer, int frame) {
+    return QString("%1.%2.frck").arg(layer, 3, 10, QChar('0')).arg(frame, 3, 10, QChar('0'));
 }
 void VectorKeyFrame::setAlignFrameToTangent(bool start, AlignTangent alignTangent){
     if (start)
@@ -1193,7 +1604,7 @@ unsigned int VectorKeyFrame::addTrajectoryConstraint(const std::shared_ptr<Traje
     unsigned int idx = pullMaxConstraintIdx();
     m_trajectories.insert(idx, traj);
     group->lattice()->addConstraint(idx);
-    group->setGridDirty();
+    group->setConstraintsDirty();
     traj->setConstraintID(idx);
     traj->setHardConstraint(true);
     makeInbetweensDirty();
@@ -1215,7 +1626,7 @@ void VectorKeyFrame::removeTrajectoryConstraint(unsigned int id) {
     Group *group = traj->group();
     m_trajectories.remove(traj->constraintID());
     group->lattice()->removeConstraint(traj->constraintID());
-    group->setGridDirty();
+    group->setConstraintsDirty();
     traj->setHardConstraint(false);
     if (traj->nextTrajectory() != nullptr)
     makeInbetweensDirty();
@@ -1305,7 +1716,7 @@ void VectorKeyFrame::resetTrajectories(bool onlySelected) {
         Group *group = traj->group();
         if (!m_selection.isPostGroupSelected(group->id())) continue;
         group->lattice()->removeConstraint(traj->constraintID());
-        group->setGridDirty();
+        group->setConstraintsDirty();
     }
 
     for (const auto &traj : m_trajectories) {
@@ -1317,7 +1728,7 @@ void VectorKeyFrame::resetTrajectories(bool onlySelected) {
         Group *group = traj->group();
         if (!m_selection.isPostGroupSelected(group->id())) continue;
         group->lattice()->addConstraint(traj->constraintID());
-        group->setGridDirty();
+        group->setConstraintsDirty();
     }
 
     makeInbetweensDirty();
@@ -1497,8 +1908,9 @@ void VectorKeyFrame::copyDeformedGroup(VectorKeyFrame *dst, Group *srcGroup, boo
                 unsigned int newId = dst->pullMaxStrokeIdx();
                 StrokePtr newStroke = std::make_shared<Stroke>(*stroke, newId, interval.from(), interval.to());
                 // deform the new stroke with the target configuration of the srcGroup lattice
+                const UVHash::StrokeUVs &strokeUVs = srcGroup->uvs().stroke(it.key());
                 for (unsigned int i = interval.from(); i <= interval.to(); ++i) {
-                    UVInfo uv = srcGroup->uvs().get(it.key(), i);
+                    UVInfo uv = strokeUVs.get(i);
                     newStroke->points()[i - interval.from()]->pos() = srcGroup->lattice()->getWarpedPoint(newStroke->points()[i - interval.from()]->pos(), uv.quadKey, uv.uv, TARGET_POS);
                     // Copy strokes visibility
                     dst->visibility()[Utils::cantor(newId, i)] = srcGroup->getParentKeyframe()->visibility().contains(Utils::cantor(stroke->id(), i)) ? srcGroup->getParentKeyframe()->visibility()[Utils::cantor(stroke->id(), i)] : 0.0;
@@ -1538,6 +1950,7 @@ void VectorKeyFrame::copyDeformedGroup(VectorKeyFrame *dst, Group *srcGroup, boo
         int key = c->getKey();
         newPostGroup->lattice()->corners()[key]->coord(REF_POS) = newPostGroup->lattice()->corners()[key]->coord(TARGET_POS);
     }
+    newPostGroup->lattice()->setRestDirty();
 
     // Rebake strokes
     newPostGroup->strokes().forEachInterval([&](const Interval &interval, unsigned int strokeID) { 
@@ -1555,7 +1968,6 @@ void VectorKeyFrame::copyDeformedGroup(VectorKeyFrame *dst, Group *srcGroup, boo
 
     // Dirty flags
     newPostGroup->setGridDirty();
-    newPostGroup->lattice()->resetPrecomputedTime();
     newPostGroup->lattice()->setBackwardUVDirty(true);
     srcGroup->lattice()->setBackwardUVDirty(true);
     makeInbetweensDirty();
@@ -1606,7 +2018,10 @@ void VectorKeyFrame::createBreakdown(Editor *editor, VectorKeyFrame *newKeyframe
 
     // retrieve the baked inbetween strokes
     QHash<int, int> backwardStrokesMapping;
-    newKeyframe->strokes() = inbetweenCopy.strokes;
+    newKeyframe->strokes().clear();
+    for (auto it = inbetweenCopy.strokes.constBegin(); it != inbetweenCopy.strokes.constEnd(); ++it) {
+        newKeyframe->strokes().insert(it.key(), it.value().toStroke());
+    }
     newKeyframe->m_visibility = m_visibility;
     newKeyframe->m_maxStrokeIdx = m_maxStrokeIdx; 
     int backwardStart = newKeyframe->m_maxStrokeIdx;
@@ -1622,7 +2037,7 @@ void VectorKeyFrame::createBreakdown(Editor *editor, VectorKeyFrame *newKeyframe
 
     // add strokes from the next keyframe and create a mapping of their IDs in both KF
     for (auto it = inbetweenCopy.backwardStrokes.constBegin(); it != inbetweenCopy.backwardStrokes.constEnd(); ++it) {
-        StrokePtr strokeCopy = std::make_shared<Stroke>(*it.value());
+        StrokePtr strokeCopy = it.value().toStroke();
         strokeCopy->resetID(newKeyframe->pullMaxStrokeIdx());
         newKeyframe->addStroke(strokeCopy, nullptr, false);
         backwardStrokesMapping.insert(it.key(), strokeCopy->id());
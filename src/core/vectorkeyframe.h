@@ -31,6 +31,9 @@ class Point;
 class Group;
 class GroupList;
 class Editor;
+class StrokeRasterizer;
+class ChunkWriter;
+struct StrokeStyle;
 
 struct AlignTangent {
     bool m_use;
@@ -61,16 +64,21 @@ class VectorKeyFrame : public KeyFrame {
 
     // Inbetweens
     void computeInbetween(qreal alpha, Inbetween &inbetween) const;
+    void computeInbetweens(const std::vector<qreal> &alphas, const std::vector<Inbetween *> &inbetweens, const std::vector<QSet<int>> &dirtyGroups = {}) const;
     void clearInbetweens();
     void initInbetweens(int stride);
     void bakeInbetween(Editor *editor, int frame, int inbetween, int stride);
-    void updateInbetween(Editor *editor, size_t i);
+    void bakeInbetweens(Editor *editor, int frame, int stride);
+    void updateInbetweens(const std::vector<qreal> &alphas, const std::vector<int> &indices);
     const Inbetweens &inbetweens() const { return m_inbetweens; }
     const Inbetween &inbetween(unsigned int inbetweenIdx) const { return m_inbetweens[inbetweenIdx]; }
-    const QHash<int, StrokePtr> &inbetweenStrokes(unsigned int inbetweenIdx) const { return m_inbetweens[inbetweenIdx].strokes; }
-    const QHash<int, std::vector<Point::VectorType>> &inbetweenCorners(unsigned int inbetweenIdx) const { return m_inbetweens[inbetweenIdx].corners; }
-    void makeInbetweensDirty() { m_inbetweens.makeDirty(); }
-    void makeInbetweenDirty(int inbetween) { m_inbetweens.makeDirty(inbetween); }
+    const QHash<int, InbetweenStroke> &inbetweenStrokes(unsigned int inbetweenIdx) const { return m_inbetweens[inbetweenIdx].strokes; }
+    const QHash<int, InterpolatedFrame> &inbetweenCorners(unsigned int inbetweenIdx) const { return m_inbetweens[inbetweenIdx].corners; }
+    void makeInbetweensDirty() { m_inbetweens.makeDirty(); ++m_animationVersion; }
+    void makeInbetweenDirty(int inbetween) { m_inbetweens.makeDirty(inbetween); ++m_animationVersion; }
+    unsigned int animationVersion() const { return m_animationVersion; }
+    void makeGroupInbetweensDirty(int groupId) { m_inbetweens.makeGroupDirty(groupId); ++m_animationVersion; }
+    void makeStrokeInbetweensDirty(int strokeId) { m_inbetweens.makeStrokeDirty(strokeId); ++m_animationVersion; }
 
     // Groups
     inline Group *selectedGroup(GroupType type = POST) const { return type == POST ? (m_selection.selectedPostGroups().empty() ? nullptr : m_selection.selectedPostGroups().begin().value()) 
@@ -100,10 +108,14 @@ class VectorKeyFrame : public KeyFrame {
     // Drawing
     void paintGroupGL(QOpenGLShaderProgram *program, QOpenGLFunctions *functions, qreal alpha, double opacityAlpha, Group *group, int inbetween, const QColor &color, double tintFactor, double strokeWeightFactor=1.0,  bool useGroupColor = false, bool crossFade = true, bool ignoreMask = false);
     void paintGroupGL(QOpenGLShaderProgram *program, QOpenGLFunctions *functions, double opacityAlpha, Group *group, const QColor &color, double tintFactor, double strokeWeightFactor=1.0,  bool useGroupColor = false, bool ignoreMask = false);
+    void paintGroup(StrokeRasterizer &rasterizer, const StrokeStyle &style, qreal alpha, double opacityAlpha, Group *group, int inbetween);
 
     // Saving/loading
     virtual bool load(QDomElement &element, const QString &path, Editor *editor);
     virtual bool save(QDomDocument &doc, QDomElement &root, const QString &path, int layer, int frame) const;
+    // Same as save but the payload, if not null, is left to the caller (the element refers to payloadFileName(layer, frame))
+    QDomElement saveElement(QDomDocument &doc, QDomElement &root, ChunkWriter *payload, int layer, int frame) const;
+    static QString payloadFileName(int layer, int frame);
 
     // Global rigid transform
     KeyframedVector *pivot() const { return m_pivot; }
@@ -173,6 +185,8 @@ class VectorKeyFrame : public KeyFrame {
     int keyframeNumber() { return m_layer->getVectorKeyFramePosition(this); }
 
    private:
+    void makeCanvasCurrent() const;
+
     Layer *m_layer;                             // parent layer of this KF
 
     float m_currentGroupHue;                    // used for cycling group color
@@ -181,6 +195,7 @@ class VectorKeyFrame : public KeyFrame {
 
     QHash<int, StrokePtr> m_strokes;            // all strokes in the keyframe
     Inbetweens m_inbetweens;                    // baked inbetweens between this keyframe and the next. The first inbetween is at idx 0 and the last stored inbetween is t=1.0!
+    unsigned int m_animationVersion;            // incremented whenever some inbetweens are made dirty or cleared (spacing, trajectories, lattices or stride changed)
     
     Partials<OrderPartial> m_orderPartials;     // drawing order of post groups
     GroupList m_preGroups;                      // subset of m_strokes used for backward interpolation
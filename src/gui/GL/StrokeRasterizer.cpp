@@ -0,0 +1,364 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2024 Melvin Even <melvin.even@inria.fr>
+ *
+ * SPDX-License-Identifier: CECILL-2.1
+ */
+
+#include "StrokeRasterizer.h"
+
+#include <QtConcurrent/QtConcurrent>
+#include <algorithm>
+#include <cmath>
+
+#include "stroke.h"
+
+// Same constants as stroke.geom and stroke.frag
+static const float PI = 3.14159265359f;
+static const float PI_2 = 1.57079632679f;
+static const float MASK_EPS = 0.001f;
+static const int CAP_RES = 14;
+static const float ST = PI_2 / CAP_RES;
+
+static const int ROWS_PER_BAND = 32;
+
+// GLSL normalize/sign, a null vector stays null
+static inline Eigen::Vector2f normalize(const Eigen::Vector2f &v) {
+    float n = v.norm();
+    return n > 0.0f ? Eigen::Vector2f(v / n) : v;
+}
+
+static inline float sign(float x) { return (float)((x > 0.0f) - (x < 0.0f)); }
+
+static inline Eigen::Vector2f rotate(const Eigen::Vector2f &v, float o) {
+    float c = std::cos(o), s = std::sin(o);
+    return Eigen::Vector2f(c * v.x() - s * v.y(), s * v.x() + c * v.y());
+}
+
+static inline bool visibleAt(float visibility, float time) {
+    return visibility >= -1.0f && (visibility >= 0.0f ? time >= visibility : -time > visibility);
+}
+
+// 1 - mask texture red channel at the given texture coordinates (origin at the bottom left like GL)
+static float sampleMask(const QImage *mask, float u, float v) {
+    if (mask == nullptr || mask->isNull()) return 1.0f;
+    int x = std::clamp((int)(u * mask->width()), 0, mask->width() - 1);
+    int y = std::clamp((int)((1.0f - v) * mask->height()), 0, mask->height() - 1);
+    return 1.0f - qRed(mask->pixel(x, y)) / 255.0f;
+}
+
+void StrokeMesh::clear() {
+    m_positions.clear();
+    m_visibility.clear();
+    m_colors.clear();
+    m_strips.clear();
+}
+
+void StrokeMesh::emitVertex(const Eigen::Vector2f &pos, const InVertex &vtx) {
+    if (m_strips.empty()) m_strips.push_back(0);
+    m_positions.push_back(pos);
+    m_visibility.push_back(vtx.visibility);
+    m_colors.push_back(vtx.color);
+}
+
+void StrokeMesh::endPrimitive() {
+    if (m_strips.empty()) return;
+    if (m_strips.back() != (int)m_positions.size()) m_strips.push_back(m_positions.size());
+}
+
+void StrokeMesh::makeQuad(const InVertex &v0, const InVertex &v1, const Eigen::Vector2f &n0, const Eigen::Vector2f &n1, float w0, float w1, const Eigen::Vector2f &winSize) {
+    Eigen::Vector2f o0 = (n0 * w0).cwiseQuotient(winSize);
+    Eigen::Vector2f o1 = (n1 * w1).cwiseQuotient(winSize);
+    emitVertex(v0.pos + o0, v0);
+    emitVertex(v0.pos - o0, v0);
+    emitVertex(v1.pos + o1, v1);
+    emitVertex(v1.pos - o1, v1);
+    endPrimitive();
+}
+
+void StrokeMesh::makeSemiCircleStrip(const InVertex &v, float w, float o, const Eigen::Vector2f &winSize) {
+    for (float theta = PI_2; theta > 0; theta -= ST) {
+        Eigen::Vector2f d = Eigen::Vector2f(std::cos(theta), std::sin(theta)) * w;
+        emitVertex(v.pos + rotate(d, o).cwiseQuotient(winSize), v);
+        emitVertex(v.pos + rotate(Eigen::Vector2f(d.x(), -d.y()), o).cwiseQuotient(winSize), v);
+    }
+    emitVertex(v.pos + rotate(Eigen::Vector2f(w, 0.0f), o).cwiseQuotient(winSize), v);
+    endPrimitive();
+}
+
+void StrokeMesh::makeArcStrip(const InVertex &v, float w, float thetaStart, float thetaEnd, float o, const Eigen::Vector2f &winSize) {
+    float tot = thetaEnd - thetaStart;
+    if (tot > PI) tot -= 2 * PI;
+    else if (tot <= -PI) tot += 2 * PI;
+    tot = std::abs(tot);
+    float tot_2 = tot * 0.5f;
+    float s = tot < ST ? tot_2 : ST;
+    if (s <= 0.0f) return;
+    emitVertex(v.pos, v);
+    for (float theta = tot_2; theta > 0; theta -= s) {
+        Eigen::Vector2f d = Eigen::Vector2f(std::cos(theta), std::sin(theta)) * w;
+        emitVertex(v.pos + rotate(d, o).cwiseQuotient(winSize), v);
+        emitVertex(v.pos + rotate(Eigen::Vector2f(d.x(), -d.y()), o).cwiseQuotient(winSize), v);
+    }
+    emitVertex(v.pos + rotate(Eigen::Vector2f(w, 0.0f), o).cwiseQuotient(winSize), v);
+    endPrimitive();
+}
+
+void StrokeMesh::makeTri(const InVertex &v, float w, const Eigen::Vector2f &n0, const Eigen::Vector2f &n1, const Eigen::Vector2f &winSize) {
+    emitVertex(v.pos, v);
+    emitVertex(v.pos + (n0 * w).cwiseQuotient(winSize), v);
+    emitVertex(v.pos + (n1 * w).cwiseQuotient(winSize), v);
+    endPrimitive();
+}
+
+void StrokeMesh::tessellate(const float *data, int size, int from, int to, const StrokeStyle &style) {
+    if (size <= 0 || to <= from) return;
+    const Eigen::Vector2f &winSize = style.winSize;
+
+    // Vertex shader, over the elements [from, to + 2] of the line strip (see Stroke::lineBufferData)
+    std::vector<InVertex> in(to - from + 3);
+    for (int e = 0; e < (int)in.size(); ++e) {
+        int k = std::clamp(from + e - 1, 0, size - 1);
+        const float *d = data + k * Stroke::BUFFER_STRIDE;
+        QPointF p = style.view.map(QPointF(d[0], d[1]));
+        QVector4D clip = style.proj * QVector4D(p.x(), p.y(), 0.5f, 1.0f);
+        in[e].pos = Eigen::Vector2f(clip.x(), clip.y());
+        in[e].pressure = d[2];
+        in[e].visibility = d[3];
+        in[e].id = k;
+        in[e].color = Eigen::Vector4f(d[4], d[5], d[6], d[7]);
+    }
+
+    // Geometry shader, one primitive per segment
+    for (int i = 0; i < to - from; ++i) {
+        const InVertex &ip = in[i], &i0 = in[i + 1], &i1 = in[i + 2], &in_ = in[i + 3];
+        Eigen::Vector2f vp = ip.pos.cwiseProduct(winSize);
+        Eigen::Vector2f v0 = i0.pos.cwiseProduct(winSize);
+        Eigen::Vector2f v1 = i1.pos.cwiseProduct(winSize);
+        Eigen::Vector2f vn = in_.pos.cwiseProduct(winSize);
+
+        Eigen::Vector2f tp = normalize(v0 - vp);
+        Eigen::Vector2f t0 = normalize(v1 - v0);
+        Eigen::Vector2f t1 = normalize(vn - v1);
+
+        Eigen::Vector2f np(-tp.y(), tp.x());
+        Eigen::Vector2f n0(-t0.y(), t0.x());
+        Eigen::Vector2f n1(-t1.y(), t1.x());
+
+        Eigen::Vector2f m0 = normalize(np + n0);
+        Eigen::Vector2f m1 = normalize(n1 + n0);
+
+        if (!style.ignoreMask) {
+            float mask0 = sampleMask(style.maskStrength, (i0.pos.x() + 1.0f) * 0.5f, (i0.pos.y() + 1.0f) * 0.5f);
+            float mask1 = sampleMask(style.maskStrength, (i1.pos.x() + 1.0f) * 0.5f, (i1.pos.y() + 1.0f) * 0.5f);
+            if (!style.sticker && (mask0 < MASK_EPS || mask1 < MASK_EPS)) continue;
+            if (style.sticker && (mask0 >= 1.0f - MASK_EPS || mask1 >= 1.0f - MASK_EPS)) continue;
+        }
+
+        float vis = (visibleAt(i0.visibility, style.time) || visibleAt(i1.visibility, style.time)) ? 1.0f : 0.0f;
+        float w0 = style.strokeWeight * i0.pressure * style.zoom * vis;
+        float w1 = style.strokeWeight * i1.pressure * style.zoom * vis;
+        if (w0 == 0.0f && w1 == 0.0f) continue; // only degenerate triangles
+
+        float b0 = std::acos(std::clamp(tp.dot(t0), -1.0f, 1.0f));
+        float b1 = std::acos(std::clamp(t0.dot(t1), -1.0f, 1.0f));
+
+        Eigen::Vector2f side0 = n0;
+        Eigen::Vector2f side1 = n0;
+
+        if (i0.id != style.capIdx[0]) {
+            if (b0 > 0.2f) {
+                float offset = tp.dot(n0) > 0 ? 0.0f : -PI;
+                makeArcStrip(i0, w0, std::atan2(np.y(), np.x()), std::atan2(n0.y(), n0.x()), std::atan2(m0.y(), m0.x()) + offset, winSize);
+            } else if (b0 > style.thetaEpsilon) {
+                float sgn = sign(tp.dot(n0));
+                makeTri(i0, w0, sgn * np, sgn * n0, winSize);
+            } else {
+                side0 = m0;
+            }
+        }
+
+        if (b1 <= style.thetaEpsilon) side1 = m1;
+
+        makeQuad(i0, i1, side0, side1, w0, w1, winSize);
+
+        if (i0.id == style.capIdx[0]) {
+            float thetaOffset = sign(n0.x()) * std::acos(std::clamp(-n0.y(), -1.0f, 1.0f));
+            makeSemiCircleStrip(i0, w0, thetaOffset, winSize);
+        }
+
+        if (i1.id == style.capIdx[1]) {
+            float thetaOffset = sign(-n0.x()) * std::acos(std::clamp(n0.y(), -1.0f, 1.0f));
+            makeSemiCircleStrip(i1, w1, thetaOffset, winSize);
+        }
+    }
+}
+
+void StrokeMesh::tessellate(const float *data, int size, const Interval &interval, bool overshoot, StrokeStyle style) {
+    int to = interval.to();
+    style.capIdx[0] = interval.from();
+    style.capIdx[1] = interval.to();
+    if (overshoot && interval.canOvershoot() && (int)interval.to() < size - 1) {
+        to += 1;
+        style.capIdx[1] += 1;
+    }
+    tessellate(data, size, interval.from(), to, style);
+}
+
+const StrokeMesh &StrokeMeshCache::mesh(const Stroke *stroke, VectorKeyFrame *keyframe, const Point::VectorType *positions, const Intervals &intervals, bool overshoot, const StrokeStyle &style) {
+    if (m_data.empty()) {
+        std::vector<GLuint> dataElt;
+        stroke->lineBufferData(keyframe, positions, m_data, dataElt);
+        m_size = stroke->size();
+    }
+    if (m_valid && matches(intervals, overshoot, style)) return m_mesh;
+
+    m_mesh.clear();
+    for (const Interval &interval : intervals) m_mesh.tessellate(m_data.data(), m_size, interval, overshoot, style);
+    m_valid = true;
+    m_intervals = intervals;
+    m_overshoot = overshoot;
+    m_style = style;
+    return m_mesh;
+}
+
+void StrokeMeshCache::clear() {
+    m_data.clear();
+    m_size = 0;
+    m_mesh.clear();
+    m_valid = false;
+}
+
+bool StrokeMeshCache::matches(const Intervals &intervals, bool overshoot, const StrokeStyle &style) const {
+    // The mask texture can change behind the same pointer, masked meshes are never reused
+    if (!style.ignoreMask || !m_style.ignoreMask) return false;
+    if (overshoot != m_overshoot || intervals.size() != m_intervals.size()) return false;
+    for (size_t i = 0; i < intervals.size(); ++i) {
+        if (!intervals.at(i).compare(m_intervals.at(i)) || intervals.at(i).canOvershoot() != m_intervals.at(i).canOvershoot()) return false;
+    }
+    return style.view == m_style.view && style.proj == m_style.proj && style.winSize == m_style.winSize && style.zoom == m_style.zoom
+        && style.thetaEpsilon == m_style.thetaEpsilon && style.strokeWeight == m_style.strokeWeight && style.time == m_style.time
+        && style.sticker == m_style.sticker;
+}
+
+StrokeRasterizer::StrokeRasterizer(int width, int height, int samples)
+    : m_width(width),
+      m_height(height) {
+    // Standard multisample patterns, in pixel units
+    if (samples >= 8) {
+        m_samplePos = {{1.f, -3.f}, {-1.f, 3.f}, {5.f, 1.f}, {-3.f, -5.f}, {-5.f, 5.f}, {-7.f, -1.f}, {3.f, 7.f}, {7.f, -7.f}};
+    } else if (samples >= 4) {
+        m_samplePos = {{-2.f, -6.f}, {6.f, -2.f}, {-6.f, 2.f}, {2.f, 6.f}};
+    } else {
+        m_samplePos = {{0.f, 0.f}};
+    }
+    for (Eigen::Vector2f &p : m_samplePos) p = p / 16.0f + Eigen::Vector2f(0.5f, 0.5f);
+    m_buffer.resize((size_t)m_width * m_height * m_samplePos.size());
+    clear();
+}
+
+void StrokeRasterizer::clear(const QColor &color) {
+    std::fill(m_buffer.begin(), m_buffer.end(), Eigen::Vector4f(color.redF(), color.greenF(), color.blueF(), color.alphaF()));
+}
+
+void StrokeRasterizer::draw(const StrokeMesh &mesh, const QColor &strokeColor, bool usePointColor) {
+    draw({DrawCall{&mesh, strokeColor, usePointColor, nullptr}});
+}
+
+void StrokeRasterizer::draw(const std::vector<DrawCall> &calls) {
+    // Window coordinates of the meshes, with the origin at the top left like the read back framebuffer
+    std::vector<std::vector<Eigen::Vector2f>> pixels(calls.size());
+    for (size_t c = 0; c < calls.size(); ++c) {
+        const std::vector<Eigen::Vector2f> &positions = calls[c].mesh->positions();
+        pixels[c].resize(positions.size());
+        for (size_t i = 0; i < positions.size(); ++i) {
+            pixels[c][i] = Eigen::Vector2f((positions[i].x() + 1.0f) * 0.5f * m_width, (1.0f - positions[i].y()) * 0.5f * m_height);
+        }
+    }
+
+    // Bands of rows are independent, each one draws every triangle in order so blending stays deterministic
+    std::vector<int> bands;
+    for (int y = 0; y < m_height; y += ROWS_PER_BAND) bands.push_back(y);
+    QtConcurrent::blockingMap(bands, [&](int rowFrom) {
+        int rowTo = std::min(m_height, rowFrom + ROWS_PER_BAND);
+        for (size_t c = 0; c < calls.size(); ++c) {
+            const StrokeMesh &mesh = *calls[c].mesh;
+            const QColor &col = calls[c].strokeColor;
+            Eigen::Vector4f strokeColor(col.redF(), col.greenF(), col.blueF(), col.alphaF());
+            for (int s = 0; s < mesh.nbStrips(); ++s) {
+                for (int i = mesh.stripBegin(s); i + 2 < mesh.stripEnd(s); ++i) {
+                    drawTriangle(calls[c], pixels[c], i, i + 1, i + 2, strokeColor, rowFrom, rowTo);
+                }
+            }
+        }
+    });
+}
+
+void StrokeRasterizer::drawTriangle(const DrawCall &call, const std::vector<Eigen::Vector2f> &pixels, int i0, int i1, int i2, const Eigen::Vector4f &strokeColor, int rowFrom, int rowTo) {
+    auto edge = [](const Eigen::Vector2f &a, const Eigen::Vector2f &b, const Eigen::Vector2f &p) {
+        return (b.x() - a.x()) * (p.y() - a.y()) - (b.y() - a.y()) * (p.x() - a.x());
+    };
+    // Samples exactly on an edge belong to only one of the two triangles sharing it
+    auto owns = [](const Eigen::Vector2f &a, const Eigen::Vector2f &b) {
+        Eigen::Vector2f d = b - a;
+        return d.y() > 0.0f || (d.y() == 0.0f && d.x() < 0.0f);
+    };
+
+    Eigen::Vector2f a = pixels[i0], b = pixels[i1], c = pixels[i2];
+    float area = edge(a, b, c);
+    if (!(std::abs(area) > 0.0f)) return;
+    if (area < 0.0f) {
+        std::swap(b, c);
+        std::swap(i1, i2);
+        area = -area;
+    }
+
+    int minX = std::max(0, (int)std::floor(std::min({a.x(), b.x(), c.x()})));
+    int maxX = std::min(m_width - 1, (int)std::ceil(std::max({a.x(), b.x(), c.x()})));
+    int minY = std::max(rowFrom, (int)std::floor(std::min({a.y(), b.y(), c.y()})));
+    int maxY = std::min(rowTo - 1, (int)std::ceil(std::max({a.y(), b.y(), c.y()})));
+    if (minX > maxX || minY > maxY) return;
+
+    const bool ownsAB = owns(a, b), ownsBC = owns(b, c), ownsCA = owns(c, a);
+    const int nbSamples = m_samplePos.size();
+    const std::vector<Eigen::Vector4f> &colors = call.mesh->colors();
+
+    for (int y = minY; y <= maxY; ++y) {
+        for (int x = minX; x <= maxX; ++x) {
+            // Fragment color, interpolated at the pixel center
+            if (call.maskStrength != nullptr && sampleMask(call.maskStrength, (x + 0.5f) / m_width, 1.0f - (y + 0.5f) / m_height) < MASK_EPS) continue;
+            Eigen::Vector4f color = strokeColor;
+            if (call.usePointColor) {
+                Eigen::Vector2f center(x + 0.5f, y + 0.5f);
+                float l0 = edge(b, c, center) / area, l1 = edge(c, a, center) / area;
+                color = l0 * colors[i0] + l1 * colors[i1] + (1.0f - l0 - l1) * colors[i2];
+            }
+            float alpha = color.w();
+            if (alpha <= 0.0f) continue;
+
+            Eigen::Vector4f *dst = &m_buffer[((size_t)y * m_width + x) * nbSamples];
+            for (int s = 0; s < nbSamples; ++s) {
+                Eigen::Vector2f p(x + m_samplePos[s].x(), y + m_samplePos[s].y());
+                float e0 = edge(a, b, p), e1 = edge(b, c, p), e2 = edge(c, a, p);
+                if (e0 < 0.0f || e1 < 0.0f || e2 < 0.0f) continue;
+                if ((e0 == 0.0f && !ownsAB) || (e1 == 0.0f && !ownsBC) || (e2 == 0.0f && !ownsCA)) continue;
+                dst[s] = color * alpha + dst[s] * (1.0f - alpha); // GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA
+            }
+        }
+    }
+}
+
+QImage StrokeRasterizer::image() const {
+    QImage img(m_width, m_height, QImage::Format_RGBA8888);
+    const int nbSamples = m_samplePos.size();
+    for (int y = 0; y < m_height; ++y) {
+        uchar *line = img.scanLine(y);
+        for (int x = 0; x < m_width; ++x) {
+            const Eigen::Vector4f *src = &m_buffer[((size_t)y * m_width + x) * nbSamples];
+            Eigen::Vector4f sum = Eigen::Vector4f::Zero();
+            for (int s = 0; s < nbSamples; ++s) sum += src[s];
+            sum /= (float)nbSamples;
+            for (int k = 0; k < 4; ++k) line[4 * x + k] = (uchar)std::lround(std::clamp(sum[k], 0.0f, 1.0f) * 255.0f);
+        }
+    }
+    return img;
+}
@@ -0,0 +1,140 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2024 Melvin Even <melvin.even@inria.fr>
+ *
+ * SPDX-License-Identifier: CECILL-2.1
+ */
+
+#ifndef STROKERASTERIZER_H
+#define STROKERASTERIZER_H
+
+#include <QColor>
+#include <QImage>
+#include <QMatrix4x4>
+#include <QTransform>
+
+#include <Eigen/Core>
+#include <vector>
+
+#include "point.h"
+#include "strokeinterval.h"
+
+class Stroke;
+class VectorKeyFrame;
+
+// CPU reference of the stroke shaders (stroke.vert/stroke.geom/stroke.frag).
+// StrokeMesh emits the same triangle strips as the geometry shader (make_quad, make_arc_strip, make_tri and
+// make_semi_circle_strip) and StrokeRasterizer blends them in a multisampled buffer like the offscreen FBO does.
+// Neither needs a GL context: they are meant for GPU-less export and for checking the GPU path against a reference.
+
+// Uniforms of the stroke program
+struct StrokeStyle {
+    QTransform view;                    // jitter * view (QTransform order, i.e. view * jitter in the vertex shader)
+    QMatrix4x4 proj;
+    Eigen::Vector2f winSize = Eigen::Vector2f(1920.0f, 1080.0f);
+    float zoom = 1.0f;
+    float thetaEpsilon = 0.01f;
+    float strokeWeight = 1.0f;
+    float time = 0.0f;
+    int capIdx[2] = {0, 0};
+    bool ignoreMask = true;
+    bool sticker = false;
+    const QImage *maskStrength = nullptr;  // mask texture (as read back by QOpenGLFramebufferObject::toImage), only used if !ignoreMask
+};
+
+// Triangle strips of a stroke in normalized device coordinates, stored as structure of arrays.
+// A mesh only depends on the stroke and its style, so it can be kept around while neither changes.
+class StrokeMesh {
+public:
+    void clear();
+
+    // Tessellate the segments [from, to] of a line buffer (see Stroke::lineBufferData), like a
+    // GL_LINE_STRIP_ADJACENCY draw starting at element from
+    void tessellate(const float *data, int size, int from, int to, const StrokeStyle &style);
+
+    // Tessellate an interval of a line buffer the way VectorKeyFrame::paintGroupGL draws it (caps included)
+    void tessellate(const float *data, int size, const Interval &interval, bool overshoot, StrokeStyle style);
+
+    inline int nbStrips() const { return m_strips.empty() ? 0 : (int)m_strips.size() - 1; }
+    inline int stripBegin(int i) const { return m_strips[i]; }
+    inline int stripEnd(int i) const { return m_strips[i + 1]; }
+    inline int nbVertices() const { return (int)m_positions.size(); }
+    inline bool empty() const { return m_positions.empty(); }
+
+    const std::vector<Eigen::Vector2f> &positions() const { return m_positions; }
+    const std::vector<float> &visibility() const { return m_visibility; }
+    const std::vector<Eigen::Vector4f> &colors() const { return m_colors; }
+
+private:
+    struct InVertex {
+        Eigen::Vector2f pos;            // NDC
+        float pressure, visibility;
+        int id;
+        Eigen::Vector4f color;
+    };
+
+    void emitVertex(const Eigen::Vector2f &pos, const InVertex &vtx);
+    void endPrimitive();
+    void makeQuad(const InVertex &v0, const InVertex &v1, const Eigen::Vector2f &n0, const Eigen::Vector2f &n1, float w0, float w1, const Eigen::Vector2f &winSize);
+    void makeSemiCircleStrip(const InVertex &v, float w, float o, const Eigen::Vector2f &winSize);
+    void makeArcStrip(const InVertex &v, float w, float thetaStart, float thetaEnd, float o, const Eigen::Vector2f &winSize);
+    void makeTri(const InVertex &v, float w, const Eigen::Vector2f &n0, const Eigen::Vector2f &n1, const Eigen::Vector2f &winSize);
+
+    std::vector<Eigen::Vector2f> m_positions;
+    std::vector<float> m_visibility;
+    std::vector<Eigen::Vector4f> m_colors;
+    std::vector<int> m_strips;          // first vertex of each strip, the last entry is the number of vertices
+};
+
+// Mesh of some intervals of a stroke, tessellated again only when the intervals or the style change.
+// Like the GL buffers of a stroke (see Stroke::createBuffers), the line buffer is built on the first call and kept until clear().
+class StrokeMeshCache {
+public:
+    const StrokeMesh &mesh(const Stroke *stroke, VectorKeyFrame *keyframe, const Point::VectorType *positions, const Intervals &intervals, bool overshoot, const StrokeStyle &style);
+    void clear();
+
+private:
+    bool matches(const Intervals &intervals, bool overshoot, const StrokeStyle &style) const;
+
+    std::vector<float> m_data;          // see Stroke::lineBufferData
+    int m_size = 0;
+    StrokeMesh m_mesh;
+    bool m_valid = false;
+    Intervals m_intervals;              // intervals and style of m_mesh
+    bool m_overshoot = false;
+    StrokeStyle m_style;
+};
+
+// Multisampled software framebuffer with the blending of the canvas (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA)
+class StrokeRasterizer {
+public:
+    struct DrawCall {
+        const StrokeMesh *mesh;
+        QColor strokeColor;
+        bool usePointColor = false;     // displayMode 1 of stroke.frag
+        const QImage *maskStrength = nullptr; // fragments where the mask is full are discarded (maskMode 0)
+    };
+
+    StrokeRasterizer(int width, int height, int samples = 8);
+
+    void clear(const QColor &color = QColor(255, 255, 255, 0));
+
+    // Draw the meshes in order, rows of the framebuffer are processed in parallel
+    void draw(const std::vector<DrawCall> &calls);
+    void draw(const StrokeMesh &mesh, const QColor &strokeColor, bool usePointColor = false);
+
+    // Resolve the samples
+    QImage image() const;
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    int samples() const { return (int)m_samplePos.size(); }
+
+private:
+    void drawTriangle(const DrawCall &call, const std::vector<Eigen::Vector2f> &pixels, int i0, int i1, int i2, const Eigen::Vector4f &strokeColor, int rowFrom, int rowTo);
+
+    int m_width, m_height;
+    std::vector<Eigen::Vector2f> m_samplePos;   // sample offsets in a pixel
+    std::vector<Eigen::Vector4f> m_buffer;      // straight RGBA, samples of a pixel are contiguous
+};
+
+#endif // STROKERASTERIZER_H
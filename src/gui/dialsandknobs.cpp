@@ -716,10 +716,17 @@ bool DialsAndKnobs::load(const QString& filename)
 }
 
 bool DialsAndKnobs::load(const QDomElement& root, bool set_sticky)
+{
+    _in_load = true;
+    bool ret = loadValues(root, set_sticky);
+    _in_load = false;
+    return ret;
+}
+
+bool DialsAndKnobs::loadValues(const QDomElement& root, bool set_sticky)
 {
     bool ret = true;
     int num_values_read = 0;
-    _in_load = true;
 
     QDomElement value_e = root.firstChildElement();
     while (!value_e.isNull())
@@ -757,7 +764,6 @@ bool DialsAndKnobs::load(const QDomElement& root, bool set_sticky)
         qWarning("DialsAndKnobs::load: read elements for %d of %d values",
                 num_values_read, dkValue::numValues());
     }*/
-    _in_load = false;
 	incrementFrameCounter();
     return ret;
 }
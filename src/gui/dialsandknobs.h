@@ -412,6 +412,8 @@ class DialsAndKnobs : public QDockWidget
 
     bool load(const QString& filename);
     bool load(const QDomElement& root, bool set_sticky = false);
+    // Same as load without a dock, e.g. when rendering without widgets
+    static bool loadValues(const QDomElement& root, bool set_sticky = false);
     bool save(const QString& filename) const;
     bool save(QDomDocument& doc, QDomElement& root, 
               bool only_sticky = false, int version = 0) const;
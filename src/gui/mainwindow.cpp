@@ -13,6 +13,7 @@
 #include <QStatusBar>
 #include <QPushButton>
 #include <QLabel>
+#include <QTimer>
 
 #include "mainwindow.h"
 #include "tabletcanvas.h"
@@ -37,6 +38,8 @@
 
 const int MAX_RECENT_WORKINGSET = 9;
 
+static dkBool k_exportHighRes("Options->Export->High res export", true);
+
 MainWindow::MainWindow(TabletCanvas* canvas) : m_canvas(canvas), m_projectDialog(nullptr), m_preferenceDialog(nullptr) {
     setCentralWidget(m_canvas);
     setUnifiedTitleAndToolBarOnMac(true);
@@ -101,9 +104,13 @@ MainWindow::MainWindow(TabletCanvas* canvas) : m_canvas(canvas), m_projectDialog
     m_editor->scrubTo(0);
 
     m_editor->tools()->setTool(Tool::Select);
+
+    m_fileManager->startAutosave(m_editor, m_dials_and_knobs);
+    QTimer::singleShot(0, this, &MainWindow::recoverAutosave);
 }
 
 MainWindow::~MainWindow() { 
+    m_fileManager->discardAutosave();
     m_fileManager->deleteWorkingDir();
 }
 
@@ -178,6 +185,7 @@ void MainWindow::newProject() {
         m_editor->undoStack()->clear();
         m_fileManager->createWorkingDir();
         m_fileManager->resetFileName();
+        m_fileManager->discardAutosave();
         setWindowTitle("[*]" + m_fileManager->fileName() + " - Frite");
         updateTitleSaveState(false);
     }
@@ -222,11 +230,30 @@ bool MainWindow::openProject(const QString& filename) {
         m_undoView->setEmptyLabel("Open project");
         m_editor->undoStack()->clear();
         m_editor->scrubTo(0);
+        m_fileManager->discardAutosave();
         return true;
     }
     return false;
 }
 
+// A journal left by a previous session means that it did not exit properly
+void MainWindow::recoverAutosave() {
+    if (!m_fileManager->hasAutosave()) return;
+
+    QString message = tr("Frite was not closed properly and the project as it was edited on %1 was found.").arg(QLocale().toString(m_fileManager->autosaveTime(), QLocale::ShortFormat));
+    int ret = QMessageBox::question(this, tr("Recover project"), message + tr("\nDo you want to restore it?"), QMessageBox::Yes | QMessageBox::No, QMessageBox::Yes);
+    if (ret == QMessageBox::Yes && m_fileManager->restoreAutosave(m_editor, m_dials_and_knobs)) {
+        statusBar()->showMessage("Project recovered", 3000);
+        setWindowTitle("[*]" + m_fileManager->fileName() + " - Frite");
+        updateTitleSaveState(false);
+        m_undoView->setEmptyLabel("Recovered project");
+        m_editor->undoStack()->clear();
+        m_editor->scrubTo(0);
+        return;
+    }
+    m_fileManager->discardRecovery();
+}
+
 bool MainWindow::saveProject(const QString& filename) {
     if (m_fileManager->save(filename, m_editor, m_dials_and_knobs)) {
         statusBar()->showMessage("Project saved", 3000);
@@ -235,6 +262,7 @@ bool MainWindow::saveProject(const QString& filename) {
         m_editor->undoStack()->beginMacro("Save project");
         m_editor->undoStack()->endMacro();
         m_editor->undoStack()->setClean();
+        m_fileManager->discardAutosave();
         return true;
     }
     return false;
@@ -269,7 +297,7 @@ void MainWindow::exportImageSequence() {
     // Export
     QSize exportSize = QSize(m_canvas->canvasRect().width(), m_canvas->canvasRect().height());
     // if (exportSize.width() < 3840 || exportSize.height() < 2160) exportSize.scale(1920, 1080, Qt::KeepAspectRatioByExpanding);
-    if (exportSize.width() < 3840 || exportSize.height() < 2160) exportSize.scale(3840, 2160, Qt::KeepAspectRatio);
+    if (k_exportHighRes && (exportSize.width() < 3840 || exportSize.height() < 2160)) exportSize.scale(3840, 2160, Qt::KeepAspectRatio);
     m_editor->exportFrames(strFilePath, exportSize);
     statusBar()->showMessage("Sequence exported", 3000);
 }
@@ -66,6 +66,7 @@ private slots:
     void updateColorIcon(const QColor &c);
     void updateTitleSaveState(bool saved);
     void exportImageSequence();
+    void recoverAutosave();
     // void importImageSequence();
 
 private:
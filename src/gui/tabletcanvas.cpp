@@ -127,6 +127,7 @@ TabletCanvas::TabletCanvas()
     connect(&k_AA, SIGNAL(valueChanged(bool)), this, SLOT(updateCursor(bool)));
     connect(&k_drawOffscreen, SIGNAL(valueChanged(bool)), this, SLOT(updateCurrentFrame(void)));
     connect(&k_drawTess, SIGNAL(valueChanged(bool)), this, SLOT(updateCurrentFrame(void)));
+    connect(&k_drawSplat, SIGNAL(valueChanged(bool)), this, SLOT(destroyStrokeBuffers(void)));
     connect(&k_displayMask, SIGNAL(valueChanged(bool)), this, SLOT(updateCurrentFrame(void)));
     connect(&k_displayMask, SIGNAL(valueChanged(bool)), this, SLOT(toggleDisplayMask(bool)));
     connect(&k_gridEdgeSize, SIGNAL(valueChanged(int)), this, SLOT(updateCurrentFrame(void)));
@@ -714,8 +715,8 @@ void TabletCanvas::paintGLInit(int offW, int offH, bool drawOffscreen, bool expo
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glEnable(GL_PROGRAM_POINT_SIZE);
     
-    double scaleW = offW / m_canvasRect.width();
-    double scaleH = offH / m_canvasRect.height();
+    double scaleW = (double)offW / m_canvasRect.width();
+    double scaleH = (double)offH / m_canvasRect.height();
 
     if (exportFrames) {
         glViewport(0, 0, offW, offH);
@@ -1625,6 +1626,12 @@ void TabletCanvas::toggleDisplayMask(bool b) {
 
 void TabletCanvas::updateDrawAggregate(bool draw) { update(); }
 
+// The line and splat modes do not use the same inbetween buffers, they are recreated on the next draw
+void TabletCanvas::destroyStrokeBuffers() {
+    m_editor->layers()->destroyBuffers();
+    update();
+}
+
 void TabletCanvas::selectAll() {
     VectorKeyFrame *key = currentKeyFrame();
     int layer = m_editor->layers()->currentLayerIndex();
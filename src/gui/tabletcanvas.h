@@ -124,6 +124,7 @@ class TabletCanvas : public QOpenGLWidget, protected QOpenGLExtraFunctions {
     void updateCursor();
     void updateCursor(bool b);
     void updateDrawAggregate(bool draw);
+    void destroyStrokeBuffers();
     void selectAll();
     void loadBackgrounds(QString dir);
     void toggleDisplayMask(bool b);
@@ -538,9 +538,7 @@ void TimeLineCells::deleteImage()
 
 void TimeLineCells::automaticRegistration(){
     Layer * layer = m_editor->layers()->layerAt(m_startLayerNumber);
-    for (VectorKeyFrame * key : layer->getSelectedKeyFrames()){
-        m_editor->registerFromRestPosition(key, true);
-    }
+    m_editor->registerFromRestPosition(layer->getSelectedKeyFrames());
 }
 
 void TimeLineCells::pasteKeyFrame(){
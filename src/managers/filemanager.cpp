@@ -10,10 +10,37 @@
 
 #include "filemanager.h"
 #include "editor.h"
+#include "layermanager.h"
+#include "layer.h"
+#include "vectorkeyframe.h"
+#include "playbackmanager.h"
 #include "dialsandknobs.h"
+#include "utils/chunkfile.h"
+#include "utils/archive.h"
 #include <JlCompress.h>
 #include <QDomElement>
+#include <QCoreApplication>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <QUndoStack>
+#include <QDataStream>
+#include <QTemporaryDir>
+#include <QSaveFile>
+#include <QtConcurrent>
+
+#include <cstring>
+
+// Version 2: keyframes payloads are saved in binary files of the data directory (see VectorKeyFrame::save)
+static const int DOCUMENT_VERSION = 2;
+static dkBool k_binaryPayloads("Options->Files->Binary keyframe payloads", true);
+static dkBool k_parallelArchive("Options->Files->Parallel compression", true);
+static dkInt k_snapshotInterval("Options->Files->Snapshot interval (min)", 5, 0, 60, 1);
+static const char JOURNAL_MAGIC[4] = {'F', 'R', 'J', 'R'};
+
+static void logThroughput(const char *operation, const QString &filename, qint64 bytes, qint64 ms) {
+    qDebug() << operation << filename << ":" << bytes / 1e6 << "MB in" << ms << "ms (" << (ms > 0 ? bytes / 1e3 / ms : 0.0) << "MB/s)";
+}
 
 FileManager::FileManager(QObject *parent)
     :  QObject(parent)
@@ -66,6 +93,9 @@ bool FileManager::load(const QString& filename, Editor *editor, DialsAndKnobs *d
         removeTmpDirectory(m_lastTempFolder);
         return false;
     }
+    if (root.attribute("version", "1").toInt() > DOCUMENT_VERSION) {
+        qWarning("This project was saved with a more recent version of Frite, it may not load correctly.");
+    }
 
     QDomElement editorElt = root.firstChildElement("editor");
 
@@ -76,8 +106,10 @@ bool FileManager::load(const QString& filename, Editor *editor, DialsAndKnobs *d
     QDomElement dkElt = root.firstChildElement("dials_and_knobs");
     if (dkElt.isNull()) {
         qWarning("Open project: no dials_and_knobs node found.\n");
-    } else {
+    } else if (dk != nullptr) {
         dk->load(dkElt);
+    } else {
+        DialsAndKnobs::loadValues(dkElt);
     }
 
     return true;
@@ -95,22 +127,19 @@ bool FileManager::save(const QString& filename, Editor *editor, DialsAndKnobs *d
         return false;
     }
 
+    // The payloads are written in a fresh directory that replaces the data directory once the project is serialized:
+    // the keyframes that were never accessed copy theirs from the data directory, the payloads of deleted keyframes are
+    // dropped with it
+    QString newDataDirPath;
     if(filename.endsWith(".fries")) {
         if(!QDir(m_workingDirPath).exists()) {
             createWorkingDir();
         }
 
-        QFileInfo dataInfo(m_dataDirPath);
-        if (!dataInfo.exists()) {
-            QDir dir(m_dataDirPath); // the directory where filePath is or will be saved
-            // creates a directory with the same name +".data"
-            if(!dir.mkpath(m_dataDirPath)) {
-                qWarning("Cannot create the data directory at temporary location \"%s\". Please make sure that you have sufficent permissions to save to that location and try again.", qPrintable(m_dataDirPath));
-                return false;
-            }
-        }
-        if(!dataInfo.isDir()) {
-            qWarning("Cannot use the data directory at temporary location \"%s\" since it is a file. Please move or delete that file and try again.",qPrintable(dataInfo.absoluteFilePath()));
+        newDataDirPath = QDir(m_workingDirPath).filePath("data.new");
+        QDir(newDataDirPath).removeRecursively();
+        if(!QDir().mkpath(newDataDirPath)) {
+            qWarning("Cannot create the data directory at temporary location \"%s\". Please make sure that you have sufficent permissions to save to that location and try again.", qPrintable(newDataDirPath));
             return false;
         }
     } else {
@@ -126,27 +155,39 @@ bool FileManager::save(const QString& filename, Editor *editor, DialsAndKnobs *d
 
     m_currentFileName = fileInfo.baseName();
 
-    QDomDocument xmlDoc("FriteDocument");
-    QDomElement root = xmlDoc.createElement("document");
-    xmlDoc.appendChild(root);
-
-    // Save editor and layers
-    editor->save(xmlDoc, root, m_dataDirPath);
-
-    // Save dials and knobs
-    dk->save(xmlDoc, root);
+    // Plain XML files (and .fries when binary payloads are disabled) are self-contained
+    bool binary = filename.endsWith(".fries") && k_binaryPayloads && ChunkFile::supported();
+    QDomDocument xmlDoc = serialize(editor, dk, binary ? newDataDirPath : QString());
 
     QTextStream out(file.data());
 
     const int indentSize = 2;
     xmlDoc.save(out, indentSize);
+    out.flush();
+    file->close();
 
     if(filename.endsWith(".fries")) {
-        if (!JlCompress::compressDir(filename, m_workingDirPath))
+        QString oldDataDirPath = QDir(m_workingDirPath).filePath("data.old");
+        QDir(oldDataDirPath).removeRecursively();
+        if ((QFileInfo::exists(m_dataDirPath) && !QDir().rename(m_dataDirPath, oldDataDirPath)) || !QDir().rename(newDataDirPath, m_dataDirPath)) {
+            qWarning("Cannot replace the data directory at temporary location \"%s\".", qPrintable(m_dataDirPath));
+            return false;
+        }
+        QDir(oldDataDirPath).removeRecursively();
+        for (int i = 0; i < editor->layers()->layersCount(); ++i) {
+            editor->layers()->layerAt(i)->payloadsMoved(m_dataDirPath);
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        qint64 bytes = 0;
+        bool compressed = k_parallelArchive ? Archive::compressDir(filename, m_workingDirPath, &bytes) : JlCompress::compressDir(filename, m_workingDirPath);
+        if (!compressed)
         {
             qWarning("Failed to compress file.");
             return false;
         }
+        if (bytes > 0) logThroughput("Compressed", filename, bytes, timer.elapsed());
     }
 
     m_filePath = filename;
@@ -154,6 +195,22 @@ bool FileManager::save(const QString& filename, Editor *editor, DialsAndKnobs *d
     return true;
 }
 
+QDomDocument FileManager::serialize(Editor *editor, DialsAndKnobs *dk, const QString &dataPath, bool keyframes) const
+{
+    QDomDocument xmlDoc("FriteDocument");
+    QDomElement root = xmlDoc.createElement("document");
+    xmlDoc.appendChild(root);
+    root.setAttribute("version", dataPath.isEmpty() ? 1 : DOCUMENT_VERSION);
+
+    // Save editor and layers
+    editor->save(xmlDoc, root, dataPath, keyframes);
+
+    // Save dials and knobs
+    if (dk != nullptr) dk->save(xmlDoc, root);
+
+    return xmlDoc;
+}
+
 void FileManager::createWorkingDir()
 {
     QString strFolderName;
@@ -206,7 +263,507 @@ void FileManager::unzip(const QString& strZipFile, const QString& strUnzipTarget
     removeTmpDirectory(strUnzipTarget);
 
     // --creates a new decompression directory
-    JlCompress::extractDir(strZipFile, strUnzipTarget);
+    QElapsedTimer timer;
+    timer.start();
+    qint64 bytes = 0;
+    if (k_parallelArchive) {
+        if (!Archive::extractDir(strZipFile, strUnzipTarget, &bytes)) qWarning("Failed to decompress \"%s\".", qPrintable(strZipFile));
+        logThroughput("Decompressed", strZipFile, bytes, timer.elapsed());
+    } else {
+        JlCompress::extractDir(strZipFile, strUnzipTarget);
+    }
 
     m_lastTempFolder = strUnzipTarget;
 }
+
+// Each session autosaves in its own subdirectory, next to the lock file it holds while it runs
+QString FileManager::autosaveRootPath()
+{
+    return QDir::tempPath() + "/Frite/autosave/";
+}
+
+// base.txt: the project file the journal of a session applies to, and how much of the journal it already contains
+static bool writeJournalBase(const QString &dirPath, const QString &basePath, qint64 offset)
+{
+    QSaveFile file(dirPath + "base.txt");
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) return false;
+    file.write(basePath.toUtf8() + "\n" + QByteArray::number(offset));
+    return file.commit();
+}
+
+static QString readJournalBase(const QString &dirPath, qint64 &offset)
+{
+    offset = 0;
+    QFile file(dirPath + "base.txt");
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) return QString();
+    QString basePath = QString::fromUtf8(file.readLine()).remove('\n');
+    offset = file.readLine().toLongLong();
+    return basePath;
+}
+
+/**
+ * Start recording the edits of the project edited in editor: whenever the undo stack changes, the keyframes touched
+ * by the change are appended to a journal (see journal) and, every k_snapshotInterval minutes, the journal is
+ * compacted into a snapshot (see autosave).
+ * The journal and snapshot are saved in a directory of this session, locked until the application exits. The
+ * directory is removed by discardAutosave when the project is saved or closed normally, so a journal in a directory
+ * whose lock is stale means that its session did not exit properly (see hasAutosave and restoreAutosave).
+ */
+void FileManager::startAutosave(Editor *editor, DialsAndKnobs *dk)
+{
+    m_autosaveEditor = editor;
+    m_autosaveDk = dk;
+    m_autosavePool.setMaxThreadCount(1);
+
+    QString session = QString("%1-%2").arg(QDateTime::currentMSecsSinceEpoch()).arg(QCoreApplication::applicationPid());
+    m_autosaveDirPath = autosaveRootPath() + session + "/";
+    QDir().mkpath(autosaveRootPath());
+    m_autosaveLock = std::make_unique<QLockFile>(autosaveRootPath() + session + ".lock");
+    m_autosaveLock->setStaleLockTime(0); // only stale if the session is not running anymore
+    if (!m_autosaveLock->tryLock()) qWarning("Snapshot: cannot lock \"%s\".", qPrintable(m_autosaveLock->fileName()));
+
+    connect(editor->undoStack(), &QUndoStack::indexChanged, this, &FileManager::journal);
+    resetJournal(m_filePath);
+
+    m_sinceAutosave.start();
+    m_autosaveTimer.setInterval(30000);
+    connect(&m_autosaveTimer, &QTimer::timeout, this, [this]() {
+        if (k_snapshotInterval > 0 && m_sinceAutosave.elapsed() >= k_snapshotInterval * 60000) autosave();
+    });
+    m_autosaveTimer.start();
+}
+
+/**
+ * Append a record to the journal of this session: the project without the content of its keyframes (see
+ * Editor::save), the keyframes that moved and the keyframes touched since the previous record, with their payloads.
+ * A keyframe is touched if it was never journaled, if its animation was invalidated (see
+ * VectorKeyFrame::animationVersion) or if it was around the current frame of the current layer when a command was
+ * done, undone or redone. The keyframes that are still not loaded cannot have been edited and are never serialized.
+ * The keyframes are serialized on the GUI thread but each in its own document, the records are converted and
+ * appended by the autosave thread.
+ */
+void FileManager::journal()
+{
+    if (m_autosaveEditor == nullptr || m_autosaveDirPath.isEmpty()) return;
+
+    struct KeyRecord {
+        int layer;
+        int frame;
+        QDomDocument doc;
+        std::shared_ptr<ChunkWriter> payload;
+    };
+    struct MoveRecord {
+        int fromLayer;
+        int fromFrame;
+        int toLayer;
+        int toFrame;
+    };
+
+    Editor *editor = m_autosaveEditor;
+    LayerManager *layers = editor->layers();
+    QUndoStack *stack = editor->undoStack();
+
+    // the keyframe at the current frame and its neighbours
+    QSet<VectorKeyFrame *> around;
+    Layer *currentLayer = layers->currentLayer();
+    if (currentLayer != nullptr) {
+        const QMap<int, VectorKeyFrame *> &keyFrames = currentLayer->keyFramesNoLoad();
+        auto it = keyFrames.upperBound(editor->playback()->currentFrame());
+        if (it != keyFrames.end()) around.insert(it.value());
+        for (int i = 0; i < 2 && it != keyFrames.begin(); ++i) around.insert((--it).value());
+    }
+
+    // keyframes edited by the commands done, undone or redone since the previous record
+    QSet<VectorKeyFrame *> touched;
+    int index = stack->index();
+    if (stack->count() == 0) {
+        m_commandKeyFrames.clear();
+    } else {
+        for (int i = std::min(index, m_undoIndex); i < std::max(index, m_undoIndex) && i < stack->count(); ++i) {
+            QSet<VectorKeyFrame *> &keyFrames = m_commandKeyFrames[stack->command(i)];
+            keyFrames.unite(around);
+            touched.unite(keyFrames);
+        }
+        // forget the commands deleted by the stack
+        if (m_commandKeyFrames.size() > stack->count()) {
+            QHash<const QUndoCommand *, QSet<VectorKeyFrame *>> commandKeyFrames;
+            for (int i = 0; i < stack->count(); ++i) {
+                auto it = m_commandKeyFrames.find(stack->command(i));
+                if (it != m_commandKeyFrames.end()) commandKeyFrames.insert(it.key(), it.value());
+            }
+            m_commandKeyFrames.swap(commandKeyFrames);
+        }
+    }
+    m_undoIndex = index;
+
+    bool binary = k_binaryPayloads && ChunkFile::supported();
+    std::vector<KeyRecord> keys;
+    std::vector<MoveRecord> moves;
+    QHash<VectorKeyFrame *, JournalState> journaled;
+    for (int i = 0; i < layers->layersCount(); ++i) {
+        Layer *layer = layers->layerAt(i);
+        const QMap<int, VectorKeyFrame *> &keyFrames = layer->keyFramesNoLoad();
+        for (auto it = keyFrames.begin(); it != keyFrames.end(); ++it) {
+            VectorKeyFrame *keyframe = it.value();
+            JournalState state{layer->id(), it.key(), keyframe->animationVersion()};
+            auto previous = m_journaled.constFind(keyframe);
+            if (!layer->isPending(keyframe) && (previous == m_journaled.constEnd() || previous->version != state.version || touched.contains(keyframe))) {
+                KeyRecord key{state.layer, state.frame, QDomDocument(), binary ? std::make_shared<ChunkWriter>() : nullptr};
+                QDomElement root = key.doc.createElement("layer");
+                key.doc.appendChild(root);
+                keyframe->saveElement(key.doc, root, key.payload.get(), state.layer, state.frame);
+                keys.push_back(key);
+            } else if (previous != m_journaled.constEnd() && (previous->layer != state.layer || previous->frame != state.frame)) {
+                moves.push_back({previous->layer, previous->frame, state.layer, state.frame});
+            }
+            journaled.insert(keyframe, state);
+        }
+    }
+    m_journaled.swap(journaled);
+
+    QDomDocument skeleton = serialize(editor, m_autosaveDk, QString(), false);
+    m_autosaveDirty = true;
+
+    QString autosaveDirPath = m_autosaveDirPath;
+    QString basePath = m_journalBasePath;
+    QString projectPath = m_filePath;
+    QtConcurrent::run(&m_autosavePool, [skeleton, keys = std::move(keys), moves = std::move(moves), autosaveDirPath, basePath, projectPath]() {
+        QDir().mkpath(autosaveDirPath);
+        // first record since the journal was reset, a snapshot replaces the base when the journal is compacted
+        if (!QFile::exists(autosaveDirPath + "base.txt")) writeJournalBase(autosaveDirPath, basePath, 0);
+        QFile project(autosaveDirPath + "project.txt");
+        if (project.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) project.write(projectPath.toUtf8());
+        project.close();
+
+        QByteArray record;
+        QDataStream out(&record, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_6_0);
+        out << skeleton.toByteArray() << quint32(moves.size());
+        for (const MoveRecord &move : moves) {
+            out << qint32(move.fromLayer) << qint32(move.fromFrame) << qint32(move.toLayer) << qint32(move.toFrame);
+        }
+        out << quint32(keys.size());
+        for (const KeyRecord &key : keys) {
+            out << qint32(key.layer) << qint32(key.frame) << key.doc.toByteArray() << (key.payload != nullptr ? key.payload->toByteArray() : QByteArray());
+        }
+
+        QFile file(autosaveDirPath + "journal.frj");
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+            qWarning("Journal: cannot write \"%s\".", qPrintable(file.fileName()));
+            return;
+        }
+        QDataStream header(&file);
+        header.writeRawData(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+        header << quint32(record.size());
+        file.write(record);
+        file.close();
+    });
+}
+
+/**
+ * Rebuild a project from the journal of a session (see journal) in outDirPath, as a working directory (main.xml and
+ * data directory) to compress into a .fries.
+ * The keyframes of basePath (a .fries or .xml project, or empty for a new project) are replaced by the journaled ones,
+ * in the order of the records, and the last record gives the rest of the project. The first journalOffset bytes of
+ * the journal are already in the base and skipped, a last record that was not completely written is ignored.
+ * Only files are accessed, this can be called from any thread.
+ */
+bool FileManager::replayJournal(const QString &basePath, const QString &journalPath, qint64 journalOffset, const QString &outDirPath)
+{
+    // the element of a keyframe is kept alive by its document
+    struct KeySource {
+        QDomDocument doc;
+        QDomElement element;
+        QByteArray payload;
+        QString payloadPath; //< the payload is in the base
+    };
+    QHash<QPair<int, int>, KeySource> keys;
+    QDomDocument skeleton;
+
+    QTemporaryDir baseDir;
+    if (!basePath.isEmpty()) {
+        QString baseXMLPath = basePath, baseDataPath;
+        if (basePath.endsWith(".fries")) {
+            if (!baseDir.isValid() || !Archive::extractDir(basePath, baseDir.path())) {
+                qWarning("Journal: cannot extract \"%s\".", qPrintable(basePath));
+                return false;
+            }
+            baseXMLPath = QDir(baseDir.path()).filePath("main.xml");
+            baseDataPath = QDir(baseDir.path()).filePath("data");
+        }
+        QFile file(baseXMLPath);
+        if (!file.open(QIODevice::ReadOnly) || !skeleton.setContent(&file)) {
+            qWarning("Journal: cannot read \"%s\".", qPrintable(baseXMLPath));
+            return false;
+        }
+        QDomElement editorElt = skeleton.documentElement().firstChildElement("editor");
+        for (QDomElement layerElt = editorElt.firstChildElement("layer"); !layerElt.isNull(); layerElt = layerElt.nextSiblingElement("layer")) {
+            int layer = layerElt.attribute("id").toInt();
+            for (QDomElement keyElt = layerElt.firstChildElement("vectorkeyframe"); !keyElt.isNull(); keyElt = keyElt.nextSiblingElement("vectorkeyframe")) {
+                QString payloadPath = keyElt.hasAttribute("data") ? QDir(baseDataPath).filePath(keyElt.attribute("data")) : QString();
+                keys.insert({layer, keyElt.attribute("frame").toInt()}, {skeleton, keyElt, QByteArray(), payloadPath});
+            }
+        }
+    }
+
+    QFile journal(journalPath);
+    if (journal.open(QIODevice::ReadOnly) && journal.seek(std::min(journalOffset, journal.size()))) {
+        QDataStream in(&journal);
+        char magic[sizeof(JOURNAL_MAGIC)];
+        while (in.readRawData(magic, sizeof(magic)) == sizeof(magic) && memcmp(magic, JOURNAL_MAGIC, sizeof(magic)) == 0) {
+            quint32 size;
+            in >> size;
+            // the session stopped while this record was appended
+            if (in.status() != QDataStream::Ok || journal.bytesAvailable() < size) break;
+
+            QDataStream record(journal.read(size));
+            record.setVersion(QDataStream::Qt_6_0);
+            QByteArray skeletonXML;
+            quint32 nbMoves, nbKeys;
+            record >> skeletonXML >> nbMoves;
+            std::vector<std::pair<QPair<int, int>, QPair<int, int>>> moves;
+            for (quint32 i = 0; i < nbMoves && record.status() == QDataStream::Ok; ++i) {
+                qint32 fromLayer, fromFrame, toLayer, toFrame;
+                record >> fromLayer >> fromFrame >> toLayer >> toFrame;
+                moves.push_back({{fromLayer, fromFrame}, {toLayer, toFrame}});
+            }
+            record >> nbKeys;
+            std::vector<std::pair<QPair<int, int>, KeySource>> sources;
+            for (quint32 i = 0; i < nbKeys && record.status() == QDataStream::Ok; ++i) {
+                qint32 layer, frame;
+                QByteArray xml;
+                KeySource source;
+                record >> layer >> frame >> xml >> source.payload;
+                source.doc.setContent(xml);
+                source.element = source.doc.documentElement().firstChildElement("vectorkeyframe");
+                sources.push_back({{layer, frame}, source});
+            }
+            QDomDocument recordSkeleton;
+            if (record.status() != QDataStream::Ok || !recordSkeleton.setContent(skeletonXML)) {
+                qWarning("Journal: corrupted record in \"%s\".", qPrintable(journalPath));
+                break;
+            }
+
+            // the keyframes move at once, e.g. when a range of keyframes is shifted
+            std::vector<std::pair<QPair<int, int>, KeySource>> moved;
+            for (const auto &move : moves) {
+                if (keys.contains(move.first)) moved.push_back({move.second, keys.take(move.first)});
+            }
+            for (const auto &key : moved) keys.insert(key.first, key.second);
+            for (const auto &key : sources) keys.insert(key.first, key.second);
+            skeleton = recordSkeleton;
+        }
+    }
+    if (skeleton.documentElement().isNull()) {
+        qWarning("Journal: nothing to replay.");
+        return false;
+    }
+
+    QDir outDir(outDirPath);
+    if (!outDir.mkpath("data")) {
+        qWarning("Journal: cannot create \"%s\".", qPrintable(outDir.filePath("data")));
+        return false;
+    }
+    QDomElement editorElt = skeleton.documentElement().firstChildElement("editor");
+    for (QDomElement layerElt = editorElt.firstChildElement("layer"); !layerElt.isNull(); layerElt = layerElt.nextSiblingElement("layer")) {
+        int layer = layerElt.attribute("id").toInt();
+        QDomElement keyElt = layerElt.firstChildElement("vectorkeyframe");
+        while (!keyElt.isNull()) {
+            QDomElement nextElt = keyElt.nextSiblingElement("vectorkeyframe");
+            int frame = keyElt.attribute("frame").toInt();
+            auto it = keys.constFind({layer, frame});
+            if (it == keys.constEnd() || it->element.isNull()) {
+                qWarning("Journal: keyframe %d of layer %d was never journaled.", frame, layer);
+                keyElt = nextElt;
+                continue;
+            }
+            QDomElement contentElt = skeleton.importNode(it->element, true).toElement();
+            contentElt.setAttribute("frame", frame);
+            if (contentElt.hasAttribute("data")) {
+                QString fileName = VectorKeyFrame::payloadFileName(layer, frame);
+                QString payloadPath = outDir.filePath("data/" + fileName);
+                bool written = false;
+                if (!it->payloadPath.isEmpty()) {
+                    written = QFile::copy(it->payloadPath, payloadPath);
+                } else {
+                    QFile payload(payloadPath);
+                    written = payload.open(QIODevice::WriteOnly) && payload.write(it->payload) == it->payload.size();
+                }
+                if (!written) {
+                    qWarning("Journal: cannot write \"%s\".", qPrintable(payloadPath));
+                    return false;
+                }
+                contentElt.setAttribute("data", fileName);
+            }
+            layerElt.replaceChild(contentElt, keyElt);
+            keyElt = nextElt;
+        }
+    }
+    skeleton.documentElement().setAttribute("version", DOCUMENT_VERSION);
+
+    QFile file(outDir.filePath("main.xml"));
+    if (!file.open(QFile::WriteOnly | QFile::Text)) {
+        qWarning("Journal: cannot write \"%s\".", qPrintable(file.fileName()));
+        return false;
+    }
+    QTextStream out(&file);
+    skeleton.save(out, 2);
+    out.flush();
+    return true;
+}
+
+/**
+ * Compact the journal of this session into a snapshot, which becomes the base of the next records.
+ * The snapshot is rebuilt by the autosave thread from the previous base and the journal (see replayJournal), the
+ * project is not serialized again.
+ */
+bool FileManager::autosave()
+{
+    // the previous snapshot is still being written
+    if (m_autosaveEditor == nullptr || !m_autosaveDirty || m_autosaveFuture.isRunning()) return false;
+
+    m_autosaveDirty = false;
+    m_sinceAutosave.restart();
+
+    QString autosaveDirPath = m_autosaveDirPath;
+    m_autosaveFuture = QtConcurrent::run(&m_autosavePool, [autosaveDirPath]() {
+        QElapsedTimer timer;
+        timer.start();
+        qint64 offset;
+        QString basePath = readJournalBase(autosaveDirPath, offset);
+        QString journalPath = autosaveDirPath + "journal.frj";
+        qint64 journalSize = QFileInfo(journalPath).size();
+
+        QString snapshotPath = autosaveDirPath + "snapshot";
+        QString autosaveFile = autosaveDirPath + "autosave.fries";
+        QDir(snapshotPath).removeRecursively();
+        bool compacted = replayJournal(basePath, journalPath, offset, snapshotPath) && Archive::compressDir(autosaveFile + ".part", snapshotPath);
+        QDir(snapshotPath).removeRecursively();
+        if (!compacted) {
+            qWarning("Snapshot: failed to compact the journal.");
+            QFile::remove(autosaveFile + ".part");
+            return;
+        }
+
+        // replace the previous snapshot only once the new one is complete, then start a new journal
+        QFile::remove(autosaveFile);
+        QFile::rename(autosaveFile + ".part", autosaveFile);
+        if (!writeJournalBase(autosaveDirPath, autosaveFile, journalSize)) return;
+        QFile::remove(journalPath);
+        writeJournalBase(autosaveDirPath, autosaveFile, 0);
+        qDebug() << "Snapshot: journal compacted in" << timer.elapsed() << "ms";
+    });
+    return true;
+}
+
+/**
+ * Look for the most recent journal left by a session that did not exit properly, i.e. whose lock is stale.
+ * Its lock is taken so that no other running session offers to recover it. The directories of the other stale
+ * sessions without a journal or snapshot are removed.
+ */
+bool FileManager::hasAutosave()
+{
+    if (m_recoveryLock != nullptr) return true;
+
+    QDir root(autosaveRootPath());
+    for (const QFileInfo &session : root.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Time)) {
+        QString dirPath = session.absoluteFilePath() + "/";
+        if (QFileInfo(dirPath) == QFileInfo(m_autosaveDirPath)) continue;
+        auto lock = std::make_unique<QLockFile>(root.filePath(session.fileName() + ".lock"));
+        lock->setStaleLockTime(0);
+        if (!lock->tryLock()) continue; // the session is running
+        if (!QFile::exists(dirPath + "journal.frj") && !QFile::exists(dirPath + "autosave.fries")) {
+            QDir(dirPath).removeRecursively();
+            continue;
+        }
+        m_recoveryDirPath = dirPath;
+        m_recoveryLock = std::move(lock);
+        return true;
+    }
+    return false;
+}
+
+// Time of the last edit recorded by the session found by hasAutosave
+QDateTime FileManager::autosaveTime() const
+{
+    QFileInfo journal(m_recoveryDirPath + "journal.frj");
+    return journal.exists() ? journal.lastModified() : QFileInfo(m_recoveryDirPath + "autosave.fries").lastModified();
+}
+
+bool FileManager::restoreAutosave(Editor *editor, DialsAndKnobs *dk)
+{
+    if (m_recoveryLock == nullptr) return false;
+
+    QString projectPath;
+    QFile project(m_recoveryDirPath + "project.txt");
+    if (project.open(QIODevice::ReadOnly | QIODevice::Text)) projectPath = QString::fromUtf8(project.readAll());
+    project.close();
+
+    // the recovered project becomes the snapshot of this session, it is kept until the restored project is saved
+    m_autosavePool.waitForDone();
+    QDir(m_autosaveDirPath).removeRecursively();
+    QDir().mkpath(m_autosaveDirPath);
+    QString autosaveFile = m_autosaveDirPath + "autosave.fries";
+    qint64 offset;
+    QString basePath = readJournalBase(m_recoveryDirPath, offset);
+    QTemporaryDir replayDir;
+    bool replayed = replayDir.isValid() && replayJournal(basePath, m_recoveryDirPath + "journal.frj", offset, replayDir.path())
+                    && Archive::compressDir(autosaveFile, replayDir.path());
+    discardRecovery();
+    if (!replayed) {
+        qWarning("Recovery: cannot replay the journal.");
+        QFile::remove(autosaveFile);
+        return false;
+    }
+
+    if (!load(autosaveFile, editor, dk)) return false;
+    resetJournal(autosaveFile);
+
+    // saving the restored project overwrites the original one
+    m_filePath = projectPath;
+    m_currentFileName = projectPath.isEmpty() ? "untitled" : QFileInfo(projectPath).baseName();
+    return true;
+}
+
+// Remove the journal found by hasAutosave and release its session
+void FileManager::discardRecovery()
+{
+    if (m_recoveryLock == nullptr) return;
+    QDir(m_recoveryDirPath).removeRecursively();
+    m_recoveryLock->unlock();
+    m_recoveryLock.reset();
+    m_recoveryDirPath.clear();
+}
+
+// Remove the journal and snapshot of this session, the project file is the base of the next records
+void FileManager::discardAutosave()
+{
+    m_autosavePool.waitForDone();
+    if (!m_autosaveDirPath.isEmpty()) QDir(m_autosaveDirPath).removeRecursively();
+    m_autosaveDirty = false;
+    m_sinceAutosave.restart();
+    resetJournal(m_filePath);
+}
+
+/**
+ * The keyframes of the editor are in basePath where they are now, they are journaled again only once touched.
+ * Without base, every keyframe is journaled by the next record.
+ */
+void FileManager::resetJournal(const QString &basePath)
+{
+    m_journalBasePath = basePath;
+    m_journaled.clear();
+    m_commandKeyFrames.clear();
+    if (m_autosaveEditor == nullptr) return;
+    m_undoIndex = m_autosaveEditor->undoStack()->index();
+    if (basePath.isEmpty()) return;
+
+    LayerManager *layers = m_autosaveEditor->layers();
+    for (int i = 0; i < layers->layersCount(); ++i) {
+        Layer *layer = layers->layerAt(i);
+        const QMap<int, VectorKeyFrame *> &keyFrames = layer->keyFramesNoLoad();
+        for (auto it = keyFrames.begin(); it != keyFrames.end(); ++it) {
+            m_journaled.insert(it.value(), {layer->id(), it.key(), it.value()->animationVersion()});
+        }
+    }
+}
@@ -11,12 +11,24 @@
 #ifndef OBJECTSAVELOADER_H
 #define OBJECTSAVELOADER_H
 
+#include <QDateTime>
 #include <QObject>
 #include <QString>
 #include <QDomElement>
+#include <QElapsedTimer>
+#include <QFuture>
+#include <QHash>
+#include <QLockFile>
+#include <QSet>
+#include <QThreadPool>
+#include <QTimer>
+
+#include <memory>
 
 class Editor;
 class DialsAndKnobs;
+class VectorKeyFrame;
+class QUndoCommand;
 
 class FileManager : public QObject
 {
@@ -25,18 +37,33 @@ class FileManager : public QObject
 public:
     FileManager(QObject* parent = 0);
 
+    // dk can be null when there is no dock, the dial values are then still loaded but not saved
     bool load(const QString& fileName, Editor *editor, DialsAndKnobs *dk);
     bool save(const QString& filename, Editor *editor, DialsAndKnobs *dk);
     
     void createWorkingDir();
     void deleteWorkingDir();
 
-    void resetFileName() { m_currentFileName = "untitled"; }
+    void resetFileName() { m_currentFileName = "untitled"; m_filePath.clear(); }
 
     QString fileName() const { return m_currentFileName; }
     QString filePath() const { return m_filePath; }
 
+    void startAutosave(Editor *editor, DialsAndKnobs *dk);
+    bool autosave();
+    bool hasAutosave();
+    QDateTime autosaveTime() const;
+    bool restoreAutosave(Editor *editor, DialsAndKnobs *dk);
+    void discardAutosave();
+    void discardRecovery();
+
+    static bool replayJournal(const QString &basePath, const QString &journalPath, qint64 journalOffset, const QString &outDirPath);
+
 private:
+    static QString autosaveRootPath();
+    QDomDocument serialize(Editor *editor, DialsAndKnobs *dk, const QString &dataPath, bool keyframes = true) const;
+    void journal();
+    void resetJournal(const QString &basePath);
     bool removeTmpDirectory(const QString &dirName);
     void unzip(const QString& strZipFile, const QString& strUnzipTarget);
 
@@ -48,6 +75,28 @@ private:
     QString m_workingDirPath; //< the folder that pclx will uncompress to.
     QString m_dataDirPath;    //< the folder which contains all bitmap & vector image & sound files.
     QString m_mainXMLFile;    //< the location of main.xml
+
+    Editor *m_autosaveEditor = nullptr;
+    DialsAndKnobs *m_autosaveDk = nullptr;
+    QString m_autosaveDirPath;      //< snapshots of this session
+    std::unique_ptr<QLockFile> m_autosaveLock;  //< held while the session runs
+    QString m_recoveryDirPath;      //< snapshot of a session that did not exit properly (see hasAutosave)
+    std::unique_ptr<QLockFile> m_recoveryLock;
+    QThreadPool m_autosavePool;     //< single thread appending to the journal and writing the snapshots
+    QFuture<void> m_autosaveFuture; //< snapshot being written
+    QTimer m_autosaveTimer;
+    QElapsedTimer m_sinceAutosave;
+    bool m_autosaveDirty = false;   //< the journal was appended to since the last snapshot
+
+    struct JournalState {
+        int layer;
+        int frame;
+        unsigned int version;
+    };
+    QString m_journalBasePath;      //< project file the journal applies to (empty if new project)
+    QHash<VectorKeyFrame *, JournalState> m_journaled;  //< where the keyframes are in the base and journal, and their animation version then
+    QHash<const QUndoCommand *, QSet<VectorKeyFrame *>> m_commandKeyFrames; //< keyframes around the current frame when each command was done
+    int m_undoIndex = 0;            //< undo stack index of the last journal record
 };
 
 #endif // OBJECTSAVELOADER_H
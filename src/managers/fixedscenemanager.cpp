@@ -34,7 +34,7 @@ void FixedSceneManager::setScene(QGraphicsScene *scene) {
 */
 void FixedSceneManager::updateKeyChart(VectorKeyFrame *keyframe) {
     Tool *currentTool = m_editor->tools()->currentTool();
-    if (currentTool != nullptr && !currentTool->isChartTool()) keyframe = nullptr;
+    if (currentTool == nullptr || !currentTool->isChartTool()) keyframe = nullptr;
     m_keyChart->refresh(keyframe);
     m_keyChart->update();
     m_scene->update();
@@ -30,6 +30,7 @@ static dkBool k_arap("Warp->ARAP", true);
 static dkSlider k_iterationGrid("Warp->Rigidity (#regularization)", 20, 1, 450, 1);
 dkInt k_cellSize("Options->Grid->Cell Size", 16, 1, 64, 1);
 dkBool k_useDeformAsSource("Warp->Plastic deformation", false);
+static dkBool k_batchStrokeInsertion("Options->Grid->Batch stroke insertion", true);
 
 GridManager::GridManager(QObject *pParent) : BaseManager(pParent) {
     m_deformRange = k_deformRange;
@@ -51,17 +52,46 @@ void GridManager::setDeformRange(int k) {
 bool GridManager::addStrokeToGrid(Group *group, Stroke *stroke, Interval &interval) {
     Lattice *grid = group->lattice();
     std::vector<QuadPtr> newQuads;
+
+    // Rasterize the whole segment at once, only the corners of the new quads need to be checked for bowties
+    if (k_batchStrokeInsertion && grid->addStrokeQuads(stroke, interval, newQuads)) {
+        grid->enforceManifoldness(group, newQuads);
+    } else {
+        addStrokeToGridPerPoint(group, stroke, interval, newQuads);
+    }
+
+    // Propagate deformation to new quads (TARGET_POS, etc)
+    if (!newQuads.empty()) {
+        group->lattice()->isConnected();
+        if (newQuads.size() != grid->quads().size()) {
+            propagateDeformToNewQuads(group, grid, newQuads);
+        }
+        group->setGridDirty();
+        group->lattice()->setBackwardUVDirty(true);
+    }
+
+    // Bake the new stroke segment in the lattice + compute UVs
+    bakeStrokeInGrid(grid, stroke, interval.from(), interval.to());
+    grid->bakeForwardUV(stroke, interval, group->uvs());
+
+    return !newQuads.empty();
+}
+
+/**
+ * Add the quads under each point of the stroke segment one at a time.
+ * Used when the lattice is deformed in rest space and cells cannot be found from the rest position alone.
+ */
+void GridManager::addStrokeToGridPerPoint(Group *group, Stroke *stroke, Interval &interval, std::vector<QuadPtr> &newQuads) {
+    Lattice *grid = group->lattice();
     Point *p;
     Point::VectorType pos, prevPos;
     bool newQuad = false;
     QuadPtr q;
 
     // Go through each point in the stroke between fromIdx and toIdx, if a point does not intersect the lattice add a new quad at the point position
-    int nbCols = grid->nbCols();
     for (size_t i = interval.from(); i <= interval.to(); ++i) {
         p = stroke->points()[i];
         pos = p->pos();
-        std::cout << "pos: " << pos.transpose() << std::endl;
         newQuad = false;
         q = grid->addQuad(pos, newQuad);
         if (newQuad) newQuads.push_back(q);
@@ -87,23 +117,7 @@ bool GridManager::addStrokeToGrid(Group *group, Stroke *stroke, Interval &interv
     }
 
     // Recheck for bowtie corners
-    group->lattice()->enforceManifoldness(group);
-
-    // Propagate deformation to new quads (TARGET_POS, etc)
-    if (!newQuads.empty()) {
-        group->lattice()->isConnected();
-        if (newQuads.size() != grid->quads().size()) {
-            propagateDeformToNewQuads(group, grid, newQuads);
-        }
-        group->setGridDirty();
-        group->lattice()->setBackwardUVDirty(true);
-    }
-
-    // Bake the new stroke segment in the lattice + compute UVs
-    bakeStrokeInGrid(grid, stroke, interval.from(), interval.to());
-    grid->bakeForwardUV(stroke, interval, group->uvs());
-
-    return !newQuads.empty();
+    grid->enforceManifoldness(group);
 }
 
 bool GridManager::addStrokeToGrid(Group *group, Stroke *stroke, Intervals &intervals) {
@@ -126,9 +140,9 @@ bool GridManager::constructGrid(Group *group, ViewManager *view, unsigned int ce
 
     grid->clear();
     grid->setCellSize(cellSize);
-    grid->setNbCols(std::ceil((float)m_editor->tabletCanvas()->canvasRect().width() / cellSize));
-    grid->setNbRows(std::ceil((float)m_editor->tabletCanvas()->canvasRect().height() / cellSize));
-    grid->setOrigin(Eigen::Vector2i(m_editor->tabletCanvas()->canvasRect().x(), m_editor->tabletCanvas()->canvasRect().y()));
+    grid->setNbCols(std::ceil((float)m_editor->canvasRect().width() / cellSize));
+    grid->setNbRows(std::ceil((float)m_editor->canvasRect().height() / cellSize));
+    grid->setOrigin(Eigen::Vector2i(m_editor->canvasRect().x(), m_editor->canvasRect().y()));
 
     bool newQuads = false;
     for (auto it = group->strokes().begin(); it != group->strokes().end(); ++it) {
@@ -145,9 +159,9 @@ bool GridManager::constructGrid(Group *group, ViewManager *view, Stroke *stroke,
         group->setGrid(new Lattice(group->getParentKeyframe()));
         grid = group->lattice();
         grid->setCellSize(k_cellSize);
-        grid->setNbCols(std::ceil((float)m_editor->tabletCanvas()->canvasRect().width() / k_cellSize));
-        grid->setNbRows(std::ceil((float)m_editor->tabletCanvas()->canvasRect().height() / k_cellSize));
-        grid->setOrigin(Eigen::Vector2i(m_editor->tabletCanvas()->canvasRect().x(), m_editor->tabletCanvas()->canvasRect().y()));
+        grid->setNbCols(std::ceil((float)m_editor->canvasRect().width() / k_cellSize));
+        grid->setNbRows(std::ceil((float)m_editor->canvasRect().height() / k_cellSize));
+        grid->setOrigin(Eigen::Vector2i(m_editor->canvasRect().x(), m_editor->canvasRect().y()));
     }
     bool newQuads = addStrokeToGrid(group, stroke, interval);
     return newQuads;
@@ -851,6 +865,7 @@ void GridManager::moveGridCornerPosition(Group *group, PosTypeIndex type, const
     for (auto c : m_cornersSelected) {
         grid->corners()[c.first]->coord(type) += delta;
     }
+    if (type == REF_POS) grid->setRestDirty();
     if (!m_cornersSelected.empty() && k_arap) {
         Arap::regularizeLattice(*grid, k_useDeformAsSource || type == REF_POS ? DEFORM_POS : REF_POS, type, k_iterationGrid);
     }
@@ -892,6 +907,7 @@ void GridManager::scaleGrid(Group *group, float factor, PosTypeIndex type, int m
         c->coord(type) += trans;
         c->coord(DEFORM_POS) = c->coord(type);
     }
+    if (type == REF_POS) group->lattice()->setRestDirty();
 }
 
 void GridManager::scaleGrid(Group *group, float factor, PosTypeIndex type, const std::vector<Corner *> &corners, int mode) {
@@ -924,6 +940,7 @@ void GridManager::scaleGrid(Group *group, float factor, PosTypeIndex type, const
         c->coord(type) += trans;
         c->coord(DEFORM_POS) = c->coord(type);
     }
+    if (type == REF_POS) group->lattice()->setRestDirty();
 }
 
 /**
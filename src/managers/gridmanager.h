@@ -38,6 +38,7 @@ public :
     bool constructGrid(Group *group, ViewManager *view, Stroke *stroke, Interval &interval);
     bool addStrokeToGrid(Group *group, Stroke *stroke, Interval &interval);
     bool addStrokeToGrid(Group *group, Stroke *stroke, Intervals &intervals);
+    void addStrokeToGridPerPoint(Group *group, Stroke *stroke, Interval &interval, std::vector<QuadPtr> &newQuads);
     bool bakeStrokeInGrid(Lattice *grid, Stroke *stroke, int fromIdx, int toIdx, PosTypeIndex type=REF_POS, bool forward=true);
     void bakeStrokeInGrid(Group *group, Lattice *grid, Stroke *stroke, int fromIdx, int toIdx, const Inbetween &inbetween, bool forward=true);
     void bakeStrokeInGridPrecomputed(Lattice *grid, Group *group, Stroke *stroke, int fromIdx, int toIdx, PosTypeIndex type=REF_POS, bool forward=true);
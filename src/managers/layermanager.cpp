@@ -55,9 +55,9 @@ bool LayerManager::load(QDomElement& element, const QString& path) {
     return success;
 }
 
-bool LayerManager::save(QDomDocument& doc, QDomElement& root, const QString& path) const {
+bool LayerManager::save(QDomDocument& doc, QDomElement& root, const QString& path, bool keyframes) const {
     for (int i = 0; i < layersCount(); ++i) {
-        m_layers[m_indices[i]]->save(doc, root, path);
+        m_layers[m_indices[i]]->save(doc, root, path, keyframes);
     }
     return true;
 }
@@ -27,7 +27,7 @@ class LayerManager : public BaseManager {
     void clear();
 
     bool load(QDomElement& element, const QString& path);
-    bool save(QDomDocument& doc, QDomElement& root, const QString& path) const;
+    bool save(QDomDocument& doc, QDomElement& root, const QString& path, bool keyframes = true) const;
 
     // Layer Management
     inline int layersCount() const { return m_layers.size(); }
@@ -10,8 +10,235 @@
 #include "group.h"
 #include "mask.h"
 #include "utils/utils.h"
+#include "dialsandknobs.h"
 
 #include <clipper2/clipper.h>
+#include <QtConcurrent/QtConcurrent>
+#include <QElapsedTimer>
+#include <map>
+#include <set>
+#include <numeric>
+
+static dkBool k_layoutSearch("Options->Layout->Search layouts", true);
+static dkInt k_layoutSearchBudget("Options->Layout->Search time budget (ms)", 200, 0, 10000, 10);
+static dkInt k_layoutBeamWidth("Options->Layout->Search beam width", 32, 1, 1024, 1);
+static dkBool k_parallelLayoutScoring("Options->Layout->Parallel scoring", true);
+static dkBool k_layoutSearchStats("Options->Layout->Print search stats", false);
+
+namespace {
+
+/**
+ * Visibility score of a keyframe layout, split into terms that only depend on the relative depth of a few groups.
+ * 
+ * Once the layout of B is fixed, the score of a stroke vertex of A only depends on whether it is occluded, i.e. whether
+ * one of the masks it intersects is in front of its group. Vertices of a group intersecting the same set of masks are
+ * merged into a single term, so evaluating a layout costs one comparison per distinct (group, occluders) pair instead of
+ * one radius search per vertex.
+ * Depths are stored per group (local index) as doubles so that a group can be moved in between two existing depths 
+ * without renumbering the others. A NaN depth means the group is not placed yet: it neither occludes nor is occluded.
+ */
+class LayoutSearch {
+public:
+    explicit LayoutSearch(int nbGroups) : m_nbGroups(nbGroups), m_termsOf(nbGroups) { }
+
+    void addVertex(int group, std::vector<int> occluders, double scoreVisible, double scoreOccluded) {
+        m_base += scoreVisible;
+        if (occluders.empty()) return;
+        std::sort(occluders.begin(), occluders.end());
+        occluders.erase(std::unique(occluders.begin(), occluders.end()), occluders.end());
+        m_memo[{group, std::move(occluders)}] += scoreOccluded - scoreVisible;
+    }
+
+    void finalize() {
+        m_terms.clear();
+        for (auto &entry : m_memo) {
+            if (entry.second == 0.0) continue;
+            int idx = m_terms.size();
+            m_terms.push_back({entry.first.first, entry.first.second, entry.second});
+            m_termsOf[entry.first.first].push_back(idx);
+            for (int occluder : entry.first.second) m_termsOf[occluder].push_back(idx);
+        }
+        m_memo.clear();
+    }
+
+    bool relevant(int group) const { return !m_termsOf[group].empty(); }
+
+    double score(const std::vector<double> &depths) const {
+        double score = m_base;
+        for (const Term &term : m_terms) {
+            if (occluded(term, depths)) score += term.weight;
+        }
+        return score;
+    }
+
+    // Score difference when moving the given group to a new depth, only the terms involving the group are evaluated
+    double moveDelta(std::vector<double> &depths, int group, double newDepth) const {
+        double delta = 0.0;
+        double oldDepth = depths[group];
+        for (int t : m_termsOf[group]) {
+            if (occluded(m_terms[t], depths)) delta -= m_terms[t].weight;
+        }
+        depths[group] = newDepth;
+        for (int t : m_termsOf[group]) {
+            if (occluded(m_terms[t], depths)) delta += m_terms[t].weight;
+        }
+        depths[group] = oldDepth;
+        return delta;
+    }
+
+    // Candidate depths for the given group: every depth used by the other placed groups and every gap between them
+    void candidateDepths(const std::vector<double> &depths, int group, std::vector<double> &candidates) const {
+        std::vector<double> levels;
+        for (int i = 0; i < m_nbGroups; ++i) {
+            if (i != group && !std::isnan(depths[i])) levels.push_back(depths[i]);
+        }
+        std::sort(levels.begin(), levels.end());
+        levels.erase(std::unique(levels.begin(), levels.end()), levels.end());
+        candidates.clear();
+        if (levels.empty()) {
+            candidates.push_back(0.0);
+            return;
+        }
+        candidates.push_back(levels.front() - 1.0);
+        for (int i = 0; i < levels.size(); ++i) {
+            candidates.push_back(levels[i]);
+            candidates.push_back(i + 1 < levels.size() ? 0.5 * (levels[i] + levels[i + 1]) : levels[i] + 1.0);
+        }
+    }
+
+    // Renumber the depths of the placed groups to 0..nbDepths-1
+    static void normalize(std::vector<double> &depths) {
+        std::vector<double> levels;
+        for (double d : depths) {
+            if (!std::isnan(d)) levels.push_back(d);
+        }
+        std::sort(levels.begin(), levels.end());
+        levels.erase(std::unique(levels.begin(), levels.end()), levels.end());
+        for (double &d : depths) {
+            if (!std::isnan(d)) d = std::lower_bound(levels.begin(), levels.end(), d) - levels.begin();
+        }
+    }
+
+    /**
+     * Steepest descent over single group moves, starting from the given depths.
+     * Stops at a local minimum or when the time budget is exhausted. Return the score of the final depths.
+     */
+    double localSearch(std::vector<double> &depths, double score, const QElapsedTimer &timer, int budget) const {
+        std::vector<double> candidates;
+        while (timer.elapsed() < budget) {
+            double bestDelta = -1e-9, bestDepth = 0.0;
+            int bestGroup = -1;
+            for (int g = 0; g < m_nbGroups; ++g) {
+                if (!relevant(g)) continue;
+                candidateDepths(depths, g, candidates);
+                for (double d : candidates) {
+                    if (d == depths[g]) continue;
+                    double delta = moveDelta(depths, g, d);
+                    if (delta < bestDelta) {
+                        bestDelta = delta;
+                        bestGroup = g;
+                        bestDepth = d;
+                    }
+                }
+            }
+            if (bestGroup < 0) break;
+            depths[bestGroup] = bestDepth;
+            normalize(depths);
+            score += bestDelta;
+        }
+        return score;
+    }
+
+    /**
+     * Beam search over depth orderings: groups are inserted one at a time (most constrained first) at every candidate
+     * depth of the partial layout. Partial layouts are ranked by a lower bound of their final score (terms whose groups
+     * are all placed plus the best case of the remaining ones) and pruned against the best complete score known (upperBound).
+     * Return false if the time budget was exhausted before a complete layout was found.
+     */
+    bool beamSearch(int width, double upperBound, const QElapsedTimer &timer, int budget, std::vector<double> &result) const {
+        // Insertion order and the step at which each term can be evaluated
+        std::vector<int> order;
+        std::vector<double> involvement(m_nbGroups, 0.0);
+        for (const Term &term : m_terms) {
+            involvement[term.group] += std::abs(term.weight);
+            for (int occluder : term.occluders) involvement[occluder] += std::abs(term.weight);
+        }
+        for (int g = 0; g < m_nbGroups; ++g) {
+            if (relevant(g)) order.push_back(g);
+        }
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return involvement[a] > involvement[b]; });
+        std::vector<int> position(m_nbGroups, -1);
+        for (int i = 0; i < order.size(); ++i) position[order[i]] = i;
+        std::vector<std::vector<int>> completedAt(order.size());
+        std::vector<double> remaining(order.size() + 1, 0.0); // best case of the terms not evaluated before step i
+        for (int t = 0; t < m_terms.size(); ++t) {
+            int step = position[m_terms[t].group];
+            for (int occluder : m_terms[t].occluders) step = std::max(step, position[occluder]);
+            completedAt[step].push_back(t);
+            for (int i = 0; i <= step; ++i) remaining[i] += std::min(0.0, m_terms[t].weight);
+        }
+
+        struct State {
+            std::vector<double> depths;
+            double partial, bound;
+        };
+        std::vector<State> beam = {{std::vector<double>(m_nbGroups, std::numeric_limits<double>::quiet_NaN()), m_base, m_base + remaining[0]}};
+        std::vector<State> children;
+        std::set<std::vector<int>> visited;
+        std::vector<int> key(m_nbGroups);
+        std::vector<double> candidates;
+        for (int step = 0; step < order.size(); ++step) {
+            if (timer.elapsed() >= budget) return false;
+            int g = order[step];
+            children.clear();
+            visited.clear();
+            for (const State &state : beam) {
+                candidateDepths(state.depths, g, candidates);
+                for (double d : candidates) {
+                    State child{state.depths, state.partial, 0.0};
+                    child.depths[g] = d;
+                    normalize(child.depths);
+                    for (int i = 0; i < m_nbGroups; ++i) key[i] = std::isnan(child.depths[i]) ? -1 : (int)child.depths[i];
+                    if (!visited.insert(key).second) continue;
+                    for (int t : completedAt[step]) {
+                        if (occluded(m_terms[t], child.depths)) child.partial += m_terms[t].weight;
+                    }
+                    child.bound = child.partial + remaining[step + 1];
+                    if (child.bound < upperBound) children.push_back(std::move(child));
+                }
+            }
+            if (children.empty()) return false;
+            std::sort(children.begin(), children.end(), [](const State &a, const State &b) { return a.bound < b.bound; });
+            if (children.size() > width) children.resize(width);
+            std::swap(beam, children);
+        }
+        result = beam.front().depths;
+        return true;
+    }
+
+private:
+    struct Term {
+        int group;
+        std::vector<int> occluders;
+        double weight;      // score difference between the occluded and visible states of the vertices of the term
+    };
+
+    bool occluded(const Term &term, const std::vector<double> &depths) const {
+        double depth = depths[term.group];
+        for (int occluder : term.occluders) {
+            if (depths[occluder] < depth) return true;
+        }
+        return false;
+    }
+
+    int m_nbGroups;
+    double m_base = 0.0;
+    std::map<std::pair<int, std::vector<int>>, double> m_memo;
+    std::vector<Term> m_terms;
+    std::vector<std::vector<int>> m_termsOf;    // terms involving each group
+};
+
+}
 
 /**
  * Optimizations: 
@@ -47,9 +274,11 @@ double LayoutManager::computeBestLayout(VectorKeyFrame *A, VectorKeyFrame *B, Gr
     makeKDTree(B, 0);
     // TODO: make sure group id is baked in points
 
-    // Get visibility score for the baseline layout
-    std::unordered_map<int, double> groupScores;
-    double baselineScore = getLayoutScore(A, B, A->orderPartials().firstPartial().groupOrder().order(), B->orderPartials().firstPartial().groupOrder().order(), stride, 0, groupScores);
+    // Get visibility score for the baseline layout, the mask bins do not depend on the layout
+    const Layout &baselineLayout = A->orderPartials().firstPartial().groupOrder().order();
+    const Layout &layoutB = B->orderPartials().firstPartial().groupOrder().order();
+    LayoutScore baselineScore = evaluateLayout(A, B, baselineLayout, layoutB, stride, 0, m_maskVertexIntersectionCacheA, m_maskVertexIntersectionCacheB, m_treeTarget, m_dataKey);
+    m_maskBins = baselineScore.maskBins;
 
     qDebug() << "mask bins " << m_maskBins.rows() << ", " << m_maskBins.cols() << " : ";
     std::cout << m_maskBins << std::endl;
@@ -61,14 +290,35 @@ double LayoutManager::computeBestLayout(VectorKeyFrame *A, VectorKeyFrame *B, Gr
 
     // Get new layout for A based on its coverage of B
     GroupOrder coverageBasedLayout = buildMatchingBasedLayout(A, B, BtoACorrespondence, noCorresp);
+    std::vector<Layout> candidates = {coverageBasedLayout.order()};
 
-    double coverageBasedLayoutScore = getLayoutScore(A, B, coverageBasedLayout.order(), B->orderPartials().firstPartial().groupOrder().order(), stride, 0, groupScores);
+    // Search for a better layout starting from the baseline and coverage-based layouts
+    if (k_layoutSearch) {
+        double searchScore;
+        Layout searchLayout = searchBestLayout(A, B, layoutB, stride, 0, {baselineLayout, coverageBasedLayout.order()}, searchScore);
+        if (!searchLayout.empty()) candidates.push_back(searchLayout);
+    }
 
     // TODO: simplify layout by collapsing adjacent depths that do not contain intersecting masks
 
-    optimalLayout = coverageBasedLayoutScore < baselineScore ? coverageBasedLayout : A->orderPartials().firstPartial().groupOrder();
-    qDebug() << "coverageBasedLayoutScore " << coverageBasedLayoutScore << " vs baselineScore" << baselineScore;
-    return (coverageBasedLayoutScore < baselineScore) ? coverageBasedLayoutScore : -1.0;
+    // Score the candidates concurrently, the first one wins ties
+    std::vector<LayoutScore> scores = evaluateLayouts(A, B, candidates, layoutB, stride, 0);
+    int best = 0;
+    for (int i = 1; i < scores.size(); ++i) {
+        if (scores[i].scoreAbs < scores[best].scoreAbs) best = i;
+    }
+    qDebug() << "coverageBasedLayoutScore " << scores[0].scoreAbs << " vs baselineScore" << baselineScore.scoreAbs;
+    if (k_layoutSearchStats && scores.size() > 1) qDebug() << "searchScore " << scores[1].scoreAbs;
+
+    if (scores[best].scoreAbs < baselineScore.scoreAbs) {
+        optimalLayout = GroupOrder(A);
+        optimalLayout.order() = candidates[best];
+        showLayoutScore(A, stride, scores[best]);
+        return scores[best].scoreAbs;
+    }
+    optimalLayout = A->orderPartials().firstPartial().groupOrder();
+    showLayoutScore(A, stride, baselineScore);
+    return -1.0;
 }
 
 /**
@@ -78,29 +328,38 @@ int LayoutManager::computeBestLayoutChangeLocation(VectorKeyFrame *A, const Grou
     int stride = A->parentLayer()->stride(A->keyframeNumber());
     int maxIdA = A->postGroups().lastKey() + 2;
 
-    std::unordered_map<int, double> groupScores;
     double minScore  = std::numeric_limits<double>::max();
-    double curScore;
     int optimalInbetween = stride;
-    
-    // Check layout score for each inbetween
-    for (int i = 0; i < stride; ++i) { // TODO: what would it mean if the optimal layout t is right before the keyframe switch (i.e. i == stride) or even at i == 0?
+
+    // Bake the inbetweens and build their caches first (not thread-safe), both layouts are evaluated on the same inbetween
+    // TODO: what would it mean if the optimal layout t is right before the keyframe switch (i.e. i == stride) or even at i == 0?
+    std::vector<std::unordered_map<unsigned int, std::vector<int>>> maskVertexIntersectionCaches(stride);
+    std::vector<PointKDTree> trees(stride);
+    std::vector<std::vector<unsigned int>> dataKeys(stride);
+    for (int i = 0; i < stride; ++i) {
         m_maskMaskIntersectionMatrixA = LayoutAdjacencyMatrix::Zero(maxIdA, maxIdA);
-        m_maskMaskIntersectionMatrixB = LayoutAdjacencyMatrix::Zero(maxIdA, maxIdA);
-        m_maskBins = Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic>::Zero(maxIdA, maxIdA);
-        computeMaskVertexIntersectionCache(A, i, m_maskVertexIntersectionCacheA, m_maskConnectedComponentCacheA, m_maskMaskIntersectionMatrixA);
-        computeMaskVertexIntersectionCache(A, i, m_maskVertexIntersectionCacheB, m_maskConnectedComponentCacheB, m_maskMaskIntersectionMatrixB);
-        makeKDTree(A, i);
-
-        curScore = getLayoutScore(A, A, A->orderPartials().firstPartial().groupOrder().order(), layoutA.order(), i, i, groupScores);
-
-        qDebug() << "   score at inbetween " << i << " = " << curScore;
-        
-        if (curScore < minScore) {
-            minScore = curScore;
+        computeMaskVertexIntersectionCache(A, i, maskVertexIntersectionCaches[i], m_maskConnectedComponentCacheA, m_maskMaskIntersectionMatrixA);
+        makeKDTree(A, i, trees[i], dataKeys[i]);
+    }
+
+    // Check layout score for each inbetween
+    std::vector<LayoutScore> scores(stride);
+    std::vector<int> jobs(stride);
+    std::iota(jobs.begin(), jobs.end(), 0);
+    auto evaluateInbetween = [&](int i) {
+        scores[i] = evaluateLayout(A, A, A->orderPartials().firstPartial().groupOrder().order(), layoutA.order(), i, i, maskVertexIntersectionCaches[i], maskVertexIntersectionCaches[i], trees[i], dataKeys[i]);
+    };
+    if (k_parallelLayoutScoring) QtConcurrent::blockingMap(jobs, evaluateInbetween);
+    else std::for_each(jobs.begin(), jobs.end(), evaluateInbetween);
+
+    for (int i = 0; i < stride; ++i) {
+        qDebug() << "   score at inbetween " << i << " = " << scores[i].scoreAbs;
+        if (scores[i].scoreAbs < minScore) {
+            minScore = scores[i].scoreAbs;
             optimalInbetween = i;
         }
     }
+    if (optimalInbetween < stride) showLayoutScore(A, optimalInbetween, scores[optimalInbetween]);
 
     qDebug() << "return best inbetween is " << optimalInbetween << " | stride = " << stride;
 
@@ -122,8 +381,6 @@ GroupOrder LayoutManager::propagateLayoutAtoB(VectorKeyFrame *A, VectorKeyFrame
     // Compute explicit matching from A to B (many to one) based on stroke coverage
     std::vector<int> noCorresp;
     std::unordered_map<int, std::vector<int>> AtoBCorrespondence = computeExactMatchingAtoB(B, noCorresp);
-    
-    generateAllLayouts(B);
 
     // Compute and return the new layout for B
     GroupOrder newBLayout = buildInverseMatchingBasedLayout(A, B, AtoBCorrespondence, noCorresp);
@@ -165,56 +422,99 @@ std::unordered_set<unsigned int> LayoutManager::getOccludedVertices(VectorKeyFra
 }
 
 /**
- * Return the sum of the absolute value of visibility scores in A. 
+ * Return the visibility score of layoutA, i.e. the sum of the absolute value of visibility scores in A. 
  * The visibility score of $v_A$, a stroke vertex in A, is the average difference of visibility between $v_A$ and all vertices in B that are within a fixed radius of $v_A$.
  * The visibility of a vertex is either 0 or 1, therefore the visibility score of a vertex is a real number in [-1, 1]
- * The visibility score (signed) for each group is stored in the map given as parameter.
+ * The vertices of B are given by a KD-tree and the key of each of its points (see makeKDTree).
+ * The visibility score (signed) for each group and the mask bins are also returned.
+ * This method has no side effect so that layouts can be evaluated concurrently, see showLayoutScore to visualize a score.
  * 
  * TODO: select interp time of A (default is t=1)
  */
-double LayoutManager::getLayoutScore(VectorKeyFrame *A, VectorKeyFrame *B, const Layout &layoutA, const Layout &layoutB, int inbetweenA, int inbetweenB, std::unordered_map<int, double> &groupScores) {
-    std::unordered_set<unsigned int> visibilityA = computeOccludedVertices(A, layoutA, m_maskVertexIntersectionCacheA, inbetweenA);
-    std::unordered_set<unsigned int> visibilityB = computeOccludedVertices(B, layoutB, m_maskVertexIntersectionCacheB, inbetweenB);
-    groupScores.clear();
+LayoutScore LayoutManager::evaluateLayout(VectorKeyFrame *A, VectorKeyFrame *B, const Layout &layoutA, const Layout &layoutB, int inbetweenA, int inbetweenB, const std::unordered_map<unsigned int, std::vector<int>> &maskVertexIntersectionCacheA, const std::unordered_map<unsigned int, std::vector<int>> &maskVertexIntersectionCacheB, const PointKDTree &treeB, const std::vector<unsigned int> &dataKeyB) const {
+    std::unordered_set<unsigned int> visibilityA = computeOccludedVertices(A, layoutA, maskVertexIntersectionCacheA, inbetweenA);
+    std::unordered_set<unsigned int> visibilityB = computeOccludedVertices(B, layoutB, maskVertexIntersectionCacheB, inbetweenB);
+    const Inbetween &inb = A->inbetween(inbetweenA);
+    LayoutScore layoutScore;
+    layoutScore.maskBins = Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic>::Zero(A->postGroups().lastKey() + 2, B->postGroups().lastKey() + 2);
+    layoutScore.vertexScores.reserve(inb.nbVertices);
 
-    // const double radSq = 10.0;
     double radSq = 10.0;
     std::vector<std::pair<size_t, Point::Scalar>> res;
-    const Inbetween &inb = A->inbetween(inbetweenA);
-    const Inbetween &inb0 = A->inbetween(0);
-    double score = 0.0, scoreAbs = 0.0, diffAbs = 0.0, diff = 0.0;
+    Point::VectorType pos;
+    double diffAbs = 0.0, diff = 0.0;
 
     // Compute score for each group of A
     for (Group *group : A->postGroups()) {
+        double &groupScore = layoutScore.groupScores[group->id()];
         for (auto it = group->strokes().constBegin(); it != group->strokes().constEnd(); ++it) {
-            if (group->size() > 0) groupScores[group->id()] = 0.0;
-            const StrokePtr &stroke = inb.strokes[it.key()];
-            double rad = stroke->strokeWidth() + 2; 
+            const InbetweenStroke &stroke = inb.strokes.constFind(it.key()).value();
+            double rad = stroke.source()->strokeWidth() + 2; 
             radSq = rad * rad;
             for (const Interval &interval : it.value()) {
                 for (unsigned int i = interval.from(); i <= interval.to(); ++i) {
-                    unsigned int count = m_treeTarget.kdtree->radiusSearch(&stroke->points()[i]->pos()[0], radSq, res, nanoflann::SearchParams(10));
+                    pos = stroke.pos(i);
+                    int occludedA = visibilityA.find(Utils::cantor(it.key(), i)) != visibilityA.end();
+                    unsigned int count = treeB.kdtree->radiusSearch(&pos[0], radSq, res, nanoflann::SearchParams(10));
                     diff = 0.0;
                     diffAbs = 0.0;
                     for (unsigned int j = 0; j < count; ++j) {
-                        m_maskBins(group->id() + 1, m_treeTarget.data[res[j].first]->groupId() + 1) += 1;
-                        diff += (int)(visibilityB.find(m_dataKey[res[j].first]) != visibilityB.end()) - (int)(visibilityA.find(Utils::cantor(stroke->id(), i)) != visibilityA.end());
+                        layoutScore.maskBins(group->id() + 1, treeB.data[res[j].first]->groupId() + 1) += 1;
+                        diff += (int)(visibilityB.find(dataKeyB[res[j].first]) != visibilityB.end()) - occludedA;
                         diffAbs += std::abs(diff);
                     }
                     if (count > 0) {
                         diff /= count;
                         diffAbs /= count;
-                    } else if (visibilityA.find(Utils::cantor(stroke->id(), i)) == visibilityA.end()) { // Vertex has no match in B but is visible => it will pop out so we need to penalize it
+                    } else if (!occludedA) { // Vertex has no match in B but is visible => it will pop out so we need to penalize it
                         diff = 5;
                         diffAbs = 5;
                     }                    
-                    score += diff;
-                    scoreAbs += diffAbs;
-                    groupScores[group->id()] += diffAbs;
+                    layoutScore.score += diff;
+                    layoutScore.scoreAbs += diffAbs;
+                    groupScore += diffAbs;
+                    layoutScore.vertexScores.push_back(diffAbs);
+                }
+            }
+        }
+    }
+
+    return layoutScore;
+}
+
+/**
+ * Evaluate the given layouts of A against the layout of B with the current caches and KD-tree. 
+ * Layouts are evaluated concurrently.
+ */
+std::vector<LayoutScore> LayoutManager::evaluateLayouts(VectorKeyFrame *A, VectorKeyFrame *B, const std::vector<Layout> &layoutsA, const Layout &layoutB, int inbetweenA, int inbetweenB) const {
+    std::vector<LayoutScore> scores(layoutsA.size());
+    std::vector<size_t> jobs(layoutsA.size());
+    std::iota(jobs.begin(), jobs.end(), 0);
+    auto evaluate = [&](size_t i) {
+        scores[i] = evaluateLayout(A, B, layoutsA[i], layoutB, inbetweenA, inbetweenB, m_maskVertexIntersectionCacheA, m_maskVertexIntersectionCacheB, m_treeTarget, m_dataKey);
+    };
+    if (k_parallelLayoutScoring) QtConcurrent::blockingMap(jobs, evaluate);
+    else std::for_each(jobs.begin(), jobs.end(), evaluate);
+    return scores;
+}
+
+/**
+ * Color the stroke vertices of A with their visibility score (see evaluateLayout)
+ */
+void LayoutManager::showLayoutScore(VectorKeyFrame *A, int inbetweenA, const LayoutScore &layoutScore) {
+    const Inbetween &inb = A->inbetween(inbetweenA);
+    const Inbetween &inb0 = A->inbetween(0);
+    size_t idx = 0;
+    for (Group *group : A->postGroups()) {
+        for (auto it = group->strokes().constBegin(); it != group->strokes().constEnd(); ++it) {
+            const StrokePtr &stroke = inb.stroke(it.key());
+            for (const Interval &interval : it.value()) {
+                for (unsigned int i = interval.from(); i <= interval.to(); ++i) {
+                    double diffAbs = layoutScore.vertexScores[idx++];
                     QColor c = QColor(diffAbs < 0.1 ? 0.0 : (128 + diffAbs * 5), 0, 0);
                     stroke->points()[i]->setColor(c);
                     if (inbetweenA == 0) {
-                        inb0.strokes[it.key()]->points()[i]->setColor(c);
+                        inb0.stroke(it.key())->points()[i]->setColor(c);
                         A->strokes().value(it.key())->points()[i]->setColor(c);
                     }
                     // stroke->points()[i]->setTemporalW(diffAbs);
@@ -223,17 +523,130 @@ double LayoutManager::getLayoutScore(VectorKeyFrame *A, VectorKeyFrame *B, const
         }
     }
 
-    qDebug() << "score: " << score;
-    qDebug() << "scoreAbs: " << scoreAbs;
-    return scoreAbs;
+    qDebug() << "score: " << layoutScore.score;
+    qDebug() << "scoreAbs: " << layoutScore.scoreAbs;
+}
+
+/**
+ * Search for the layout of A with the lowest visibility score (see evaluateLayout) given the layout of B.
+ * Instead of enumerating every ordered partition of the groups, the score is precomputed per group and set of
+ * intersecting masks (see LayoutSearch) and the layouts are explored by beam search and local search from the seed layouts.
+ * The search stops after k_layoutSearchBudget milliseconds and returns the best layout found so far.
+ * The score of the returned layout is stored in bestScore.
+ */
+Layout LayoutManager::searchBestLayout(VectorKeyFrame *A, VectorKeyFrame *B, const Layout &layoutB, int inbetweenA, int inbetweenB, const std::vector<Layout> &seeds, double &bestScore) {
+    QElapsedTimer timer;
+    timer.start();
+    std::unordered_set<unsigned int> visibilityB = computeOccludedVertices(B, layoutB, m_maskVertexIntersectionCacheB, inbetweenB);
+
+    // Local index of the groups of A
+    std::vector<int> groupIds;
+    std::unordered_map<int, int> localIdx;
+    for (Group *group : A->postGroups()) {
+        localIdx[group->id()] = groupIds.size();
+        groupIds.push_back(group->id());
+    }
+
+    // Score of each vertex of A when it is visible or occluded (same as evaluateLayout)
+    LayoutSearch search(groupIds.size());
+    double radSq;
+    std::vector<std::pair<size_t, Point::Scalar>> res;
+    std::vector<int> occluders;
+    const Inbetween &inb = A->inbetween(inbetweenA);
+    for (Group *group : A->postGroups()) {
+        for (auto it = group->strokes().constBegin(); it != group->strokes().constEnd(); ++it) {
+            const StrokePtr &stroke = inb.stroke(it.key());
+            double rad = stroke->strokeWidth() + 2; 
+            radSq = rad * rad;
+            for (const Interval &interval : it.value()) {
+                for (unsigned int i = interval.from(); i <= interval.to(); ++i) {
+                    unsigned int count = m_treeTarget.kdtree->radiusSearch(&stroke->points()[i]->pos()[0], radSq, res, nanoflann::SearchParams(10));
+                    double scores[2];
+                    for (int visA = 0; visA < 2; ++visA) {
+                        double diff = 0.0, diffAbs = 0.0;
+                        for (unsigned int j = 0; j < count; ++j) {
+                            diff += (int)(visibilityB.find(m_dataKey[res[j].first]) != visibilityB.end()) - visA;
+                            diffAbs += std::abs(diff);
+                        }
+                        scores[visA] = count > 0 ? diffAbs / count : (visA == 0 ? 5.0 : 0.0);
+                    }
+                    occluders.clear();
+                    auto vertexIntersections = m_maskVertexIntersectionCacheA.find(Utils::cantor(stroke->id(), i));
+                    if (vertexIntersections != m_maskVertexIntersectionCacheA.end()) {
+                        for (int groupId : vertexIntersections->second) {
+                            auto occluder = localIdx.find(groupId);
+                            if (occluder != localIdx.end()) occluders.push_back(occluder->second);
+                        }
+                    }
+                    search.addVertex(localIdx[group->id()], occluders, scores[0], scores[1]);
+                }
+            }
+        }
+    }
+    search.finalize();
+
+    auto toDepths = [&](const Layout &layout) {
+        std::vector<double> depths(groupIds.size(), std::numeric_limits<double>::quiet_NaN());
+        for (int d = 0; d < layout.size(); ++d) {
+            for (int id : layout[d]) {
+                auto idx = localIdx.find(id);
+                if (idx != localIdx.end()) depths[idx->second] = d;
+            }
+        }
+        // Groups missing from the layout are added to the back layer
+        for (double &d : depths) {
+            if (std::isnan(d)) d = std::max((int)layout.size() - 1, 0);
+        }
+        return depths;
+    };
+
+    // Improve the seeds first so that the beam search can be pruned with a good upper bound
+    const int budget = k_layoutSearchBudget;
+    std::vector<double> best;
+    bestScore = std::numeric_limits<double>::max();
+    for (const Layout &seed : seeds) {
+        std::vector<double> depths = toDepths(seed);
+        double score = search.localSearch(depths, search.score(depths), timer, budget);
+        if (score < bestScore) {
+            bestScore = score;
+            best = depths;
+        }
+    }
+
+    std::vector<double> depths;
+    if (search.beamSearch(k_layoutBeamWidth, bestScore, timer, budget, depths)) {
+        // Groups that do not change the score are added to the back layer
+        double back = 0.0;
+        for (double d : depths) {
+            if (!std::isnan(d)) back = std::max(back, d);
+        }
+        for (double &d : depths) {
+            if (std::isnan(d)) d = back;
+        }
+        double score = search.localSearch(depths, search.score(depths), timer, budget);
+        if (score < bestScore) {
+            bestScore = score;
+            best = depths;
+        }
+    }
+
+    Layout layout;
+    if (best.empty()) return layout;
+    LayoutSearch::normalize(best);
+    for (int i = 0; i < best.size(); ++i) {
+        int d = best[i];
+        if (d >= layout.size()) layout.resize(d + 1);
+        layout[d].push_back(groupIds[i]);
+    }
+    if (k_layoutSearchStats) qDebug() << "layout search score: " << bestScore << " in " << timer.elapsed() << "ms";
+    return layout;
 }
 
 /**
  * Compute the visibility of every stroke vertices of the given keyframe based on the given mask layout.
  */
-std::unordered_set<unsigned int> LayoutManager::computeOccludedVertices(VectorKeyFrame *keyframe, const Layout &layout, const std::unordered_map<unsigned int, std::vector<int>> &maskVertexIntersectionCache, int inbetween) {
+std::unordered_set<unsigned int> LayoutManager::computeOccludedVertices(VectorKeyFrame *keyframe, const Layout &layout, const std::unordered_map<unsigned int, std::vector<int>> &maskVertexIntersectionCache, int inbetween) const {
     unsigned int key;
-    unsigned int totalVertices = 0;
     std::unordered_set<unsigned int> occludedVertices;
     const Inbetween &inb = keyframe->inbetween(inbetween);
     LayoutAdjacencyMatrix adj = computeLayoutAdjacencyMatrix(layout);
@@ -241,11 +654,9 @@ std::unordered_set<unsigned int> LayoutManager::computeOccludedVertices(VectorKe
     // Using the precomputed vertex-mask intersection cache and the layout adjacency matrix, test if a vertex is visible or not.
     for (Group *group: keyframe->postGroups()) {
         for (auto it = group->strokes().constBegin(); it != group->strokes().constEnd(); ++it) {
-            const StrokePtr &stroke = inb.strokes[it.key()];
             for (const Interval &interval : it.value()) {
                 for (unsigned int i = interval.from(); i <= interval.to(); ++i) {
                     key = Utils::cantor(it.key(), i);
-                    totalVertices++;
                     auto vertexIntersections = maskVertexIntersectionCache.find(key);
                     if (vertexIntersections != maskVertexIntersectionCache.end()) { // vertex intersects a mask (except its own)
                         for (int groupId : vertexIntersections->second) {
@@ -260,7 +671,6 @@ std::unordered_set<unsigned int> LayoutManager::computeOccludedVertices(VectorKe
         }
     }
 
-    std::cout << "occluded vertices: " << occludedVertices.size() << "/" << totalVertices << std::endl; 
     return occludedVertices; // moved by return value optimization
 }
 
@@ -299,17 +709,17 @@ void LayoutManager::computeMaskVertexIntersectionCache(VectorKeyFrame *keyframe,
     // For each stroke vertex, test if it is inside another group's mask. If it does, store that information in the cache
     unsigned int key;
     Clipper2Lib::PointD pClipper;
-    Point *p;
+    Point::VectorType p;
     for (Group *group : keyframe->postGroups()) {
         maskMaskIntersection[group->id()].insert(group->id());
         if (group->size() == 0) continue;
         for (auto it = group->strokes().constBegin(); it != group->strokes().constEnd(); ++it) {
-            const StrokePtr &stroke = inb.strokes[it.key()];
+            const InbetweenStroke &stroke = inb.strokes.constFind(it.key()).value();
             for (const Interval &interval : it.value()) {
                 for (unsigned int i = interval.from(); i <= interval.to(); ++i) {
                     key = Utils::cantor(it.key(), i);
-                    p = stroke->points()[i];
-                    pClipper = Clipper2Lib::PointD(p->pos().x(), p->pos().y());
+                    p = stroke.pos(i);
+                    pClipper = Clipper2Lib::PointD(p.x(), p.y());
                     for (Group *groupTest : keyframe->postGroups()) {
                         if (group == groupTest) continue;
                         auto res = Clipper2Lib::PointInPolygon(pClipper, masks[groupTest->id()]); // TODO: batch
@@ -377,26 +787,33 @@ LayoutAdjacencyMatrix LayoutManager::computeLayoutAdjacencyMatrix(const Layout &
  * Construct KD-tree from keyframe B's vertices 
  */
 void LayoutManager::makeKDTree(VectorKeyFrame *B, int inbetween) {
+    makeKDTree(B, inbetween, m_treeTarget, m_dataKey);
+}
+
+/**
+ * Construct a KD-tree from keyframe B's vertices, the key of each vertex is stored in dataKey
+ */
+void LayoutManager::makeKDTree(VectorKeyFrame *B, int inbetween, PointKDTree &tree, std::vector<unsigned int> &dataKey) {
     const Inbetween &inb = B->inbetween(inbetween);
     std::vector<Point *> data;
     data.reserve(inb.nbVertices);
-    m_dataKey.clear();
-    m_dataKey.reserve(inb.nbVertices);
+    dataKey.clear();
+    dataKey.reserve(inb.nbVertices);
 
     for (Group *group : B->postGroups()) {
         if (group->size() == 0) continue;
         for (auto it = group->strokes().constBegin(); it != group->strokes().constEnd(); ++it) {
-            const StrokePtr &stroke = inb.strokes[it.key()];
+            const StrokePtr &stroke = inb.stroke(it.key());
             for (const Interval &interval : it.value()) {
                 for (unsigned int i = interval.from(); i <= interval.to(); ++i) {
                     data.push_back(stroke->points()[i]); 
-                    m_dataKey.push_back(Utils::cantor(stroke->id(), i));
+                    dataKey.push_back(Utils::cantor(stroke->id(), i));
                 }
             }
         }
     }
 
-    m_treeTarget.make(std::move(data));
+    tree.make(std::move(data));
 }
 
 /**
@@ -415,12 +832,13 @@ void LayoutManager::computeMaskBins(VectorKeyFrame *A, VectorKeyFrame *B) {
 
     for (Group *group : A->postGroups()) {
         for (auto it = group->strokes().constBegin(); it != group->strokes().constEnd(); ++it) {
-            const StrokePtr &stroke = inb.strokes[it.key()];
-            double rad = stroke->strokeWidth() + 2; 
+            const InbetweenStroke &stroke = inb.strokes.constFind(it.key()).value();
+            double rad = stroke.source()->strokeWidth() + 2; 
             radSq = rad * rad;
             for (const Interval &interval : it.value()) {
                 for (unsigned int i = interval.from(); i <= interval.to(); ++i) {
-                    unsigned int count = m_treeTarget.kdtree->radiusSearch(&stroke->points()[i]->pos()[0], radSq, res, nanoflann::SearchParams(10));
+                    Point::VectorType pos = stroke.pos(i);
+                    unsigned int count = m_treeTarget.kdtree->radiusSearch(&pos[0], radSq, res, nanoflann::SearchParams(10));
                     for (unsigned int j = 0; j < count; ++j) {
                         m_maskBins(group->id() + 1, m_treeTarget.data[res[j].first]->groupId() + 1) += 1;
                     }
@@ -529,64 +947,3 @@ GroupOrder LayoutManager::buildInverseMatchingBasedLayout(VectorKeyFrame *A, Vec
 
     return order; 
 }
-
-/**
- * Generate all possible layouts of the given keyframe
- */
-std::vector<Layout> LayoutManager::generateAllLayouts(VectorKeyFrame *keyframe) {
-    std::vector<Layout> layouts;
-    std::vector<std::vector<int>> possibleDepths;
-
-
-    // Merge depth i with depth j in the given layout. Returns a new layout with one less depth.
-    auto merge = [&](std::vector<std::vector<int>> layout, int i, int j) {
-        Layout newLayout = layout;
-        for (int k : layout[j]) {
-            newLayout[i].push_back(k);
-        }
-        auto it = newLayout.begin();
-        std::advance(it, j);
-        newLayout.erase(it);
-        return newLayout;
-    };
-
-    // Power set
-    Layout baseLayout;
-    for (Group *group : keyframe->postGroups()) {
-        baseLayout.push_back({group->id()});
-    }
-    std::vector<Layout> allLayouts;
-    int index = 0;
-    allLayouts.push_back(baseLayout);
-    while (index < allLayouts.size()) {
-        Layout l = allLayouts[index];
-        if (l.size() == 1) {
-            ++index;
-            continue;
-        }
-        for (int i = 0; i < l.size() - 1; ++i) {
-            for (int j = i + 1; j < l.size(); ++j) {
-                Layout newL = merge(l, i, j);
-                allLayouts.push_back(newL);
-            }
-        }
-        ++index;
-    }
-
-    // Permutations
-    for (auto l : allLayouts) {
-        if (l.size() == 1) {
-            layouts.push_back(l);
-            continue;
-        }
-
-        auto lCopy = l;
-        do {
-            layouts.push_back(lCopy);
-        } while (std::next_permutation(lCopy.begin(), lCopy.end()));
-    }
-
-    qDebug() << "layouts size: " << layouts.size();
-
-    return layouts;
-}
\ No newline at end of file
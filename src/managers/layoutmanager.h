@@ -22,6 +22,15 @@ typedef std::vector<std::vector<int>> Layout;
 
 class GroupOrder; 
 
+// Visibility score of a layout of A against a layout of B (see LayoutManager::evaluateLayout)
+struct LayoutScore {
+    double score = 0.0;                                             // sum of the signed vertex scores
+    double scoreAbs = 0.0;                                          // sum of the absolute vertex scores
+    std::unordered_map<int, double> groupScores;                    // group id -> sum of the absolute vertex scores
+    Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic> maskBins;    // number of matches between each pair of groups (A, B)
+    std::vector<double> vertexScores;                               // absolute score of each stroke vertex of A, in traversal order
+};
+
 class LayoutManager : public BaseManager
 {
     Q_OBJECT
@@ -40,12 +49,16 @@ public:
     std::unordered_set<unsigned int> getOccludedVertices(VectorKeyFrame *keyframe, int inbetween);
     
 protected:
-    double getLayoutScore(VectorKeyFrame *A, VectorKeyFrame *B, const Layout &layoutA, const Layout &layoutB, int inbetweenA,int inbetweenB, std::unordered_map<int, double> &groupScores); 
-    std::unordered_set<unsigned int> computeOccludedVertices(VectorKeyFrame *keyframe, const Layout &layout, const std::unordered_map<unsigned int, std::vector<int>> &maskVertexIntersectionCache, int inbetween);
+    LayoutScore evaluateLayout(VectorKeyFrame *A, VectorKeyFrame *B, const Layout &layoutA, const Layout &layoutB, int inbetweenA, int inbetweenB, const std::unordered_map<unsigned int, std::vector<int>> &maskVertexIntersectionCacheA, const std::unordered_map<unsigned int, std::vector<int>> &maskVertexIntersectionCacheB, const PointKDTree &treeB, const std::vector<unsigned int> &dataKeyB) const;
+    std::vector<LayoutScore> evaluateLayouts(VectorKeyFrame *A, VectorKeyFrame *B, const std::vector<Layout> &layoutsA, const Layout &layoutB, int inbetweenA, int inbetweenB) const;
+    void showLayoutScore(VectorKeyFrame *A, int inbetweenA, const LayoutScore &layoutScore);
+    std::unordered_set<unsigned int> computeOccludedVertices(VectorKeyFrame *keyframe, const Layout &layout, const std::unordered_map<unsigned int, std::vector<int>> &maskVertexIntersectionCache, int inbetween) const;
     void computeMaskVertexIntersectionCache(VectorKeyFrame *keyframe, int inbetween, std::unordered_map<unsigned int, std::vector<int>> &maskVertexIntersectionCache, std::vector<std::set<int>> &maskConnectedComponentCache, LayoutAdjacencyMatrix &maskMaskIntersectionMatrix);
     LayoutAdjacencyMatrix computeLayoutAdjacencyMatrix(const Layout &layout) const;
+    Layout searchBestLayout(VectorKeyFrame *A, VectorKeyFrame *B, const Layout &layoutB, int inbetweenA, int inbetweenB, const std::vector<Layout> &seeds, double &bestScore);
 
     void makeKDTree(VectorKeyFrame *B, int inbetween);    
+    void makeKDTree(VectorKeyFrame *B, int inbetween, PointKDTree &tree, std::vector<unsigned int> &dataKey);
 
     void computeMaskBins(VectorKeyFrame *A, VectorKeyFrame *B);
     std::unordered_map<int, std::vector<int>> computeExactMatchingBtoA(VectorKeyFrame *A, std::vector<int> &groupsNotMatched);
@@ -54,8 +67,6 @@ protected:
     GroupOrder buildInverseMatchingBasedLayout(VectorKeyFrame *A, VectorKeyFrame *B, const std::unordered_map<int, std::vector<int>> &matching, const std::vector<int> &groupsNotMatched);
 
 private:
-    std::vector<Layout> generateAllLayouts(VectorKeyFrame *keyframe);
-
     std::unordered_map<unsigned int, std::vector<int>> m_maskVertexIntersectionCacheA, m_maskVertexIntersectionCacheB;
     std::vector<std::set<int>> m_maskConnectedComponentCacheA, m_maskConnectedComponentCacheB;      // !unused
     LayoutAdjacencyMatrix m_maskMaskIntersectionMatrixA, m_maskMaskIntersectionMatrixB;             // !unused
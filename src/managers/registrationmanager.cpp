@@ -5,6 +5,8 @@
  */
 
 #include "registrationmanager.h"
+#include "editor.h"
+#include "gridmanager.h"
 #include "vectorkeyframe.h"
 #include "group.h"
 #include "arap.h"
@@ -16,7 +18,11 @@
 #include <cpd/rigid.hpp>
 #include <cpd/affine.hpp>
 #include <cpd/gauss_transform_fgt.hpp>
+#include <QtConcurrent/QtConcurrent>
+#include <QElapsedTimer>
+#include <QDebug>
 #include <unordered_set>
+#include <numeric>
 
 // REGISTRATION PARAMETERS
 dkInt k_registrationIt("Options->Registration->Iterations", 10, 0, 1000, 1);
@@ -27,17 +33,20 @@ static dkInt k_cpdIt("Options->Registration->CPD iterations", 10, 0, 200, 1);
 static dkFloat k_proximityFactor("Options->Registration->Proximity factor", 3.0, 0.1, 50, 0.1);
 static dkFloat k_stepSize("Options->Registration->Step size", 1.0, 0.001, 1.0, 0.001);
 static dkBool k_useCoverageCriterion("Warp->Use coverage local criterion", false);
+static dkBool k_parallelPush("Options->Registration->Parallel push phase", true);
+static dkInt k_pyramidLevels("Options->Registration->Pyramid levels", 1, 1, 4, 1);
+static dkInt k_pyramidFineIt("Options->Registration->Pyramid finest level iterations", 2, 0, 1000, 1);
+static dkBool k_registrationStats("Options->Registration->Print statistics", false);
 extern dkInt k_cellSize;
 
 RegistrationManager::RegistrationManager(QObject* pParent) : BaseManager(pParent) {
-    m_registrationTargetKey = nullptr;
-    m_registrationKDTree = nullptr;
+    m_preRegistrationScaling = 1.0;
 }
 
 void RegistrationManager::preRegistration(Group *source, PosTypeIndex type) {
     StopWatch sw("Pre registration");
     source->lattice()->resetDeformation();
-    if (k_cpdIt > 0) rigidCPD({{source->id(), source}});
+    if (k_cpdIt > 0) m_preRegistrationScaling = rigidCPD({{source->id(), source}}, m_target);
     sw.stop();
 }
 
@@ -46,23 +55,73 @@ void RegistrationManager::preRegistration(const QMap<int, Group *> &groups, PosT
     for (Group *group : groups) {
         group->lattice()->resetDeformation();
     }
-    rigidCPD(groups);
+    m_preRegistrationScaling = rigidCPD(groups, m_target);
     sw.stop();
 }
 
 void RegistrationManager::registration(Group *source, PosTypeIndex type, PosTypeIndex regularizationSource, bool usePreRegistration) {
-    registration(source, type, regularizationSource, usePreRegistration, k_registrationIt, k_registrationRegularizationIt);
+    registration(source, m_target, type, regularizationSource, usePreRegistration, k_registrationIt, k_registrationRegularizationIt);
+}
+
+void RegistrationManager::registration(Group *source, PosTypeIndex type, PosTypeIndex regularizationSource, bool usePreRegistration, int registrationIt, int regularizationIt) {
+    registration(source, m_target, type, regularizationSource, usePreRegistration, registrationIt, regularizationIt);
+}
+
+/**
+ * Register every keyframe with its target keyframe, as Editor::registerFromRestPosition does for a single keyframe.
+ * The registration of a keyframe only writes in the lattices of its own groups and only reads the target strokes, so
+ * the pairs run concurrently. The current registration target is left untouched.
+ * The coarse-to-fine registration builds its lattices with the grid manager, which reads the canvas and view and writes
+ * the strokes points, so the pairs run sequentially when it is enabled.
+ */
+void RegistrationManager::registration(const std::vector<std::pair<VectorKeyFrame *, VectorKeyFrame *>> &keyframes) {
+    StopWatch sw("Registration (keyframes)");
+    std::vector<Target> targets(keyframes.size());
+    for (size_t i = 0; i < keyframes.size(); ++i) {
+        targets[i].set(keyframes[i].second);
+    }
+
+    std::vector<size_t> jobs(keyframes.size());
+    std::iota(jobs.begin(), jobs.end(), 0);
+    auto registerKeyframe = [&](size_t i) {
+        if (keyframes[i].first != nullptr && !targets[i].empty()) registration(keyframes[i].first, targets[i]);
+    };
+    if (k_parallelPush && k_pyramidLevels <= 1) QtConcurrent::blockingMap(jobs, registerKeyframe);
+    else std::for_each(jobs.begin(), jobs.end(), registerKeyframe);
+    sw.stop();
+}
+
+// Register the selected post groups of the keyframe (all of them if none is selected)
+void RegistrationManager::registration(VectorKeyFrame *key, const Target &target) {
+    const QMap<int, Group *> &groups = key->selection().selectedPostGroups().empty() ? key->groups(POST) : key->selection().selectedPostGroups();
+    bool multipleGroupsSelected = groups.size() > 1;
+    Point::Affine scalingMat;
+    if (multipleGroupsSelected) {
+        for (Group *group : groups) {
+            group->lattice()->resetDeformation();
+        }
+        scalingMat.setIdentity();
+        scalingMat.scale(rigidCPD(groups, target));
+    }
+    for (Group *group : groups) {
+        registration(group, target, TARGET_POS, TARGET_POS, !multipleGroupsSelected, k_registrationIt, k_registrationRegularizationIt);
+        if (multipleGroupsSelected) group->lattice()->setScaling(scalingMat);
+    }
 }
 
 // TODO: maybe add an overloaded method that takes directly a vector of points instead of a StrokeIntervals
 // Given a group and a target set of strokes, computes the group's lattice TARGET_POS that best aligns with the target strokes
 // If updateSource is true, the regularization will converge towards the deformed configuration of the lattice
-void RegistrationManager::registration(Group *source, PosTypeIndex type, PosTypeIndex regularizationSource, bool usePreRegistration, int registrationIt, int regularizationIt) {
+void RegistrationManager::registration(Group *source, const Target &target, PosTypeIndex type, PosTypeIndex regularizationSource, bool usePreRegistration, int registrationIt, int regularizationIt) {
     StopWatch sw0("Registration");
-    if (source == nullptr || source->lattice() == nullptr || m_registrationTargetKey == nullptr || m_registrationTargetPoints.empty()) return;
+    if (source == nullptr || source->lattice() == nullptr || target.key == nullptr || target.empty()) return;
 
+    double preRegistrationScaling = 1.0;
     if (usePreRegistration) {
-        preRegistration(source, type);
+        StopWatch sw("Pre registration");
+        source->lattice()->resetDeformation();
+        if (k_cpdIt > 0) preRegistrationScaling = rigidCPD({{source->id(), source}}, target);
+        sw.stop();
         regularizationSource = TARGET_POS;
     }
 
@@ -78,20 +137,14 @@ void RegistrationManager::registration(Group *source, PosTypeIndex type, PosType
         source->lattice()->copyPositions(source->lattice(), regularizationSource, INTERP_POS);
     }
 
-    // Alternate an iterative push phase and lattice regularization until -convergence- or a fixed max number of iterations
-    StopWatch sw1("Main loop");
-    int it = 0;
-    do {
-        StopWatch sw2("Push phase");
-        if (k_useCoverageCriterion) pushPhaseWithCoverage(source);
-        else                        pushPhaseWithoutCoverage(source);
-        sw2.stop();
-        StopWatch sw3("Regularization phase");
-        Arap::regularizeLattice(*source->lattice(), INTERP_POS, type, regularizationIt, true, k_useRegularisationStoppingCriterion);
-        sw3.stop();
-        ++it;
-    } while(it < registrationIt);
-    sw1.stop();
+    if (k_pyramidLevels > 1 && m_editor != nullptr) {
+        registrationPyramid(source, target, type, registrationIt, regularizationIt);
+    } else {
+        QElapsedTimer timer;
+        timer.start();
+        int sweeps = registrationLoop(source, target, type, registrationIt, regularizationIt);
+        if (k_registrationStats) qDebug() << "Registration: cell size" << source->lattice()->cellSize() << "|" << registrationIt << "iterations," << sweeps << "regularization sweeps |" << timer.elapsed() << "ms";
+    }
 
     // Dirty flag for ARAP interpolation (recompute prefactorized matrix)
     source->setGridDirty();
@@ -101,7 +154,7 @@ void RegistrationManager::registration(Group *source, PosTypeIndex type, PosType
     if (usePreRegistration) {
         Point::Affine scalingMat;
         scalingMat.setIdentity();
-        scalingMat.scale(m_preRegistrationScaling);
+        scalingMat.scale(preRegistrationScaling);
         source->lattice()->setScaling(scalingMat);
     }
 
@@ -109,66 +162,181 @@ void RegistrationManager::registration(Group *source, PosTypeIndex type, PosType
     sw0.stop();
 }
 
-void RegistrationManager::setRegistrationTarget(VectorKeyFrame *targetKey) {
-    m_registrationTargetKey = targetKey;
-    // Point::Affine globalRigidTransformInverse = m_registrationTargetKey->rigidTransform(1.0f).inverse();
-    m_registrationTargetPoints.clear();
-    m_registrationTargetPointsCM = Point::VectorType::Zero();
-    for (const StrokePtr &stroke : m_registrationTargetKey->strokes()) {
-        for (Point *point : stroke->points()) {
-            m_registrationTargetPoints.push_back(point);
-            m_registrationTargetPointsCM += m_registrationTargetPoints.back()->pos();
+/**
+ * Alternate an iterative push phase and lattice regularization until -convergence- or a fixed max number of iterations.
+ * The regularization converges towards INTERP_POS.
+ * Returns the total number of regularization sweeps.
+ */
+int RegistrationManager::registrationLoop(Group *source, const Target &target, PosTypeIndex type, int registrationIt, int regularizationIt) {
+    StopWatch sw1("Main loop");
+    int it = 0, sweeps = 0;
+    while (it < registrationIt) {
+        StopWatch sw2("Push phase");
+        if (k_useCoverageCriterion) pushPhaseWithCoverage(source, target);
+        else                        pushPhaseWithoutCoverage(source, target);
+        sw2.stop();
+        StopWatch sw3("Regularization phase");
+        sweeps += Arap::regularizeLattice(*source->lattice(), INTERP_POS, type, regularizationIt, true, k_useRegularisationStoppingCriterion);
+        sw3.stop();
+        ++it;
+    }
+    sw1.stop();
+    return sweeps;
+}
+
+namespace {
+/**
+ * Set the given configuration of dst by applying the deformation of src (from its REF_POS to the given configuration)
+ * to the REF_POS corners of dst. Corners of dst outside of src are extrapolated from the closest quad.
+ */
+void transferDeformation(Lattice &src, Lattice &dst, PosTypeIndex type) {
+    for (Corner *corner : dst.corners()) {
+        const Point::VectorType &p = corner->coord(REF_POS);
+
+        // The REF_POS lattices are aligned grids, look for the quad in the cells around the point first
+        QuadPtr quad = nullptr;
+        int x, y;
+        src.posToCoord(p, x, y);
+        static const int offsets[9][2] = {{0, 0}, {-1, 0}, {0, -1}, {-1, -1}, {1, 0}, {0, 1}, {1, 1}, {1, -1}, {-1, 1}};
+        for (const int *offset : offsets) {
+            int qx = x + offset[0], qy = y + offset[1];
+            if (qx < 0 || qy < 0 || qx >= src.nbCols() || qy >= src.nbRows()) continue;
+            quad = src.quad(src.coordToKey(qx, qy));
+            if (quad != nullptr) break;
+        }
+        if (quad == nullptr) {
+            double minDist = std::numeric_limits<double>::max();
+            for (QuadPtr q : src.quads()) {
+                q->computeCentroid(REF_POS);
+                double dist = (q->centroid(REF_POS) - p).squaredNorm();
+                if (dist < minDist) {
+                    minDist = dist;
+                    quad = q;
+                }
+            }
+        }
+        if (quad == nullptr) continue;
+
+        corner->coord(type) = src.getWarpedPoint(p, quad->key(), src.getUV(p, REF_POS, quad), type);
+    }
+}
+}
+
+/**
+ * Coarse-to-fine registration.
+ * The group strokes are embedded in coarser lattices (cell size doubled at each level) that are registered first, the
+ * deformation of each level is transferred to the next finer one by bilinear interpolation. The group lattice is then
+ * only refined by k_pyramidFineIt iterations.
+ * The regularization source (INTERP_POS) of the group lattice must be set.
+ */
+void RegistrationManager::registrationPyramid(Group *source, const Target &target, PosTypeIndex type, int registrationIt, int regularizationIt) {
+    StopWatch sw("Registration pyramid");
+    QElapsedTimer timer;
+    timer.start();
+
+    // Take the group lattice out of the group, the coarse lattices are built in its place
+    std::shared_ptr<Lattice> fineGrid;
+    UVHash fineUVs;
+    source->swapGrid(fineGrid, fineUVs);
+    const int cellSize = fineGrid->cellSize();
+
+    std::shared_ptr<Lattice> prevGrid = fineGrid;
+    for (int level = k_pyramidLevels - 1; level >= 1; --level) {
+        m_editor->grid()->constructGrid(source, m_editor->view(), cellSize << level);
+        Lattice *grid = source->lattice();
+        transferDeformation(*prevGrid, *grid, TARGET_POS);
+        transferDeformation(*fineGrid, *grid, INTERP_POS);
+        int sweeps = registrationLoop(source, target, type, registrationIt, regularizationIt);
+        if (k_registrationStats) qDebug() << "Registration pyramid: cell size" << grid->cellSize() << "|" << grid->size() << "quads," << registrationIt << "iterations," << sweeps << "regularization sweeps |" << timer.elapsed() << "ms";
+
+        // Keep this level (the group is left without lattice for the next one)
+        std::shared_ptr<Lattice> levelGrid;
+        UVHash levelUVs;
+        source->swapGrid(levelGrid, levelUVs);
+        prevGrid = levelGrid;
+    }
+
+    // Refine the group lattice
+    source->swapGrid(fineGrid, fineUVs);
+    transferDeformation(*prevGrid, *source->lattice(), TARGET_POS);
+    int sweeps = registrationLoop(source, target, type, k_pyramidFineIt, regularizationIt);
+    if (k_registrationStats) qDebug() << "Registration pyramid: cell size" << cellSize << "|" << source->lattice()->size() << "quads," << k_pyramidFineIt << "iterations," << sweeps << "regularization sweeps |" << timer.elapsed() << "ms";
+    sw.stop();
+}
+
+/**
+ * Embed the target points in a kd-tree
+ */
+void RegistrationManager::Target::set(VectorKeyFrame *targetKey, std::vector<Point *> &&targetPoints) {
+    key = targetKey;
+    points = std::move(targetPoints);
+    pointsCM = Point::VectorType::Zero();
+    for (Point *point : points) {
+        pointsCM += point->pos();
+    }
+    pointsCM /= points.size();
+    if (points.empty()) {
+        kdTree.reset();
+        dataset.reset();
+        return;
+    }
+    dataset.reset(new DatasetAdaptorPoint(points));
+    kdTree.reset(new KDTree(2, *dataset, nanoflann::KDTreeSingleIndexAdaptorParams(10)));
+}
+
+// All the points of the target keyframe
+void RegistrationManager::Target::set(VectorKeyFrame *targetKey) {
+    std::vector<Point *> targetPoints;
+    if (targetKey != nullptr) {
+        for (const StrokePtr &stroke : targetKey->strokes()) {
+            for (Point *point : stroke->points()) {
+                targetPoints.push_back(point);
+            }
         }
     }
-    m_registrationTargetPointsCM /= m_registrationTargetPoints.size();
-    resetKDTree();
+    set(targetKey, std::move(targetPoints));
+}
+
+void RegistrationManager::Target::clear() {
+    key = nullptr;
+    points.clear();
+}
+
+void RegistrationManager::setRegistrationTarget(VectorKeyFrame *targetKey) {
+    m_target.set(targetKey);
 }
 
 void RegistrationManager::setRegistrationTarget(VectorKeyFrame *targetKey, StrokeIntervals &targetStrokes) {
-    m_registrationTargetKey = targetKey;
-    Point::Affine globalRigidTransformInverse = m_registrationTargetKey->rigidTransform(1.0f).inverse();
-    m_registrationTargetPoints.clear();
-    m_registrationTargetPointsCM = Point::VectorType::Zero();
-    targetStrokes.forEachPoint(m_registrationTargetKey, [&](Point *point) {
-        m_registrationTargetPoints.push_back(point);
-        m_registrationTargetPointsCM += m_registrationTargetPoints.back()->pos();
+    std::vector<Point *> targetPoints;
+    targetStrokes.forEachPoint(targetKey, [&](Point *point) {
+        targetPoints.push_back(point);
     });
-    m_registrationTargetPointsCM /= m_registrationTargetPoints.size();
-    resetKDTree();
+    m_target.set(targetKey, std::move(targetPoints));
 }
 
 void RegistrationManager::setRegistrationTarget(VectorKeyFrame *targetKey, const std::vector<Point *> &targetPos) {
-    m_registrationTargetKey = targetKey;
-    m_registrationTargetPoints.clear();
-    m_registrationTargetPointsCM = Point::VectorType::Zero();
-    m_registrationTargetPoints.reserve(targetPos.size());
-    for (Point *p : targetPos) {
-        m_registrationTargetPoints.push_back(p);
-        m_registrationTargetPointsCM += m_registrationTargetPoints.back()->pos();
-    }
-    m_registrationTargetPointsCM /= m_registrationTargetPoints.size();
-    resetKDTree();
+    m_target.set(targetKey, std::vector<Point *>(targetPos));
 }
 
 void RegistrationManager::clearRegistrationTarget() { 
-    m_registrationTargetKey = nullptr;
-    m_registrationTargetPoints.clear(); 
+    m_target.clear();
 }
 
-void RegistrationManager::alignCenterOfMass(Group *source) {
-    Point::VectorType diff = m_registrationTargetPointsCM - source->lattice()->refCM();
+void RegistrationManager::alignCenterOfMass(Group *source, const Target &target) {
+    Point::VectorType diff = target.pointsCM - source->lattice()->refCM();
     source->lattice()->applyTransform(Point::Affine(Point::Translation(diff)), REF_POS, TARGET_POS);
 }
 
-void RegistrationManager::rigidCPD(const QMap<int, Group *> &groups) {
+// Returns the scaling factor of the similarity transform
+double RegistrationManager::rigidCPD(const QMap<int, Group *> &groups, const Target &target) {
     cpd::Matrix targetMatrix; 
     cpd::Matrix sourceMatrix;
     Point::VectorType sourceCenterOfMass = Point::VectorType::Zero();
 
     // Fill targetMatrix
-    targetMatrix.conservativeResize(m_registrationTargetPoints.size(), 2);
-    for (int i = 0; i < m_registrationTargetPoints.size(); ++i) {
-        targetMatrix.row(i) = m_registrationTargetPoints[i]->pos();
+    targetMatrix.conservativeResize(target.points.size(), 2);
+    for (int i = 0; i < target.points.size(); ++i) {
+        targetMatrix.row(i) = target.points[i]->pos();
     }
 
     // Fill sourceMatrix
@@ -196,120 +364,139 @@ void RegistrationManager::rigidCPD(const QMap<int, Group *> &groups) {
     cpd::RigidResult result = rigid.run(targetMatrix, sourceMatrix);
     Point::Affine resultTransform;
     resultTransform.matrix() = result.matrix();
-    m_preRegistrationScaling = result.scale;
 
     // Apply the transform to the source positions and store the result in the target positions
     for (Group *group : groups) {
         group->lattice()->applyTransform(resultTransform, REF_POS, TARGET_POS);
     }
+    return result.scale;
+}
+
+
+namespace {
+typedef std::vector<std::pair<Point::VectorType, Point::VectorType>> MatchedPoints;
+
+// Displacement of the corners of a quad computed by a push phase
+struct QuadPush {
+    QuadPtr quad = nullptr;
+    bool moved = false;
+    Point::VectorType disp[4];
+};
+
+/**
+ * Compute the optimal rigid transform between the matched points of a quad (closed-form formula) and store the
+ * displacement it induces on the quad corners.
+ * The transform is a pure translation if one point is matched or if all points are matched to the same point.
+ */
+void fitQuadPush(QuadPush &push, const MatchedPoints &matchedPoints, const Point::VectorType &sourceCenter, const Point::VectorType &targetCenter, bool translationOnly) {
+    push.moved = true;
+    if (translationOnly) {
+        for (size_t i = 0; i < 4; ++i) {
+            push.disp[i] = (targetCenter - sourceCenter) * k_stepSize;
+        }
+        return;
+    }
+
+    double a = 0.0, b = 0.0;
+    for (size_t i = 0; i < matchedPoints.size(); ++i) {
+        Point::VectorType p = matchedPoints[i].first - sourceCenter;
+        Point::VectorType q = matchedPoints[i].second - targetCenter;
+        a += q.dot(p);
+        b += q.dot(Point::VectorType(-p.y(), p.x()));
+    }
+    double mu = sqrt(a * a + b * b);
+    if (mu < 0.01) mu = 0.01;
+    double r1 = a / mu;
+    double r2 = -b / mu;
+    Matrix2d R;
+    R << r1, r2, -r2, r1;
+    Point::VectorType t = targetCenter - R * sourceCenter;
+    Point::Affine optimalRigid = Point::Translation(t) * Point::Rotation(R);
+
+    for (size_t i = 0; i < 4; ++i) {
+        Corner *corner = push.quad->corners[i];
+        Point::VectorType transformedPos = optimalRigid * corner->coord(TARGET_POS);
+        push.disp[i] = (transformedPos - corner->coord(TARGET_POS)) * k_stepSize;
+    }
+}
+
+// Move the quad corners (and average for all neighbors)
+void applyQuadPush(const QuadPush &push) {
+    if (!push.moved) return;
+    for (size_t i = 0; i < 4; ++i) {
+        Corner *corner = push.quad->corners[i];
+        corner->coord(DEFORM_POS) += push.disp[i] / Point::Scalar(corner->nbQuads());
+    }
+}
 }
 
 /**
  * Move each quad towards the closest stroke patch in the set of target strokes.
  * This displacement does *not* preserve the rigidity of the lattice.
+ * Quads are matched concurrently (the kd-tree and TARGET_POS are only read), their displacements are then summed in
+ * the corners in the order of the quads so the result does not depend on the scheduling.
  * @param source the group to push
  */
-void RegistrationManager::pushPhaseWithoutCoverage(Group *source) {
+void RegistrationManager::pushPhaseWithoutCoverage(Group *source, const Target &target) {
     const UVHash &uvs = source->uvs();
-
-    // NN init
-    Point::VectorType queryPoint, quadDisp;
-    nanoflann::KNNResultSet<Point::Scalar> nnResult(1);
-    size_t nnIdx; 
-    Point::Scalar nnDistSq;
-
-    size_t prevNNIdx, pointsMatched;
-    const Point::Scalar cellSq = source->lattice()->cellSize() * source->lattice()->cellSize();
+    Lattice *lattice = source->lattice();
+    const VectorKeyFrame *keyframe = source->getParentKeyframe();
+    const Point::Scalar cellSq = lattice->cellSize() * lattice->cellSize();
     const Point::Scalar searchRadiusSq = k_proximityFactor * k_proximityFactor * cellSq; // search radius = k_proximityFactor*k_cellSize
-    bool found = false;
-    bool diffNeighbor = false;
-
-    // Optimal rigid transform init
-    Point::VectorType sourceCenter, targetCenter, p, q, t;
-    std::vector<std::pair<Point::VectorType, Point::VectorType>> matchedPoints; // List of matched point pairs (reset for each quad)
-    double a, b, r1, r2, mu;
-    Matrix2d R;
-    Point::Affine optimalRigid;
 
     // All computation are done in DEFORM_POS so we initialize it with the TARGET_POS 
-    for (Corner *corner : source->lattice()->corners()) {
+    for (Corner *corner : lattice->corners()) {
         corner->coord(DEFORM_POS) = corner->coord(TARGET_POS);
     }
 
-    sourceCenter = Point::VectorType::Zero();
-    targetCenter = Point::VectorType::Zero();
+    std::vector<QuadPush> pushes;
+    pushes.reserve(lattice->size());
+    for (QuadPtr quad : lattice->quads()) {
+        pushes.push_back({quad});
+    }
 
-    // Move every quad in the lattice
-    for (QuadPtr quad : source->lattice()->quads()) {
-        quadDisp = Point::VectorType::Zero();
-        diffNeighbor = false;
-        pointsMatched = 0;
-        prevNNIdx = -1;
-        a = b = 0.0;
-        sourceCenter = targetCenter = Point::VectorType::Zero();
-        matchedPoints.clear();
+    auto matchQuad = [&](QuadPush &push) {
+        // NN init
+        Point::VectorType queryPoint;
+        nanoflann::KNNResultSet<Point::Scalar> nnResult(1);
+        size_t nnIdx, prevNNIdx = -1;
+        Point::Scalar nnDistSq;
+        bool diffNeighbor = false;
+        Point::VectorType sourceCenter = Point::VectorType::Zero(), targetCenter = Point::VectorType::Zero();
+        MatchedPoints matchedPoints; // List of matched point pairs
 
         // For each point in the quad, find the closest point in targetStrokes and accumulate the displacement vector
-        quad->forwardStrokes().forEachPoint(source->getParentKeyframe(), [&](Point *point, unsigned int sId, unsigned int pId) {
+        push.quad->forwardStrokes().forEachPoint(keyframe, [&](Point *point, unsigned int sId, unsigned int pId) {
             UVInfo uv = uvs.get(sId, pId);
-            queryPoint = source->lattice()->getWarpedPoint(point->pos(), uv.quadKey, uv.uv, TARGET_POS);
+            queryPoint = lattice->getWarpedPoint(point->pos(), uv.quadKey, uv.uv, TARGET_POS);
             nnResult.init(&nnIdx, &nnDistSq);
-            found = m_registrationKDTree->findNeighbors(nnResult, &queryPoint[0], nanoflann::SearchParams(10));
+            target.kdTree->findNeighbors(nnResult, &queryPoint[0], nanoflann::SearchParams(10));
 
             // If we've found a neighbor and it is in the search radius, we keep its and the query point positions 
             if (nnResult.size() >= 1 && nnDistSq <= searchRadiusSq) {
                 if (prevNNIdx != -1 && nnIdx != prevNNIdx) diffNeighbor = true; // diffNeighbor is false if all points in the quad share the same NN
                 sourceCenter += queryPoint;
-                targetCenter += m_registrationTargetPoints[nnIdx]->pos();
+                targetCenter += target.points[nnIdx]->pos();
                 prevNNIdx = nnIdx;
-                matchedPoints.push_back({queryPoint, m_registrationTargetPoints[nnIdx]->pos()});
-                pointsMatched += 1;
+                matchedPoints.push_back({queryPoint, target.points[nnIdx]->pos()});
             }
         });
 
-        if (pointsMatched == 0) continue;
+        if (matchedPoints.empty()) return;
 
-        sourceCenter /= pointsMatched;
-        targetCenter /= pointsMatched;
+        sourceCenter /= matchedPoints.size();
+        targetCenter /= matchedPoints.size();
+        fitQuadPush(push, matchedPoints, sourceCenter, targetCenter, matchedPoints.size() == 1 || !diffNeighbor);
+    };
+    if (k_parallelPush) QtConcurrent::blockingMap(pushes, matchQuad);
+    else std::for_each(pushes.begin(), pushes.end(), matchQuad);
 
-        // In these cases the optimal rigid transform is a pure translation (one point matched or all points matched to the same point)
-        if (pointsMatched == 1 || !diffNeighbor) {
-            // move the quad
-            for (size_t i = 0; i < 4; ++i) {
-                Corner *corner = quad->corners[i];
-                Point::VectorType quadDisp = (targetCenter - sourceCenter) * k_stepSize;
-                corner->coord(DEFORM_POS) += quadDisp / Point::Scalar(corner->nbQuads());
-            }
-            continue;
-        }
-
-        // Compute optimal rigid transform between the two point clouds (closed-form formula) 
-        for (size_t i = 0; i < matchedPoints.size(); ++i) {
-            p = matchedPoints[i].first - sourceCenter;
-            q = matchedPoints[i].second - targetCenter;
-            a += q.dot(p);
-            b += q.dot(Point::VectorType(-p.y(), p.x()));
-        }
-        mu = sqrt(a * a + b * b);
-        if (mu < 0.01) mu = 0.01;
-        r1 = a / mu;
-        r2 = -b / mu;
-        R << r1, r2, -r2, r1;
-        t = targetCenter - R * sourceCenter;
-
-        optimalRigid = Point::Translation(t) * Point::Rotation(R);
-
-        // Move the quad corners (and average for all neighbors)
-        for (size_t i = 0; i < 4; ++i) {
-            Corner *corner = quad->corners[i];
-            Point::VectorType transformedPos = optimalRigid * corner->coord(TARGET_POS);
-            Point::VectorType quadDisp = (transformedPos - corner->coord(TARGET_POS)) * k_stepSize;
-            corner->coord(DEFORM_POS) += quadDisp / Point::Scalar(corner->nbQuads());
-        }
+    for (const QuadPush &push : pushes) {
+        applyQuadPush(push);
     }
-   
+
     // Copy result
-    for (Corner *corner : source->lattice()->corners()) {
+    for (Corner *corner : lattice->corners()) {
         corner->coord(TARGET_POS) = corner->coord(DEFORM_POS);
     }
 }
@@ -317,51 +504,44 @@ void RegistrationManager::pushPhaseWithoutCoverage(Group *source) {
 /**
  * Move each quad towards the closest stroke patch in the set of target strokes that has not already been matched with a quad.
  * This displacement does *not* preserve the rigidity of the lattice.
+ * The quads are processed sequentially (each one marks the target points it covers) but the nearest neighbors of their
+ * embedded points do not depend on the visited points, they are queried concurrently beforehand.
  * @param source the group to push
  */
-void RegistrationManager::pushPhaseWithCoverage(Group *source) {
+void RegistrationManager::pushPhaseWithCoverage(Group *source, const Target &target) {
+    static const int NN_COUNT = 50;
     const UVHash &uvs = source->uvs();
+    Lattice *lattice = source->lattice();
+    const VectorKeyFrame *keyframe = source->getParentKeyframe();
 
     // Nearest-neighbor search init
-    Point::VectorType queryPoint, quadDisp;
+    Point::VectorType queryPoint;
 
     nanoflann::KNNResultSet<Point::Scalar> nnResultPreProcess(1);
     size_t nnIdxPreProcess; 
     Point::Scalar nnDistSqPreProcess;
 
-    nanoflann::KNNResultSet<Point::Scalar> nnResult(50);
-    size_t nnIdx[50]; 
-    Point::Scalar nnDistSq[50];
+    nanoflann::KNNResultSet<Point::Scalar> nnResult(NN_COUNT);
+    size_t nnIdx[NN_COUNT]; 
+    Point::Scalar nnDistSq[NN_COUNT];
 
-    size_t prevNNIdx, pointsMatched;
-    const Point::Scalar cellSq = source->lattice()->cellSize() * source->lattice()->cellSize();
+    const Point::Scalar cellSq = lattice->cellSize() * lattice->cellSize();
     const Point::Scalar searchRadiusSq = k_proximityFactor * k_proximityFactor * cellSq; // search radius = k_proximityFactor*k_cellSize
     bool found = false;
-    bool diffNeighbor = false;
-
-    // Optimal rigid transform init
-    Point::VectorType sourceCenter, targetCenter, p, q, t;
-    std::vector<std::pair<Point::VectorType, Point::VectorType>> matchedPoints; // List of matched point pairs (reset for each quad)
-    double a, b, r1, r2, mu;
-    Matrix2d R;
-    Point::Affine optimalRigid;
 
     // All computation are done in DEFORM_POS so we initialize it with the TARGET_POS 
-    for (Corner *corner : source->lattice()->corners()) {
+    for (Corner *corner : lattice->corners()) {
         corner->coord(DEFORM_POS) = corner->coord(TARGET_POS);
     }
 
-    sourceCenter = Point::VectorType::Zero();
-    targetCenter = Point::VectorType::Zero();
-
     // Find registration order
     std::vector<std::pair<int, double>> quadIdxOrder;
-    quadIdxOrder.reserve(source->lattice()->size());
-    for (QuadPtr quad : source->lattice()->quads()) {
+    quadIdxOrder.reserve(lattice->size());
+    for (QuadPtr quad : lattice->quads()) {
         quad->computeCentroid(TARGET_POS);
         queryPoint = quad->centroid(TARGET_POS);
         nnResultPreProcess.init(&nnIdxPreProcess, &nnDistSqPreProcess);
-        found = m_registrationKDTree->findNeighbors(nnResultPreProcess, &queryPoint[0], nanoflann::SearchParams(10));
+        found = target.kdTree->findNeighbors(nnResultPreProcess, &queryPoint[0], nanoflann::SearchParams(10));
         if (found && nnDistSqPreProcess <= searchRadiusSq) {
             quadIdxOrder.push_back({quad->key(), nnDistSqPreProcess});
         } else {
@@ -370,101 +550,79 @@ void RegistrationManager::pushPhaseWithCoverage(Group *source) {
     }
     std::sort(quadIdxOrder.begin(), quadIdxOrder.end(), [](auto &a, auto &b) { return a.second < b.second; });
 
+    // Query the nearest neighbors of the embedded points of every quad
+    struct QuadNeighbors {
+        std::vector<Point::VectorType> queryPoints;
+        std::vector<int> nnCount;
+        std::vector<size_t> nnIdx;          // NN_COUNT entries per query point
+        std::vector<Point::Scalar> nnDistSq;
+    };
+    std::vector<QuadNeighbors> neighbors(quadIdxOrder.size());
+    std::vector<int> jobs(quadIdxOrder.size());
+    std::iota(jobs.begin(), jobs.end(), 0);
+    auto queryQuad = [&](int i) {
+        QuadNeighbors &nn = neighbors[i];
+        nanoflann::KNNResultSet<Point::Scalar> result(NN_COUNT);
+        lattice->quad(quadIdxOrder[i].first)->forwardStrokes().forEachPoint(keyframe, [&](Point *point, unsigned int sId, unsigned int pId) {
+            UVInfo uv = uvs.get(sId, pId);
+            nn.queryPoints.push_back(lattice->getWarpedPoint(point->pos(), uv.quadKey, uv.uv, TARGET_POS));
+            nn.nnIdx.resize(nn.nnIdx.size() + NN_COUNT);
+            nn.nnDistSq.resize(nn.nnDistSq.size() + NN_COUNT);
+            result.init(&nn.nnIdx[nn.nnIdx.size() - NN_COUNT], &nn.nnDistSq[nn.nnDistSq.size() - NN_COUNT]);
+            target.kdTree->findNeighbors(result, &nn.queryPoints.back()[0], nanoflann::SearchParams(10));
+            nn.nnCount.push_back(result.size());
+        });
+    };
+    if (k_parallelPush) QtConcurrent::blockingMap(jobs, queryQuad);
+    else std::for_each(jobs.begin(), jobs.end(), queryQuad);
+
     // Move every quad in the lattice
     std::unordered_set<int> usedIdx;
-    for (const auto& el : quadIdxOrder) {
-        QuadPtr quad = source->lattice()->quad(el.first);
-        quadDisp = Point::VectorType::Zero();
-        diffNeighbor = false;
-        pointsMatched = 0;
-        prevNNIdx = -1;
-        a = b = 0.0;
-        sourceCenter = targetCenter = Point::VectorType::Zero();
+    MatchedPoints matchedPoints; // List of matched point pairs (reset for each quad)
+    for (size_t j = 0; j < quadIdxOrder.size(); ++j) {
+        QuadPush push{lattice->quad(quadIdxOrder[j].first)};
+        const QuadNeighbors &nn = neighbors[j];
+        bool diffNeighbor = false;
+        size_t prevNNIdx = -1;
+        Point::VectorType sourceCenter = Point::VectorType::Zero(), targetCenter = Point::VectorType::Zero();
         matchedPoints.clear();
 
         // For each point in the quad, find the closest point in targetStrokes and accumulate the displacement vector
-        quad->forwardStrokes().forEachPoint(source->getParentKeyframe(), [&](Point *point, unsigned int sId, unsigned int pId) {
-            UVInfo uv = uvs.get(sId, pId);
-            queryPoint = source->lattice()->getWarpedPoint(point->pos(), uv.quadKey, uv.uv, TARGET_POS);
-            nnResult.init(nnIdx, nnDistSq);
-            found = m_registrationKDTree->findNeighbors(nnResult, &queryPoint[0], nanoflann::SearchParams(10));
+        for (size_t k = 0; k < nn.queryPoints.size(); ++k) {
+            const size_t *pointNNIdx = &nn.nnIdx[k * NN_COUNT];
+            const Point::Scalar *pointNNDistSq = &nn.nnDistSq[k * NN_COUNT];
 
             // find the closest non-visited point 
             int idx = -1;
-            for (int i = 0; i < nnResult.size(); ++i) {
-                if (usedIdx.find(nnIdx[i]) == usedIdx.end()) {
+            for (int i = 0; i < nn.nnCount[k]; ++i) {
+                if (usedIdx.find(pointNNIdx[i]) == usedIdx.end()) {
                     idx = i;
                     break;
                 }
             }
 
             // If we've found a neighbor and it is in the search radius, we keep its and the query point positions 
-            if (idx >= 0 && nnResult.size() >= 1 && nnDistSq[idx] <= searchRadiusSq) {
-                if (prevNNIdx != -1 && nnIdx[idx] != prevNNIdx) diffNeighbor = true; // diffNeighbor is false if all points in the quad share the same NN
-                sourceCenter += queryPoint;
-                targetCenter += m_registrationTargetPoints[nnIdx[idx]]->pos();
-                prevNNIdx = nnIdx[idx];
-                matchedPoints.push_back({queryPoint, m_registrationTargetPoints[nnIdx[idx]]->pos()});
-                pointsMatched += 1;
+            if (idx >= 0 && pointNNDistSq[idx] <= searchRadiusSq) {
+                if (prevNNIdx != -1 && pointNNIdx[idx] != prevNNIdx) diffNeighbor = true; // diffNeighbor is false if all points in the quad share the same NN
+                sourceCenter += nn.queryPoints[k];
+                targetCenter += target.points[pointNNIdx[idx]]->pos();
+                prevNNIdx = pointNNIdx[idx];
+                matchedPoints.push_back({nn.queryPoints[k], target.points[pointNNIdx[idx]]->pos()});
             }
-        });
-
-        if (pointsMatched == 0) continue;
-
-        sourceCenter /= pointsMatched;
-        targetCenter /= pointsMatched;
-
-        // In these cases the optimal rigid transform is a pure translation (one point matched or all points matched to the same point)
-        if (pointsMatched == 1 || !diffNeighbor) {
-            // move the quad
-            for (size_t i = 0; i < 4; ++i) {
-                Corner *corner = quad->corners[i];
-                Point::VectorType quadDisp = (targetCenter - sourceCenter) * k_stepSize;
-                corner->coord(DEFORM_POS) += quadDisp / Point::Scalar(corner->nbQuads());
-            }
-
-            // Mark vertices as visited
-            quad->computeCentroid(DEFORM_POS);
-            queryPoint = quad->centroid(DEFORM_POS);
-            nnResult.init(nnIdx, nnDistSq);
-            found = m_registrationKDTree->findNeighbors(nnResult, &queryPoint[0], nanoflann::SearchParams(10));
-            for (int i = 0; i < nnResult.size(); ++i) {
-                if (nnDistSq[i] <= cellSq) {
-                    usedIdx.insert(nnIdx[i]);
-                }
-            }
-            continue;
         }
 
-        // Compute optimal rigid transform between the two point clouds (closed-form formula) 
-        for (size_t i = 0; i < matchedPoints.size(); ++i) {
-            p = matchedPoints[i].first - sourceCenter;
-            q = matchedPoints[i].second - targetCenter;
-            a += q.dot(p);
-            b += q.dot(Point::VectorType(-p.y(), p.x()));
-        }
-        mu = sqrt(a * a + b * b);
-        if (mu < 0.01) mu = 0.01;
-        r1 = a / mu;
-        r2 = -b / mu;
-        R << r1, r2, -r2, r1;
-        t = targetCenter - R * sourceCenter;
-
-        optimalRigid = Point::Translation(t) * Point::Rotation(R);
+        if (matchedPoints.empty()) continue;
 
-        // Move the quad corners (and average for all neighbors)
-        for (size_t i = 0; i < 4; ++i) {
-            Corner *corner = quad->corners[i];
-            Point::VectorType transformedPos = optimalRigid * corner->coord(TARGET_POS);
-            Point::VectorType quadDisp = (transformedPos - corner->coord(TARGET_POS)) * k_stepSize;
-            corner->coord(DEFORM_POS) += quadDisp / Point::Scalar(corner->nbQuads());
-        }
+        sourceCenter /= matchedPoints.size();
+        targetCenter /= matchedPoints.size();
+        fitQuadPush(push, matchedPoints, sourceCenter, targetCenter, matchedPoints.size() == 1 || !diffNeighbor);
+        applyQuadPush(push);
 
         // Mark vertices as visited
-        quad->computeCentroid(DEFORM_POS);
-        queryPoint = quad->centroid(DEFORM_POS);
+        push.quad->computeCentroid(DEFORM_POS);
+        queryPoint = push.quad->centroid(DEFORM_POS);
         nnResult.init(nnIdx, nnDistSq);
-        found = m_registrationKDTree->findNeighbors(nnResult, &queryPoint[0], nanoflann::SearchParams(10));
+        found = target.kdTree->findNeighbors(nnResult, &queryPoint[0], nanoflann::SearchParams(10));
         for (int i = 0; i < nnResult.size(); ++i) {
             if (nnDistSq[i] <= cellSq) {
                 usedIdx.insert(nnIdx[i]);
@@ -473,19 +631,11 @@ void RegistrationManager::pushPhaseWithCoverage(Group *source) {
     }
 
     // Copy result
-    for (Corner *corner : source->lattice()->corners()) {
+    for (Corner *corner : lattice->corners()) {
         corner->coord(TARGET_POS) = corner->coord(DEFORM_POS);
     }
 }
 
-/**
- * Embed the current list of target points in a kd-tree
- */
-void RegistrationManager::resetKDTree() {
-    m_registrationDataset.reset(new DatasetAdaptorPoint(m_registrationTargetPoints));
-    m_registrationKDTree.reset(new KDTree(2, *m_registrationDataset, nanoflann::KDTreeSingleIndexAdaptorParams(10)));
-}
-
 /**
  * Compute new TARGET_POS of the given group's lattice based on its pinned quad.
  * Find the optimal affine transformation between the pins source positions and their target positions.
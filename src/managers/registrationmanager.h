@@ -26,6 +26,20 @@ class RegistrationManager : public BaseManager
 public :
     typedef nanoflann::KDTreeSingleIndexAdaptor<nanoflann::L2_Simple_Adaptor<Point::Scalar, DatasetAdaptorPoint>, DatasetAdaptorPoint, 2, size_t> KDTree;
 
+    // Points a group is registered with, the kd-tree is only read during the registration
+    struct Target {
+        VectorKeyFrame *key = nullptr;
+        std::vector<Point *> points;
+        Point::VectorType pointsCM;
+        std::unique_ptr<DatasetAdaptorPoint> dataset;
+        std::unique_ptr<KDTree> kdTree;
+
+        void set(VectorKeyFrame *targetKey, std::vector<Point *> &&targetPoints);
+        void set(VectorKeyFrame *targetKey);
+        void clear();
+        bool empty() const { return points.empty(); }
+    };
+
     RegistrationManager(QObject* pParent);
 
     double preRegistrationScaling() const { return m_preRegistrationScaling; }
@@ -35,29 +49,30 @@ public :
     void preRegistration(const QMap<int, Group *> &groups, PosTypeIndex type);
     void registration(Group *source, PosTypeIndex type, PosTypeIndex regularizationSource, bool usePreRegistration);
     void registration(Group *source, PosTypeIndex type, PosTypeIndex regularizationSource, bool usePreRegistration, int registrationIt, int regularizationIt);
+    // Register the post groups of each keyframe with its target keyframe (pairs are independent and processed in parallel)
+    void registration(const std::vector<std::pair<VectorKeyFrame *, VectorKeyFrame *>> &keyframes);
 
     // Registration target
     void setRegistrationTarget(VectorKeyFrame *targetKey);
     void setRegistrationTarget(VectorKeyFrame *targetKey, StrokeIntervals &targetStrokes);
     void setRegistrationTarget(VectorKeyFrame *targetKey, const std::vector<Point *> &targetPos);
     void clearRegistrationTarget();
-    bool registrationTargetEmpty() const { return m_registrationTargetPoints.empty(); }
+    bool registrationTargetEmpty() const { return m_target.empty(); }
 
     // Pins deformation
     void applyOptimalRigidTransformBasedOnPinnedQuads(Group *group);
 
 protected:
-    void alignCenterOfMass(Group *source);
-    void rigidCPD(const QMap<int, Group *> &groups);
-    void pushPhaseWithoutCoverage(Group *source);
-    void pushPhaseWithCoverage(Group *source);
-    void resetKDTree();
+    void registration(Group *source, const Target &target, PosTypeIndex type, PosTypeIndex regularizationSource, bool usePreRegistration, int registrationIt, int regularizationIt);
+    void registration(VectorKeyFrame *key, const Target &target);
+    int registrationLoop(Group *source, const Target &target, PosTypeIndex type, int registrationIt, int regularizationIt);
+    void registrationPyramid(Group *source, const Target &target, PosTypeIndex type, int registrationIt, int regularizationIt);
+    void alignCenterOfMass(Group *source, const Target &target);
+    double rigidCPD(const QMap<int, Group *> &groups, const Target &target);
+    void pushPhaseWithoutCoverage(Group *source, const Target &target);
+    void pushPhaseWithCoverage(Group *source, const Target &target);
 private:
-    VectorKeyFrame *m_registrationTargetKey;
-    std::vector<Point *> m_registrationTargetPoints;
-    Point::VectorType m_registrationTargetPointsCM; 
-    std::unique_ptr<DatasetAdaptorPoint> m_registrationDataset;
-    std::unique_ptr<KDTree> m_registrationKDTree;
+    Target m_target;
     double m_preRegistrationScaling;
 };
 #endif // REGISTRATIONMANAGER_H
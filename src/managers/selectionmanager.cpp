@@ -137,7 +137,8 @@ void SelectionManager::selectStrokes(VectorKeyFrame *keyframe, std::function<boo
 }
 
 void SelectionManager::selectStrokes(VectorKeyFrame *keyframe, unsigned int inbetween, std::function<bool(const StrokePtr &stroke)> predicate, StrokeIntervals &selection) {
-    for (const StrokePtr &stroke : keyframe->inbetween(inbetween).strokes) {
+    for (const InbetweenStroke &inbStroke : keyframe->inbetween(inbetween).strokes) {
+        const StrokePtr &stroke = inbStroke.stroke();
         if (predicate(stroke)) {
             selection[stroke->id()].clear();
             selection[stroke->id()].append(Interval(0, stroke->size() - 1));
@@ -146,11 +147,30 @@ void SelectionManager::selectStrokes(VectorKeyFrame *keyframe, unsigned int inbe
 }
 
 void SelectionManager::selectStrokes(VectorKeyFrame *keyframe, unsigned int inbetween, std::function<bool(const StrokePtr &stroke)> predicate, std::vector<int> &strokesIdx) {
-    for (const StrokePtr &stroke : keyframe->inbetween(inbetween).strokes) {
+    for (const InbetweenStroke &inbStroke : keyframe->inbetween(inbetween).strokes) {
+        const StrokePtr &stroke = inbStroke.stroke();
         if (predicate(stroke)) strokesIdx.push_back(stroke->id());
     }
 }
 
+/**
+ * Only the vertices in the bounding box of the shape are tested (see Inbetween::spatialIndex)
+ */
+void SelectionManager::selectStrokes(VectorKeyFrame *keyframe, unsigned int inbetween, const QPolygonF &bounds, std::function<bool(unsigned int strokeId)> predicate, StrokeIntervals &selection) const {
+    const Inbetween &inb = keyframe->inbetween(inbetween);
+    QSet<unsigned int> selected, rejected;
+    inb.spatialIndex().forEachPointInRect(bounds.boundingRect(), [&](unsigned int strokeId, unsigned int i, const Point::VectorType &pos) {
+        if (selected.contains(strokeId) || rejected.contains(strokeId)) return;
+        if (!bounds.containsPoint(QPointF(pos.x(), pos.y()), Qt::OddEvenFill)) return;
+        if (predicate(strokeId)) selected.insert(strokeId);
+        else rejected.insert(strokeId);
+    });
+    for (unsigned int strokeId : selected) {
+        selection[strokeId].clear();
+        selection[strokeId].append(Interval(0, inb.strokes.constFind(strokeId).value().size() - 1));
+    }
+}
+
 int SelectionManager::selectTrajectoryConstraint(VectorKeyFrame *keyframe, const QPointF &pickPos, bool useFilter) {
     for (const std::shared_ptr<Trajectory> &traj : keyframe->trajectories()) {
         if (traj->approxPathHull().contains(pickPos) && (!useFilter || keyframe->selection().selectedPostGroups().contains(traj->group()->id()))) {                   
@@ -53,6 +53,9 @@ public:
     void selectStrokes(VectorKeyFrame *keyframe, unsigned int inbetween, std::function<bool(const StrokePtr &stroke)> predicate, StrokeIntervals &selection);
     void selectStrokes(VectorKeyFrame *keyframe, unsigned int inbetween, std::function<bool(const StrokePtr &stroke)> predicate, std::vector<int> &strokesIdx);
 
+    // Select strokes with at least one vertex inside a shape (+ predicate function)
+    void selectStrokes(VectorKeyFrame *keyframe, unsigned int inbetween, const QPolygonF &bounds, std::function<bool(unsigned int strokeId)> predicate, StrokeIntervals &selection) const;
+
     // Select trajectory constraint
     int selectTrajectoryConstraint(VectorKeyFrame *keyframe, const QPointF &pickPos, bool useFilter);
     void selectTrajectoryConstraint(VectorKeyFrame *keyframe, const QPolygonF &bounds, bool useFilter);
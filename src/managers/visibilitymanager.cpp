@@ -12,12 +12,28 @@
 #include "layoutmanager.h"
 #include "canvascommands.h"
 #include "arap.h"
+#include "utils/stopwatch.h"
 
 #include <unordered_map>
 #include <unordered_set>
 
 // TODO: add macro to all qundocommands
 
+typedef nanoflann::KDTreeSingleIndexAdaptor<nanoflann::L2_Simple_Adaptor<Point::Scalar, DatasetAdaptor>, DatasetAdaptor, 2, size_t> SourceKDTree;
+
+/**
+ * Return the squared distance from pos to the closest point of the KD-tree
+ */
+template<typename KDTree>
+static Point::Scalar closestDistanceSq(const KDTree &tree, const Point::VectorType &pos) {
+    size_t idx;
+    Point::Scalar distSq;
+    nanoflann::KNNResultSet<Point::Scalar> result(1);
+    result.init(&idx, &distSq);
+    tree.findNeighbors(result, &pos[0], nanoflann::SearchParams(10));
+    return distSq;
+}
+
 VisibilityManager::VisibilityManager(QObject* pParent) : BaseManager(pParent) {
 
 }
@@ -62,7 +78,7 @@ void VisibilityManager::init(VectorKeyFrame *A, VectorKeyFrame *B) {
     for (Group *group : B->postGroups()) {
         if (group->size() == 0) continue;
         for (auto it = group->strokes().constBegin(); it != group->strokes().constEnd(); ++it) {
-            const StrokePtr &stroke = inbB.strokes[it.key()];
+            const StrokePtr &stroke = inbB.stroke(it.key());
             for (const Interval &interval : it.value()) {
                 for (unsigned int i = interval.from(); i <= interval.to(); ++i) {
                     if (occludedVertices.find(Utils::cantor(stroke->id(), i)) == occludedVertices.end() && B->visibility().value(Utils::cantor(stroke->id(), i), 0) != -2.0) { // only visible vertices
@@ -93,18 +109,18 @@ void VisibilityManager::computePointsFirstPass(VectorKeyFrame *A, VectorKeyFrame
     m_radiusSq.reserve(inbetween.nbVertices);
     for (Group *group : A->postGroups()) {
         for (auto it = group->strokes().constBegin(); it != group->strokes().constEnd(); ++it) {
-            const Stroke *stroke = inbetween.strokes[it.key()].get(); // TODo last inb?
-            double rad = stroke->strokeWidth() + 2;
+            const InbetweenStroke &stroke = inbetween.strokes.constFind(it.key()).value(); // TODo last inb?
+            double rad = stroke.source()->strokeWidth() + 2;
             radSq = rad * rad;
             for (const Interval &interval : it.value()) {
                 for (unsigned int i = interval.from(); i <= interval.to(); ++i) {
-                    if (occludedVertices.find(Utils::cantor(stroke->id(), i)) == occludedVertices.end() && A->visibility().value(Utils::cantor(stroke->id(), i), 0) != -2.0) {
-                        Point *point = stroke->points()[i];
-                        unsigned int count = treeB.kdtree->radiusSearch(&stroke->points()[i]->pos()[0], radSq, res, nanoflann::SearchParams(10));
+                    if (occludedVertices.find(Utils::cantor(stroke.id(), i)) == occludedVertices.end() && A->visibility().value(Utils::cantor(stroke.id(), i), 0) != -2.0) {
+                        Point::VectorType pos = stroke.pos(i);
+                        unsigned int count = treeB.kdtree->radiusSearch(&pos[0], radSq, res, nanoflann::SearchParams(10));
                         if (count == 0) {
                             m_points.push_back(A->stroke(it.key())->points()[i]);
-                            m_pointsKeys.push_back(Utils::cantor(stroke->id(), i));
-                            m_radiusSq.insert({Utils::cantor(stroke->id(), i), radSq});
+                            m_pointsKeys.push_back(Utils::cantor(stroke.id(), i));
+                            m_radiusSq.insert({Utils::cantor(stroke.id(), i), radSq});
                             A->stroke(it.key())->points()[i]->setColor(QColor(Qt::darkRed));
                         }
                     }
@@ -151,25 +167,16 @@ bool VisibilityManager::findSources(VectorKeyFrame *A, std::vector<Point *> &sou
 
 void VisibilityManager::assignVisibilityThreshold(VectorKeyFrame *A, const std::vector<Point *> &sources) {
     if (sources.empty()) qWarning() << "Error in assignVisibilityThreshold: no source point!";
-    int strideA = A->parentLayer()->stride(A->keyframeNumber());
+    StopWatch sw("Assign visibility threshold");
 
-    std::vector<Point::VectorType> curSources(sources.size());
-    for (int i = 0; i < sources.size(); ++i) {
-        curSources[i] = sources[i]->pos();
-    }
+    // Precompute KD tree of the sources
+    PointKDTree sourcesTree;
+    if (!sources.empty()) sourcesTree.make(sources);
 
     // Assign visibility threshold based on distance to closest source
-    Point *point;
-    double maxDist = 0.0, distSqToClosestSource, d;
-    int closestSourceId;
+    double maxDist = 0.0, distSqToClosestSource;
     for (unsigned int i = 0; i < m_points.size(); ++i) {
-        point = m_points[i];
-        distSqToClosestSource = std::numeric_limits<double>::max();
-        closestSourceId = -1;
-        for (Point::VectorType source : curSources) {
-            d = (source - point->pos()).squaredNorm();
-            if (d < distSqToClosestSource) distSqToClosestSource = d;
-        }
+        distSqToClosestSource = sources.empty() ? std::numeric_limits<double>::max() : closestDistanceSq(*sourcesTree.kdtree, m_points[i]->pos());
         distSqToClosestSource = sqrt(distSqToClosestSource);
         A->visibility()[m_pointsKeys[i]] = distSqToClosestSource;
         if (distSqToClosestSource > maxDist) maxDist = distSqToClosestSource;
@@ -185,6 +192,7 @@ void VisibilityManager::assignVisibilityThreshold(VectorKeyFrame *A, const std::
         }
     }
     A->updateBuffers();
+    sw.stop();
 }
 
 
@@ -236,30 +244,30 @@ void VisibilityManager::computePointsFirstPassAppearance(VectorKeyFrame *A, Vect
     m_radiusSq.reserve(inbetween.nbVertices);
     for (Group *group : B->postGroups()) {
         for (auto it = group->strokes().constBegin(); it != group->strokes().constEnd(); ++it) {
-            const Stroke *stroke = inbetween.strokes[it.key()].get(); // TODo last inb?
+            const InbetweenStroke &stroke = inbetween.strokes.constFind(it.key()).value(); // TODo last inb?
             for (const Interval &interval : it.value()) {
                 int start = -1, end = -1;
                 for (unsigned int i = interval.from(); i <= interval.to(); ++i) {
-                    Point *point = stroke->points()[i];
-                    double rad = stroke->strokeWidth() * point->pressure() + 2;
+                    double rad = stroke.source()->strokeWidth() * stroke.source()->points()[i]->pressure() + 2;
                     radSq = rad * rad;
-                    unsigned int count = treeA.kdtree->radiusSearch(&stroke->points()[i]->pos()[0], radSq * 2.0, res, nanoflann::SearchParams(10));
+                    Point::VectorType pos = stroke.pos(i);
+                    unsigned int count = treeA.kdtree->radiusSearch(&pos[0], radSq * 2.0, res, nanoflann::SearchParams(10));
                     if (count == 0) {
                         // TODO stroke intervals
                         if (start == -1) start = i;
                         end = i;
                         m_pointsAppearance.push_back(B->stroke(it.key())->points()[i]);
-                        m_pointsKeysAppearance.push_back(Utils::cantor(stroke->id(), i));
-                        m_radiusSqAppearance.insert({Utils::cantor(stroke->id(), i), radSq});
+                        m_pointsKeysAppearance.push_back(Utils::cantor(stroke.id(), i));
+                        m_radiusSqAppearance.insert({Utils::cantor(stroke.id(), i), radSq});
                         B->stroke(it.key())->points()[i]->setColor(QColor(2, 68, 252));
                     } else {
-                        if (start != end) m_strokesAppearance[stroke->id()].append(Interval(start, end));
+                        if (start != end) m_strokesAppearance[stroke.id()].append(Interval(start, end));
                         start = -1;
                         end = -1;
                     }
                 }
                 if (start != end) {
-                    m_strokesAppearance[stroke->id()].append(Interval(start, end));
+                    m_strokesAppearance[stroke.id()].append(Interval(start, end));
                 }
             }
         }
@@ -613,27 +621,28 @@ void VisibilityManager::assignVisibilityThresholdAppearance(VectorKeyFrame *A, c
     std::vector<double> clusterMaxDist(clusters);
     for (int i = 0; i < clusters; ++i) clusterMaxDist[i] = 0.0;
 
-    for (int i = 0; i < sources.size(); ++i) {
-        std::cout << "source: " << sources[i].transpose() << "   " << sourcesGroupsId[i] << std::endl;
+    StopWatch sw("Assign visibility threshold (appearance)");
+
+    // Precompute a KD tree of the sources of each group, points are only compared to the sources of their group
+    std::unordered_map<int, std::vector<Point::VectorType>> groupSources;
+    for (unsigned int j = 0; j < sources.size(); ++j) {
+        groupSources[sourcesGroupsId[j]].push_back(sources[j]);
+    }
+    std::unordered_map<int, std::unique_ptr<DatasetAdaptor>> datasets;
+    std::unordered_map<int, std::unique_ptr<SourceKDTree>> sourcesTrees;
+    for (auto it = groupSources.begin(); it != groupSources.end(); ++it) {
+        datasets[it->first] = std::make_unique<DatasetAdaptor>(it->second);
+        sourcesTrees[it->first] = std::make_unique<SourceKDTree>(2, *datasets[it->first], nanoflann::KDTreeSingleIndexAdaptorParams(10));
     }
 
     // Assign visibility threshold based on distance to closest source
     Point *point;
-    double distSqToClosestSource, d;
-    int closestSourceId, count;
+    double distSqToClosestSource;
     for (unsigned int i = 0; i < m_appearingPointsKeys.size(); ++i) {
         point = m_appearingPointsKeys[i].second;
-        distSqToClosestSource = std::numeric_limits<double>::max();
-        closestSourceId = -1;
-        count = 0;
-        for (unsigned int j = 0; j < sources.size(); ++j) {
-            if (sourcesGroupsId[j] != point->groupId()) continue;
-            ++count;
-            Point::VectorType source = sources[j];
-            d = (source - point->pos()).squaredNorm();
-            if (d < distSqToClosestSource) distSqToClosestSource = d;
-        }
-        if (count == 0) continue;
+        auto tree = sourcesTrees.find(point->groupId());
+        if (tree == sourcesTrees.end()) continue;
+        distSqToClosestSource = closestDistanceSq(*tree->second, point->pos());
         distSqToClosestSource = sqrt(distSqToClosestSource);
         A->visibility()[m_appearingPointsKeys[i].first] = distSqToClosestSource;
         if (distSqToClosestSource > clusterMaxDist[m_appearingPointsCluster[i]]) clusterMaxDist[m_appearingPointsCluster[i]] = distSqToClosestSource;
@@ -646,4 +655,5 @@ void VisibilityManager::assignVisibilityThresholdAppearance(VectorKeyFrame *A, c
         A->visibility()[m_appearingPointsKeys[i].first] = std::clamp((A->visibility()[m_appearingPointsKeys[i].first]), 0.0, 1.0);
     }
     A->updateBuffers();
+    sw.stop();
 }
\ No newline at end of file
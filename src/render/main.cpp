@@ -0,0 +1,221 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2024 Melvin Even <melvin.even@inria.fr>
+ *
+ * SPDX-License-Identifier: CECILL-2.1
+ */
+
+// frite-render: export the frames of .fries projects without opening the editor window
+//
+//   frite-render [-o dir] [-f png|svg] [--from N] [--to N] [-s WxH] [-j jobs] [-r auto|gl|cpu] shot1.fries [shot2.fries ...]
+//
+// The canvas is still a QOpenGLWidget, so the gl renderer goes through a hidden window on the "offscreen" platform
+// plugin by default (set QT_QPA_PLATFORM to use another one, e.g. eglfs on a GPU node).
+// The cpu renderer rasterizes the strokes in software (see Editor::exportFramesSoftware) and creates no widget: the editor
+// runs without a canvas. A QApplication is still needed since the fixed scene is a QGraphicsScene (QtWidgets).
+// By default (auto), the gl renderer is used if an OpenGL context can be created and the cpu renderer otherwise.
+// With several projects and -j > 1, each project is rendered by its own child process.
+
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QEventLoop>
+#include <QFileInfo>
+#include <QMainWindow>
+#include <QMenuBar>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QProcess>
+#include <QSurfaceFormat>
+#include <QtDebug>
+
+#include <functional>
+
+#include "dialsandknobs.h"
+#include "editor.h"
+#include "filemanager.h"
+#include "tabletcanvas.h"
+
+struct RenderOptions {
+    QString outputDir;
+    QString format;
+    int from = -1;
+    int to = -1;
+    QSize size;
+    bool software = false;
+};
+
+// Whether a context with the default format can be created and made current, without any window
+static bool openGLAvailable() {
+    QOffscreenSurface surface;
+    surface.create();
+    QOpenGLContext context;
+    if (!surface.isValid() || !context.create()) return false;
+    bool current = context.makeCurrent(&surface);
+    if (current) context.doneCurrent();
+    return current;
+}
+
+static QString outputPath(const QString &filename, const RenderOptions &options) {
+    QFileInfo info(filename);
+    QString dir = options.outputDir.isEmpty() ? info.absolutePath() : options.outputDir;
+    QDir().mkpath(dir);
+    return dir + "/" + info.baseName() + "." + options.format;
+}
+
+static bool renderProjectSoftware(const QString &filename, const RenderOptions &options) {
+    Editor editor;
+    editor.init(nullptr);
+
+    FileManager fileManager;
+    fileManager.createWorkingDir();
+    if (!fileManager.load(filename, &editor, nullptr)) return false;
+    editor.scrubTo(0);
+
+    QSize exportSize = options.size.isValid() ? options.size : editor.canvasRect().size();
+    editor.exportFramesSoftware(outputPath(filename, options), exportSize, options.from, options.to);
+    return true;
+}
+
+static bool renderProject(const QString &filename, const RenderOptions &options) {
+    if (options.software) return renderProjectSoftware(filename, options);
+
+    // Like in MainWindow, the editor outlives the canvas
+    Editor editor;
+
+    // The canvas and the dials need a main window, it is never shown on a screen
+    QMainWindow host;
+    TabletCanvas *canvas = new TabletCanvas;
+    host.setCentralWidget(canvas);
+    DialsAndKnobs *dk = new DialsAndKnobs(&host, host.menuBar()->addMenu("Window"));
+
+    editor.init(canvas);
+    canvas->setEditor(&editor);
+
+    FileManager fileManager;
+    fileManager.createWorkingDir();
+    if (!fileManager.load(filename, &editor, dk)) return false;
+    editor.scrubTo(0);
+
+    QSize exportSize = options.size.isValid() ? options.size : canvas->canvasRect().size();
+    QString path = outputPath(filename, options);
+
+    // Create the GL context of the canvas
+    host.resize(canvas->canvasRect().size());
+    host.show();
+    QCoreApplication::processEvents();
+    if (canvas->context() == nullptr || !canvas->context()->isValid()) {
+        qCritical("No OpenGL context available to render \"%s\".", qPrintable(filename));
+        return false;
+    }
+    editor.exportFrames(path, exportSize, true, options.from, options.to);
+    return true;
+}
+
+// Render each project in a child process, at most jobs at a time. Returns the number of failed projects
+static int renderInParallel(const QStringList &projects, const QStringList &arguments, int jobs) {
+    QEventLoop loop;
+    int next = 0, running = 0, failed = 0;
+
+    std::function<void()> startNext = [&]() {
+        while (running < jobs && next < projects.size()) {
+            QProcess *process = new QProcess(&loop);
+            process->setProcessChannelMode(QProcess::ForwardedChannels);
+            auto done = [&, process](bool success) {
+                if (!success) failed++;
+                running--;
+                process->deleteLater();
+                startNext();
+                if (running == 0) loop.quit();
+            };
+            QObject::connect(process, &QProcess::finished, [done](int exitCode, QProcess::ExitStatus status) {
+                done(status == QProcess::NormalExit && exitCode == 0);
+            });
+            QObject::connect(process, &QProcess::errorOccurred, [done](QProcess::ProcessError error) {
+                if (error == QProcess::FailedToStart) done(false);
+            });
+            running++;
+            process->start(QCoreApplication::applicationFilePath(), arguments + QStringList{projects[next++]});
+        }
+    };
+
+    startNext();
+    if (running > 0) loop.exec();
+    return failed;
+}
+
+int main(int argc, char *argv[]) {
+    QLocale::setDefault(QLocale(QLocale::English, QLocale::UnitedStates));
+
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM")) qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QSurfaceFormat format;
+    format.setDepthBufferSize(24);
+    format.setStencilBufferSize(8);
+    format.setSamples(8);
+    format.setVersion(4, 1);
+    format.setProfile(QSurfaceFormat::CoreProfile);
+    QSurfaceFormat::setDefaultFormat(format);
+
+    QApplication app(argc, argv);
+    QCoreApplication::setApplicationName("frite-render");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Export the frames of Frite projects without opening a window.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("projects", "Projects to render (.fries or .xml).", "<project>...");
+    QCommandLineOption outputOption({"o", "output"}, "Output directory (default: next to each project).", "dir");
+    QCommandLineOption formatOption({"f", "format"}, "Output format: png, jpg, tif, bmp or svg (default: png).", "format", "png");
+    QCommandLineOption fromOption("from", "First exported frame (default: export range of the project).", "frame");
+    QCommandLineOption toOption("to", "Last exported frame (default: last frame of the project).", "frame");
+    QCommandLineOption sizeOption({"s", "size"}, "Export size as WIDTHxHEIGHT (default: canvas size).", "size");
+    QCommandLineOption jobsOption({"j", "jobs"}, "Number of projects rendered in parallel (default: 1).", "jobs", "1");
+    QCommandLineOption rendererOption({"r", "renderer"}, "Stroke renderer: auto, gl or cpu (default: auto, cpu if OpenGL is not available).", "renderer", "auto");
+    parser.addOptions({outputOption, formatOption, fromOption, toOption, sizeOption, jobsOption, rendererOption});
+    parser.process(app);
+
+    const QStringList projects = parser.positionalArguments();
+    if (projects.isEmpty()) parser.showHelp(1);
+
+    RenderOptions options;
+    options.outputDir = parser.value(outputOption);
+    options.format = parser.value(formatOption).toLower();
+    bool ok = true;
+    if (parser.isSet(fromOption)) options.from = parser.value(fromOption).toInt(&ok);
+    if (ok && parser.isSet(toOption)) options.to = parser.value(toOption).toInt(&ok);
+    if (ok && parser.isSet(sizeOption)) {
+        QStringList wh = parser.value(sizeOption).split('x');
+        bool okH = false;
+        if (wh.size() == 2) options.size = QSize(wh[0].toInt(&ok), wh[1].toInt(&okH));
+        ok = ok && okH && !options.size.isEmpty();
+    }
+    QString renderer = parser.value(rendererOption).toLower();
+    if (renderer != "auto" && renderer != "gl" && renderer != "cpu") ok = false;
+    int jobs = parser.value(jobsOption).toInt();
+    if (!ok || jobs < 1) {
+        qCritical("Invalid arguments.");
+        parser.showHelp(1);
+    }
+    if (renderer == "auto") {
+        renderer = openGLAvailable() ? "gl" : "cpu";
+        if (renderer == "cpu") qWarning("OpenGL is not available, the frames are rendered on the CPU.");
+    }
+    options.software = renderer == "cpu";
+
+    if (projects.size() > 1 && jobs > 1) {
+        QStringList arguments = {"-f", options.format, "-j", "1", "-r", renderer};
+        if (!options.outputDir.isEmpty()) arguments << "-o" << QDir(options.outputDir).absolutePath();
+        if (options.from >= 0) arguments << "--from" << QString::number(options.from);
+        if (options.to >= 0) arguments << "--to" << QString::number(options.to);
+        if (options.size.isValid()) arguments << "-s" << parser.value(sizeOption);
+        return renderInParallel(projects, arguments, jobs) == 0 ? 0 : 1;
+    }
+
+    int failed = 0;
+    for (const QString &project : projects) {
+        if (!renderProject(project, options)) {
+            qCritical("Failed to render \"%s\".", qPrintable(project));
+            failed++;
+        }
+    }
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,189 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2024 Melvin Even <melvin.even@inria.fr>
+ *
+ * SPDX-License-Identifier: CECILL-2.1
+ */
+
+#include "archive.h"
+
+#include <quazip.h>
+#include <quazipfile.h>
+#include <quazipnewinfo.h>
+#include <zlib.h>
+
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QThread>
+#include <QtConcurrent>
+
+#include <atomic>
+#include <cstring>
+#include <deque>
+
+namespace {
+    struct Entry {
+        QString name;       // path relative to the archived directory, directories end with '/'
+        QString filePath;
+        QByteArray data;    // raw deflate stream
+        qint64 size = 0;
+        quint32 crc = 0;
+        bool ok = true;
+    };
+
+    // Raw deflate stream (no zlib header and trailer) as expected by the zip format
+    bool deflateRaw(const QByteArray &in, QByteArray &out) {
+        z_stream stream;
+        std::memset(&stream, 0, sizeof(z_stream));
+        if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+        out.resize(deflateBound(&stream, in.size()));
+        stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.constData()));
+        stream.avail_in = in.size();
+        stream.next_out = reinterpret_cast<Bytef *>(out.data());
+        stream.avail_out = out.size();
+        int res = deflate(&stream, Z_FINISH);
+        out.resize(stream.total_out);
+        deflateEnd(&stream);
+        return res == Z_STREAM_END;
+    }
+
+    void deflateEntry(Entry &entry) {
+        if (entry.name.endsWith('/')) return;
+        QFile file(entry.filePath);
+        if (!file.open(QIODevice::ReadOnly)) {
+            entry.ok = false;
+            return;
+        }
+        QByteArray data = file.readAll();
+        entry.size = data.size();
+        entry.crc = crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef *>(data.constData()), data.size());
+        entry.ok = deflateRaw(data, entry.data);
+    }
+}
+
+bool Archive::compressDir(const QString &zipFile, const QString &dir, qint64 *bytes) {
+    QDir root(dir);
+    if (!root.exists()) return false;
+
+    // list the files and subdirectories (as JlCompress::compressDir, directories get their own entry)
+    std::vector<Entry> entries;
+    QDirIterator it(dir, QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        Entry entry;
+        entry.filePath = it.filePath();
+        entry.name = root.relativeFilePath(it.filePath());
+        if (it.fileInfo().isDir()) entry.name += '/';
+        entries.push_back(entry);
+    }
+
+    QuaZip zip(zipFile);
+    QDir().mkpath(QFileInfo(zipFile).absolutePath());
+    if (!zip.open(QuaZip::mdCreate)) {
+        qWarning() << "Archive: cannot create " << zipFile;
+        return false;
+    }
+
+    // Deflate the files concurrently while the archive is written in order. At most maxInFlight files are read or kept
+    // compressed at a time: the next one is only started once the oldest is written and its buffer released.
+    const size_t maxInFlight = 2 * std::max(1, QThread::idealThreadCount());
+    std::deque<QFuture<void>> inFlight;
+    size_t next = 0;
+    qint64 total = 0;
+    bool success = true;
+    for (Entry &entry : entries) {
+        for (; next < entries.size() && inFlight.size() < maxInFlight; ++next) {
+            Entry *nextEntry = &entries[next];
+            inFlight.push_back(QtConcurrent::run([nextEntry]() { deflateEntry(*nextEntry); }));
+        }
+        inFlight.front().waitForFinished();
+        inFlight.pop_front();
+
+        if (!entry.ok) {
+            qWarning() << "Archive: cannot compress " << entry.filePath;
+            success = false;
+            continue;
+        }
+        QuaZipNewInfo info(entry.name, entry.filePath);
+        QuaZipFile out(&zip);
+        if (entry.name.endsWith('/')) {
+            success &= out.open(QIODevice::WriteOnly, info);
+        } else {
+            info.uncompressedSize = entry.size;
+            success &= out.open(QIODevice::WriteOnly, info, nullptr, entry.crc, Z_DEFLATED, Z_DEFAULT_COMPRESSION, true);
+            success &= out.write(entry.data) == entry.data.size();
+            total += entry.size;
+            entry.data = QByteArray();
+        }
+        out.close();
+        success &= out.getZipError() == ZIP_OK;
+    }
+    zip.close();
+    success &= zip.getZipError() == ZIP_OK;
+
+    if (!success) QFile::remove(zipFile);
+    if (bytes != nullptr) *bytes = total;
+    return success;
+}
+
+bool Archive::extractDir(const QString &zipFile, const QString &dir, qint64 *bytes) {
+    QStringList names;
+    {
+        QuaZip zip(zipFile);
+        if (!zip.open(QuaZip::mdUnzip)) {
+            qWarning() << "Archive: cannot open " << zipFile;
+            return false;
+        }
+        names = zip.getFileNameList();
+    }
+
+    QDir root(dir);
+    QString rootPath = QDir::cleanPath(root.absolutePath()) + '/';
+    root.mkpath(".");
+
+    // each worker goes through every nbJobs-th entry with its own handle on the archive
+    QList<int> jobs;
+    for (int i = 0; i < std::min((int)names.size(), QThread::idealThreadCount()); ++i) jobs.append(i);
+    std::atomic<bool> success(true);
+    std::atomic<qint64> total(0);
+    QtConcurrent::blockingMap(jobs, [&](int job) {
+        QuaZip zip(zipFile);
+        if (!zip.open(QuaZip::mdUnzip)) {
+            success = false;
+            return;
+        }
+        for (int i = job; i < names.size(); i += jobs.size()) {
+            const QString &name = names[i];
+            QString path = QDir::cleanPath(root.absoluteFilePath(name));
+            if (!(path + '/').startsWith(rootPath)) {
+                qWarning() << "Archive: ignoring entry outside of the extraction directory: " << name;
+                continue;
+            }
+            if (name.endsWith('/')) {
+                QDir().mkpath(path);
+                continue;
+            }
+            QDir().mkpath(QFileInfo(path).absolutePath());
+
+            QuaZipFile in(&zip);
+            if (!zip.setCurrentFile(name) || !in.open(QIODevice::ReadOnly)) {
+                qWarning() << "Archive: cannot read " << name << " in " << zipFile;
+                success = false;
+                continue;
+            }
+            QByteArray data = in.readAll();
+            in.close();
+            QFile out(path);
+            if (in.getZipError() != UNZ_OK || !out.open(QIODevice::WriteOnly) || out.write(data) != data.size()) {
+                qWarning() << "Archive: cannot extract " << name << " to " << path;
+                success = false;
+                continue;
+            }
+            total += data.size();
+        }
+    });
+
+    if (bytes != nullptr) *bytes = total;
+    return success;
+}
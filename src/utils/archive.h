@@ -0,0 +1,27 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2024 Melvin Even <melvin.even@inria.fr>
+ *
+ * SPDX-License-Identifier: CECILL-2.1
+ */
+
+#ifndef __ARCHIVE_H__
+#define __ARCHIVE_H__
+
+#include <QString>
+
+/**
+ * Zip archive of a project working directory, a drop-in replacement for JlCompress::compressDir and
+ * JlCompress::extractDir that processes the entries (main.xml and the keyframes payloads) in parallel.
+ *
+ * compressDir deflates the files on the global thread pool while the archive is written sequentially from the
+ * compressed buffers (QuaZip raw mode), only a few files are held in memory at a time. extractDir splits the entries between workers which each open their own
+ * handle on the archive.
+ * The archives are regular zip files, readable by JlCompress and the previous versions of Frite.
+ */
+namespace Archive {
+    // bytes, if not null, receives the total uncompressed size of the files
+    bool compressDir(const QString &zipFile, const QString &dir, qint64 *bytes = nullptr);
+    bool extractDir(const QString &zipFile, const QString &dir, qint64 *bytes = nullptr);
+}
+
+#endif // __ARCHIVE_H__
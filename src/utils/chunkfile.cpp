@@ -0,0 +1,154 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2024 Melvin Even <melvin.even@inria.fr>
+ *
+ * SPDX-License-Identifier: CECILL-2.1
+ */
+
+#include "chunkfile.h"
+
+#include <QBuffer>
+#include <QDebug>
+#include <QSaveFile>
+
+namespace {
+    struct Header {
+        char magic[4];
+        quint32 version;
+        quint32 nbChunks;
+        quint32 reserved;
+    };
+
+    struct TableEntry {
+        char name[ChunkFile::NAME_SIZE];
+        quint64 offset;
+        quint64 count;
+        quint32 elementSize;
+        quint32 reserved;
+    };
+
+    inline quint64 align(quint64 offset) { return (offset + ChunkFile::ALIGNMENT - 1) / ChunkFile::ALIGNMENT * ChunkFile::ALIGNMENT; }
+}
+
+ChunkWriter::Chunk &ChunkWriter::find(const char *name, quint32 elementSize) {
+    for (Chunk &chunk : m_chunks) {
+        if (chunk.name == name) {
+            if (chunk.elementSize != elementSize) qCritical() << "ChunkWriter: inconsistent element size for chunk " << name;
+            return chunk;
+        }
+    }
+    if (std::strlen(name) >= ChunkFile::NAME_SIZE) qCritical() << "ChunkWriter: chunk name too long: " << name;
+    m_chunks.push_back({QByteArray(name).left(ChunkFile::NAME_SIZE - 1), elementSize, QByteArray()});
+    return m_chunks.back();
+}
+
+bool ChunkWriter::write(const QString &fileName) const {
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "ChunkWriter: cannot open " << fileName;
+        return false;
+    }
+    return write(file) && file.commit();
+}
+
+QByteArray ChunkWriter::toByteArray() const {
+    QByteArray bytes;
+    QBuffer buffer(&bytes);
+    buffer.open(QIODevice::WriteOnly);
+    if (!write(buffer)) return QByteArray();
+    return bytes;
+}
+
+bool ChunkWriter::write(QIODevice &device) const {
+    if (!ChunkFile::supported()) {
+        qWarning() << "ChunkWriter: binary payloads are not supported on big-endian hosts";
+        return false;
+    }
+
+    Header header;
+    std::memcpy(header.magic, ChunkFile::MAGIC, 4);
+    header.version = ChunkFile::VERSION;
+    header.nbChunks = m_chunks.size();
+    header.reserved = 0;
+
+    std::vector<TableEntry> table(m_chunks.size());
+    quint64 offset = align(sizeof(Header) + table.size() * sizeof(TableEntry));
+    for (size_t i = 0; i < m_chunks.size(); ++i) {
+        TableEntry &entry = table[i];
+        std::memset(&entry, 0, sizeof(TableEntry));
+        std::memcpy(entry.name, m_chunks[i].name.constData(), m_chunks[i].name.size());
+        entry.offset = offset;
+        entry.count = m_chunks[i].data.size() / m_chunks[i].elementSize;
+        entry.elementSize = m_chunks[i].elementSize;
+        offset = align(offset + m_chunks[i].data.size());
+    }
+
+    static const char padding[ChunkFile::ALIGNMENT] = {0};
+    bool success = device.write(reinterpret_cast<const char *>(&header), sizeof(Header)) == sizeof(Header);
+    success &= device.write(reinterpret_cast<const char *>(table.data()), table.size() * sizeof(TableEntry)) == qint64(table.size() * sizeof(TableEntry));
+    qint64 pos = sizeof(Header) + table.size() * sizeof(TableEntry);
+    for (size_t i = 0; i < m_chunks.size(); ++i) {
+        success &= device.write(padding, table[i].offset - pos) == qint64(table[i].offset - pos);
+        success &= device.write(m_chunks[i].data) == m_chunks[i].data.size();
+        pos = table[i].offset + m_chunks[i].data.size();
+    }
+    return success;
+}
+
+ChunkReader::~ChunkReader() {
+    close();
+}
+
+bool ChunkReader::open(const QString &fileName) {
+    close();
+    if (!ChunkFile::supported()) {
+        qWarning() << "ChunkReader: binary payloads are not supported on big-endian hosts";
+        return false;
+    }
+
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        qWarning() << "ChunkReader: cannot open " << fileName;
+        return false;
+    }
+
+    qint64 fileSize = m_file.size();
+    const uchar *data = fileSize >= (qint64)sizeof(Header) ? m_file.map(0, fileSize) : nullptr;
+    if (data == nullptr) {
+        qWarning() << "ChunkReader: cannot map " << fileName;
+        m_file.close();
+        return false;
+    }
+
+    Header header;
+    std::memcpy(&header, data, sizeof(Header));
+    if (std::memcmp(header.magic, ChunkFile::MAGIC, 4) != 0 || header.version > ChunkFile::VERSION
+        || (quint64)fileSize < sizeof(Header) + (quint64)header.nbChunks * sizeof(TableEntry)) {
+        qWarning() << "ChunkReader: invalid or unsupported file " << fileName;
+        m_file.close();
+        return false;
+    }
+
+    for (quint32 i = 0; i < header.nbChunks; ++i) {
+        TableEntry entry;
+        std::memcpy(&entry, data + sizeof(Header) + i * sizeof(TableEntry), sizeof(TableEntry));
+        // count * elementSize may overflow, compare count to the number of elements that fit after the offset instead
+        if (entry.elementSize == 0 || entry.offset % ChunkFile::ALIGNMENT != 0
+            || (entry.count > 0 && (entry.offset > (quint64)fileSize || entry.count > ((quint64)fileSize - entry.offset) / entry.elementSize))) {
+            qWarning() << "ChunkReader: corrupted chunk table in " << fileName;
+            m_entries.clear();
+            m_file.close();
+            return false;
+        }
+        entry.name[ChunkFile::NAME_SIZE - 1] = '\0';
+        m_entries.insert(QByteArray(entry.name), {entry.offset, entry.count, entry.elementSize});
+    }
+
+    m_data = data;
+    return true;
+}
+
+void ChunkReader::close() {
+    m_entries.clear();
+    m_data = nullptr;
+    if (m_file.isOpen()) m_file.close();    // also unmaps the file
+}
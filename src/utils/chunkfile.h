@@ -0,0 +1,112 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2024 Melvin Even <melvin.even@inria.fr>
+ *
+ * SPDX-License-Identifier: CECILL-2.1
+ */
+
+#ifndef __CHUNKFILE_H__
+#define __CHUNKFILE_H__
+
+#include <QByteArray>
+#include <QFile>
+#include <QIODevice>
+#include <QHash>
+#include <QString>
+
+#include <vector>
+#include <cstring>
+#include <type_traits>
+
+/**
+ * Binary payload of a keyframe (strokes points, groups intervals and UVs, lattices quads and corners).
+ * The XML document stays the manifest of the project and only refers to ranges of the named arrays of this file, see
+ * VectorKeyFrame::save.
+ *
+ * Layout (little-endian):
+ *   header      "FRCK", uint32 version, uint32 number of chunks, uint32 reserved
+ *   chunk table per chunk: char name[24] (null-padded), uint64 offset, uint64 number of elements, uint32 element size, uint32 reserved
+ *   payloads    raw arrays, each aligned on ChunkFile::ALIGNMENT bytes
+ *
+ * Payloads are stored uncompressed so a ChunkReader can map the file and hand out pointers into it without copying.
+ */
+namespace ChunkFile {
+    static constexpr char MAGIC[4] = {'F', 'R', 'C', 'K'};
+    static constexpr quint32 VERSION = 1;
+    static constexpr int NAME_SIZE = 24;
+    static constexpr int ALIGNMENT = 16;
+
+    // Payloads are written in host order, only little-endian hosts can read and write them
+    inline bool supported() { return Q_BYTE_ORDER == Q_LITTLE_ENDIAN; }
+}
+
+class ChunkWriter {
+public:
+    // Append count elements to the named array (created on first use), return the index of the first appended element
+    template<typename T>
+    size_t append(const char *name, const T *data, size_t count) {
+        static_assert(std::is_trivially_copyable<T>::value, "chunk elements must be trivially copyable");
+        Chunk &chunk = find(name, sizeof(T));
+        size_t first = chunk.data.size() / sizeof(T);
+        chunk.data.append(reinterpret_cast<const char *>(data), count * sizeof(T));
+        return first;
+    }
+
+    template<typename T>
+    size_t append(const char *name, const std::vector<T> &data) { return append(name, data.data(), data.size()); }
+
+    bool empty() const { return m_chunks.empty(); }
+    bool write(const QString &fileName) const;
+    bool write(QIODevice &device) const;
+    // Content of the file written by write, e.g. to be written later by another thread
+    QByteArray toByteArray() const;
+
+private:
+    struct Chunk {
+        QByteArray name;
+        quint32 elementSize;
+        QByteArray data;
+    };
+
+    Chunk &find(const char *name, quint32 elementSize);
+
+    std::vector<Chunk> m_chunks;
+};
+
+class ChunkReader {
+public:
+    ChunkReader() { }
+    ~ChunkReader();
+    ChunkReader(const ChunkReader &other) = delete;
+    ChunkReader &operator=(const ChunkReader &other) = delete;
+
+    // Map the file and read its chunk table
+    bool open(const QString &fileName);
+    void close();
+    bool isOpen() const { return m_data != nullptr; }
+
+    // Elements [first, first + count[ of the named array, nullptr if the array does not exist, has another element type or is too short.
+    // The pointer is only valid while the reader is open.
+    template<typename T>
+    const T *array(const char *name, size_t first, size_t count) const {
+        auto it = m_entries.constFind(QByteArray(name));
+        if (it == m_entries.cend() || it->elementSize != sizeof(T) || first > it->count || count > it->count - first) return nullptr;
+        return reinterpret_cast<const T *>(m_data + it->offset) + first;
+    }
+
+    size_t size(const char *name) const {
+        auto it = m_entries.constFind(QByteArray(name));
+        return it == m_entries.cend() ? 0 : it->count;
+    }
+
+private:
+    struct Entry {
+        quint64 offset, count;
+        quint32 elementSize;
+    };
+
+    QFile m_file;
+    const uchar *m_data = nullptr;
+    QHash<QByteArray, Entry> m_entries;
+};
+
+#endif // __CHUNKFILE_H__
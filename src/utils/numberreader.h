@@ -0,0 +1,103 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2024 Melvin Even <melvin.even@inria.fr>
+ *
+ * SPDX-License-Identifier: CECILL-2.1
+ */
+
+#ifndef __NUMBERREADER_H__
+#define __NUMBERREADER_H__
+
+#include <QDomElement>
+#include <QString>
+#include <QStringView>
+
+#include <charconv>
+#include <type_traits>
+
+/**
+ * Reader of the whitespace-separated numbers saved as text in the XML documents (strokes points, groups intervals,
+ * correspondences...), a replacement for QTextStream >> that does not allocate.
+ * Each token is narrowed from UTF-16 into a stack buffer and parsed with std::from_chars, which is locale-independent
+ * like QTextStream and QString::toDouble. Tokens it rejects (e.g. subnormal values, or floating-point values when the
+ * standard library has no floating-point from_chars) go through QStringView's conversions instead, so the results
+ * are the same as before.
+ */
+class NumberReader {
+public:
+    explicit NumberReader(QStringView text) : m_pos(text.data()), m_end(text.data() + text.size()) { }
+
+    // Read the next number. If there is none or it is malformed, value is set to 0 and false is returned.
+    template<typename T>
+    bool read(T &value) {
+        static_assert(std::is_arithmetic<T>::value, "NumberReader only reads numbers");
+        while (m_pos != m_end && m_pos->isSpace()) ++m_pos;
+        const QChar *begin = m_pos;
+        while (m_pos != m_end && !m_pos->isSpace()) ++m_pos;
+        return parse(QStringView(begin, m_pos), value);
+    }
+
+    template<typename T, typename... Ts>
+    bool read(T &value, Ts &...values) {
+        bool ok = read(value);
+        return read(values...) && ok;
+    }
+
+    bool atEnd() {
+        while (m_pos != m_end && m_pos->isSpace()) ++m_pos;
+        return m_pos == m_end;
+    }
+
+    // Single number, replaces QString::toDouble, QString::toInt...
+    template<typename T>
+    static T number(QStringView text, T defaultValue = T(0)) {
+        T value;
+        return NumberReader(text).read(value) ? value : defaultValue;
+    }
+
+    // Text of the element, without the copy made by QDomElement::text when it only has one text node
+    static QString text(const QDomElement &element) {
+        QDomNode child = element.firstChild();
+        if (child.isNull()) return QString();
+        if (child.isText() && child.nextSibling().isNull()) return child.nodeValue();
+        return element.text();
+    }
+
+private:
+    template<typename T>
+    static bool parse(QStringView token, T &value) {
+        if (!token.isEmpty() && token.front().unicode() == u'+') token = token.mid(1);   // accepted by Qt but not by from_chars
+        if (token.isEmpty()) {
+            value = T(0);
+            return false;
+        }
+        char buffer[64];
+        if (token.size() >= qsizetype(sizeof(buffer))) return fallback(token, value);
+        for (qsizetype i = 0; i < token.size(); ++i) {
+            char16_t c = token[i].unicode();
+            if (c > 127) return fallback(token, value);
+            buffer[i] = char(c);
+        }
+#if defined(__cpp_lib_to_chars)
+        constexpr bool fromChars = true;
+#else
+        constexpr bool fromChars = std::is_integral<T>::value;   // no floating-point from_chars
+#endif
+        if constexpr (fromChars) {
+            auto result = std::from_chars(buffer, buffer + token.size(), value);
+            if (result.ec == std::errc() && result.ptr == buffer + token.size()) return true;
+        }
+        return fallback(token, value);
+    }
+
+    static bool fallback(QStringView token, double &value) { bool ok; value = token.toDouble(&ok); return ok; }
+    static bool fallback(QStringView token, float &value) { bool ok; value = token.toFloat(&ok); return ok; }
+    static bool fallback(QStringView token, int &value) { bool ok; value = token.toInt(&ok); return ok; }
+    static bool fallback(QStringView token, unsigned int &value) { bool ok; value = token.toUInt(&ok); return ok; }
+    static bool fallback(QStringView token, qlonglong &value) { bool ok; value = token.toLongLong(&ok); return ok; }
+    static bool fallback(QStringView token, qulonglong &value) { bool ok; value = token.toULongLong(&ok); return ok; }
+
+    const QChar *m_pos;
+    const QChar *m_end;
+};
+
+#endif // __NUMBERREADER_H__
@@ -16,12 +16,19 @@ void Test::sampleGridCornerTrajectory(Group *group, Lattice *grid, Corner *corne
     VectorKeyFrame *key = group->getParentKeyframe();
     double step = 1.0 / (double)(samples + 1);
     double t = 0.0;
-    double cumLength = 0.0;
+    std::vector<qreal> alphasLinear;
+    std::vector<Point::Affine> transforms;
     while (t <= 1.0) {
-        grid->interpolateARAP(t, group->spacingAlpha(t), key->rigidTransform((float)t));
-        outTrajectoryPoly.push_back(corner->coord(INTERP_POS));
+        alphasLinear.push_back(t);
+        transforms.push_back(key->rigidTransform((float)t));
         t += step;
     }
+    std::vector<InterpolatedFrame> frames;
+    grid->cornersTrajectories(group);
+    grid->interpolateCached(alphasLinear, transforms, frames);
+    for (const InterpolatedFrame &frame : frames) {
+        outTrajectoryPoly.push_back(frame[corner->getKey()]);
+    }
 }
 
 Point::Scalar Test::evalCornerTrajectoryArcLength(Group *group, Lattice *grid, Corner *corner, std::vector<double>&outDiffs) {
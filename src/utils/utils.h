@@ -13,6 +13,7 @@
 #endif
 
 #include <Eigen/Dense>
+#include <cstdint>
 
 namespace Utils {
 
@@ -48,12 +49,17 @@ namespace Utils {
         return 0.5 * (a + b) * (a + b + 1) + b;
     }
 
+    // 8 * z + 1 and the triangle numbers overflow 32 bits for z >= 2^29, everything is computed in 64 bits
     inline std::pair<unsigned int, unsigned int> invCantor(unsigned int z) {
-        unsigned int w = (unsigned int)(std::sqrt(8 * z + 1) - 1) / 2; // floor w/ unsigned int division
-        unsigned int t = (w * w + w) / 2; // triangle number of w
-        unsigned int y = z - t;
-        unsigned int x = w - y;
-        return {x, y};
+        uint64_t z64 = z;
+        uint64_t w = (uint64_t)((std::sqrt(8.0 * (double)z64 + 1.0) - 1.0) / 2.0);
+        // the floating point square root may be off by one
+        while (w > 0 && (w * w + w) / 2 > z64) --w;
+        while (((w + 1) * (w + 1) + w + 1) / 2 <= z64) ++w;
+        uint64_t t = (w * w + w) / 2; // triangle number of w
+        uint64_t y = z64 - t;
+        uint64_t x = w - y;
+        return {(unsigned int)x, (unsigned int)y};
     }
 
     // Find the smallest root in [0,1] of a quadratic polynomial
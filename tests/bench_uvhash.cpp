@@ -0,0 +1,69 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2024 Melvin Even <melvin.even@inria.fr>
+ *
+ * SPDX-License-Identifier: CECILL-2.1
+ */
+
+#include <QtTest>
+
+#include "uvhash.h"
+#include "utils/utils.h"
+
+/**
+ * Per-vertex UV lookups of the inbetween warping loop (see VectorKeyFrame::computeInbetweens):
+ * the former QHash keyed by Utils::cantor(stroke id, point index) against the per-stroke arrays of UVHash.
+ */
+class BenchUVHash : public QObject {
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cantorHash();
+    void strokeArrays();
+
+private:
+    static constexpr unsigned int NB_STROKES = 2000;
+    static constexpr unsigned int NB_POINTS = 200;
+
+    QHash<unsigned int, UVInfo> m_cantorUVs;
+    UVHash m_uvs;
+};
+
+void BenchUVHash::initTestCase() {
+    m_cantorUVs.reserve(NB_STROKES * NB_POINTS);
+    for (unsigned int s = 0; s < NB_STROKES; ++s) {
+        for (unsigned int i = 0; i < NB_POINTS; ++i) {
+            UVInfo info{int(s * 31 + i), Point::VectorType(i * 0.01, s * 0.01)};
+            m_cantorUVs.insert(Utils::cantor(s, i), info);
+            m_uvs.add(s, i, info);
+        }
+    }
+}
+
+void BenchUVHash::cantorHash() {
+    double sum = 0.0;
+    QBENCHMARK {
+        for (unsigned int s = 0; s < NB_STROKES; ++s) {
+            for (unsigned int i = 0; i < NB_POINTS; ++i) {
+                sum += m_cantorUVs.value(Utils::cantor(s, i)).uv.x();
+            }
+        }
+    }
+    QVERIFY(sum > 0.0);
+}
+
+void BenchUVHash::strokeArrays() {
+    double sum = 0.0;
+    QBENCHMARK {
+        for (unsigned int s = 0; s < NB_STROKES; ++s) {
+            const UVHash::StrokeUVs &strokeUVs = m_uvs.stroke(s);
+            for (unsigned int i = 0; i < NB_POINTS; ++i) {
+                sum += strokeUVs.get(i).uv.x();
+            }
+        }
+    }
+    QVERIFY(sum > 0.0);
+}
+
+QTEST_GUILESS_MAIN(BenchUVHash)
+#include "bench_uvhash.moc"
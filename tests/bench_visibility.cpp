@@ -0,0 +1,90 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2024 Melvin Even <melvin.even@inria.fr>
+ *
+ * SPDX-License-Identifier: CECILL-2.1
+ */
+
+#include <QtTest>
+
+#include "editor.h"
+#include "filemanager.h"
+#include "layermanager.h"
+#include "visibilitymanager.h"
+#include "layer.h"
+#include "vectorkeyframe.h"
+
+#include <memory>
+
+/**
+ * Visibility threshold passes of ComputeVisibilityCommand on the first keyframe of the visibility examples.
+ * The editor is headless but still needs a platform, run with QT_QPA_PLATFORM=offscreen.
+ */
+class BenchVisibility : public QObject {
+    Q_OBJECT
+
+private slots:
+    void disappearance_data() { examples(); }
+    void disappearance();
+    void appearance_data() { examples(); }
+    void appearance();
+
+private:
+    static void examples();
+    // Load the project and return the first keyframe of the first layer that has a next keyframe
+    static VectorKeyFrame *load(const QString &path, Editor &editor, FileManager &fileManager);
+};
+
+void BenchVisibility::examples() {
+    QTest::addColumn<QString>("path");
+    QTest::newRow("headturn-visibility") << QFINDTESTDATA("../examples/headturn-visibility/final.xml");
+    QTest::newRow("cacarosa") << QFINDTESTDATA("../examples/cacarosa/animated-visibility-noisy.xml");
+}
+
+VectorKeyFrame *BenchVisibility::load(const QString &path, Editor &editor, FileManager &fileManager) {
+    if (path.isEmpty()) return nullptr;
+    editor.init(nullptr);
+    fileManager.createWorkingDir();
+    if (!fileManager.load(path, &editor, nullptr)) return nullptr;
+    Layer *layer = editor.layers()->layerAt(0);
+    VectorKeyFrame *keyframe = layer->getVectorKeyFrameAtFrame(layer->firstKeyFramePosition());
+    return (keyframe != nullptr && keyframe->nextKeyframe() != nullptr) ? keyframe : nullptr;
+}
+
+void BenchVisibility::disappearance() {
+    QFETCH(QString, path);
+    Editor editor;
+    FileManager fileManager;
+    VectorKeyFrame *keyframe = load(path, editor, fileManager);
+    if (keyframe == nullptr) QSKIP("Example not found or without a pair of keyframes");
+
+    VisibilityManager *visibility = editor.visibility();
+    visibility->init(keyframe, keyframe->nextKeyframe());
+    visibility->computePointsFirstPass(keyframe, keyframe->nextKeyframe());
+    std::vector<Point *> sources;
+    visibility->findSources(keyframe, sources);
+    QBENCHMARK {
+        visibility->assignVisibilityThreshold(keyframe, sources);
+    }
+}
+
+void BenchVisibility::appearance() {
+    QFETCH(QString, path);
+    Editor editor;
+    FileManager fileManager;
+    VectorKeyFrame *keyframe = load(path, editor, fileManager);
+    if (keyframe == nullptr) QSKIP("Example not found or without a pair of keyframes");
+
+    VisibilityManager *visibility = editor.visibility();
+    visibility->initAppearance(keyframe, keyframe->nextKeyframe());
+    visibility->computePointsFirstPassAppearance(keyframe, keyframe->nextKeyframe());
+    std::vector<Point::VectorType> sources;
+    std::vector<int> sourcesGroupsId;
+    visibility->findSourcesAppearance(keyframe->nextKeyframe(), sources);
+    visibility->addGroupsOrBake(keyframe, keyframe->nextKeyframe(), sources, sourcesGroupsId);
+    QBENCHMARK {
+        visibility->assignVisibilityThresholdAppearance(keyframe, sources, sourcesGroupsId);
+    }
+}
+
+QTEST_MAIN(BenchVisibility)
+#include "bench_visibility.moc"
@@ -0,0 +1,107 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2024 Melvin Even <melvin.even@inria.fr>
+ *
+ * SPDX-License-Identifier: CECILL-2.1
+ */
+
+#include <QtTest>
+
+#include "arap.h"
+#include "lattice.h"
+#include "corner.h"
+#include "quad.h"
+#include "dialsandknobs.h"
+
+#include <memory>
+
+static const char *k_referenceName = "Options->Grid->Reference regularization (sequential)";
+static const char *k_parallelName = "Options->Grid->Parallel regularization";
+static const char *k_andersonName = "Options->Grid->Regularization Anderson depth";
+
+class TestArap : public QObject {
+    Q_OBJECT
+
+private slots:
+    void cleanup();
+    void regularizationMatchesReference_data();
+    void regularizationMatchesReference();
+
+private:
+    // nbCols x nbRows lattice, TARGET_POS is a non-rigid deformation of REF_POS
+    static std::unique_ptr<Lattice> makeLattice(int nbCols, int nbRows, bool pinned);
+    static std::vector<Point::VectorType> regularize(bool reference, bool parallel, int nbCols, int nbRows, bool pinned, int &iterations);
+};
+
+std::unique_ptr<Lattice> TestArap::makeLattice(int nbCols, int nbRows, bool pinned) {
+    std::unique_ptr<Lattice> lattice = std::make_unique<Lattice>(nullptr);
+    lattice->init(16, nbCols, nbRows, Eigen::Vector2i(-200, -120));
+    bool isNewQuad;
+    for (int y = 0; y < nbRows; ++y) {
+        for (int x = 0; x < nbCols; ++x) {
+            lattice->addQuad(lattice->coordToKey(x, y), x, y, isNewQuad);
+        }
+    }
+    for (Corner *c : lattice->corners()) {
+        Point::VectorType p = c->coord(REF_POS);
+        c->coord(TARGET_POS) = p + Point::VectorType(0.002 * p.y() * p.y(), 10.0 * std::sin(p.x() / 30.0));
+    }
+    if (pinned) {
+        // a few pins away from their rest position, some of them share corners
+        const int pins[4][2] = {{2, 2}, {3, 2}, {nbCols / 2, nbRows / 2}, {nbCols - 3, nbRows - 2}};
+        for (int i = 0; i < 4; ++i) {
+            QuadPtr quad = lattice->quad(lattice->coordToKey(pins[i][0], pins[i][1]));
+            quad->pin(Point::VectorType(0.3, 0.6), quad->getPoint(Point::VectorType(0.3, 0.6), REF_POS) + Point::VectorType(6.0, -4.0));
+        }
+    }
+    lattice->isConnected();
+    return lattice;
+}
+
+std::vector<Point::VectorType> TestArap::regularize(bool reference, bool parallel, int nbCols, int nbRows, bool pinned, int &iterations) {
+    dkBool::find(k_referenceName)->setValue(reference);
+    dkBool::find(k_parallelName)->setValue(parallel);
+    std::unique_ptr<Lattice> lattice = makeLattice(nbCols, nbRows, pinned);
+    iterations = Arap::regularizeLattice(*lattice, REF_POS, TARGET_POS, 60, true, false, pinned);
+    std::vector<Point::VectorType> positions;
+    lattice->gatherPositions(TARGET_POS, positions);
+    return positions;
+}
+
+void TestArap::cleanup() {
+    dkBool::find(k_referenceName)->setValue(false);
+    dkBool::find(k_parallelName)->setValue(true);
+    dkInt::find(k_andersonName)->setValue(0);
+}
+
+void TestArap::regularizationMatchesReference_data() {
+    QTest::addColumn<bool>("parallel");
+    QTest::addColumn<int>("nbCols");
+    QTest::addColumn<int>("nbRows");
+    QTest::addColumn<bool>("pinned");
+    // more than one chunk of quads so that the parallel sweeps are split
+    QTest::newRow("sequential sweeps") << false << 24 << 16 << false;
+    QTest::newRow("parallel sweeps") << true << 24 << 16 << false;
+    QTest::newRow("parallel sweeps, pinned") << true << 24 << 16 << true;
+    QTest::newRow("small lattice, pinned") << true << 5 << 4 << true;
+}
+
+// Without Anderson mixing, the structure of arrays sweeps are the sequential regularizeQuads up to the summation order
+void TestArap::regularizationMatchesReference() {
+    QFETCH(bool, parallel);
+    QFETCH(int, nbCols);
+    QFETCH(int, nbRows);
+    QFETCH(bool, pinned);
+    dkInt::find(k_andersonName)->setValue(0);
+
+    int referenceIterations, iterations;
+    std::vector<Point::VectorType> expected = regularize(true, parallel, nbCols, nbRows, pinned, referenceIterations);
+    std::vector<Point::VectorType> actual = regularize(false, parallel, nbCols, nbRows, pinned, iterations);
+    QCOMPARE(iterations, referenceIterations);
+    QCOMPARE(actual.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+        QVERIFY2((actual[i] - expected[i]).norm() < 1e-8, qPrintable(QString("corner %1 differs by %2").arg(i).arg((actual[i] - expected[i]).norm())));
+    }
+}
+
+QTEST_GUILESS_MAIN(TestArap)
+#include "tst_arap.moc"
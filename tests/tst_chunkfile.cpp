@@ -0,0 +1,180 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2024 Melvin Even <melvin.even@inria.fr>
+ *
+ * SPDX-License-Identifier: CECILL-2.1
+ */
+
+#include <QtTest>
+
+#include "utils/chunkfile.h"
+#include "editor.h"
+#include "filemanager.h"
+#include "layermanager.h"
+#include "layer.h"
+#include "vectorkeyframe.h"
+#include "group.h"
+#include "lattice.h"
+#include "corner.h"
+#include "dialsandknobs.h"
+
+#include <limits>
+
+class TestChunkFile : public QObject {
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void arrays();
+    void corruptedCount();
+    void projectRoundTrip();
+
+private:
+    static void compareKeyFrames(VectorKeyFrame *expected, VectorKeyFrame *actual);
+    static void compareGroups(const Group *expected, const Group *actual);
+};
+
+void TestChunkFile::initTestCase() {
+    if (!ChunkFile::supported()) QSKIP("Binary payloads are not supported on big-endian hosts");
+}
+
+void TestChunkFile::arrays() {
+    QTemporaryDir dir;
+    QString fileName = dir.filePath("arrays.frck");
+    std::vector<double> doubles = {1.0, -2.5, 3.25};
+    std::vector<int> ints = {7, 8};
+    ChunkWriter writer;
+    QCOMPARE(writer.append("doubles", doubles), size_t(0));
+    QCOMPARE(writer.append("ints", ints), size_t(0));
+    QCOMPARE(writer.append("doubles", doubles.data(), 2), size_t(3));
+    QVERIFY(writer.write(fileName));
+
+    ChunkReader reader;
+    QVERIFY(reader.open(fileName));
+    QCOMPARE(reader.size("doubles"), size_t(5));
+    QCOMPARE(reader.size("ints"), size_t(2));
+    QCOMPARE(reader.size("missing"), size_t(0));
+    const double *d = reader.array<double>("doubles", 2, 3);
+    QVERIFY(d != nullptr);
+    QCOMPARE(d[0], 3.25);
+    QCOMPARE(d[1], 1.0);
+    QCOMPARE(d[2], -2.5);
+    const int *i = reader.array<int>("ints", 0, 2);
+    QVERIFY(i != nullptr);
+    QCOMPARE(i[1], 8);
+    QVERIFY(reader.array<int>("doubles", 0, 1) == nullptr);
+    QVERIFY(reader.array<double>("doubles", 4, 2) == nullptr);
+    QVERIFY(reader.array<double>("doubles", 1, std::numeric_limits<size_t>::max()) == nullptr);
+}
+
+// A count whose size in bytes overflows 64 bits must not pass the bound check
+void TestChunkFile::corruptedCount() {
+    QTemporaryDir dir;
+    QString fileName = dir.filePath("corrupted.frck");
+    std::vector<float> floats(4, 1.0f);
+    ChunkWriter writer;
+    writer.append("floats", floats);
+    QVERIFY(writer.write(fileName));
+
+    // count field of the first table entry: header (16 bytes), name (24 bytes), offset (8 bytes)
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    quint64 count = (quint64(1) << 62) + 1;   // count * sizeof(float) == 4
+    QVERIFY(file.seek(16 + ChunkFile::NAME_SIZE + 8));
+    QCOMPARE(file.write(reinterpret_cast<const char *>(&count), sizeof(count)), qint64(sizeof(count)));
+    file.close();
+
+    ChunkReader reader;
+    QVERIFY(!reader.open(fileName));
+}
+
+void TestChunkFile::compareGroups(const Group *expected, const Group *actual) {
+    QCOMPARE(actual->id(), expected->id());
+    QVERIFY(actual->strokes().compare(expected->strokes()));
+    QCOMPARE(actual->uvs().size(), expected->uvs().size());
+    for (auto it = expected->strokes().constBegin(); it != expected->strokes().constEnd(); ++it) {
+        for (const Interval &interval : it.value()) {
+            for (unsigned int i = interval.from(); i <= interval.to(); ++i) {
+                QCOMPARE(actual->uvs().has(it.key(), i), expected->uvs().has(it.key(), i));
+                UVInfo e = expected->uvs().get(it.key(), i), a = actual->uvs().get(it.key(), i);
+                QCOMPARE(a.quadKey, e.quadKey);
+                QCOMPARE(a.uv, e.uv);
+            }
+        }
+    }
+
+    QCOMPARE(actual->lattice() != nullptr, expected->lattice() != nullptr);
+    if (expected->lattice() == nullptr) return;
+    Lattice *e = expected->lattice(), *a = actual->lattice();
+    QCOMPARE(a->nbCols(), e->nbCols());
+    QCOMPARE(a->cellSize(), e->cellSize());
+    QCOMPARE(a->quads().size(), e->quads().size());
+    for (auto it = e->quads().constBegin(); it != e->quads().constEnd(); ++it) QVERIFY(a->quads().contains(it.key()));
+    QCOMPARE(a->corners().size(), e->corners().size());
+    for (int i = 0; i < e->corners().size(); ++i) {
+        QCOMPARE(a->corners()[i]->coord(REF_POS), e->corners()[i]->coord(REF_POS));
+        QCOMPARE(a->corners()[i]->coord(TARGET_POS), e->corners()[i]->coord(TARGET_POS));
+    }
+}
+
+void TestChunkFile::compareKeyFrames(VectorKeyFrame *expected, VectorKeyFrame *actual) {
+    QCOMPARE(actual->strokes().size(), expected->strokes().size());
+    for (auto it = expected->strokes().constBegin(); it != expected->strokes().constEnd(); ++it) {
+        QVERIFY(actual->strokes().contains(it.key()));
+        const Stroke *e = it.value().get(), *a = actual->strokes().value(it.key()).get();
+        QCOMPARE(a->size(), e->size());
+        for (size_t i = 0; i < e->size(); ++i) {
+            QCOMPARE(a->points()[i]->pos(), e->points()[i]->pos());
+            QCOMPARE(a->points()[i]->pressure(), e->points()[i]->pressure());
+        }
+    }
+    QCOMPARE(actual->visibility(), expected->visibility());
+
+    QCOMPARE(actual->postGroups().size(), expected->postGroups().size());
+    for (const Group *group : expected->postGroups()) {
+        QVERIFY(actual->postGroups().contains(group->id()));
+        compareGroups(group, actual->postGroups().value(group->id()));
+    }
+    QCOMPARE(actual->preGroups().size(), expected->preGroups().size());
+    for (const Group *group : expected->preGroups()) {
+        QVERIFY(actual->preGroups().contains(group->id()));
+        compareGroups(group, actual->preGroups().value(group->id()));
+    }
+}
+
+// Saving an example as a .fries (version 2, binary payloads) and loading it back gives the same keyframes
+void TestChunkFile::projectRoundTrip() {
+    QString example = QFINDTESTDATA("../examples/growing-roots/growing_roots.xml");
+    if (example.isEmpty()) QSKIP("Example not found");
+    QTemporaryDir dir;
+    QString fileName = dir.filePath("roundtrip.fries");
+    dkBool::find("Options->Files->Binary keyframe payloads")->setValue(true);
+
+    Editor expected;
+    expected.init(nullptr);
+    FileManager expectedFiles;
+    expectedFiles.createWorkingDir();
+    QVERIFY(expectedFiles.load(example, &expected, nullptr));
+    // keyframes that were never accessed would be saved as their XML element
+    for (int i = 0; i < expected.layers()->layersCount(); ++i) expected.layers()->layerAt(i)->ensureAllLoaded();
+    QVERIFY(expectedFiles.save(fileName, &expected, nullptr));
+
+    Editor actual;
+    actual.init(nullptr);
+    FileManager actualFiles;
+    QVERIFY(actualFiles.load(fileName, &actual, nullptr));
+
+    QCOMPARE(actual.layers()->layersCount(), expected.layers()->layersCount());
+    for (int i = 0; i < expected.layers()->layersCount(); ++i) {
+        Layer *e = expected.layers()->layerAt(i), *a = actual.layers()->layerAt(i);
+        QCOMPARE(a->keys(), e->keys());
+        for (auto it = e->keysBegin(); it != e->keysEnd(); ++it) {
+            compareKeyFrames(it.value(), a->getVectorKeyFrameAtFrame(it.key()));
+        }
+    }
+
+    expectedFiles.deleteWorkingDir();
+    actualFiles.deleteWorkingDir();
+}
+
+QTEST_MAIN(TestChunkFile)
+#include "tst_chunkfile.moc"
@@ -0,0 +1,112 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2024 Melvin Even <melvin.even@inria.fr>
+ *
+ * SPDX-License-Identifier: CECILL-2.1
+ */
+
+#include <QtTest>
+
+#include "lattice.h"
+#include "corner.h"
+#include "dialsandknobs.h"
+
+#include <memory>
+
+static const char *k_symmetricSolverName = "Options->Grid->Symmetric ARAP solver";
+
+class TestLattice : public QObject {
+    Q_OBJECT
+
+private slots:
+    void cleanup();
+    void interpolateARAP_data();
+    void interpolateARAP();
+    void symmetricSolverMatchesLU();
+
+private:
+    // nbCols x nbRows lattice whose target configuration is the given affine map of its reference configuration
+    static std::unique_ptr<Lattice> makeLattice(int nbCols, int nbRows, const Point::Affine &target);
+    static void bendTarget(Lattice &lattice);
+    static std::vector<InterpolatedFrame> interpolate(Lattice &lattice, bool symmetricSolver, const std::vector<qreal> &alphas);
+};
+
+std::unique_ptr<Lattice> TestLattice::makeLattice(int nbCols, int nbRows, const Point::Affine &target) {
+    std::unique_ptr<Lattice> lattice = std::make_unique<Lattice>(nullptr);
+    lattice->init(16, nbCols, nbRows, Eigen::Vector2i(-40, 25));
+    bool isNewQuad;
+    for (int y = 0; y < nbRows; ++y) {
+        for (int x = 0; x < nbCols; ++x) {
+            lattice->addQuad(lattice->coordToKey(x, y), x, y, isNewQuad);
+        }
+    }
+    for (Corner *c : lattice->corners()) c->coord(TARGET_POS) = target * c->coord(REF_POS);
+    lattice->isConnected();
+    return lattice;
+}
+
+// Non-affine target configuration, ARAP cannot reproduce it exactly in between
+void TestLattice::bendTarget(Lattice &lattice) {
+    for (Corner *c : lattice.corners()) {
+        Point::VectorType p = c->coord(REF_POS);
+        c->coord(TARGET_POS) = p + Point::VectorType(0.002 * p.y() * p.y(), 6.0 * std::sin(p.x() / 20.0));
+    }
+}
+
+std::vector<InterpolatedFrame> TestLattice::interpolate(Lattice &lattice, bool symmetricSolver, const std::vector<qreal> &alphas) {
+    dkBool::find(k_symmetricSolverName)->setValue(symmetricSolver);
+    lattice.precompute();
+    std::vector<InterpolatedFrame> frames;
+    std::vector<Point::Affine> identities(alphas.size(), Point::Affine::Identity());
+    lattice.interpolateARAP(alphas, alphas, identities, frames, false);
+    return frames;
+}
+
+void TestLattice::cleanup() {
+    dkBool::find(k_symmetricSolverName)->setValue(true);
+}
+
+void TestLattice::interpolateARAP_data() {
+    QTest::addColumn<bool>("symmetricSolver");
+    QTest::newRow("LU") << false;
+    QTest::newRow("LDLT") << true;
+}
+
+// The end configurations are reproduced exactly when the target is an affine map of the reference
+void TestLattice::interpolateARAP() {
+    QFETCH(bool, symmetricSolver);
+    Point::Affine target = Eigen::Translation2d(12.0, -7.0) * Eigen::Rotation2Dd(0.6) * Eigen::Scaling(1.3, 0.8);
+    std::unique_ptr<Lattice> lattice = makeLattice(5, 4, target);
+    QVERIFY(lattice->isSingleConnectedComponent());
+
+    std::vector<InterpolatedFrame> frames = interpolate(*lattice, symmetricSolver, {0.0, 1.0});
+    QCOMPARE(frames.size(), size_t(2));
+    for (Corner *c : lattice->corners()) {
+        QVERIFY((frames[0][c->getKey()] - c->coord(REF_POS)).norm() < 1e-6);
+        QVERIFY((frames[1][c->getKey()] - c->coord(TARGET_POS)).norm() < 1e-6);
+    }
+}
+
+// Both solver modes solve the same constrained problem and must agree at every alpha
+void TestLattice::symmetricSolverMatchesLU() {
+    std::unique_ptr<Lattice> lattice = makeLattice(7, 5, Point::Affine::Identity());
+    bendTarget(*lattice);
+    const std::vector<qreal> alphas = {0.0, 0.2, 0.45, 0.5, 0.8, 1.0};
+
+    std::vector<InterpolatedFrame> lu = interpolate(*lattice, false, alphas);
+    std::vector<InterpolatedFrame> ldlt = interpolate(*lattice, true, alphas);
+    QCOMPARE(lu.size(), alphas.size());
+    QCOMPARE(ldlt.size(), alphas.size());
+    for (size_t j = 0; j < alphas.size(); ++j) {
+        Point::VectorType cmLU = Point::VectorType::Zero(), cmLDLT = Point::VectorType::Zero();
+        for (Corner *c : lattice->corners()) {
+            int key = c->getKey();
+            QVERIFY2((lu[j][key] - ldlt[j][key]).norm() < 1e-6, qPrintable(QString("alpha %1, corner %2").arg(alphas[j]).arg(key)));
+            cmLU += lu[j][key];
+            cmLDLT += ldlt[j][key];
+        }
+        QVERIFY((cmLU - cmLDLT).norm() / lattice->corners().size() < 1e-8);
+    }
+}
+
+QTEST_GUILESS_MAIN(TestLattice)
+#include "tst_lattice.moc"
@@ -0,0 +1,277 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2024 Melvin Even <melvin.even@inria.fr>
+ *
+ * SPDX-License-Identifier: CECILL-2.1
+ */
+
+#include <QtTest>
+#include <QOffscreenSurface>
+#include <QOpenGLBuffer>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLTexture>
+#include <QOpenGLVertexArrayObject>
+
+#include "GL/StrokeRasterizer.h"
+#include "stroke.h"
+
+#include <cmath>
+#include <memory>
+
+// Golden images of the stroke shaders: the GPU path (stroke.vert/stroke.geom/stroke.frag) is rendered in a multisampled
+// FBO and compared to the CPU reference (StrokeMesh/StrokeRasterizer). Skipped when no OpenGL 4.1 context is available.
+
+static const int WIDTH = 480;
+static const int HEIGHT = 270;
+static const int SAMPLES = 8;
+
+// Pixels can differ by a few samples on the edges of the strokes, the sample patterns of the GPU are not the reference ones
+static const int CHANNEL_TOLERANCE = 64;
+static const double MAX_MISMATCH = 0.005;
+
+class TestStrokeRasterizer : public QObject {
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void matchesGL_data();
+    void matchesGL();
+
+private:
+    // Line buffer of a test stroke (see Stroke::lineBufferData)
+    static std::vector<float> lineData(const QString &shape);
+    static StrokeStyle style(float strokeWeight, float time);
+    static QImage renderCPU(const std::vector<float> &data, const Interval &interval, const StrokeStyle &style, const QColor &color);
+    QImage renderGL(const std::vector<float> &data, const Interval &interval, const StrokeStyle &style, const QColor &color);
+
+    QOffscreenSurface m_surface;
+    std::unique_ptr<QOpenGLContext> m_context;
+    std::unique_ptr<QOpenGLShaderProgram> m_program;
+    std::unique_ptr<QOpenGLTexture> m_mask;
+};
+
+void TestStrokeRasterizer::initTestCase() {
+    QSurfaceFormat format;
+    format.setVersion(4, 1);
+    format.setProfile(QSurfaceFormat::CoreProfile);
+    m_surface.setFormat(format);
+    m_surface.create();
+    m_context = std::make_unique<QOpenGLContext>();
+    m_context->setFormat(format);
+    if (!m_surface.isValid() || !m_context->create() || !m_context->makeCurrent(&m_surface) || m_context->format().version() < qMakePair(4, 1)) {
+        m_context.reset();
+        return;
+    }
+
+    m_program = std::make_unique<QOpenGLShaderProgram>();
+    QVERIFY2(m_program->addShaderFromSourceFile(QOpenGLShader::Vertex, ":/shaders/stroke.vert"), qPrintable(m_program->log()));
+    QVERIFY2(m_program->addShaderFromSourceFile(QOpenGLShader::Geometry, ":/shaders/stroke.geom"), qPrintable(m_program->log()));
+    QVERIFY2(m_program->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/shaders/stroke.frag"), qPrintable(m_program->log()));
+    QVERIFY2(m_program->link(), qPrintable(m_program->log()));
+
+    // Empty mask (red = 0), like the cleared mask attachment of the canvas
+    QImage mask(1, 1, QImage::Format_RGBA8888);
+    mask.fill(Qt::black);
+    m_mask = std::make_unique<QOpenGLTexture>(mask);
+}
+
+void TestStrokeRasterizer::cleanupTestCase() {
+    if (m_context == nullptr) return;
+    m_context->makeCurrent(&m_surface);
+    m_mask.reset();
+    m_program.reset();
+    m_context->doneCurrent();
+}
+
+std::vector<float> TestStrokeRasterizer::lineData(const QString &shape) {
+    std::vector<Eigen::Vector2f> pts;
+    std::vector<float> visibility;
+    if (shape == "wave" || shape == "visibility") {
+        for (int i = 0; i < 60; ++i) pts.emplace_back(-200.0f + i * 400.0f / 59.0f, 60.0f * std::sin(i / 6.0f));
+    } else if (shape == "zigzag") {
+        for (int i = 0; i < 12; ++i) pts.emplace_back(-220.0f + i * 40.0f, (i % 2 == 0) ? -70.0f : 70.0f);
+    } else if (shape == "hairpin") {
+        for (int i = 0; i < 10; ++i) pts.emplace_back(-150.0f + i * 30.0f, -20.0f);
+        for (int i = 0; i < 10; ++i) pts.emplace_back(120.0f - i * 30.0f, 20.0f);
+    }
+    // points with a positive threshold appear once the time reaches it: at t = 0.5 only the first half is drawn
+    for (size_t i = 0; i < pts.size(); ++i) visibility.push_back(shape == "visibility" ? (i < pts.size() / 2 ? 0.3f : 0.8f) : 0.0f);
+
+    std::vector<float> data(pts.size() * Stroke::BUFFER_STRIDE);
+    for (size_t i = 0; i < pts.size(); ++i) {
+        float *d = &data[i * Stroke::BUFFER_STRIDE];
+        d[0] = pts[i].x();
+        d[1] = pts[i].y();
+        d[2] = 0.6f + 0.4f * std::sin(i / 3.0f);
+        d[3] = visibility[i];
+        d[4] = 0.2f; d[5] = 0.3f; d[6] = 0.4f; d[7] = 1.0f;
+    }
+    return data;
+}
+
+// Uniforms of TabletCanvas::paintGLInit when exporting at the canvas size
+StrokeStyle TestStrokeRasterizer::style(float strokeWeight, float time) {
+    StrokeStyle style;
+    style.view = QTransform().translate(WIDTH / 2, HEIGHT / 2);
+    style.proj.ortho(QRect(0, 0, WIDTH, HEIGHT));
+    style.winSize = Eigen::Vector2f(WIDTH, HEIGHT);
+    style.zoom = 1.0f;
+    style.thetaEpsilon = 0.01f;
+    style.strokeWeight = strokeWeight;
+    style.time = time;
+    return style;
+}
+
+QImage TestStrokeRasterizer::renderCPU(const std::vector<float> &data, const Interval &interval, const StrokeStyle &style, const QColor &color) {
+    StrokeMesh mesh;
+    mesh.tessellate(data.data(), data.size() / Stroke::BUFFER_STRIDE, interval, false, style);
+    StrokeRasterizer rasterizer(WIDTH, HEIGHT, SAMPLES);
+    rasterizer.clear(QColor(255, 255, 255, 0));
+    rasterizer.draw(mesh, color);
+    return rasterizer.image();
+}
+
+// Same vertex layout as Stroke::initBuffers and same draw call as InbetweenStroke::render
+QImage TestStrokeRasterizer::renderGL(const std::vector<float> &data, const Interval &interval, const StrokeStyle &style, const QColor &color) {
+    m_context->makeCurrent(&m_surface);
+    QOpenGLExtraFunctions *f = m_context->extraFunctions();
+    int size = data.size() / Stroke::BUFFER_STRIDE;
+
+    QOpenGLFramebufferObjectFormat formatMS;
+    formatMS.setSamples(SAMPLES);
+    formatMS.setInternalTextureFormat(GL_RGBA8);
+    QOpenGLFramebufferObject fboMS(WIDTH, HEIGHT, formatMS);
+    QOpenGLFramebufferObjectFormat format;
+    format.setInternalTextureFormat(GL_RGBA8);
+    QOpenGLFramebufferObject fbo(WIDTH, HEIGHT, format);
+
+    std::vector<GLuint> elements(size + 2);
+    elements[0] = 0;
+    for (int i = 0; i < size; ++i) elements[i + 1] = i;
+    elements[size + 1] = size - 1;
+
+    QOpenGLVertexArrayObject vao;
+    QOpenGLBuffer vbo(QOpenGLBuffer::VertexBuffer), ebo(QOpenGLBuffer::IndexBuffer);
+    vao.create();
+    vao.bind();
+    vbo.create();
+    vbo.bind();
+    vbo.allocate(data.data(), data.size() * sizeof(GLfloat));
+    ebo.create();
+    ebo.bind();
+    ebo.allocate(elements.data(), elements.size() * sizeof(GLuint));
+    m_program->bind();
+    m_program->enableAttributeArray(0);
+    m_program->setAttributeBuffer(0, GL_FLOAT, 0, 2, Stroke::BUFFER_STRIDE * sizeof(GLfloat));
+    m_program->enableAttributeArray(1);
+    m_program->setAttributeBuffer(1, GL_FLOAT, 2 * sizeof(GLfloat), 1, Stroke::BUFFER_STRIDE * sizeof(GLfloat));
+    m_program->enableAttributeArray(2);
+    m_program->setAttributeBuffer(2, GL_FLOAT, 3 * sizeof(GLfloat), 1, Stroke::BUFFER_STRIDE * sizeof(GLfloat));
+    m_program->enableAttributeArray(3);
+    m_program->setAttributeBuffer(3, GL_FLOAT, 4 * sizeof(GLfloat), 4, Stroke::BUFFER_STRIDE * sizeof(GLfloat));
+
+    int cap[2] = {(int)interval.from(), (int)interval.to()};
+    m_program->setUniformValue("view", style.view);
+    m_program->setUniformValue("jitter", QTransform());
+    m_program->setUniformValue("proj", style.proj);
+    m_program->setUniformValue("winSize", QVector2D(style.winSize.x(), style.winSize.y()));
+    m_program->setUniformValue("zoom", style.zoom);
+    m_program->setUniformValue("thetaEpsilon", style.thetaEpsilon);
+    m_program->setUniformValue("strokeWeight", style.strokeWeight);
+    m_program->setUniformValue("time", style.time);
+    m_program->setUniformValueArray("capIdx", cap, 2);
+    m_program->setUniformValue("groupId", 0);
+    m_program->setUniformValue("ignoreMask", style.ignoreMask);
+    m_program->setUniformValue("sticker", style.sticker);
+    m_program->setUniformValue("displayVisibility", false);
+    m_program->setUniformValue("maskStrength", 0);
+    m_program->setUniformValue("maskMode", 0);
+    m_program->setUniformValue("stride", 1);
+    m_program->setUniformValue("displayMode", 0);
+    m_program->setUniformValue("strokeColor", color);
+    m_mask->bind(0);
+
+    fboMS.bind();
+    f->glViewport(0, 0, WIDTH, HEIGHT);
+    f->glClearColor(1.0f, 1.0f, 1.0f, 0.0f);
+    f->glClear(GL_COLOR_BUFFER_BIT);
+    f->glEnable(GL_BLEND);
+    f->glBlendEquation(GL_FUNC_ADD);
+    f->glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    f->glDrawElements(GL_LINE_STRIP_ADJACENCY, interval.to() - interval.from() + 3, GL_UNSIGNED_INT, (const void *)(interval.from() * sizeof(GLuint)));
+    fboMS.release();
+    m_program->release();
+    vao.release();
+
+    QOpenGLFramebufferObject::blitFramebuffer(&fbo, &fboMS);
+    QImage image(WIDTH, HEIGHT, QImage::Format_RGBA8888);
+    fbo.bind();
+    f->glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    f->glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, image.bits());
+    fbo.release();
+
+    ebo.destroy();
+    vbo.destroy();
+    vao.destroy();
+    m_context->doneCurrent();
+
+    // GL rows start at the bottom
+    return image.mirrored(false, true);
+}
+
+void TestStrokeRasterizer::matchesGL_data() {
+    QTest::addColumn<QString>("shape");
+    QTest::addColumn<int>("from");
+    QTest::addColumn<int>("to");
+    QTest::addColumn<float>("strokeWeight");
+    QTest::addColumn<float>("time");
+    QTest::newRow("wave") << "wave" << 0 << 59 << 6.0f << 0.0f;
+    QTest::newRow("wave interval") << "wave" << 12 << 40 << 6.0f << 0.0f;
+    QTest::newRow("zigzag joins") << "zigzag" << 0 << 11 << 10.0f << 0.0f;
+    QTest::newRow("hairpin") << "hairpin" << 0 << 19 << 8.0f << 0.0f;
+    QTest::newRow("visibility") << "visibility" << 0 << 59 << 6.0f << 0.5f;
+}
+
+void TestStrokeRasterizer::matchesGL() {
+    if (m_context == nullptr) QSKIP("No OpenGL 4.1 context available");
+    QFETCH(QString, shape);
+    QFETCH(int, from);
+    QFETCH(int, to);
+    QFETCH(float, strokeWeight);
+    QFETCH(float, time);
+
+    std::vector<float> data = lineData(shape);
+    Interval interval(from, to);
+    QColor color(40, 60, 200, 190);
+    QImage cpu = renderCPU(data, interval, style(strokeWeight, time), color);
+    QImage gl = renderGL(data, interval, style(strokeWeight, time), color);
+    QCOMPARE(cpu.size(), gl.size());
+
+    int covered = 0, mismatched = 0;
+    for (int y = 0; y < HEIGHT; ++y) {
+        const uchar *a = cpu.constScanLine(y);
+        const uchar *b = gl.constScanLine(y);
+        for (int x = 0; x < WIDTH; ++x) {
+            if (a[4 * x + 3] > 0 || b[4 * x + 3] > 0) covered++;
+            for (int k = 0; k < 4; ++k) {
+                if (std::abs(a[4 * x + k] - b[4 * x + k]) > CHANNEL_TOLERANCE) {
+                    mismatched++;
+                    break;
+                }
+            }
+        }
+    }
+    QVERIFY2(covered > 100, "The stroke was not drawn");
+    double mismatch = (double)mismatched / (WIDTH * HEIGHT);
+    if (mismatch >= MAX_MISMATCH) {
+        cpu.save(QString("%1_cpu.png").arg(QTest::currentDataTag()).replace(' ', '_'));
+        gl.save(QString("%1_gl.png").arg(QTest::currentDataTag()).replace(' ', '_'));
+    }
+    QVERIFY2(mismatch < MAX_MISMATCH, qPrintable(QString("%1 pixels differ").arg(mismatched)));
+}
+
+QTEST_MAIN(TestStrokeRasterizer)
+#include "tst_strokerasterizer.moc"
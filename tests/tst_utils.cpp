@@ -0,0 +1,40 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2024 Melvin Even <melvin.even@inria.fr>
+ *
+ * SPDX-License-Identifier: CECILL-2.1
+ */
+
+#include <QtTest>
+
+#include "utils/utils.h"
+
+class TestUtils : public QObject {
+    Q_OBJECT
+
+private slots:
+    void invCantor_data();
+    void invCantor();
+};
+
+void TestUtils::invCantor_data() {
+    QTest::addColumn<uint>("a");
+    QTest::addColumn<uint>("b");
+    QTest::newRow("zero") << 0u << 0u;
+    QTest::newRow("small") << 12u << 345u;
+    // 8 * z + 1 does not fit in 32 bits anymore
+    QTest::newRow("z >= 2^29") << 40000u << 1200u;
+    QTest::newRow("largest keys") << 90000u << 2600u;
+    QTest::newRow("column") << 0u << 92680u;
+}
+
+// The keys saved in the text format must be decoded back to the same (stroke id, point index)
+void TestUtils::invCantor() {
+    QFETCH(uint, a);
+    QFETCH(uint, b);
+    std::pair<unsigned int, unsigned int> p = Utils::invCantor(Utils::cantor(a, b));
+    QCOMPARE(p.first, a);
+    QCOMPARE(p.second, b);
+}
+
+QTEST_GUILESS_MAIN(TestUtils)
+#include "tst_utils.moc"